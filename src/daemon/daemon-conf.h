@@ -76,7 +76,10 @@ typedef struct pa_daemon_conf {
         log_time,
         flat_volumes,
         lock_memory,
-        deferred_volume;
+        huge_pages,
+        deferred_volume,
+        scache_preload,
+        scache_disk_cache;
     pa_server_type_t local_server_type;
     int exit_idle_time,
         scache_idle_time,
@@ -133,7 +136,7 @@ typedef struct pa_daemon_conf {
     pa_sample_spec default_sample_spec;
     uint32_t alternate_sample_rate;
     pa_channel_map default_channel_map;
-    size_t shm_size;
+    size_t shm_size, shm_slot_size;
 } pa_daemon_conf;
 
 /* Allocate a new structure and fill it with sane defaults */
@@ -25,6 +25,7 @@
 #endif
 
 #include <sys/types.h>
+#include <errno.h>
 #include <asoundlib.h>
 #include <math.h>
 
@@ -33,6 +34,7 @@
 #endif
 
 #include <pulse/mainloop-api.h>
+#include <pulse/rtclock.h>
 #include <pulse/sample.h>
 #include <pulse/timeval.h>
 #include <pulse/util.h>
@@ -3741,33 +3743,33 @@ fail:
 }
 
 static void mapping_paths_probe(pa_alsa_mapping *m, pa_alsa_profile *profile,
-                                pa_alsa_direction_t direction) {
+                                pa_alsa_direction_t direction, int alsa_card_index) {
 
     pa_alsa_path *p;
     void *state;
-    snd_pcm_t *pcm_handle;
     pa_alsa_path_set *ps;
-    snd_mixer_t *mixer_handle;
-    snd_hctl_t *hctl_handle;
+    snd_mixer_t *mixer_handle = NULL;
+    snd_hctl_t *hctl_handle = NULL;
 
     if (direction == PA_ALSA_DIRECTION_OUTPUT) {
         if (m->output_path_set)
             return; /* Already probed */
         m->output_path_set = ps = pa_alsa_path_set_new(m, direction, NULL); /* FIXME: Handle paths_dir */
-        pcm_handle = m->output_pcm;
     } else {
         if (m->input_path_set)
             return; /* Already probed */
         m->input_path_set = ps = pa_alsa_path_set_new(m, direction, NULL); /* FIXME: Handle paths_dir */
-        pcm_handle = m->input_pcm;
     }
 
     if (!ps)
         return; /* No paths */
 
-    pa_assert(pcm_handle);
-
-    mixer_handle = pa_alsa_open_mixer_for_pcm(pcm_handle, NULL, &hctl_handle);
+    /* The PCMs have all been closed again at this point, so we go for
+     * the mixer of the card directly. This is where
+     * pa_alsa_open_mixer_for_pcm() ends up for the device strings we
+     * use, too. */
+    if (alsa_card_index >= 0)
+        mixer_handle = pa_alsa_open_mixer(alsa_card_index, NULL, &hctl_handle);
     if (!mixer_handle || !hctl_handle) {
          /* Cannot open mixer, remove all entries */
         while (pa_hashmap_steal_first(ps->paths));
@@ -4125,6 +4127,16 @@ void pa_alsa_decibel_fix_dump(pa_alsa_decibel_fix *db_fix) {
     pa_xfree(db_values);
 }
 
+char *pa_alsa_profile_set_path(const char *fname) {
+
+    if (!fname)
+        fname = "default.conf";
+
+    return pa_maybe_prefix_path(fname,
+                                pa_run_from_build_tree() ? PA_BUILDDIR "/modules/alsa/mixer/profile-sets/" :
+                                PA_ALSA_PROFILE_SETS_DIR);
+}
+
 pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel_map *bonus) {
     pa_alsa_profile_set *ps;
     pa_alsa_profile *p;
@@ -4170,13 +4182,7 @@ pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel
 
     items[0].data = &ps->auto_profiles;
 
-    if (!fname)
-        fname = "default.conf";
-
-    fn = pa_maybe_prefix_path(fname,
-                              pa_run_from_build_tree() ? PA_BUILDDIR "/modules/alsa/mixer/profile-sets/" :
-                              PA_ALSA_PROFILE_SETS_DIR);
-
+    fn = pa_alsa_profile_set_path(fname);
     r = pa_config_parse(fn, NULL, items, NULL, ps);
     pa_xfree(fn);
 
@@ -4292,7 +4298,7 @@ static void paths_drop_unsupported(pa_hashmap* h) {
     }
 }
 
-void pa_alsa_profile_set_probe(
+void pa_alsa_profile_set_probe_profiles(
         pa_alsa_profile_set *ps,
         const char *dev_id,
         const pa_sample_spec *ss,
@@ -4303,14 +4309,17 @@ void pa_alsa_profile_set_probe(
     pa_alsa_profile *p, *last = NULL;
     pa_alsa_mapping *m;
     pa_hashmap *broken_inputs, *broken_outputs;
+    pa_usec_t t;
 
     pa_assert(ps);
     pa_assert(dev_id);
     pa_assert(ss);
 
-    if (ps->probed)
+    if (ps->probed || ps->profiles_probed)
         return;
 
+    t = pa_rtclock_now();
+
     broken_inputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     broken_outputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
 
@@ -4358,6 +4367,9 @@ void pa_alsa_profile_set_probe(
                                                            SND_PCM_STREAM_PLAYBACK,
                                                            default_n_fragments,
                                                            default_fragment_size_msec))) {
+                        if (errno == EBUSY)
+                            ps->probe_busy = TRUE;
+
                         p->supported = FALSE;
                         if (pa_idxset_size(p->output_mappings) == 1 &&
                             ((!p->input_mappings) || pa_idxset_size(p->input_mappings) == 0)) {
@@ -4379,6 +4391,9 @@ void pa_alsa_profile_set_probe(
                                                           SND_PCM_STREAM_CAPTURE,
                                                           default_n_fragments,
                                                           default_fragment_size_msec))) {
+                        if (errno == EBUSY)
+                            ps->probe_busy = TRUE;
+
                         p->supported = FALSE;
                         if (pa_idxset_size(p->input_mappings) == 1 &&
                             ((!p->output_mappings) || pa_idxset_size(p->output_mappings) == 0)) {
@@ -4396,29 +4411,175 @@ void pa_alsa_profile_set_probe(
         }
 
         pa_log_debug("Profile %s supported.", p->name);
+    }
+
+    /* Clean up */
+    profile_finalize_probing(last, NULL);
+
+    pa_hashmap_free(broken_inputs, NULL, NULL);
+    pa_hashmap_free(broken_outputs, NULL, NULL);
+
+    ps->profiles_probed = TRUE;
+
+    pa_log_debug("Probing profiles of %s took %llu ms.", dev_id, (unsigned long long) ((pa_rtclock_now() - t) / PA_USEC_PER_MSEC));
+}
+
+void pa_alsa_profile_set_probe(
+        pa_alsa_profile_set *ps,
+        const char *dev_id,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec) {
+
+    void *state;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    int alsa_card_index;
+    pa_usec_t t;
+
+    pa_assert(ps);
+    pa_assert(dev_id);
+    pa_assert(ss);
+
+    if (ps->probed)
+        return;
 
+    pa_alsa_profile_set_probe_profiles(ps, dev_id, ss, default_n_fragments, default_fragment_size_msec);
+
+    t = pa_rtclock_now();
+
+    if ((alsa_card_index = snd_card_get_index(dev_id)) < 0)
+        pa_log_info("Card '%s' doesn't exist, not probing any mixer paths: %s", dev_id, pa_alsa_strerror(alsa_card_index));
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state) {
+        uint32_t idx;
+
+        if (!p->supported)
+            continue;
+
+        /* Only mappings that could actually be opened get paths */
         if (p->output_mappings)
             PA_IDXSET_FOREACH(m, p->output_mappings, idx)
-                if (m->output_pcm)
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT);
+                if (m->supported > 0)
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_OUTPUT, alsa_card_index);
 
         if (p->input_mappings)
             PA_IDXSET_FOREACH(m, p->input_mappings, idx)
-                if (m->input_pcm)
-                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT);
+                if (m->supported > 0)
+                    mapping_paths_probe(m, p, PA_ALSA_DIRECTION_INPUT, alsa_card_index);
     }
 
-    /* Clean up */
-    profile_finalize_probing(last, NULL);
-
     pa_alsa_profile_set_drop_unsupported(ps);
 
     paths_drop_unsupported(ps->input_paths);
     paths_drop_unsupported(ps->output_paths);
-    pa_hashmap_free(broken_inputs, NULL, NULL);
-    pa_hashmap_free(broken_outputs, NULL, NULL);
 
     ps->probed = TRUE;
+
+    pa_log_debug("Probing mixer paths of %s took %llu ms.", dev_id, (unsigned long long) ((pa_rtclock_now() - t) / PA_USEC_PER_MSEC));
+}
+
+char *pa_alsa_profile_set_supported_to_string(pa_alsa_profile_set *ps) {
+    pa_strbuf *buf;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    void *state;
+
+    pa_assert(ps);
+    pa_assert(ps->profiles_probed);
+
+    buf = pa_strbuf_new();
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        if (p->supported)
+            pa_strbuf_printf(buf, "P %s\n", p->name);
+
+    PA_HASHMAP_FOREACH(m, ps->mappings, state)
+        if (m->supported > 0)
+            pa_strbuf_printf(buf, "M %u %s\n", m->supported, m->name);
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+/* Parses one line of the string created by
+ * pa_alsa_profile_set_supported_to_string(). If apply is FALSE the
+ * line is only checked. */
+static int supported_line_parse(pa_alsa_profile_set *ps, const char *l, pa_bool_t apply) {
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    uint32_t n;
+    char *k;
+    int r = -1;
+
+    if (pa_startswith(l, "P ")) {
+        if (!(p = pa_hashmap_get(ps->profiles, l + 2)))
+            return -1;
+
+        if (apply)
+            p->supported = TRUE;
+
+        return 0;
+    }
+
+    if (!pa_startswith(l, "M "))
+        return -1;
+
+    l += 2;
+    k = pa_xstrndup(l, strcspn(l, " "));
+    l += strlen(k);
+
+    if (*l == ' ' && pa_atou(k, &n) >= 0 && n > 0 && (m = pa_hashmap_get(ps->mappings, l + 1))) {
+        if (apply)
+            m->supported = (unsigned) n;
+
+        r = 0;
+    }
+
+    pa_xfree(k);
+    return r;
+}
+
+int pa_alsa_profile_set_supported_from_string(pa_alsa_profile_set *ps, const char *s) {
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    const char *state = NULL;
+    void *state2;
+    char *l;
+
+    pa_assert(ps);
+    pa_assert(s);
+
+    if (ps->probed || ps->profiles_probed)
+        return -1;
+
+    /* Check everything first, so that a stale string leaves the profile
+     * set untouched and it can still be probed the normal way */
+    while ((l = pa_split(s, "\n", &state))) {
+        int r = supported_line_parse(ps, l, FALSE);
+
+        if (r < 0)
+            pa_log_debug("Invalid probe result '%s'.", l);
+
+        pa_xfree(l);
+
+        if (r < 0)
+            return -1;
+    }
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state2)
+        p->supported = FALSE;
+    PA_HASHMAP_FOREACH(m, ps->mappings, state2)
+        m->supported = 0;
+
+    state = NULL;
+    while ((l = pa_split(s, "\n", &state))) {
+        pa_assert_se(supported_line_parse(ps, l, TRUE) >= 0);
+        pa_xfree(l);
+    }
+
+    ps->profiles_probed = TRUE;
+
+    return 0;
 }
 
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *ps) {
@@ -315,6 +315,10 @@ struct pa_alsa_profile_set {
     pa_bool_t auto_profiles;
     pa_bool_t ignore_dB:1;
     pa_bool_t probed:1;
+    pa_bool_t profiles_probed:1;
+
+    /* Some PCM was in use while probing, so the result might change */
+    pa_bool_t probe_busy:1;
 };
 
 void pa_alsa_mapping_dump(pa_alsa_mapping *m);
@@ -322,8 +326,21 @@ void pa_alsa_profile_dump(pa_alsa_profile *p);
 void pa_alsa_decibel_fix_dump(pa_alsa_decibel_fix *db_fix);
 pa_alsa_mapping *pa_alsa_mapping_get(pa_alsa_profile_set *ps, const char *name);
 
+char *pa_alsa_profile_set_path(const char *fname);
 pa_alsa_profile_set* pa_alsa_profile_set_new(const char *fname, const pa_channel_map *bonus);
 void pa_alsa_profile_set_probe(pa_alsa_profile_set *ps, const char *dev_id, const pa_sample_spec *ss, unsigned default_n_fragments, unsigned default_fragment_size_msec);
+
+/* The first half of pa_alsa_profile_set_probe(): finds out which
+ * profiles can be opened, but doesn't look at the mixer. This doesn't
+ * touch anything but the profile set and ALSA, so different cards may
+ * be probed from different threads at the same time. */
+void pa_alsa_profile_set_probe_profiles(pa_alsa_profile_set *ps, const char *dev_id, const pa_sample_spec *ss, unsigned default_n_fragments, unsigned default_fragment_size_msec);
+
+/* Saves and restores the result of pa_alsa_profile_set_probe_profiles(),
+ * for the probe cache. Restoring fails if the string doesn't match the
+ * profile set. */
+char *pa_alsa_profile_set_supported_to_string(pa_alsa_profile_set *ps);
+int pa_alsa_profile_set_supported_from_string(pa_alsa_profile_set *ps, const char *s);
 void pa_alsa_profile_set_free(pa_alsa_profile_set *s);
 void pa_alsa_profile_set_dump(pa_alsa_profile_set *s);
 void pa_alsa_profile_set_drop_unsupported(pa_alsa_profile_set *s);
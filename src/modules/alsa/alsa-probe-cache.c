@@ -0,0 +1,396 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <asoundlib.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/thread.h>
+
+#ifdef HAVE_UDEV
+#include <modules/udev-util.h>
+#endif
+
+#include "alsa-util.h"
+#include "alsa-probe-cache.h"
+
+/* Bump this whenever the meaning of the stored string changes */
+#define ENTRY_VERSION "1"
+
+struct probe_job {
+    char *device_id;
+    char *key;
+    pa_alsa_profile_set *profile_set;
+    pa_thread *thread;
+
+    pa_sample_spec ss;
+    unsigned default_n_fragments;
+    unsigned default_fragment_size_msec;
+};
+
+/* 64 bit FNV-1a */
+static uint64_t hash_data(uint64_t h, const void *data, size_t length) {
+    const uint8_t *p = data;
+
+    while (length-- > 0) {
+        h ^= *(p++);
+        h *= 0x100000001b3ULL;
+    }
+
+    return h;
+}
+
+static uint64_t hash_string(uint64_t h, const char *s) {
+    /* Include the terminating NUL, so that "ab" "c" and "a" "bc" differ */
+    return hash_data(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static int hash_file(uint64_t *h, const char *fn) {
+    FILE *f;
+    char buf[4096];
+    size_t n;
+    int r = 0;
+
+    if (!(f = pa_fopen_cloexec(fn, "r"))) {
+        pa_log_debug("Failed to open %s: %s", fn, pa_cstrerror(errno));
+        return -1;
+    }
+
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        *h = hash_data(*h, buf, n);
+
+    if (ferror(f))
+        r = -1;
+
+    fclose(f);
+    return r;
+}
+
+pa_database *pa_alsa_probe_cache_open(void) {
+    char *fn;
+    pa_database *db;
+
+    if (!(fn = pa_state_path("alsa-probe-cache", TRUE)))
+        return NULL;
+
+    if (!(db = pa_database_open(fn, TRUE)))
+        pa_log_debug("Failed to open probe cache %s: %s", fn, pa_cstrerror(errno));
+
+    pa_xfree(fn);
+    return db;
+}
+
+char *pa_alsa_probe_cache_key(
+        int alsa_card_index,
+        const char *profile_set,
+        const pa_channel_map *bonus,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec) {
+
+    snd_ctl_t *ctl;
+    snd_ctl_card_info_t *info;
+    char *t, *fn;
+    char cm[PA_CHANNEL_MAP_SNPRINT_MAX], sst[PA_SAMPLE_SPEC_SNPRINT_MAX];
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int err;
+
+    snd_ctl_card_info_alloca(&info);
+
+    pa_assert(alsa_card_index >= 0);
+    pa_assert(ss);
+
+    t = pa_sprintf_malloc("hw:%i", alsa_card_index);
+    err = snd_ctl_open(&ctl, t, 0);
+    pa_xfree(t);
+
+    if (err < 0) {
+        pa_log_debug("Failed to open control device of card %i: %s", alsa_card_index, pa_alsa_strerror(err));
+        return NULL;
+    }
+
+    if ((err = snd_ctl_card_info(ctl, info)) < 0) {
+        pa_log_debug("Failed to get info of card %i: %s", alsa_card_index, pa_alsa_strerror(err));
+        snd_ctl_close(ctl);
+        return NULL;
+    }
+
+    h = hash_string(h, snd_ctl_card_info_get_driver(info));
+    h = hash_string(h, snd_ctl_card_info_get_name(info));
+    h = hash_string(h, snd_ctl_card_info_get_longname(info));
+    h = hash_string(h, snd_ctl_card_info_get_mixername(info));
+    h = hash_string(h, snd_ctl_card_info_get_components(info));
+
+    fn = pa_alsa_profile_set_path(profile_set);
+    h = hash_string(h, fn);
+    err = hash_file(&h, fn);
+    pa_xfree(fn);
+
+    if (err < 0) {
+        snd_ctl_close(ctl);
+        return NULL;
+    }
+
+    h = hash_string(h, bonus ? pa_channel_map_snprint(cm, sizeof(cm), bonus) : NULL);
+    h = hash_string(h, pa_sample_spec_snprint(sst, sizeof(sst), ss));
+    h = hash_data(h, &default_n_fragments, sizeof(default_n_fragments));
+    h = hash_data(h, &default_fragment_size_msec, sizeof(default_fragment_size_msec));
+
+    t = pa_sprintf_malloc("%s:%016llx", snd_ctl_card_info_get_id(info), (unsigned long long) h);
+    snd_ctl_close(ctl);
+
+    return t;
+}
+
+pa_bool_t pa_alsa_probe_cache_has(pa_database *db, const char *key) {
+    pa_datum k, data;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+
+    if (!pa_database_get(db, &k, &data))
+        return FALSE;
+
+    pa_datum_free(&data);
+    return TRUE;
+}
+
+pa_bool_t pa_alsa_probe_cache_load(pa_database *db, const char *key, pa_alsa_profile_set *ps) {
+    pa_datum k, data;
+    const char *s;
+    pa_bool_t loaded = FALSE;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(ps);
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+
+    if (!pa_database_get(db, &k, &data))
+        return FALSE;
+
+    s = data.data;
+
+    if (data.size < sizeof(ENTRY_VERSION "\n") || s[data.size - 1] != 0 || !pa_startswith(s, ENTRY_VERSION "\n"))
+        pa_log_debug("Probe cache entry %s has the wrong format.", key);
+    else if (pa_alsa_profile_set_supported_from_string(ps, s + strlen(ENTRY_VERSION "\n")) < 0)
+        pa_log_debug("Probe cache entry %s doesn't match the profile set.", key);
+    else
+        loaded = TRUE;
+
+    pa_datum_free(&data);
+
+    if (!loaded)
+        pa_alsa_probe_cache_remove(db, key);
+
+    return loaded;
+}
+
+void pa_alsa_probe_cache_save(pa_database *db, const char *key, pa_alsa_profile_set *ps) {
+    pa_datum k, data;
+    char *s, *t;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(ps);
+
+    /* Profiles that failed because some other program had the PCM
+     * open will probably work next time */
+    if (ps->probe_busy) {
+        pa_log_debug("Some PCMs of %s were busy, not caching the probe results.", key);
+        pa_alsa_probe_cache_remove(db, key);
+        return;
+    }
+
+    s = pa_alsa_profile_set_supported_to_string(ps);
+
+    /* If nothing worked at all, something else is most likely wrong
+     * for now. Better probe it again next time. */
+    if (!*s) {
+        pa_log_debug("No working profiles on %s, not caching that.", key);
+        pa_xfree(s);
+        pa_alsa_probe_cache_remove(db, key);
+        return;
+    }
+
+    t = pa_sprintf_malloc(ENTRY_VERSION "\n%s", s);
+    pa_xfree(s);
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+    data.data = t;
+    data.size = strlen(t) + 1;
+
+    if (pa_database_set(db, &k, &data, TRUE) < 0)
+        pa_log_warn("Failed to save probe results for %s.", key);
+    else
+        pa_database_sync(db);
+
+    pa_xfree(t);
+}
+
+void pa_alsa_probe_cache_remove(pa_database *db, const char *key) {
+    pa_datum k;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+
+    if (pa_database_unset(db, &k) >= 0)
+        pa_database_sync(db);
+}
+
+static pa_bool_t card_has_ucm(int alsa_card_index) {
+    snd_use_case_mgr_t *uc_mgr;
+    char *card_name;
+    int err;
+
+    if (snd_card_get_name(alsa_card_index, &card_name) < 0)
+        return FALSE;
+
+    err = snd_use_case_mgr_open(&uc_mgr, card_name);
+    free(card_name);
+
+    if (err < 0)
+        return FALSE;
+
+    snd_use_case_mgr_close(uc_mgr);
+    return TRUE;
+}
+
+static void probe_thread(void *userdata) {
+    struct probe_job *j = userdata;
+
+    pa_alsa_profile_set_probe_profiles(j->profile_set, j->device_id, &j->ss,
+                                       j->default_n_fragments, j->default_fragment_size_msec);
+}
+
+void pa_alsa_probe_cache_fill(pa_core *c, const char * const *device_ids, unsigned n) {
+    pa_database *db;
+    struct probe_job *jobs;
+    unsigned i, n_jobs = 0;
+    pa_usec_t t;
+
+    pa_assert(c);
+    pa_assert(device_ids || n == 0);
+
+    if (n == 0)
+        return;
+
+    if (!(db = pa_alsa_probe_cache_open()))
+        return;
+
+    t = pa_rtclock_now();
+    jobs = pa_xnew0(struct probe_job, n);
+
+    pa_alsa_refcnt_inc();
+
+    /* Have alsa-lib load its configuration here, rather than from
+     * several threads at once when they open their first PCM */
+    snd_config_update();
+
+    for (i = 0; i < n; i++) {
+        struct probe_job *j = &jobs[n_jobs];
+        int alsa_card_index;
+        char *fn = NULL;
+
+        if ((alsa_card_index = snd_card_get_index(device_ids[i])) < 0)
+            continue;
+
+        /* module-alsa-card doesn't use the profile sets for these */
+        if (card_has_ucm(alsa_card_index)) {
+            pa_log_debug("Card %s uses UCM, not probing it in advance.", device_ids[i]);
+            continue;
+        }
+
+#ifdef HAVE_UDEV
+        fn = pa_udev_get_property(alsa_card_index, "PULSE_PROFILE_SET");
+#endif
+
+        j->key = pa_alsa_probe_cache_key(alsa_card_index, fn, &c->default_channel_map, &c->default_sample_spec,
+                                         c->default_n_fragments, c->default_fragment_size_msec);
+
+        /* The profile set has to be loaded here, because the config
+         * parser isn't thread-safe */
+        if (j->key && !pa_alsa_probe_cache_has(db, j->key))
+            j->profile_set = pa_alsa_profile_set_new(fn, &c->default_channel_map);
+
+        pa_xfree(fn);
+
+        if (!j->profile_set) {
+            pa_xfree(j->key);
+            j->key = NULL;
+            continue;
+        }
+
+        j->device_id = pa_xstrdup(device_ids[i]);
+        j->ss = c->default_sample_spec;
+        j->default_n_fragments = c->default_n_fragments;
+        j->default_fragment_size_msec = c->default_fragment_size_msec;
+
+        if (!(j->thread = pa_thread_new("alsa-probe", probe_thread, j))) {
+            pa_log_debug("Failed to create probing thread, probing %s right away.", j->device_id);
+            probe_thread(j);
+        }
+
+        n_jobs++;
+    }
+
+    for (i = 0; i < n_jobs; i++) {
+        struct probe_job *j = &jobs[i];
+
+        if (j->thread)
+            pa_thread_free(j->thread);
+
+        pa_alsa_probe_cache_save(db, j->key, j->profile_set);
+
+        pa_alsa_profile_set_free(j->profile_set);
+        pa_xfree(j->device_id);
+        pa_xfree(j->key);
+    }
+
+    pa_alsa_refcnt_dec();
+
+    pa_xfree(jobs);
+    pa_database_close(db);
+
+    if (n_jobs > 0)
+        pa_log_info("Probed %u of %u cards in %llu ms.", n_jobs, n, (unsigned long long) ((pa_rtclock_now() - t) / PA_USEC_PER_MSEC));
+}
@@ -0,0 +1,67 @@
+#ifndef fooalsaprobecachehfoo
+#define fooalsaprobecachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulse/channelmap.h>
+
+#include <pulsecore/core.h>
+#include <pulsecore/database.h>
+
+#include "alsa-mixer.h"
+
+/* Finding out which profiles of a card work means opening every PCM
+ * of every mapping, which can take a good part of a second per card.
+ * The answer only changes with the hardware or the profile set, so we
+ * keep it in a database in the state directory. Entries are keyed by
+ * the card ID and a hash of everything else the result depends on:
+ * the driver and card names, the contents of the profile set file and
+ * the sample spec and fragment settings used for probing. Results are
+ * not stored if some PCM was busy during probing. The mixer paths are
+ * still probed on every start. */
+
+pa_database *pa_alsa_probe_cache_open(void);
+
+/* Returns NULL if the card can't be identified */
+char *pa_alsa_probe_cache_key(
+        int alsa_card_index,
+        const char *profile_set,
+        const pa_channel_map *bonus,
+        const pa_sample_spec *ss,
+        unsigned default_n_fragments,
+        unsigned default_fragment_size_msec);
+
+pa_bool_t pa_alsa_probe_cache_has(pa_database *db, const char *key);
+
+/* Restores the supported profiles of ps from the cache, if there is a
+ * valid entry for key. Afterwards, pa_alsa_profile_set_probe() only
+ * needs to probe the mixer paths. */
+pa_bool_t pa_alsa_probe_cache_load(pa_database *db, const char *key, pa_alsa_profile_set *ps);
+void pa_alsa_probe_cache_save(pa_database *db, const char *key, pa_alsa_profile_set *ps);
+void pa_alsa_probe_cache_remove(pa_database *db, const char *key);
+
+/* Probes the profiles of the given cards in parallel, one thread per
+ * card, and stores the results in the cache. module-alsa-card then
+ * finds them there when it is loaded for these cards. Cards that use
+ * UCM or are in the cache already are skipped. */
+void pa_alsa_probe_cache_fill(pa_core *c, const char * const *device_ids, unsigned n);
+
+#endif
@@ -25,6 +25,7 @@
 #endif
 
 #include <sys/types.h>
+#include <errno.h>
 #include <asoundlib.h>
 
 #include <pulse/sample.h>
@@ -728,6 +729,7 @@ snd_pcm_t *pa_alsa_open_by_device_string(
 fail:
     pa_xfree(d);
 
+    errno = -err;
     return NULL;
 }
 
@@ -747,6 +749,7 @@ snd_pcm_t *pa_alsa_open_by_template(
 
     snd_pcm_t *pcm_handle;
     char **i;
+    int err = ENODEV;
 
     for (i = template; *i; i++) {
         char *d;
@@ -766,12 +769,19 @@ snd_pcm_t *pa_alsa_open_by_template(
                 use_tsched,
                 require_exact_channel_number);
 
-        pa_xfree(d);
-
-        if (pcm_handle)
+        if (pcm_handle) {
+            pa_xfree(d);
             return pcm_handle;
+        }
+
+        /* If a device is busy it's likely to work later on */
+        if (err != EBUSY)
+            err = errno;
+
+        pa_xfree(d);
     }
 
+    errno = err;
     return NULL;
 }
 
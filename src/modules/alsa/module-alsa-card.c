@@ -23,6 +23,8 @@
 #include <config.h>
 #endif
 
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
@@ -38,6 +40,7 @@
 
 #include "alsa-util.h"
 #include "alsa-ucm.h"
+#include "alsa-probe-cache.h"
 #include "alsa-sink.h"
 #include "alsa-source.h"
 #include "module-alsa-card-symdef.h"
@@ -71,6 +74,7 @@ PA_MODULE_USAGE(
         "profile_set=<profile set configuration file> "
         "paths_dir=<directory containing the path configuration files> "
         "use_ucm=<load use case manager> "
+        "probe_cache=<remember which profiles work across restarts?> "
 );
 
 static const char* const valid_modargs[] = {
@@ -98,6 +102,7 @@ static const char* const valid_modargs[] = {
     "profile_set",
     "paths_dir",
     "use_ucm",
+    "probe_cache",
     NULL
 };
 
@@ -529,18 +534,22 @@ static pa_hook_result_t source_output_unlink_hook_callback(pa_core *c, pa_source
 int pa__init(pa_module *m) {
     pa_card_new_data data;
     pa_modargs *ma;
-    pa_bool_t ignore_dB = FALSE;
+    pa_bool_t ignore_dB = FALSE, probe_cache = TRUE, cached = FALSE;
     struct userdata *u;
     pa_reserve_wrapper *reserve = NULL;
     const char *description;
     const char *profile = NULL;
-    char *fn = NULL;
+    char *fn = NULL, *cache_key = NULL;
     pa_bool_t namereg_fail = FALSE;
+    pa_database *cache = NULL;
+    pa_usec_t t;
 
     pa_alsa_refcnt_inc();
 
     pa_assert(m);
 
+    t = pa_rtclock_now();
+
     if (!(ma = pa_modargs_new(m->argument, valid_modargs))) {
         pa_log("Failed to parse module arguments");
         goto fail;
@@ -551,6 +560,11 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    if (pa_modargs_get_value_boolean(ma, "probe_cache", &probe_cache) < 0) {
+        pa_log("Failed to parse probe_cache argument.");
+        goto fail;
+    }
+
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
@@ -609,7 +623,6 @@ int pa__init(pa_module *m) {
         }
 
         u->profile_set = pa_alsa_profile_set_new(fn, &u->core->default_channel_map);
-        pa_xfree(fn);
     }
 
     u->profile_set->ignore_dB = ignore_dB;
@@ -617,9 +630,30 @@ int pa__init(pa_module *m) {
     if (!u->profile_set)
         goto fail;
 
+    if (!u->use_ucm && probe_cache && (cache = pa_alsa_probe_cache_open())) {
+        cache_key = pa_alsa_probe_cache_key(u->alsa_card_index, fn, &m->core->default_channel_map, &m->core->default_sample_spec,
+                                            m->core->default_n_fragments, m->core->default_fragment_size_msec);
+
+        if (cache_key && (cached = pa_alsa_probe_cache_load(cache, cache_key, u->profile_set)))
+            pa_log_info("Using cached probe results for card %s.", u->device_id);
+    }
+
     pa_alsa_profile_set_probe(u->profile_set, u->device_id, &m->core->default_sample_spec, m->core->default_n_fragments, m->core->default_fragment_size_msec);
     pa_alsa_profile_set_dump(u->profile_set);
 
+    if (cache_key && !cached)
+        pa_alsa_probe_cache_save(cache, cache_key, u->profile_set);
+
+    if (cache) {
+        pa_database_close(cache);
+        cache = NULL;
+    }
+
+    pa_xfree(cache_key);
+    cache_key = NULL;
+    pa_xfree(fn);
+    fn = NULL;
+
     pa_card_new_data_init(&data);
     data.driver = __FILE__;
     data.module = m;
@@ -688,12 +722,20 @@ int pa__init(pa_module *m) {
                     "is abused (i.e. fixes are not pushed to ALSA), the decibel fix feature may be removed in some future "
                     "PulseAudio version.", u->card->name);
 
+    pa_log_debug("Card %s initialized in %llu ms.", u->card->name, (unsigned long long) ((pa_rtclock_now() - t) / PA_USEC_PER_MSEC));
+
     return 0;
 
 fail:
     if (reserve)
         pa_reserve_wrapper_unref(reserve);
 
+    if (cache)
+        pa_database_close(cache);
+
+    pa_xfree(cache_key);
+    pa_xfree(fn);
+
     pa__done(m);
 
     return -1;
@@ -41,6 +41,8 @@
 
 #include <pulsecore/i18n.h>
 #include <pulsecore/atomic.h>
+#include <pulsecore/asyncq.h>
+#include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sink.h>
@@ -52,6 +54,7 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/thread.h>
 
 #include "module-echo-cancel-symdef.h"
 
@@ -77,6 +80,7 @@ PA_MODULE_USAGE(
           "save_aec=<save AEC data in /tmp> "
           "autoloaded=<set if this module is being loaded automatically> "
           "use_volume_sharing=<yes or no> "
+          "aec_thread=<run the canceller on its own thread> "
         ));
 
 /* NOTE: Make sure the enum and ec_table are maintained in the correct order */
@@ -142,6 +146,10 @@ static const pa_echo_canceller ec_table[] = {
 #define DEFAULT_ADJUST_TOLERANCE (5*PA_USEC_PER_MSEC)
 #define DEFAULT_SAVE_AEC FALSE
 #define DEFAULT_AUTOLOADED FALSE
+#define DEFAULT_AEC_THREAD FALSE
+
+/* How many blocks we average the canceller statistics over */
+#define AEC_STATS_INTERVAL 1000
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
@@ -176,6 +184,13 @@ static const pa_echo_canceller ec_table[] = {
  *    be before capture and the difference should not be bigger than one frame
  *    size. We would ideally like to resample the sink_input but most driver
  *    don't give enough accuracy to be able to do that right now.
+ *
+ * With aec_thread=1 the canceller itself runs on a thread of its own, so
+ * that a slow canceller can't delay the source IO thread and overrun the
+ * master source. The source IO thread still does all the buffering and
+ * alignment, but hands the blocks it would have passed to the canceller
+ * to that thread through a lock-free queue. The canceller thread posts
+ * the processed blocks back to the source IO thread through asyncmsgq.
  */
 
 struct userdata;
@@ -202,6 +217,41 @@ struct snapshot {
     size_t plen;
 };
 
+/* Canceller work, in the order the source IO thread queues it */
+typedef enum {
+    AEC_JOB_DRIFT,      /* set_drift() */
+    AEC_JOB_PLAY,       /* play() */
+    AEC_JOB_RECORD,     /* record(), posts the result */
+    AEC_JOB_RUN,        /* run(), or pass rec through if there's no play */
+    AEC_JOB_QUIT
+} aec_job_type_t;
+
+struct aec_job {
+    aec_job_type_t type;
+    pa_memchunk rec, play;
+    float drift;
+
+    /* The message queue to the main thread of the thread that queued the
+     * job, for volume changes the canceller makes */
+    pa_asyncmsgq *outq;
+};
+
+PA_STATIC_FLIST_DECLARE(aec_jobs, 0, pa_xfree);
+
+struct aec_thread {
+    pa_thread *thread;
+    int rtprio;
+
+    pa_asyncq *jobs;
+    pa_atomic_t queued;
+    pa_atomic_t pending_play;   /* bytes */
+    pa_atomic_t overruns;
+
+    /* Only used from the canceller thread */
+    pa_asyncmsgq *outq;
+    unsigned max_queued;
+};
+
 struct userdata {
     pa_core *core;
     pa_module *module;
@@ -250,8 +300,18 @@ struct userdata {
 
     pa_bool_t use_volume_sharing;
 
+    /* NULL if the canceller runs in the source IO thread */
+    struct aec_thread *aec_thread;
+
+    /* Updated by whichever thread runs the canceller */
+    struct {
+        unsigned n_blocks;
+        pa_usec_t total, max;
+    } aec_stats;
+
     struct {
         pa_cvolume current_volume;
+        size_t aec_pending;     /* capture bytes queued to the canceller thread */
     } thread_info;
 };
 
@@ -275,6 +335,7 @@ static const char* const valid_modargs[] = {
     "save_aec",
     "autoloaded",
     "use_volume_sharing",
+    "aec_thread",
     NULL
 };
 
@@ -282,7 +343,8 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST = PA_SOURCE_OUTPUT_MESSAGE_MAX,
     SOURCE_OUTPUT_MESSAGE_REWIND,
     SOURCE_OUTPUT_MESSAGE_LATENCY_SNAPSHOT,
-    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME
+    SOURCE_OUTPUT_MESSAGE_APPLY_DIFF_TIME,
+    SOURCE_OUTPUT_MESSAGE_AEC_DONE
 };
 
 enum {
@@ -413,7 +475,7 @@ static int source_process_msg_cb(pa_msgobject *o, int code, void *data, int64_t
                 /* Add the latency internal to our source output on top */
                 pa_bytes_to_usec(pa_memblockq_get_length(u->source_output->thread_info.delay_memblockq), &u->source_output->source->sample_spec) +
                 /* and the buffering we do on the source */
-                pa_bytes_to_usec(u->blocksize, &u->source_output->source->sample_spec);
+                pa_bytes_to_usec(u->blocksize + u->thread_info.aec_pending, &u->source_output->source->sample_spec);
 
             return 0;
 
@@ -702,6 +764,205 @@ static void do_resync(struct userdata *u) {
     apply_diff_time(u, diff_time);
 }
 
+/* Called from source I/O thread context or the canceller thread */
+static void account_block(struct userdata *u, pa_usec_t t) {
+    u->aec_stats.n_blocks++;
+    u->aec_stats.total += t;
+    u->aec_stats.max = PA_MAX(u->aec_stats.max, t);
+
+    if (u->aec_stats.n_blocks < AEC_STATS_INTERVAL)
+        return;
+
+    if (u->aec_thread)
+        pa_log_debug("Canceller took %llu usec per block on average, %llu usec at most, with up to %u blocks queued and %u overruns so far",
+                     (unsigned long long) (u->aec_stats.total / u->aec_stats.n_blocks),
+                     (unsigned long long) u->aec_stats.max,
+                     u->aec_thread->max_queued,
+                     (unsigned) pa_atomic_load(&u->aec_thread->overruns));
+    else
+        pa_log_debug("Canceller took %llu usec per block on average, %llu usec at most",
+                     (unsigned long long) (u->aec_stats.total / u->aec_stats.n_blocks),
+                     (unsigned long long) u->aec_stats.max);
+
+    pa_zero(u->aec_stats);
+
+    if (u->aec_thread)
+        u->aec_thread->max_queued = 0;
+}
+
+/* Runs the canceller on one job. If the job yields data for our source
+ * it is returned in out, otherwise out->memblock is NULL.
+ *
+ * Called from source I/O thread context or the canceller thread. */
+static void run_job(struct userdata *u, struct aec_job *j, pa_memchunk *out) {
+    const uint8_t *rdata, *pdata;
+    uint8_t *cdata;
+    pa_usec_t t;
+    int unused PA_GCC_UNUSED;
+
+    pa_memchunk_reset(out);
+
+    if (j->type == AEC_JOB_RUN && !j->play.memblock) {
+        /* Nothing to cancel against, forward the data as it is */
+        *out = j->rec;
+        pa_memblock_ref(out->memblock);
+        return;
+    }
+
+    t = pa_rtclock_now();
+
+    switch (j->type) {
+        case AEC_JOB_DRIFT:
+            /* Now let the canceller work its drift compensation magic */
+            u->ec->set_drift(u->ec, j->drift);
+
+            if (u->save_aec) {
+                if (u->drift_file)
+                    fprintf(u->drift_file, "d %a\n", j->drift);
+            }
+
+            /* Not worth accounting for */
+            return;
+
+        case AEC_JOB_PLAY:
+            pdata = pa_memblock_acquire_chunk(&j->play);
+
+            u->ec->play(u->ec, pdata);
+
+            if (u->save_aec) {
+                if (u->drift_file)
+                    fprintf(u->drift_file, "p %d\n", u->blocksize);
+                if (u->played_file)
+                    unused = fwrite(pdata, 1, u->blocksize, u->played_file);
+            }
+
+            pa_memblock_release(j->play.memblock);
+            break;
+
+        case AEC_JOB_RECORD:
+            rdata = pa_memblock_acquire_chunk(&j->rec);
+
+            out->index = 0;
+            out->length = u->blocksize;
+            out->memblock = pa_memblock_new(u->core->mempool, out->length);
+            cdata = pa_memblock_acquire(out->memblock);
+
+            u->ec->record(u->ec, rdata, cdata);
+
+            if (u->save_aec) {
+                if (u->drift_file)
+                    fprintf(u->drift_file, "c %d\n", u->blocksize);
+                if (u->captured_file)
+                    unused = fwrite(rdata, 1, u->blocksize, u->captured_file);
+                if (u->canceled_file)
+                    unused = fwrite(cdata, 1, u->blocksize, u->canceled_file);
+            }
+
+            pa_memblock_release(out->memblock);
+            pa_memblock_release(j->rec.memblock);
+            break;
+
+        case AEC_JOB_RUN:
+            rdata = pa_memblock_acquire_chunk(&j->rec);
+            pdata = pa_memblock_acquire_chunk(&j->play);
+
+            out->index = 0;
+            out->length = u->blocksize;
+            out->memblock = pa_memblock_new(u->core->mempool, out->length);
+            cdata = pa_memblock_acquire(out->memblock);
+
+            if (u->save_aec) {
+                if (u->captured_file)
+                    unused = fwrite(rdata, 1, u->blocksize, u->captured_file);
+                if (u->played_file)
+                    unused = fwrite(pdata, 1, u->blocksize, u->played_file);
+            }
+
+            /* perform echo cancellation */
+            u->ec->run(u->ec, rdata, pdata, cdata);
+
+            if (u->save_aec) {
+                if (u->canceled_file)
+                    unused = fwrite(cdata, 1, u->blocksize, u->canceled_file);
+            }
+
+            pa_memblock_release(out->memblock);
+            pa_memblock_release(j->play.memblock);
+            pa_memblock_release(j->rec.memblock);
+            break;
+
+        default:
+            pa_assert_not_reached();
+    }
+
+    account_block(u, pa_rtclock_now() - t);
+}
+
+static void free_job(struct aec_job *j) {
+    if (j->rec.memblock)
+        pa_memblock_unref(j->rec.memblock);
+    if (j->play.memblock)
+        pa_memblock_unref(j->play.memblock);
+
+    if (pa_flist_push(PA_STATIC_FLIST_GET(aec_jobs), j) < 0)
+        pa_xfree(j);
+}
+
+/* Hands a job to the canceller, or runs it right away if there's no
+ * canceller thread. Takes over the references to the chunks.
+ *
+ * Called from source I/O thread context. */
+static void submit_job(struct userdata *u, aec_job_type_t type, const pa_memchunk *rec, const pa_memchunk *play, float drift) {
+    struct aec_job *j;
+
+    if (!(j = pa_flist_pop(PA_STATIC_FLIST_GET(aec_jobs))))
+        j = pa_xnew(struct aec_job, 1);
+
+    j->type = type;
+    j->drift = drift;
+    j->outq = pa_thread_mq_get()->outq;
+
+    if (rec)
+        j->rec = *rec;
+    else
+        pa_memchunk_reset(&j->rec);
+
+    if (play)
+        j->play = *play;
+    else
+        pa_memchunk_reset(&j->play);
+
+    if (!u->aec_thread) {
+        pa_memchunk out;
+
+        run_job(u, j, &out);
+
+        if (out.memblock) {
+            /* forward the (echo-canceled) data to the virtual source */
+            pa_source_post(u->source, &out);
+            pa_memblock_unref(out.memblock);
+        }
+
+        free_job(j);
+        return;
+    }
+
+    if (pa_asyncq_push(u->aec_thread->jobs, j, FALSE) < 0) {
+        /* The canceller doesn't keep up. We'd rather lose this block than
+         * block the source IO thread, which would overrun the master. */
+        pa_atomic_inc(&u->aec_thread->overruns);
+        free_job(j);
+        return;
+    }
+
+    pa_atomic_inc(&u->aec_thread->queued);
+
+    if (rec)
+        u->thread_info.aec_pending += rec->length;
+    if (play)
+        pa_atomic_add(&u->aec_thread->pending_play, (int) play->length);
+}
+
 /* 1. Calculate drift at this point, pass to canceller
  * 2. Push out playback samples in blocksize chunks
  * 3. Push out capture samples in blocksize chunks
@@ -712,10 +973,8 @@ static void do_resync(struct userdata *u) {
  */
 static void do_push_drift_comp(struct userdata *u) {
     size_t rlen, plen;
-    pa_memchunk rchunk, pchunk, cchunk;
-    uint8_t *rdata, *pdata, *cdata;
+    pa_memchunk rchunk, pchunk;
     float drift;
-    int unused PA_GCC_UNUSED;
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
     plen = pa_memblockq_get_length(u->sink_memblockq);
@@ -734,32 +993,14 @@ static void do_push_drift_comp(struct userdata *u) {
     u->sink_rem = plen % u->blocksize;
     u->source_rem = rlen % u->blocksize;
 
-    /* Now let the canceller work its drift compensation magic */
-    u->ec->set_drift(u->ec, drift);
-
-    if (u->save_aec) {
-        if (u->drift_file)
-            fprintf(u->drift_file, "d %a\n", drift);
-    }
+    submit_job(u, AEC_JOB_DRIFT, NULL, NULL, drift);
 
     /* Send in the playback samples first */
     while (plen >= u->blocksize) {
         pa_memblockq_peek_fixed_size(u->sink_memblockq, u->blocksize, &pchunk);
-        pdata = pa_memblock_acquire(pchunk.memblock);
-        pdata += pchunk.index;
-
-        u->ec->play(u->ec, pdata);
-
-        if (u->save_aec) {
-            if (u->drift_file)
-                fprintf(u->drift_file, "p %d\n", u->blocksize);
-            if (u->played_file)
-                unused = fwrite(pdata, 1, u->blocksize, u->played_file);
-        }
-
-        pa_memblock_release(pchunk.memblock);
         pa_memblockq_drop(u->sink_memblockq, u->blocksize);
-        pa_memblock_unref(pchunk.memblock);
+
+        submit_job(u, AEC_JOB_PLAY, NULL, &pchunk, 0);
 
         plen -= u->blocksize;
     }
@@ -767,35 +1008,10 @@ static void do_push_drift_comp(struct userdata *u) {
     /* And now the capture samples */
     while (rlen >= u->blocksize) {
         pa_memblockq_peek_fixed_size(u->source_memblockq, u->blocksize, &rchunk);
+        pa_memblockq_drop(u->source_memblockq, u->blocksize);
 
-        rdata = pa_memblock_acquire(rchunk.memblock);
-        rdata += rchunk.index;
-
-        cchunk.index = 0;
-        cchunk.length = u->blocksize;
-        cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
-        cdata = pa_memblock_acquire(cchunk.memblock);
-
-        u->ec->record(u->ec, rdata, cdata);
-
-        if (u->save_aec) {
-            if (u->drift_file)
-                fprintf(u->drift_file, "c %d\n", u->blocksize);
-            if (u->captured_file)
-                unused = fwrite(rdata, 1, u->blocksize, u->captured_file);
-            if (u->canceled_file)
-                unused = fwrite(cdata, 1, u->blocksize, u->canceled_file);
-        }
-
-        pa_memblock_release(cchunk.memblock);
-        pa_memblock_release(rchunk.memblock);
-
-        pa_memblock_unref(rchunk.memblock);
-
-        pa_source_post(u->source, &cchunk);
-        pa_memblock_unref(cchunk.memblock);
+        submit_job(u, AEC_JOB_RECORD, &rchunk, NULL, 0);
 
-        pa_memblockq_drop(u->source_memblockq, u->blocksize);
         rlen -= u->blocksize;
     }
 }
@@ -807,9 +1023,7 @@ static void do_push_drift_comp(struct userdata *u) {
  * Called from source I/O thread context. */
 static void do_push(struct userdata *u) {
     size_t rlen, plen;
-    pa_memchunk rchunk, pchunk, cchunk;
-    uint8_t *rdata, *pdata, *cdata;
-    int unused PA_GCC_UNUSED;
+    pa_memchunk rchunk, pchunk;
 
     rlen = pa_memblockq_get_length(u->source_memblockq);
     plen = pa_memblockq_get_length(u->sink_memblockq);
@@ -817,57 +1031,21 @@ static void do_push(struct userdata *u) {
     while (rlen >= u->blocksize) {
         /* take fixed block from recorded samples */
         pa_memblockq_peek_fixed_size(u->source_memblockq, u->blocksize, &rchunk);
+        pa_memblockq_drop(u->source_memblockq, u->blocksize);
 
         if (plen >= u->blocksize) {
             /* take fixed block from played samples */
             pa_memblockq_peek_fixed_size(u->sink_memblockq, u->blocksize, &pchunk);
 
-            rdata = pa_memblock_acquire(rchunk.memblock);
-            rdata += rchunk.index;
-            pdata = pa_memblock_acquire(pchunk.memblock);
-            pdata += pchunk.index;
-
-            cchunk.index = 0;
-            cchunk.length = u->blocksize;
-            cchunk.memblock = pa_memblock_new(u->source->core->mempool, cchunk.length);
-            cdata = pa_memblock_acquire(cchunk.memblock);
-
-            if (u->save_aec) {
-                if (u->captured_file)
-                    unused = fwrite(rdata, 1, u->blocksize, u->captured_file);
-                if (u->played_file)
-                    unused = fwrite(pdata, 1, u->blocksize, u->played_file);
-            }
-
-            /* perform echo cancellation */
-            u->ec->run(u->ec, rdata, pdata, cdata);
-
-            if (u->save_aec) {
-                if (u->canceled_file)
-                    unused = fwrite(cdata, 1, u->blocksize, u->canceled_file);
-            }
-
-            pa_memblock_release(cchunk.memblock);
-            pa_memblock_release(pchunk.memblock);
-            pa_memblock_release(rchunk.memblock);
-
             /* drop consumed sink samples */
             pa_memblockq_drop(u->sink_memblockq, u->blocksize);
-            pa_memblock_unref(pchunk.memblock);
 
-            pa_memblock_unref(rchunk.memblock);
-            /* the filtered samples now become the samples from our
-             * source */
-            rchunk = cchunk;
+            submit_job(u, AEC_JOB_RUN, &rchunk, &pchunk, 0);
 
             plen -= u->blocksize;
-        }
+        } else
+            submit_job(u, AEC_JOB_RUN, &rchunk, NULL, 0);
 
-        /* forward the (echo-canceled) data to the virtual source */
-        pa_source_post(u->source, &rchunk);
-        pa_memblock_unref(rchunk.memblock);
-
-        pa_memblockq_drop(u->source_memblockq, u->blocksize);
         rlen -= u->blocksize;
     }
 }
@@ -923,11 +1101,11 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
         if (to_skip) {
             pa_memblockq_peek_fixed_size(u->source_memblockq, to_skip, &rchunk);
-            pa_source_post(u->source, &rchunk);
-
-            pa_memblock_unref(rchunk.memblock);
             pa_memblockq_drop(u->source_memblockq, to_skip);
 
+            /* Goes through the canceller thread too, to keep the order */
+            submit_job(u, AEC_JOB_RUN, &rchunk, NULL, 0);
+
             rlen -= to_skip;
             u->source_skip -= to_skip;
         }
@@ -1037,6 +1215,12 @@ static void source_output_snapshot_within_thread(struct userdata *u, struct snap
     snapshot->recv_counter = u->recv_counter;
     snapshot->rlen = rlen + u->sink_skip;
     snapshot->plen = plen + u->source_skip;
+
+    /* Blocks the canceller thread has yet to process */
+    if (u->aec_thread) {
+        snapshot->rlen += u->thread_info.aec_pending;
+        snapshot->plen += (size_t) pa_atomic_load(&u->aec_thread->pending_play);
+    }
 }
 
 /* Called from source I/O thread context. */
@@ -1084,6 +1268,18 @@ static int source_output_process_msg_cb(pa_msgobject *obj, int code, void *data,
             apply_diff_time(u, offset);
             return 0;
 
+        case SOURCE_OUTPUT_MESSAGE_AEC_DONE:
+            pa_source_output_assert_io_context(u->source_output);
+
+            pa_assert(u->thread_info.aec_pending >= chunk->length);
+            u->thread_info.aec_pending -= chunk->length;
+
+            /* forward the (echo-canceled) data to the virtual source */
+            if (u->source->thread_info.state == PA_SOURCE_RUNNING)
+                pa_source_post(u->source, chunk);
+
+            return 0;
+
     }
 
     return pa_source_output_process_msg(obj, code, data, offset, chunk);
@@ -1549,21 +1745,105 @@ static int canceller_process_msg_cb(pa_msgobject *o, int code, void *userdata, i
     return 0;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread context or the canceller
+ * thread. */
 void pa_echo_canceller_get_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
     *v = ec->msg->userdata->thread_info.current_volume;
 }
 
-/* Called by the canceller, so source I/O thread context. */
+/* Called by the canceller, so source I/O thread context or the canceller
+ * thread. */
 void pa_echo_canceller_set_capture_volume(pa_echo_canceller *ec, pa_cvolume *v) {
-    if (!pa_cvolume_equal(&ec->msg->userdata->thread_info.current_volume, v)) {
+    struct userdata *u = ec->msg->userdata;
+
+    if (!pa_cvolume_equal(&u->thread_info.current_volume, v)) {
         pa_cvolume *vol = pa_xnewdup(pa_cvolume, v, 1);
+        pa_asyncmsgq *outq;
 
-        pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, vol, 0, NULL,
+        /* The canceller thread has no message queue of its own, it uses
+         * the one of the source I/O thread that queued the current job */
+        outq = u->aec_thread ? u->aec_thread->outq : pa_thread_mq_get()->outq;
+
+        pa_asyncmsgq_post(outq, PA_MSGOBJECT(ec->msg), ECHO_CANCELLER_MESSAGE_SET_VOLUME, vol, 0, NULL,
                 pa_xfree);
     }
 }
 
+static void aec_thread_func(void *userdata) {
+    struct userdata *u = userdata;
+    struct aec_thread *t = u->aec_thread;
+
+    /* We work towards the deadline of the source IO thread */
+    if (t->rtprio > 0)
+        pa_make_realtime(t->rtprio);
+
+    for (;;) {
+        struct aec_job *j;
+        pa_memchunk out;
+        unsigned queued;
+
+        pa_assert_se(j = pa_asyncq_pop(t->jobs, TRUE));
+
+        if (j->type == AEC_JOB_QUIT) {
+            free_job(j);
+            break;
+        }
+
+        queued = (unsigned) pa_atomic_load(&t->queued);
+        t->max_queued = PA_MAX(t->max_queued, queued);
+        t->outq = j->outq;
+
+        run_job(u, j, &out);
+
+        if (j->play.memblock)
+            pa_atomic_sub(&t->pending_play, (int) j->play.length);
+
+        if (out.memblock) {
+            pa_asyncmsgq_post(u->asyncmsgq, PA_MSGOBJECT(u->source_output), SOURCE_OUTPUT_MESSAGE_AEC_DONE, NULL, 0, &out, NULL);
+            pa_memblock_unref(out.memblock);
+        }
+
+        pa_atomic_dec(&t->queued);
+        free_job(j);
+    }
+}
+
+/* Called from main context. */
+static int start_aec_thread(struct userdata *u, int rtprio) {
+    u->aec_thread = pa_xnew0(struct aec_thread, 1);
+    u->aec_thread->rtprio = rtprio;
+    u->aec_thread->jobs = pa_asyncq_new(0);
+
+    if (!(u->aec_thread->thread = pa_thread_new("echo-cancel", aec_thread_func, u))) {
+        pa_log("Failed to create canceller thread.");
+        pa_asyncq_free(u->aec_thread->jobs, NULL);
+        pa_xfree(u->aec_thread);
+        u->aec_thread = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Called from main context, once the source I/O thread doesn't queue
+ * jobs anymore. */
+static void stop_aec_thread(struct userdata *u) {
+    struct aec_job *j;
+
+    if (!u->aec_thread)
+        return;
+
+    j = pa_xnew0(struct aec_job, 1);
+    j->type = AEC_JOB_QUIT;
+    pa_assert_se(pa_asyncq_push(u->aec_thread->jobs, j, TRUE) == 0);
+
+    pa_thread_free(u->aec_thread->thread);
+    pa_asyncq_free(u->aec_thread->jobs, NULL);
+
+    pa_xfree(u->aec_thread);
+    u->aec_thread = NULL;
+}
+
 static pa_echo_canceller_method_t get_ec_method_from_string(const char *method) {
     if (pa_streq(method, "null"))
         return PA_ECHO_CANCELLER_NULL;
@@ -1636,6 +1916,7 @@ int pa__init(pa_module*m) {
     pa_sink_new_data sink_data;
     pa_memchunk silence;
     uint32_t temp;
+    pa_bool_t use_aec_thread;
 
     pa_assert(m);
 
@@ -1722,7 +2003,9 @@ int pa__init(pa_module*m) {
     if (init_common(ma, u, &source_ss, &source_map) < 0)
         goto fail;
 
-    u->asyncmsgq = pa_asyncmsgq_new(0);
+    /* The sink I/O thread, the main thread and possibly the canceller
+     * thread all post to this one */
+    u->asyncmsgq = pa_asyncmsgq_new_mpsc(0);
     u->need_realign = TRUE;
 
     if (u->ec->init) {
@@ -1735,6 +2018,15 @@ int pa__init(pa_module*m) {
     if (u->ec->params.drift_compensation)
         pa_assert(u->ec->set_drift);
 
+    use_aec_thread = DEFAULT_AEC_THREAD;
+    if (pa_modargs_get_value_boolean(ma, "aec_thread", &use_aec_thread) < 0) {
+        pa_log("Failed to parse aec_thread value");
+        goto fail;
+    }
+
+    if (use_aec_thread && start_aec_thread(u, m->core->realtime_scheduling ? m->core->realtime_priority : 0) < 0)
+        goto fail;
+
     /* Create source */
     pa_source_new_data_init(&source_data);
     source_data.driver = __FILE__;
@@ -2009,6 +2301,9 @@ void pa__done(pa_module*m) {
     if (u->sink_input)
         pa_sink_input_unlink(u->sink_input);
 
+    /* Nothing gets queued to the canceller anymore now */
+    stop_aec_thread(u);
+
     if (u->source)
         pa_source_unlink(u->source);
     if (u->sink)
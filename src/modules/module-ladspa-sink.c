@@ -29,6 +29,8 @@
 #include <math.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 #include <pulsecore/i18n.h>
 #include <pulsecore/namereg.h>
@@ -40,6 +42,9 @@
 #include <pulsecore/rtpoll.h>
 #include <pulsecore/sample-util.h>
 #include <pulsecore/ltdl-helper.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/semaphore.h>
+#include <pulsecore/atomic.h>
 
 #ifdef HAVE_DBUS
 #include <pulsecore/protocol-dbus.h>
@@ -65,13 +70,28 @@ PA_MODULE_USAGE(
       "label=<ladspa plugin label> "
       "control=<comma separated list of input control values> "
       "input_ladspaport_map=<comma separated list of input LADSPA port names> "
-      "output_ladspaport_map=<comma separated list of output LADSPA port names> "));
+      "output_ladspaport_map=<comma separated list of output LADSPA port names> "
+      "threads=<number of worker threads running plugin instances in parallel> "
+      "rewind_preroll=<msec of input to replay through the plugin after a rewind> "));
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
 /* PLEASE NOTICE: The PortAudio ports and the LADSPA ports are two different concepts.
 They are not related and where possible the names of the LADSPA port variables contains "ladspa" to avoid confusion */
 
+struct userdata;
+
+/* The plugin instances are independent of each other, so with more than
+ * one of them we let a few worker threads help the IO thread run them.
+ * The IO thread hands out the instances of a block through an atomic
+ * counter and waits until all of them are done before it returns. */
+struct worker {
+    struct userdata *u;
+    pa_thread *thread;
+    pa_semaphore *start;
+    int rtprio;
+};
+
 struct userdata {
     pa_module *module;
 
@@ -81,17 +101,35 @@ struct userdata {
     const LADSPA_Descriptor *descriptor;
     LADSPA_Handle handle[PA_CHANNELS_MAX];
     unsigned long max_ladspaport_count, input_count, output_count, channels;
+    /* max_ladspaport_count buffers per instance, so that the instances
+     * can run concurrently */
     LADSPA_Data **input, **output;
     size_t block_size;
     LADSPA_Data *control;
     long unsigned n_control;
 
     /* This is a dummy buffer. Every port must be connected, but we don't care
-    about control out ports. We connect them all to this single buffer. */
-    LADSPA_Data control_out;
+    about control out ports. We connect them all to one slot per instance. */
+    LADSPA_Data control_out[PA_CHANNELS_MAX];
+
+    struct worker *workers;
+    unsigned n_workers;
+    pa_semaphore *workers_done;
+    pa_bool_t workers_quit;
+
+    /* The block currently being processed */
+    const float *job_src;
+    float *job_dst;
+    unsigned job_n;
+    pa_atomic_t job_next;
 
     pa_memblockq *memblockq;
 
+    /* How much input we run through the plugin again to restore its
+     * state after a rewind, and where its output goes to */
+    size_t preroll;
+    float *preroll_buffer;
+
     pa_bool_t *use_default;
     pa_sample_spec ss;
 
@@ -116,6 +154,8 @@ static const char* const valid_modargs[] = {
     "control",
     "input_ladspaport_map",
     "output_ladspaport_map",
+    "threads",
+    "rewind_preroll",
     NULL
 };
 
@@ -451,12 +491,170 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+/* Copies the channels of one instance from the interleaved block into
+ * its buffers, one pass over the frames for all of them instead of one
+ * strided pa_sample_clamp() per channel */
+static void deinterleave(const float *src, unsigned stride, LADSPA_Data **dst, unsigned long count, unsigned n) {
+    unsigned i;
+    unsigned long c;
+
+    if (count == 1) {
+        LADSPA_Data *d0 = dst[0];
+
+        for (i = 0; i < n; i++, src += stride)
+            d0[i] = PA_CLAMP_UNLIKELY(src[0], -1.0f, 1.0f);
+
+    } else if (count == 2) {
+        LADSPA_Data *d0 = dst[0], *d1 = dst[1];
+
+        for (i = 0; i < n; i++, src += stride) {
+            d0[i] = PA_CLAMP_UNLIKELY(src[0], -1.0f, 1.0f);
+            d1[i] = PA_CLAMP_UNLIKELY(src[1], -1.0f, 1.0f);
+        }
+
+    } else
+        for (i = 0; i < n; i++, src += stride)
+            for (c = 0; c < count; c++)
+                dst[c][i] = PA_CLAMP_UNLIKELY(src[c], -1.0f, 1.0f);
+}
+
+static void interleave(LADSPA_Data **src, unsigned long count, float *dst, unsigned stride, unsigned n) {
+    unsigned i;
+    unsigned long c;
+
+    if (count == 1) {
+        const LADSPA_Data *s0 = src[0];
+
+        for (i = 0; i < n; i++, dst += stride)
+            dst[0] = PA_CLAMP_UNLIKELY(s0[i], -1.0f, 1.0f);
+
+    } else if (count == 2) {
+        const LADSPA_Data *s0 = src[0], *s1 = src[1];
+
+        for (i = 0; i < n; i++, dst += stride) {
+            dst[0] = PA_CLAMP_UNLIKELY(s0[i], -1.0f, 1.0f);
+            dst[1] = PA_CLAMP_UNLIKELY(s1[i], -1.0f, 1.0f);
+        }
+
+    } else
+        for (i = 0; i < n; i++, dst += stride)
+            for (c = 0; c < count; c++)
+                dst[c] = PA_CLAMP_UNLIKELY(src[c][i], -1.0f, 1.0f);
+}
+
+/* Called from I/O thread context or a worker thread */
+static void run_instances(struct userdata *u) {
+    unsigned long n_instances = u->channels / u->max_ladspaport_count;
+    unsigned h;
+
+    while ((h = (unsigned) pa_atomic_inc(&u->job_next)) < n_instances) {
+        LADSPA_Data **input = u->input + h * u->max_ladspaport_count;
+        LADSPA_Data **output = u->output + h * u->max_ladspaport_count;
+
+        deinterleave(u->job_src + h * u->max_ladspaport_count, (unsigned) u->channels, input, u->input_count, u->job_n);
+        u->descriptor->run(u->handle[h], u->job_n);
+        interleave(output, u->output_count, u->job_dst + h * u->max_ladspaport_count, (unsigned) u->channels, u->job_n);
+    }
+}
+
+/* Called from I/O thread context */
+static void process_block(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned w;
+
+    u->job_src = src;
+    u->job_dst = dst;
+    u->job_n = n;
+    pa_atomic_store(&u->job_next, 0);
+
+    for (w = 0; w < u->n_workers; w++)
+        pa_semaphore_post(u->workers[w].start);
+
+    run_instances(u);
+
+    for (w = 0; w < u->n_workers; w++)
+        pa_semaphore_wait(u->workers_done);
+}
+
+static void worker_func(void *userdata) {
+    struct worker *w = userdata;
+    struct userdata *u = w->u;
+
+    /* We work towards the deadline of the IO thread */
+    if (w->rtprio > 0)
+        pa_make_realtime(w->rtprio);
+
+    for (;;) {
+        pa_semaphore_wait(w->start);
+
+        if (u->workers_quit)
+            break;
+
+        run_instances(u);
+        pa_semaphore_post(u->workers_done);
+    }
+}
+
+static void stop_workers(struct userdata *u) {
+    unsigned w;
+
+    if (!u->workers)
+        return;
+
+    u->workers_quit = TRUE;
+
+    for (w = 0; w < u->n_workers; w++)
+        pa_semaphore_post(u->workers[w].start);
+
+    for (w = 0; w < u->n_workers; w++) {
+        pa_thread_free(u->workers[w].thread);
+        pa_semaphore_free(u->workers[w].start);
+    }
+
+    pa_semaphore_free(u->workers_done);
+    pa_xfree(u->workers);
+
+    u->workers = NULL;
+    u->n_workers = 0;
+}
+
+static int start_workers(struct userdata *u, unsigned n, int rtprio) {
+    unsigned w;
+
+    if (n <= 0)
+        return 0;
+
+    u->workers = pa_xnew0(struct worker, n);
+    u->workers_done = pa_semaphore_new(0);
+    u->workers_quit = FALSE;
+
+    for (w = 0; w < n; w++) {
+        u->workers[w].u = u;
+        u->workers[w].rtprio = rtprio;
+        u->workers[w].start = pa_semaphore_new(0);
+
+        if (!(u->workers[w].thread = pa_thread_new("ladspa-worker", worker_func, &u->workers[w]))) {
+            pa_log("Failed to create worker thread.");
+            pa_semaphore_free(u->workers[w].start);
+            break;
+        }
+
+        u->n_workers++;
+    }
+
+    if (u->n_workers < n) {
+        stop_workers(u);
+        return -1;
+    }
+
+    return 0;
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
     float *src, *dst;
     size_t fs;
-    unsigned n, h, c;
+    unsigned n;
     pa_memchunk tchunk;
 
     pa_sink_input_assert_ref(i);
@@ -491,13 +689,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
-        for (c = 0; c < u->input_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, u->input[c], sizeof(float), src+ h*u->max_ladspaport_count + c, u->channels*sizeof(float), n);
-        u->descriptor->run(u->handle[h], n);
-        for (c = 0; c < u->output_count; c++)
-            pa_sample_clamp(PA_SAMPLE_FLOAT32NE, dst + h*u->max_ladspaport_count + c, u->channels*sizeof(float), u->output[c], sizeof(float), n);
-    }
+    process_block(u, src, dst, n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -507,10 +699,70 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     return 0;
 }
 
+/* Called from I/O thread context */
+static void reset_instances(struct userdata *u) {
+    unsigned c;
+
+    pa_log_debug("Resetting plugin");
+
+    if (u->descriptor->deactivate)
+        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
+            u->descriptor->deactivate(u->handle[c]);
+    if (u->descriptor->activate)
+        for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
+            u->descriptor->activate(u->handle[c]);
+}
+
+/* Called from I/O thread context */
+static void preroll_instances(struct userdata *u) {
+    size_t fs, left;
+
+    /* LADSPA has no way to save and restore the state of a plugin, so
+     * we run the freshly reset plugin over the input that preceded the
+     * current read index again and throw its output away. For filters
+     * with a memory shorter than that this restores the state they had
+     * when they first processed the data at the read index. Where our
+     * history has holes or doesn't reach back that far we replay
+     * silence, so that the timing of the input stays the same. */
+    fs = pa_frame_size(&u->ss);
+    left = u->preroll;
+
+    pa_memblockq_rewind(u->memblockq, left);
+
+    while (left > 0) {
+        pa_memchunk tchunk;
+        unsigned n;
+
+        if (pa_memblockq_peek(u->memblockq, &tchunk) < 0) {
+            pa_memblockq_drop(u->memblockq, left);
+            break;
+        }
+
+        n = (unsigned) (PA_MIN(tchunk.length, left) / fs);
+        n = PA_MIN(n, (unsigned) (u->block_size / fs));
+        pa_assert(n > 0);
+
+        if (tchunk.memblock) {
+            process_block(u, pa_memblock_acquire_chunk(&tchunk), u->preroll_buffer, n);
+            pa_memblock_release(tchunk.memblock);
+            pa_memblock_unref(tchunk.memblock);
+        } else {
+            /* Every instance reads its own channels before writing
+             * them, so this can be done in place */
+            memset(u->preroll_buffer, 0, n * fs);
+            process_block(u, u->preroll_buffer, u->preroll_buffer, n);
+        }
+
+        pa_memblockq_drop(u->memblockq, n * fs);
+        left -= n * fs;
+    }
+}
+
 /* Called from I/O thread context */
 static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
     struct userdata *u;
     size_t amount = 0;
+    pa_bool_t reset = FALSE;
 
     pa_sink_input_assert_ref(i);
     pa_assert_se(u = i->userdata);
@@ -523,24 +775,27 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
         u->sink->thread_info.rewind_nbytes = 0;
 
         if (amount > 0) {
-            unsigned c;
-
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
-
-            pa_log_debug("Resetting plugin");
-
-            /* Reset the plugin */
-            if (u->descriptor->deactivate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->deactivate(u->handle[c]);
-            if (u->descriptor->activate)
-                for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                    u->descriptor->activate(u->handle[c]);
+            reset = TRUE;
         }
     }
 
     pa_sink_process_rewind(u->sink, amount);
     pa_memblockq_rewind(u->memblockq, nbytes);
+
+    /* With a pre-roll we can bring the plugin back to the right state
+     * for any rewind, including those of our master that leave our own
+     * input untouched. Without one we only reset it if the input
+     * changed, which is audible either way. */
+    if (u->preroll > 0)
+        reset = reset || nbytes > 0;
+
+    if (reset) {
+        reset_instances(u);
+
+        if (u->preroll > 0)
+            preroll_instances(u);
+    }
 }
 
 /* Called from I/O thread context */
@@ -552,7 +807,7 @@ static void sink_input_update_max_rewind_cb(pa_sink_input *i, size_t nbytes) {
 
     /* FIXME: Too small max_rewind:
      * https://bugs.freedesktop.org/show_bug.cgi?id=53709 */
-    pa_memblockq_set_maxrewind(u->memblockq, nbytes);
+    pa_memblockq_set_maxrewind(u->memblockq, nbytes + u->preroll);
     pa_sink_set_max_rewind_within_thread(u->sink, nbytes);
 }
 
@@ -790,7 +1045,7 @@ static void connect_control_ports(struct userdata *u) {
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
             for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+                d->connect_port(u->handle[c], p, &u->control_out[c]);
             continue;
         }
 
@@ -893,7 +1148,7 @@ static int write_control_parameters(struct userdata *u, double *control_values,
 
         if (LADSPA_IS_PORT_OUTPUT(d->PortDescriptors[p])) {
             for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
-                d->connect_port(u->handle[c], p, &u->control_out);
+                d->connect_port(u->handle[c], p, &u->control_out[c]);
             continue;
         }
 
@@ -993,7 +1248,8 @@ int pa__init(pa_module*m) {
     unsigned long input_ladspaport[PA_CHANNELS_MAX], output_ladspaport[PA_CHANNELS_MAX];
     const char *e, *cdata;
     const LADSPA_Descriptor *d;
-    unsigned long p, h, j, n_control, c;
+    unsigned long p, h, j, n_control, c, n_instances, n_buffers;
+    uint32_t n_threads, preroll_msec = 0;
 
     pa_assert(m);
 
@@ -1181,31 +1437,36 @@ int pa__init(pa_module*m) {
 
     u->block_size = pa_frame_align(pa_mempool_block_size_max(m->core->mempool), &ss);
 
-    /* Create buffers */
+    /* Create buffers, each instance gets its own set */
+    n_instances = u->channels / u->max_ladspaport_count;
+    n_buffers = n_instances * u->max_ladspaport_count;
+
     if (LADSPA_IS_INPLACE_BROKEN(d->Properties)) {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->input_count);
-        for (c = 0; c < u->input_count; c++)
-            u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
-        u->output = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->output_count);
-        for (c = 0; c < u->output_count; c++)
-            u->output[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+        u->input = (LADSPA_Data**) pa_xnew0(LADSPA_Data*, (unsigned) n_buffers);
+        u->output = (LADSPA_Data**) pa_xnew0(LADSPA_Data*, (unsigned) n_buffers);
+        for (h = 0; h < n_instances; h++) {
+            for (c = 0; c < u->input_count; c++)
+                u->input[h * u->max_ladspaport_count + c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+            for (c = 0; c < u->output_count; c++)
+                u->output[h * u->max_ladspaport_count + c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
+        }
     } else {
-        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) u->max_ladspaport_count);
-        for (c = 0; c < u->max_ladspaport_count; c++)
+        u->input = (LADSPA_Data**) pa_xnew(LADSPA_Data*, (unsigned) n_buffers);
+        for (c = 0; c < n_buffers; c++)
             u->input[c] = (LADSPA_Data*) pa_xnew(uint8_t, (unsigned) u->block_size);
         u->output = u->input;
     }
     /* Initialize plugin instances */
-    for (h = 0; h < (u->channels / u->max_ladspaport_count); h++) {
+    for (h = 0; h < n_instances; h++) {
         if (!(u->handle[h] = d->instantiate(d, ss.rate))) {
             pa_log("Failed to instantiate plugin %s with label %s", plugin, d->Label);
             goto fail;
         }
 
         for (c = 0; c < u->input_count; c++)
-            d->connect_port(u->handle[h], input_ladspaport[c], u->input[c]);
+            d->connect_port(u->handle[h], input_ladspaport[c], u->input[h * u->max_ladspaport_count + c]);
         for (c = 0; c < u->output_count; c++)
-            d->connect_port(u->handle[h], output_ladspaport[c], u->output[c]);
+            d->connect_port(u->handle[h], output_ladspaport[c], u->output[h * u->max_ladspaport_count + c]);
     }
 
     u->n_control = n_control;
@@ -1240,6 +1501,29 @@ int pa__init(pa_module*m) {
         for (c = 0; c < (u->channels / u->max_ladspaport_count); c++)
             d->activate(u->handle[c]);
 
+    /* By default use one thread per instance, as far as we have CPUs
+     * for them, the IO thread itself being the first one */
+    n_threads = (uint32_t) PA_MIN(n_instances, pa_ncpus()) - 1;
+    if (pa_modargs_get_value_u32(ma, "threads", &n_threads) < 0 || n_threads >= n_instances) {
+        pa_log("Invalid number of threads, must be less than the number of plugin instances (%lu).", n_instances);
+        goto fail;
+    }
+
+    if (start_workers(u, n_threads, m->core->realtime_scheduling ? m->core->realtime_priority : 0) < 0)
+        goto fail;
+
+    pa_log_debug("Running %lu plugin instances with %u worker threads", n_instances, n_threads);
+
+    if (pa_modargs_get_value_u32(ma, "rewind_preroll", &preroll_msec) < 0) {
+        pa_log("Invalid rewind pre-roll.");
+        goto fail;
+    }
+
+    if (preroll_msec > 0) {
+        u->preroll = pa_usec_to_bytes(preroll_msec * PA_USEC_PER_MSEC, &ss);
+        u->preroll_buffer = (float*) pa_xnew(uint8_t, u->block_size);
+    }
+
     /* Create sink */
     pa_sink_new_data_init(&sink_data);
     sink_data.driver = __FILE__;
@@ -1356,7 +1640,7 @@ int pa__get_n_used(pa_module *m) {
 
 void pa__done(pa_module*m) {
     struct userdata *u;
-    unsigned c;
+    unsigned c, n_buffers;
 
     pa_assert(m);
 
@@ -1382,6 +1666,8 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unref(u->sink);
 
+    stop_workers(u);
+
     for (c = 0; c < (u->channels / u->max_ladspaport_count); c++) {
         if (u->handle[c]) {
             if (u->descriptor->deactivate)
@@ -1390,20 +1676,22 @@ void pa__done(pa_module*m) {
         }
     }
 
+    n_buffers = (u->channels / u->max_ladspaport_count) * u->max_ladspaport_count;
+
     if (u->output == u->input) {
         if (u->input != NULL) {
-            for (c = 0; c < u->max_ladspaport_count; c++)
+            for (c = 0; c < n_buffers; c++)
                 pa_xfree(u->input[c]);
             pa_xfree(u->input);
         }
     } else {
         if (u->input != NULL) {
-            for (c = 0; c < u->input_count; c++)
+            for (c = 0; c < n_buffers; c++)
                 pa_xfree(u->input[c]);
             pa_xfree(u->input);
         }
         if (u->output != NULL) {
-            for (c = 0; c < u->output_count; c++)
+            for (c = 0; c < n_buffers; c++)
                 pa_xfree(u->output[c]);
             pa_xfree(u->output);
         }
@@ -1412,7 +1700,287 @@ void pa__done(pa_module*m) {
     if (u->memblockq)
         pa_memblockq_free(u->memblockq);
 
+    pa_xfree(u->preroll_buffer);
     pa_xfree(u->control);
     pa_xfree(u->use_default);
     pa_xfree(u);
 }
+
+#ifdef LADSPA_SINK_TEST
+/*
+ * Stand-alone benchmark of the per-period plugin processing, using a
+ * built-in mono plugin that burns a fixed amount of CPU per sample, and
+ * a check of the rewind pre-roll with the same plugin.
+ */
+
+#define BENCH_FRAMES 1024
+#define BENCH_PERIODS 200
+
+struct bench_plugin {
+    LADSPA_Data *in, *out;
+    float state;
+};
+
+static LADSPA_Handle bench_instantiate(const LADSPA_Descriptor *d, unsigned long rate) {
+    return pa_xnew0(struct bench_plugin, 1);
+}
+
+static void bench_connect_port(LADSPA_Handle h, unsigned long port, LADSPA_Data *data) {
+    struct bench_plugin *b = h;
+
+    if (port == 0)
+        b->in = data;
+    else
+        b->out = data;
+}
+
+static void bench_run(LADSPA_Handle h, unsigned long n) {
+    struct bench_plugin *b = h;
+    unsigned long i;
+    unsigned k;
+
+    for (i = 0; i < n; i++) {
+        float v = b->in[i];
+
+        /* A cascade of one pole lowpasses */
+        for (k = 0; k < 64; k++)
+            v = b->state = b->state * 0.5f + v * 0.5f;
+
+        b->out[i] = v;
+    }
+}
+
+static void bench_activate(LADSPA_Handle h) {
+    struct bench_plugin *b = h;
+
+    b->state = 0;
+}
+
+static void bench_cleanup(LADSPA_Handle h) {
+    pa_xfree(h);
+}
+
+static const LADSPA_PortDescriptor bench_port_descriptors[] = {
+    LADSPA_PORT_INPUT | LADSPA_PORT_AUDIO,
+    LADSPA_PORT_OUTPUT | LADSPA_PORT_AUDIO
+};
+
+static const char * const bench_port_names[] = { "Input", "Output" };
+
+static const LADSPA_Descriptor bench_descriptor = {
+    .UniqueID = 0,
+    .Label = "bench",
+    .Name = "Benchmark",
+    .PortCount = 2,
+    .PortDescriptors = bench_port_descriptors,
+    .PortNames = bench_port_names,
+    .instantiate = bench_instantiate,
+    .connect_port = bench_connect_port,
+    .activate = bench_activate,
+    .run = bench_run,
+    .cleanup = bench_cleanup
+};
+
+static void bench_init(struct userdata *u, unsigned channels) {
+    unsigned c;
+
+    pa_memzero(u, sizeof(*u));
+    u->descriptor = &bench_descriptor;
+    u->channels = channels;
+    u->max_ladspaport_count = u->input_count = u->output_count = 1;
+    u->input = pa_xnew(LADSPA_Data*, channels);
+    u->output = pa_xnew(LADSPA_Data*, channels);
+
+    for (c = 0; c < channels; c++) {
+        u->input[c] = pa_xnew0(LADSPA_Data, BENCH_FRAMES);
+        u->output[c] = pa_xnew0(LADSPA_Data, BENCH_FRAMES);
+        u->handle[c] = u->descriptor->instantiate(u->descriptor, 48000);
+        u->descriptor->connect_port(u->handle[c], 0, u->input[c]);
+        u->descriptor->connect_port(u->handle[c], 1, u->output[c]);
+    }
+}
+
+static void bench_done(struct userdata *u) {
+    unsigned c;
+
+    for (c = 0; c < u->channels; c++) {
+        u->descriptor->cleanup(u->handle[c]);
+        pa_xfree(u->input[c]);
+        pa_xfree(u->output[c]);
+    }
+
+    pa_xfree(u->input);
+    pa_xfree(u->output);
+}
+
+/* Returns the time per period, and the sum of the output to compare the
+ * parallel to the serial results */
+static pa_usec_t bench(unsigned channels, unsigned threads, double *sum) {
+    struct userdata u;
+    float *src, *dst;
+    pa_usec_t t;
+    unsigned i;
+
+    bench_init(&u, channels);
+
+    src = pa_xnew(float, BENCH_FRAMES * channels);
+    dst = pa_xnew(float, BENCH_FRAMES * channels);
+
+    for (i = 0; i < BENCH_FRAMES * channels; i++)
+        src[i] = (float) (i % 200) / 100.0f - 1.0f;
+
+    pa_assert_se(start_workers(&u, threads, 0) >= 0);
+
+    t = pa_rtclock_now();
+    for (i = 0; i < BENCH_PERIODS; i++)
+        process_block(&u, src, dst, BENCH_FRAMES);
+    t = pa_rtclock_now() - t;
+
+    stop_workers(&u);
+
+    *sum = 0;
+    for (i = 0; i < BENCH_FRAMES * channels; i++)
+        *sum += dst[i];
+
+    bench_done(&u);
+
+    pa_xfree(src);
+    pa_xfree(dst);
+
+    return t / BENCH_PERIODS;
+}
+
+#define PREROLL_FRAMES 512
+#define PREROLL_TOTAL_FRAMES 4000
+
+/* Reads n frames from the queue like sink_input_pop_cb() does */
+static void preroll_pop(struct userdata *u, float *dst, unsigned n) {
+    size_t fs = pa_frame_size(&u->ss);
+
+    while (n > 0) {
+        pa_memchunk tchunk;
+        unsigned k;
+
+        pa_assert_se(pa_memblockq_peek(u->memblockq, &tchunk) >= 0);
+        pa_assert(tchunk.memblock);
+
+        k = (unsigned) (PA_MIN(tchunk.length, u->block_size) / fs);
+        k = PA_MIN(k, n);
+
+        process_block(u, pa_memblock_acquire_chunk(&tchunk), dst, k);
+        pa_memblock_release(tchunk.memblock);
+        pa_memblock_unref(tchunk.memblock);
+
+        pa_memblockq_drop(u->memblockq, k * fs);
+        dst += k * u->channels;
+        n -= k;
+    }
+}
+
+/* After a rewind, the output with pre-roll has to be the same as the
+ * first time round. The plugin forgets its state within a few hundred
+ * samples, so the pre-roll covers it. The last rewind goes back to
+ * close to the start of the stream, so that the pre-roll has to replay
+ * silence before it. */
+static pa_bool_t preroll_test(unsigned channels) {
+    static const unsigned rewinds[] = { 1, 100, 700, 3000, PREROLL_TOTAL_FRAMES - 100 };
+    struct userdata u;
+    pa_mempool *pool;
+    pa_memchunk chunk;
+    float *src, *ref, *out;
+    size_t fs;
+    unsigned i;
+    pa_bool_t good = TRUE;
+
+    bench_init(&u, channels);
+
+    u.ss.format = PA_SAMPLE_FLOAT32NE;
+    u.ss.rate = 48000;
+    u.ss.channels = (uint8_t) channels;
+    fs = pa_frame_size(&u.ss);
+
+    u.block_size = 256 * fs;
+    u.preroll = PREROLL_FRAMES * fs;
+    u.preroll_buffer = (float*) pa_xnew(uint8_t, u.block_size);
+
+    pa_assert_se(pool = pa_mempool_new(FALSE, 0));
+    u.memblockq = pa_memblockq_new("ladspa-sink-test memblockq", 0, MEMBLOCKQ_MAXLENGTH, 0, &u.ss, 1, 1,
+                                   PREROLL_TOTAL_FRAMES * fs + u.preroll, NULL);
+
+    chunk.memblock = pa_memblock_new(pool, PREROLL_TOTAL_FRAMES * fs);
+    chunk.index = 0;
+    chunk.length = PREROLL_TOTAL_FRAMES * fs;
+
+    src = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < PREROLL_TOTAL_FRAMES * channels; i++)
+        src[i] = (float) ((i * 7919) % 2000) / 1000.0f - 1.0f;
+    pa_memblock_release(chunk.memblock);
+
+    pa_assert_se(pa_memblockq_push(u.memblockq, &chunk) >= 0);
+    pa_memblock_unref(chunk.memblock);
+
+    ref = pa_xnew(float, PREROLL_TOTAL_FRAMES * channels);
+    out = pa_xnew(float, PREROLL_TOTAL_FRAMES * channels);
+
+    preroll_pop(&u, ref, PREROLL_TOTAL_FRAMES);
+
+    for (i = 0; i < PA_ELEMENTSOF(rewinds); i++) {
+        unsigned n = rewinds[i];
+
+        pa_memblockq_rewind(u.memblockq, n * fs);
+        reset_instances(&u);
+        preroll_instances(&u);
+        preroll_pop(&u, out, n);
+
+        if (memcmp(out, ref + (PREROLL_TOTAL_FRAMES - n) * channels, n * fs) != 0) {
+            pa_log_error("Output after a rewind of %u frames differs.", n);
+            good = FALSE;
+        }
+    }
+
+    pa_memblockq_free(u.memblockq);
+    pa_mempool_free(pool);
+
+    bench_done(&u);
+
+    pa_xfree(u.preroll_buffer);
+    pa_xfree(ref);
+    pa_xfree(out);
+
+    return good;
+}
+
+int main(int argc, char* argv[]) {
+    unsigned channels, max_threads;
+
+    pa_log_set_level(PA_LOG_DEBUG);
+
+    /* Optionally override the number of CPUs we make use of */
+    max_threads = argc > 1 ? (unsigned) atoi(argv[1]) : pa_ncpus() - 1;
+
+    if (!preroll_test(1) || !preroll_test(4))
+        return 1;
+
+    pa_log_info("%u frames per period, %u CPUs", BENCH_FRAMES, pa_ncpus());
+
+    for (channels = 1; channels <= 16; channels *= 2) {
+        unsigned threads = PA_MIN(channels - 1, max_threads);
+        pa_usec_t serial, parallel;
+        double serial_sum, parallel_sum;
+
+        serial = bench(channels, 0, &serial_sum);
+        parallel = bench(channels, threads, &parallel_sum);
+
+        pa_log_info("%2u instances: %6llu usec per period serial, %6llu usec with %u worker threads",
+                    channels, (unsigned long long) serial, (unsigned long long) parallel, threads);
+
+        if (serial_sum != parallel_sum) {
+            pa_log_error("Parallel processing yielded different results.");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+#endif /* LADSPA_SINK_TEST */
@@ -39,9 +39,7 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/log.h>
-#include <pulsecore/thread.h>
-#include <pulsecore/thread-mq.h>
-#include <pulsecore/rtpoll.h>
+#include <pulsecore/io-thread-pool.h>
 
 #include "module-null-sink-symdef.h"
 
@@ -65,9 +63,7 @@ struct userdata {
     pa_module *module;
     pa_sink *sink;
 
-    pa_thread *thread;
-    pa_thread_mq thread_mq;
-    pa_rtpoll *rtpoll;
+    pa_io_thread_job *job;
 
     pa_usec_t block_usec;
     pa_usec_t timestamp;
@@ -195,56 +191,27 @@ static void process_render(struct userdata *u, pa_usec_t now) {
 /*     pa_log_debug("Ate in sum %lu bytes (of %lu)", (unsigned long) ate, (unsigned long) nbytes); */
 }
 
-static void thread_func(void *userdata) {
+/* Called from IO context */
+static pa_usec_t job_cb(pa_io_thread_job *j, pa_usec_t now, void *userdata) {
     struct userdata *u = userdata;
 
     pa_assert(u);
 
-    pa_log_debug("Thread starting up");
+    if (!PA_SINK_IS_OPENED(u->sink->thread_info.state))
+        return PA_USEC_INVALID;
 
-    pa_thread_mq_install(&u->thread_mq);
-
-    u->timestamp = pa_rtclock_now();
-
-    for (;;) {
-        int ret;
-
-        /* Render some data and drop it immediately */
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            pa_usec_t now;
-
-            now = pa_rtclock_now();
-
-            if (u->sink->thread_info.rewind_requested) {
-                if (u->sink->thread_info.rewind_nbytes > 0)
-                    process_rewind(u, now);
-                else
-                    pa_sink_process_rewind(u->sink, 0);
-            }
-
-            if (u->timestamp <= now)
-                process_render(u, now);
-
-            pa_rtpoll_set_timer_absolute(u->rtpoll, u->timestamp);
-        } else
-            pa_rtpoll_set_timer_disabled(u->rtpoll);
-
-        /* Hmm, nothing to do. Let's sleep */
-        if ((ret = pa_rtpoll_run(u->rtpoll, TRUE)) < 0)
-            goto fail;
-
-        if (ret == 0)
-            goto finish;
+    /* Render some data and drop it immediately */
+    if (u->sink->thread_info.rewind_requested) {
+        if (u->sink->thread_info.rewind_nbytes > 0)
+            process_rewind(u, now);
+        else
+            pa_sink_process_rewind(u->sink, 0);
     }
 
-fail:
-    /* If this was no regular exit from the loop we have to continue
-     * processing messages until we received PA_MESSAGE_SHUTDOWN */
-    pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->core), PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
-    pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+    if (u->timestamp <= now)
+        process_render(u, now);
 
-finish:
-    pa_log_debug("Thread shutting down");
+    return u->timestamp;
 }
 
 int pa__init(pa_module*m) {
@@ -272,8 +239,13 @@ int pa__init(pa_module*m) {
     m->userdata = u = pa_xnew0(struct userdata, 1);
     u->core = m->core;
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
-    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
+
+    /* Many null sinks may be loaded at the same time, hence don't
+     * spawn a thread for each of them */
+    if (!(u->job = pa_io_thread_job_new(pa_core_get_io_thread_pool(m->core), m, job_cb, u))) {
+        pa_log("Failed to create IO thread job.");
+        goto fail;
+    }
 
     pa_sink_new_data_init(&data);
     data.driver = __FILE__;
@@ -302,18 +274,16 @@ int pa__init(pa_module*m) {
     u->sink->update_requested_latency = sink_update_requested_latency_cb;
     u->sink->userdata = u;
 
-    pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
-    pa_sink_set_rtpoll(u->sink, u->rtpoll);
+    pa_sink_set_asyncmsgq(u->sink, pa_io_thread_job_get_asyncmsgq(u->job));
+    pa_sink_set_rtpoll(u->sink, pa_io_thread_job_get_rtpoll(u->job));
 
     u->block_usec = BLOCK_USEC;
     nbytes = pa_usec_to_bytes(u->block_usec, &u->sink->sample_spec);
     pa_sink_set_max_rewind(u->sink, nbytes);
     pa_sink_set_max_request(u->sink, nbytes);
 
-    if (!(u->thread = pa_thread_new("null-sink", thread_func, u))) {
-        pa_log("Failed to create thread.");
-        goto fail;
-    }
+    u->timestamp = pa_rtclock_now();
+    pa_io_thread_job_start(u->job);
 
     pa_sink_set_latency_range(u->sink, 0, BLOCK_USEC);
 
@@ -352,18 +322,11 @@ void pa__done(pa_module*m) {
     if (u->sink)
         pa_sink_unlink(u->sink);
 
-    if (u->thread) {
-        pa_asyncmsgq_send(u->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
-        pa_thread_free(u->thread);
-    }
-
-    pa_thread_mq_done(&u->thread_mq);
+    if (u->job)
+        pa_io_thread_job_free(u->job);
 
     if (u->sink)
         pa_sink_unref(u->sink);
 
-    if (u->rtpoll)
-        pa_rtpoll_free(u->rtpoll);
-
     pa_xfree(u);
 }
@@ -54,6 +54,7 @@
 #include <pulsecore/proplist-util.h>
 #include <pulsecore/auth-cookie.h>
 #include <pulsecore/mcalign.h>
+#include <pulsecore/pcm-codec.h>
 
 #ifdef TUNNEL_SINK
 #include "module-tunnel-sink-symdef.h"
@@ -72,7 +73,8 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "channels=<number of channels> "
         "rate=<sample rate> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "compression=<none, lossless or adpcm>");
 #else
 PA_MODULE_DESCRIPTION("Tunnel module for sources");
 PA_MODULE_USAGE(
@@ -84,7 +86,8 @@ PA_MODULE_USAGE(
         "format=<sample format> "
         "channels=<number of channels> "
         "rate=<sample rate> "
-        "channel_map=<channel map>");
+        "channel_map=<channel map> "
+        "compression=<none, lossless or adpcm>");
 #endif
 
 PA_MODULE_AUTHOR("Lennart Poettering");
@@ -107,6 +110,7 @@ static const char* const valid_modargs[] = {
     "source",
 #endif
     "channel_map",
+    "compression",
     NULL,
 };
 
@@ -198,6 +202,11 @@ struct userdata {
 
     pa_auth_cookie *auth_cookie;
 
+    /* The codec is only used from the IO thread, once the stream is
+     * created */
+    pa_pcm_codec_type_t compression;
+    pa_pcm_codec *codec;
+
     uint32_t version;
     uint32_t ctag;
     uint32_t device_index;
@@ -464,10 +473,20 @@ static void send_data(struct userdata *u) {
     pa_assert(u);
 
     while (u->requested_bytes > 0) {
-        pa_memchunk memchunk;
+        pa_memchunk memchunk, data;
 
         pa_sink_render(u->sink, u->requested_bytes, &memchunk);
-        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, 0, &memchunk, NULL);
+
+        if (u->codec)
+            pa_pcm_codec_encode(u->codec, &memchunk, &data);
+        else {
+            data = memchunk;
+            pa_memblock_ref(data.memblock);
+        }
+
+        /* Pass the uncompressed length along for the latency accounting */
+        pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_POST, NULL, (int64_t) memchunk.length, &data, NULL);
+        pa_memblock_unref(data.memblock);
         pa_memblock_unref(memchunk.memblock);
 
         u->requested_bytes -= memchunk.length;
@@ -551,7 +570,7 @@ static int sink_process_msg(pa_msgobject *o, int code, void *data, int64_t offse
 
             pa_pstream_send_memblock(u->pstream, u->channel, 0, PA_SEEK_RELATIVE, chunk);
 
-            u->counter_delta += (int64_t) chunk->length;
+            u->counter_delta += offset;
 
             return 0;
     }
@@ -615,10 +634,27 @@ static int source_process_msg(pa_msgobject *o, int code, void *data, int64_t off
         }
 
         case SOURCE_MESSAGE_POST: {
-            pa_memchunk c;
+            pa_memchunk c, decoded;
+
+            /* Tell the main thread how much we got, after decompression */
+            *(size_t*) data = 0;
+
+            if (u->codec) {
+                pa_pcm_codec_decode(u->codec, chunk, &decoded);
+
+                if (!decoded.memblock)
+                    return 0;
+
+                chunk = &decoded;
+            }
+
+            *(size_t*) data = chunk->length;
 
             pa_mcalign_push(u->mcalign, chunk);
 
+            if (u->codec)
+                pa_memblock_unref(decoded.memblock);
+
             while (pa_mcalign_pop(u->mcalign, &c) >= 0) {
 
                 if (PA_SOURCE_IS_OPENED(u->source->thread_info.state))
@@ -1526,6 +1562,32 @@ static void create_stream_callback(pa_pdispatch *pd, uint32_t command,  uint32_t
         pa_format_info_free(format);
     }
 
+    if (u->version >= 30) {
+        uint32_t c;
+        pa_pcm_codec_type_t compression;
+
+        if (pa_tagstruct_getu32(t, &c) < 0 ||
+            c >= PA_PCM_CODEC_MAX)
+            goto parse_error;
+
+        compression = (pa_pcm_codec_type_t) c;
+
+        if (compression != PA_PCM_CODEC_NONE) {
+            if (compression != u->compression)
+                goto parse_error;
+
+#ifdef TUNNEL_SINK
+            u->codec = pa_pcm_codec_new(u->compression, &u->sink->sample_spec, u->core->mempool);
+#else
+            u->codec = pa_pcm_codec_new(u->compression, &u->source->sample_spec, u->core->mempool);
+#endif
+            pa_assert(u->codec);
+
+            pa_log_info("Using %s compression.", pa_pcm_codec_type_to_string(u->compression));
+        } else if (u->compression != PA_PCM_CODEC_NONE)
+            pa_log_info("Server refused %s compression, transferring uncompressed data.", pa_pcm_codec_type_to_string(u->compression));
+    }
+
     if (!pa_tagstruct_eof(t))
         goto parse_error;
 
@@ -1745,6 +1807,11 @@ static void setup_complete_callback(pa_pdispatch *pd, uint32_t command, uint32_t
     }
 #endif
 
+    if (u->version >= 30)
+        pa_tagstruct_putu32(reply, u->compression);
+    else if (u->compression != PA_PCM_CODEC_NONE)
+        pa_log_info("Server doesn't support compression, transferring uncompressed data.");
+
     pa_pstream_send_tagstruct(u->pstream, reply);
     pa_pdispatch_register_reply(u->pdispatch, tag, DEFAULT_TIMEOUT, create_stream_callback, u, NULL);
 
@@ -1768,14 +1835,14 @@ static void pstream_die_callback(pa_pstream *p, void *userdata) {
 }
 
 /* Called from main context */
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     struct userdata *u = userdata;
 
     pa_assert(p);
     pa_assert(packet);
     pa_assert(u);
 
-    if (pa_pdispatch_run(u->pdispatch, packet, creds, u) < 0) {
+    if (pa_pdispatch_run(u->pdispatch, packet, ancil_data, u) < 0) {
         pa_log("Invalid packet");
         pa_module_unload_request(u->module, TRUE);
         return;
@@ -1786,6 +1853,7 @@ static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_c
 /* Called from main context */
 static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
     struct userdata *u = userdata;
+    size_t length;
 
     pa_assert(p);
     pa_assert(chunk);
@@ -1797,9 +1865,9 @@ static void pstream_memblock_callback(pa_pstream *p, uint32_t channel, int64_t o
         return;
     }
 
-    pa_asyncmsgq_send(u->source->asyncmsgq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_POST, PA_UINT_TO_PTR(seek), offset, chunk);
+    pa_asyncmsgq_send(u->source->asyncmsgq, PA_MSGOBJECT(u->source), SOURCE_MESSAGE_POST, &length, offset, chunk);
 
-    u->counter_delta += (int64_t) chunk->length;
+    u->counter_delta += (int64_t) length;
 }
 #endif
 
@@ -1968,6 +2036,16 @@ int pa__init(pa_module*m) {
         goto fail;
     }
 
+    if ((u->compression = pa_pcm_codec_type_from_string(pa_modargs_get_value(ma, "compression", "none"))) == PA_PCM_CODEC_INVALID) {
+        pa_log("Invalid compression specification");
+        goto fail;
+    }
+
+    if (u->compression != PA_PCM_CODEC_NONE && !pa_pcm_codec_supported(u->compression, &ss)) {
+        pa_log("Compression is only supported for s16le and s16be samples");
+        goto fail;
+    }
+
     if (!(u->client = pa_socket_client_new_string(m->core->mainloop, TRUE, u->server_name, PA_NATIVE_DEFAULT_PORT))) {
         pa_log("Failed to connect to server '%s'", u->server_name);
         goto fail;
@@ -2158,6 +2236,9 @@ void pa__done(pa_module*m) {
         pa_mcalign_free(u->mcalign);
 #endif
 
+    if (u->codec)
+        pa_pcm_codec_free(u->codec);
+
 #ifdef TUNNEL_SINK
     pa_xfree(u->sink_name);
 #else
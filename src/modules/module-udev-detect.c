@@ -29,6 +29,7 @@
 #include <sys/inotify.h>
 #include <libudev.h>
 
+#include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 
 #include <pulsecore/modargs.h>
@@ -37,6 +38,10 @@
 #include <pulsecore/namereg.h>
 #include <pulsecore/ratelimit.h>
 
+#ifdef HAVE_ALSA
+#include <modules/alsa/alsa-probe-cache.h>
+#endif
+
 #include "module-udev-detect-symdef.h"
 
 PA_MODULE_AUTHOR("Lennart Poettering");
@@ -73,6 +78,11 @@ struct userdata {
 
     int inotify_fd;
     pa_io_event *inotify_io;
+
+    /* While enumerating the cards at startup, cards that are ready to
+     * be loaded are collected here, so that they can be probed in
+     * parallel before the modules are loaded one after another */
+    pa_idxset *deferred;
 };
 
 static const char* const valid_modargs[] = {
@@ -327,6 +337,11 @@ static void verify_access(struct userdata *u, struct device *d) {
                  * during opening was canceled by a "try again"
                  * failure or a "fatal" failure. */
 
+                if (u->deferred) {
+                    pa_idxset_put(u->deferred, d, NULL);
+                    return;
+                }
+
                 if (pa_ratelimit_test(&d->ratelimit, PA_LOG_DEBUG)) {
                     pa_log_debug("Loading module-alsa-card with arguments '%s'", d->args);
                     m = pa_module_load(u->core, "module-alsa-card", d->args);
@@ -409,6 +424,38 @@ static void card_changed(struct userdata *u, struct udev_device *dev) {
     verify_access(u, d);
 }
 
+static void load_deferred(struct userdata *u) {
+    struct device *d;
+    uint32_t idx;
+    pa_idxset *deferred;
+
+    pa_assert(u);
+
+    if (!(deferred = u->deferred))
+        return;
+
+    u->deferred = NULL;
+
+#ifdef HAVE_ALSA
+    if (!pa_idxset_isempty(deferred)) {
+        const char **ids;
+        unsigned n = 0;
+
+        ids = pa_xnew(const char*, pa_idxset_size(deferred));
+        PA_IDXSET_FOREACH(d, deferred, idx)
+            ids[n++] = path_get_card_id(d->path);
+
+        pa_alsa_probe_cache_fill(u->core, ids, n);
+        pa_xfree(ids);
+    }
+#endif
+
+    PA_IDXSET_FOREACH(d, deferred, idx)
+        verify_access(u, d);
+
+    pa_idxset_free(deferred, NULL, NULL);
+}
+
 static void remove_card(struct userdata *u, struct udev_device *dev) {
     struct device *d;
 
@@ -668,7 +715,7 @@ int pa__init(pa_module *m) {
     struct udev_list_entry *item = NULL, *first = NULL;
     int fd;
     pa_bool_t use_tsched = TRUE, fixed_latency_range = FALSE, ignore_dB = FALSE, deferred_volume = m->core->deferred_volume;
-
+    pa_usec_t t;
 
     pa_assert(m);
 
@@ -756,6 +803,9 @@ int pa__init(pa_module *m) {
         goto fail;
     }
 
+    t = pa_rtclock_now();
+    u->deferred = pa_idxset_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
+
     first = udev_enumerate_get_list_entry(enumerate);
     udev_list_entry_foreach(item, first)
         process_path(u, udev_list_entry_get_name(item));
@@ -764,6 +814,10 @@ int pa__init(pa_module *m) {
 
     pa_log_info("Found %u cards.", pa_hashmap_size(u->devices));
 
+    load_deferred(u);
+
+    pa_log_debug("Loading modules for all cards took %llu ms.", (unsigned long long) ((pa_rtclock_now() - t) / PA_USEC_PER_MSEC));
+
     pa_modargs_free(ma);
 
     return 0;
@@ -804,6 +858,9 @@ void pa__done(pa_module *m) {
     if (u->inotify_fd >= 0)
         pa_close(u->inotify_fd);
 
+    if (u->deferred)
+        pa_idxset_free(u->deferred, NULL, NULL);
+
     if (u->devices) {
         struct device *d;
 
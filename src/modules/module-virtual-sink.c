@@ -286,6 +286,14 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
             /* (5) PUT YOUR CODE HERE TO RESET YOUR FILTER  */
+
+            /* If your filter has state, resetting it is audible. If
+             * that state has a limited memory, you can instead reset
+             * it and run it again over input history from before the
+             * read index after pa_memblockq_rewind() below, discarding
+             * the output. Keep that much more history with
+             * pa_memblockq_set_maxrewind() in update_max_rewind().
+             * module-ladspa-sink does so with rewind_preroll=. */
         }
     }
 
@@ -43,6 +43,10 @@
 
 #include <math.h>
 
+#ifdef HAVE_FFTW
+#include <fftw3.h>
+#endif
+
 #include "module-virtual-surround-sink-symdef.h"
 
 PA_MODULE_AUTHOR("Niels Ole Salscheider");
@@ -64,6 +68,13 @@ PA_MODULE_USAGE(
 
 #define MEMBLOCKQ_MAXLENGTH (16*1024*1024)
 
+/* The hrir is split into partitions of BLOCK_SIZE samples. The first
+ * partition is folded directly with the input so that we don't add any
+ * latency, the remaining ones are applied in the frequency domain
+ * (uniformly partitioned overlap-save) once per block. Without FFTW
+ * only the first partition is used. */
+#define BLOCK_SIZE 64
+
 struct userdata {
     pa_module *module;
 
@@ -87,8 +98,32 @@ struct userdata {
     unsigned hrir_samples;
     float *hrir_data;
 
+    /* The input of the previous and the current block, the current
+     * block starts at frame BLOCK_SIZE */
     float *input_buffer;
-    int input_buffer_offset;
+    unsigned input_buffer_offset;
+
+#ifdef HAVE_FFTW
+    /* Number of partitions handled in the frequency domain, i.e. all
+     * but the first one */
+    unsigned n_partitions;
+
+    fftwf_plan forward_plan, inverse_plan;
+    float *work_buffer;
+    fftwf_complex *spectrum;
+
+    /* [partition][channel][bin] */
+    fftwf_complex *hrir_spectra_left;
+    fftwf_complex *hrir_spectra_right;
+
+    /* Spectra of the last n_partitions input blocks, [block][channel][bin] */
+    fftwf_complex *input_spectra;
+    unsigned input_spectra_index;
+
+    /* What the frequency domain partitions contribute to the current block */
+    float *tail_left;
+    float *tail_right;
+#endif
 };
 
 static const char* const valid_modargs[] = {
@@ -213,6 +248,193 @@ static void sink_set_mute_cb(pa_sink *s) {
     pa_sink_input_set_mute(u->sink_input, s->muted, s->save_muted);
 }
 
+#ifdef HAVE_FFTW
+#define SPECTRUM_SIZE (BLOCK_SIZE + 1)
+
+/* Called from I/O thread context */
+static void convolve_tail(struct userdata *u, const fftwf_complex *hrir_spectra, float *tail) {
+    unsigned p, k, i;
+
+    memset(u->spectrum, 0, SPECTRUM_SIZE * sizeof(fftwf_complex));
+
+    /* Partition p + 1 of the hrir applies to the input block that is p
+     * blocks older than the most recent one */
+    for (p = 0; p < u->n_partitions; p++) {
+        unsigned slot = (u->input_spectra_index + u->n_partitions - p) % u->n_partitions;
+        const fftwf_complex *x = u->input_spectra + slot * u->channels * SPECTRUM_SIZE;
+        const fftwf_complex *h = hrir_spectra + p * u->channels * SPECTRUM_SIZE;
+
+        for (k = 0; k < u->channels; k++, x += SPECTRUM_SIZE, h += SPECTRUM_SIZE) {
+            for (i = 0; i < SPECTRUM_SIZE; i++) {
+                u->spectrum[i][0] += x[i][0] * h[i][0] - x[i][1] * h[i][1];
+                u->spectrum[i][1] += x[i][0] * h[i][1] + x[i][1] * h[i][0];
+            }
+        }
+    }
+
+    /* The first half is wrapped around, the second half is what we want */
+    fftwf_execute_dft_c2r(u->inverse_plan, u->spectrum, u->work_buffer);
+    memcpy(tail, u->work_buffer + BLOCK_SIZE, BLOCK_SIZE * sizeof(float));
+}
+
+/* Called from I/O thread context */
+static void convolve_block(struct userdata *u) {
+    unsigned k, i;
+    fftwf_complex *x;
+
+    /* Transform the previous and the just completed block of every
+     * channel into the next slot of the delay line */
+    u->input_spectra_index = (u->input_spectra_index + 1) % u->n_partitions;
+    x = u->input_spectra + u->input_spectra_index * u->channels * SPECTRUM_SIZE;
+
+    for (k = 0; k < u->channels; k++, x += SPECTRUM_SIZE) {
+        for (i = 0; i < 2 * BLOCK_SIZE; i++)
+            u->work_buffer[i] = u->input_buffer[i * u->channels + k];
+
+        fftwf_execute_dft_r2c(u->forward_plan, u->work_buffer, x);
+    }
+
+    convolve_tail(u, u->hrir_spectra_left, u->tail_left);
+    convolve_tail(u, u->hrir_spectra_right, u->tail_right);
+}
+
+/* Called from main context */
+static void transform_hrir(struct userdata *u, const unsigned *mapping, fftwf_complex *hrir_spectra) {
+    unsigned p, k, j;
+
+    for (p = 0; p < u->n_partitions; p++) {
+        for (k = 0; k < u->channels; k++) {
+            memset(u->work_buffer, 0, 2 * BLOCK_SIZE * sizeof(float));
+
+            /* Zero padded to twice the block size, FFTW doesn't
+             * normalize so we fold that into the hrir */
+            for (j = 0; j < BLOCK_SIZE && (p + 1) * BLOCK_SIZE + j < u->hrir_samples; j++)
+                u->work_buffer[j] = u->hrir_data[((p + 1) * BLOCK_SIZE + j) * u->hrir_channels + mapping[k]] / (2 * BLOCK_SIZE);
+
+            fftwf_execute_dft_r2c(u->forward_plan, u->work_buffer, hrir_spectra + (p * u->channels + k) * SPECTRUM_SIZE);
+        }
+    }
+}
+
+/* Called from main context */
+static void init_partitions(struct userdata *u) {
+    u->n_partitions = (u->hrir_samples + BLOCK_SIZE - 1) / BLOCK_SIZE - 1;
+
+    if (u->n_partitions > 0) {
+        size_t spectra_size = u->n_partitions * u->channels * SPECTRUM_SIZE * sizeof(fftwf_complex);
+
+        u->work_buffer = fftwf_malloc(2 * BLOCK_SIZE * sizeof(float));
+        u->spectrum = fftwf_malloc(SPECTRUM_SIZE * sizeof(fftwf_complex));
+        u->hrir_spectra_left = fftwf_malloc(spectra_size);
+        u->hrir_spectra_right = fftwf_malloc(spectra_size);
+        u->input_spectra = fftwf_malloc(spectra_size);
+        u->tail_left = pa_xnew0(float, BLOCK_SIZE);
+        u->tail_right = pa_xnew0(float, BLOCK_SIZE);
+
+        pa_assert_se(u->work_buffer && u->spectrum && u->hrir_spectra_left && u->hrir_spectra_right && u->input_spectra);
+
+        /* The delay line and the hrir spectra are addressed with an
+         * offset, so the plans must not rely on any particular alignment */
+        u->forward_plan = fftwf_plan_dft_r2c_1d(2 * BLOCK_SIZE, u->work_buffer, u->spectrum, FFTW_ESTIMATE | FFTW_UNALIGNED);
+        u->inverse_plan = fftwf_plan_dft_c2r_1d(2 * BLOCK_SIZE, u->spectrum, u->work_buffer, FFTW_ESTIMATE | FFTW_UNALIGNED);
+
+        transform_hrir(u, u->mapping_left, u->hrir_spectra_left);
+        transform_hrir(u, u->mapping_right, u->hrir_spectra_right);
+
+        memset(u->input_spectra, 0, spectra_size);
+        u->input_spectra_index = 0;
+    }
+}
+
+/* Called from main context */
+static void free_partitions(struct userdata *u) {
+    if (u->forward_plan)
+        fftwf_destroy_plan(u->forward_plan);
+    if (u->inverse_plan)
+        fftwf_destroy_plan(u->inverse_plan);
+
+    if (u->work_buffer)
+        fftwf_free(u->work_buffer);
+    if (u->spectrum)
+        fftwf_free(u->spectrum);
+    if (u->hrir_spectra_left)
+        fftwf_free(u->hrir_spectra_left);
+    if (u->hrir_spectra_right)
+        fftwf_free(u->hrir_spectra_right);
+    if (u->input_spectra)
+        fftwf_free(u->input_spectra);
+
+    if (u->tail_left)
+        pa_xfree(u->tail_left);
+    if (u->tail_right)
+        pa_xfree(u->tail_right);
+}
+#endif
+
+/* Called from I/O thread context */
+static void reset_input_buffer(struct userdata *u) {
+    memset(u->input_buffer, 0, 2 * BLOCK_SIZE * u->sink_fs);
+    u->input_buffer_offset = 0;
+
+#ifdef HAVE_FFTW
+    if (u->n_partitions > 0) {
+        memset(u->input_spectra, 0, u->n_partitions * u->channels * SPECTRUM_SIZE * sizeof(fftwf_complex));
+        memset(u->tail_left, 0, BLOCK_SIZE * sizeof(float));
+        memset(u->tail_right, 0, BLOCK_SIZE * sizeof(float));
+    }
+#endif
+}
+
+/* Called from I/O thread context */
+static void process_frames(struct userdata *u, const float *src, float *dst, unsigned n) {
+    unsigned j, k, l, head;
+    float sum_right, sum_left;
+    float current_sample;
+    float *in;
+
+    head = PA_MIN(u->hrir_samples, (unsigned) BLOCK_SIZE);
+
+    for (l = 0; l < n; l++) {
+        in = u->input_buffer + (BLOCK_SIZE + u->input_buffer_offset) * u->channels;
+        memcpy(in, src + l * u->channels, u->sink_fs);
+
+        sum_left = 0;
+        sum_right = 0;
+
+#ifdef HAVE_FFTW
+        if (u->n_partitions > 0) {
+            sum_left = u->tail_left[u->input_buffer_offset];
+            sum_right = u->tail_right[u->input_buffer_offset];
+        }
+#endif
+
+        /* fold the input buffer with the first partition of the impulse response */
+        for (j = 0; j < head; j++, in -= u->channels) {
+            for (k = 0; k < u->channels; k++) {
+                current_sample = in[k];
+
+                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
+                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
+            }
+        }
+
+        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
+        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
+
+        if (++u->input_buffer_offset < BLOCK_SIZE)
+            continue;
+
+#ifdef HAVE_FFTW
+        if (u->n_partitions > 0)
+            convolve_block(u);
+#endif
+
+        /* The current block becomes the previous one */
+        memmove(u->input_buffer, u->input_buffer + BLOCK_SIZE * u->channels, BLOCK_SIZE * u->sink_fs);
+        u->input_buffer_offset = 0;
+    }
+}
+
 /* Called from I/O thread context */
 static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk) {
     struct userdata *u;
@@ -220,10 +442,6 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     unsigned n;
     pa_memchunk tchunk;
 
-    unsigned j, k, l;
-    float sum_right, sum_left;
-    float current_sample;
-
     pa_sink_input_assert_ref(i);
     pa_assert(chunk);
     pa_assert_se(u = i->userdata);
@@ -255,29 +473,7 @@ static int sink_input_pop_cb(pa_sink_input *i, size_t nbytes, pa_memchunk *chunk
     src = pa_memblock_acquire_chunk(&tchunk);
     dst = pa_memblock_acquire(chunk->memblock);
 
-    for (l = 0; l < n; l++) {
-        memcpy(((char*) u->input_buffer) + u->input_buffer_offset * u->sink_fs, ((char *) src) + l * u->sink_fs, u->sink_fs);
-
-        sum_right = 0;
-        sum_left = 0;
-
-        /* fold the input buffer with the impulse response */
-        for (j = 0; j < u->hrir_samples; j++) {
-            for (k = 0; k < u->channels; k++) {
-                current_sample = u->input_buffer[((u->input_buffer_offset + j) % u->hrir_samples) * u->channels + k];
-
-                sum_left += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_left[k]];
-                sum_right += current_sample * u->hrir_data[j * u->hrir_channels + u->mapping_right[k]];
-            }
-        }
-
-        dst[2 * l] = PA_CLAMP_UNLIKELY(sum_left, -1.0f, 1.0f);
-        dst[2 * l + 1] = PA_CLAMP_UNLIKELY(sum_right, -1.0f, 1.0f);
-
-        u->input_buffer_offset--;
-        if (u->input_buffer_offset < 0)
-            u->input_buffer_offset += u->hrir_samples;
-    }
+    process_frames(u, src, dst, n);
 
     pa_memblock_release(tchunk.memblock);
     pa_memblock_release(chunk->memblock);
@@ -306,8 +502,7 @@ static void sink_input_process_rewind_cb(pa_sink_input *i, size_t nbytes) {
             pa_memblockq_seek(u->memblockq, - (int64_t) amount, PA_SEEK_RELATIVE, TRUE);
 
             /* Reset the input buffer */
-            memset(u->input_buffer, 0, u->hrir_samples * u->sink_fs);
-            u->input_buffer_offset = 0;
+            reset_input_buffer(u);
         }
     }
 
@@ -724,10 +919,12 @@ int pa__init(pa_module*m) {
                                  PA_RESAMPLER_SRC_SINC_BEST_QUALITY, PA_RESAMPLER_NO_REMAP);
 
     u->hrir_samples = hrir_temp_chunk.length / pa_frame_size(&hrir_temp_ss) * hrir_ss.rate / hrir_temp_ss.rate;
-    if (u->hrir_samples > 64) {
-        u->hrir_samples = 64;
-        pa_log("The (resampled) hrir contains more than 64 samples. Only the first 64 samples will be used to limit processor usage.");
+#ifndef HAVE_FFTW
+    if (u->hrir_samples > BLOCK_SIZE) {
+        u->hrir_samples = BLOCK_SIZE;
+        pa_log("The (resampled) hrir contains more than %u samples. Only the first %u samples will be used to limit processor usage.", BLOCK_SIZE, BLOCK_SIZE);
     }
+#endif
 
     hrir_total_length = u->hrir_samples * pa_frame_size(&hrir_ss);
     u->hrir_channels = hrir_ss.channels;
@@ -815,9 +1012,13 @@ int pa__init(pa_module*m) {
         }
     }
 
-    u->input_buffer = pa_xmalloc0(u->hrir_samples * u->sink_fs);
+    u->input_buffer = pa_xmalloc0(2 * BLOCK_SIZE * u->sink_fs);
     u->input_buffer_offset = 0;
 
+#ifdef HAVE_FFTW
+    init_partitions(u);
+#endif
+
     pa_sink_put(u->sink);
     pa_sink_input_put(u->sink_input);
 
@@ -880,6 +1081,10 @@ void pa__done(pa_module*m) {
     if (u->input_buffer)
         pa_xfree(u->input_buffer);
 
+#ifdef HAVE_FFTW
+    free_partitions(u);
+#endif
+
     if (u->mapping_left)
         pa_xfree(u->mapping_left);
     if (u->mapping_right)
@@ -887,3 +1092,118 @@ void pa__done(pa_module*m) {
 
     pa_xfree(u);
 }
+
+#ifdef VIRTUAL_SURROUND_SINK_TEST
+/*
+ * Stand-alone check of the convolution against a naive time domain one,
+ * with hrirs of one and several partitions, fed in chunks that end
+ * before, on and after the block boundaries.
+ */
+
+#define TEST_CHANNELS 2
+#define TEST_FRAMES 3000
+
+static const unsigned test_chunks[] = { 1, 63, 64, 65, 127, 128, 129, 7, 191, 256 };
+
+static float random_sample(void) {
+    return (float) rand() / RAND_MAX * 2.0f - 1.0f;
+}
+
+static pa_bool_t convolution_test(unsigned hrir_samples) {
+    struct userdata u;
+    float *src, *dst, *ref;
+    unsigned i, j, k, l;
+    float max_error = 0;
+
+    pa_memzero(&u, sizeof(u));
+
+#ifndef HAVE_FFTW
+    /* See pa__init() */
+    hrir_samples = PA_MIN(hrir_samples, (unsigned) BLOCK_SIZE);
+#endif
+
+    u.channels = u.hrir_channels = TEST_CHANNELS;
+    u.sink_fs = TEST_CHANNELS * sizeof(float);
+    u.hrir_samples = hrir_samples;
+
+    /* Small enough that the output is never clamped */
+    u.hrir_data = pa_xnew(float, hrir_samples * TEST_CHANNELS);
+    for (i = 0; i < hrir_samples * TEST_CHANNELS; i++)
+        u.hrir_data[i] = random_sample() / (hrir_samples * TEST_CHANNELS);
+
+    u.mapping_left = pa_xnew(unsigned, TEST_CHANNELS);
+    u.mapping_right = pa_xnew(unsigned, TEST_CHANNELS);
+    for (k = 0; k < TEST_CHANNELS; k++) {
+        u.mapping_left[k] = k;
+        u.mapping_right[k] = TEST_CHANNELS - 1 - k;
+    }
+
+    u.input_buffer = pa_xmalloc0(2 * BLOCK_SIZE * u.sink_fs);
+
+#ifdef HAVE_FFTW
+    init_partitions(&u);
+#endif
+
+    src = pa_xnew(float, TEST_FRAMES * TEST_CHANNELS);
+    dst = pa_xnew(float, TEST_FRAMES * 2);
+    ref = pa_xnew0(float, TEST_FRAMES * 2);
+
+    for (i = 0; i < TEST_FRAMES * TEST_CHANNELS; i++)
+        src[i] = random_sample();
+
+    for (l = 0; l < TEST_FRAMES; l++)
+        for (j = 0; j < hrir_samples && j <= l; j++)
+            for (k = 0; k < TEST_CHANNELS; k++) {
+                ref[2 * l] += src[(l - j) * TEST_CHANNELS + k] * u.hrir_data[j * TEST_CHANNELS + u.mapping_left[k]];
+                ref[2 * l + 1] += src[(l - j) * TEST_CHANNELS + k] * u.hrir_data[j * TEST_CHANNELS + u.mapping_right[k]];
+            }
+
+    for (l = 0, i = 0; l < TEST_FRAMES; i++) {
+        unsigned n = PA_MIN(test_chunks[i % PA_ELEMENTSOF(test_chunks)], TEST_FRAMES - l);
+
+        process_frames(&u, src + l * TEST_CHANNELS, dst + l * 2, n);
+        l += n;
+    }
+
+    for (i = 0; i < TEST_FRAMES * 2; i++)
+        max_error = PA_MAX(max_error, fabsf(dst[i] - ref[i]));
+
+    pa_log_debug("hrir of %u samples: maximum error %g", hrir_samples, max_error);
+
+#ifdef HAVE_FFTW
+    free_partitions(&u);
+#endif
+
+    pa_xfree(u.hrir_data);
+    pa_xfree(u.mapping_left);
+    pa_xfree(u.mapping_right);
+    pa_xfree(u.input_buffer);
+    pa_xfree(src);
+    pa_xfree(dst);
+    pa_xfree(ref);
+
+    if (max_error > 1e-5f) {
+        pa_log_error("Convolution with a hrir of %u samples differs from the naive one.", hrir_samples);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+int main(int argc, char* argv[]) {
+    static const unsigned hrir_lengths[] = { 1, 63, 64, 65, 128, 200, 512, 1000 };
+    unsigned i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(0);
+
+    for (i = 0; i < PA_ELEMENTSOF(hrir_lengths); i++)
+        if (!convolution_test(hrir_lengths[i]))
+            return 1;
+
+    return 0;
+}
+
+#endif /* VIRTUAL_SURROUND_SINK_TEST */
@@ -77,6 +77,8 @@ PA_MODULE_USAGE(
 #define DEATH_TIMEOUT 20
 #define RATE_UPDATE_INTERVAL (5*PA_USEC_PER_SEC)
 #define LATENCY_USEC (500*PA_USEC_PER_MSEC)
+/* How many packets may arrive after a missing one before it is considered lost */
+#define JITTER_BUFFER_PACKETS 16
 
 static const char* const valid_modargs[] = {
     "sink",
@@ -98,6 +100,7 @@ struct session {
     struct pa_sdp_info sdp_info;
 
     pa_rtp_context rtp_context;
+    pa_rtp_jitter_buffer *jitter_buffer;
 
     pa_rtpoll_item *rtpoll_item;
 
@@ -201,13 +204,41 @@ static void sink_input_suspend_within_thread(pa_sink_input* i, pa_bool_t b) {
         s->first_packet = FALSE;
 }
 
+/* Called from I/O thread context */
+static void session_push(struct session *s, const pa_memchunk *chunk, uint32_t timestamp) {
+    int64_t k, j, delta;
+
+    /* Check whether there was a timestamp overflow */
+    k = (int64_t) timestamp - (int64_t) s->offset;
+    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) timestamp;
+
+    if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
+        delta = k;
+    else
+        delta = j;
+
+    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, TRUE);
+
+    if (pa_memblockq_push(s->memblockq, chunk) < 0) {
+        pa_log_warn("Queue overrun");
+        pa_memblockq_seek(s->memblockq, (int64_t) chunk->length, PA_SEEK_RELATIVE, TRUE);
+    }
+
+/*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
+
+    /* The next timestamp we expect */
+    s->offset = timestamp + (uint32_t) (chunk->length / s->rtp_context.frame_size);
+}
+
 /* Called from I/O thread context */
 static int rtpoll_work_cb(pa_rtpoll_item *i) {
     pa_memchunk chunk;
-    int64_t k, j, delta;
+    uint32_t timestamp;
     struct timeval now = { 0, 0 };
     struct session *s;
     struct pollfd *p;
+    unsigned n = 0;
+    int r;
 
     pa_assert_se(s = pa_rtpoll_item_get_userdata(i));
 
@@ -223,40 +254,44 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
 
     p->revents = 0;
 
-    if (pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now) < 0)
-        return 0;
+    /* Take everything that arrived since the last wakeup */
+    while ((r = pa_rtp_recv(&s->rtp_context, &chunk, s->userdata->module->core->mempool, &now)) > 0) {
 
-    if (s->sdp_info.payload != s->rtp_context.payload ||
-        !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
-        pa_memblock_unref(chunk.memblock);
-        return 0;
-    }
+        if (s->sdp_info.payload != s->rtp_context.payload ||
+            !PA_SINK_IS_OPENED(s->sink_input->sink->thread_info.state)) {
+            pa_memblock_unref(chunk.memblock);
+            continue;
+        }
 
-    if (!s->first_packet) {
-        s->first_packet = TRUE;
+        if (!s->first_packet) {
+            s->first_packet = TRUE;
 
-        s->ssrc = s->rtp_context.ssrc;
-        s->offset = s->rtp_context.timestamp;
+            s->ssrc = s->rtp_context.ssrc;
+            s->offset = s->rtp_context.timestamp;
+            pa_rtp_jitter_buffer_reset(s->jitter_buffer);
 
-        if (s->ssrc == s->userdata->module->core->cookie)
-            pa_log_warn("Detected RTP packet loop!");
-    } else {
-        if (s->ssrc != s->rtp_context.ssrc) {
-            pa_memblock_unref(chunk.memblock);
-            return 0;
+            if (s->ssrc == s->userdata->module->core->cookie)
+                pa_log_warn("Detected RTP packet loop!");
+        } else {
+            if (s->ssrc != s->rtp_context.ssrc) {
+                pa_memblock_unref(chunk.memblock);
+                continue;
+            }
         }
-    }
 
-    /* Check whether there was a timestamp overflow */
-    k = (int64_t) s->rtp_context.timestamp - (int64_t) s->offset;
-    j = (int64_t) 0x100000000LL - (int64_t) s->offset + (int64_t) s->rtp_context.timestamp;
+        pa_rtp_jitter_buffer_push(s->jitter_buffer, s->rtp_context.sequence, s->rtp_context.timestamp, &chunk);
+        pa_memblock_unref(chunk.memblock);
 
-    if ((k < 0 ? -k : k) < (j < 0 ? -j : j))
-        delta = k;
-    else
-        delta = j;
+        while (pa_rtp_jitter_buffer_pop(s->jitter_buffer, &chunk, &timestamp)) {
+            session_push(s, &chunk, timestamp);
+            pa_memblock_unref(chunk.memblock);
+        }
 
-    pa_memblockq_seek(s->memblockq, delta * (int64_t) s->rtp_context.frame_size, PA_SEEK_RELATIVE, TRUE);
+        n++;
+    }
+
+    if (n <= 0)
+        return 0;
 
     if (now.tv_sec == 0) {
         PA_ONCE_BEGIN {
@@ -266,18 +301,6 @@ static int rtpoll_work_cb(pa_rtpoll_item *i) {
     } else
         pa_rtclock_from_wallclock(&now);
 
-    if (pa_memblockq_push(s->memblockq, &chunk) < 0) {
-        pa_log_warn("Queue overrun");
-        pa_memblockq_seek(s->memblockq, (int64_t) chunk.length, PA_SEEK_RELATIVE, TRUE);
-    }
-
-/*     pa_log("blocks in q: %u", pa_memblockq_get_nblocks(s->memblockq)); */
-
-    pa_memblock_unref(chunk.memblock);
-
-    /* The next timestamp we expect */
-    s->offset = s->rtp_context.timestamp + (uint32_t) (chunk.length / s->rtp_context.frame_size);
-
     pa_atomic_store(&s->timestamp, (int) now.tv_sec);
 
     if (s->last_rate_update + RATE_UPDATE_INTERVAL < pa_timeval_load(&now)) {
@@ -575,6 +598,7 @@ static struct session *session_new(struct userdata *u, const pa_sdp_info *sdp_in
     pa_memblock_unref(silence.memblock);
 
     pa_rtp_context_init_recv(&s->rtp_context, fd, pa_frame_size(&s->sdp_info.sample_spec));
+    s->jitter_buffer = pa_rtp_jitter_buffer_new(&s->sdp_info.sample_spec, JITTER_BUFFER_PACKETS);
 
     pa_hashmap_put(s->userdata->by_origin, s->sdp_info.origin, s);
     u->n_sessions++;
@@ -611,6 +635,7 @@ static void session_free(struct session *s) {
     pa_memblockq_free(s->memblockq);
     pa_sdp_info_destroy(&s->sdp_info);
     pa_rtp_context_destroy(&s->rtp_context);
+    pa_rtp_jitter_buffer_free(s->jitter_buffer);
 
     pa_xfree(s);
 }
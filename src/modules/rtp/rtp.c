@@ -37,11 +37,14 @@
 #include <sys/uio.h>
 #endif
 
+#include <pulse/xmalloc.h>
+
 #include <pulsecore/core-error.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/arpa-inet.h>
+#include <pulsecore/sample-util.h>
 
 #include "rtp.h"
 
@@ -57,17 +60,135 @@ pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssr
     c->frame_size = frame_size;
 
     pa_memchunk_reset(&c->memchunk);
+    c->recv_batch = NULL;
 
     return c;
 }
 
 #define MAX_IOVECS 16
 
-int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
+/* How many packets are passed to the kernel at once */
+#define MAX_BATCH_PACKETS 32
+
+/* Enough for SCM_TIMESTAMP and whatever else may come along */
+#define RECV_AUX_SIZE 128
+
+/* No UDP datagram is larger than this */
+#define MAX_PACKET_SIZE 65536
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+typedef struct mmsghdr rtp_mmsghdr;
+#else
+typedef struct rtp_mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned msg_len;
+} rtp_mmsghdr;
+#endif
+
+/* Both return the number of messages transferred. Where the system
+ * lacks the batched calls, they loop over the messages. */
+static int rtp_sendmmsg(int fd, rtp_mmsghdr *m, unsigned n) {
+#ifdef HAVE_SENDMMSG
+    return sendmmsg(fd, m, n, MSG_DONTWAIT);
+#else
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        ssize_t r;
+
+        if ((r = sendmsg(fd, &m[i].msg_hdr, MSG_DONTWAIT)) < 0)
+            return i > 0 ? (int) i : -1;
+
+        m[i].msg_len = (unsigned) r;
+    }
+
+    return (int) n;
+#endif
+}
+
+static int rtp_recvmmsg(int fd, rtp_mmsghdr *m, unsigned n) {
+#ifdef HAVE_RECVMMSG
+    return recvmmsg(fd, m, n, MSG_DONTWAIT, NULL);
+#else
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        ssize_t r;
+
+        if ((r = recvmsg(fd, &m[i].msg_hdr, MSG_DONTWAIT)) < 0)
+            return i > 0 ? (int) i : -1;
+
+        m[i].msg_len = (unsigned) r;
+    }
+
+    return (int) n;
+#endif
+}
+
+struct recv_packet {
+    pa_memchunk chunk;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    uint16_t sequence;
+    uint8_t payload;
+    struct timeval tstamp;
+};
+
+struct pa_rtp_recv_batch {
+    rtp_mmsghdr msgs[MAX_BATCH_PACKETS];
+    struct iovec iov[MAX_BATCH_PACKETS][2];
+    uint8_t aux[MAX_BATCH_PACKETS][RECV_AUX_SIZE];
+
+    struct recv_packet packets[MAX_BATCH_PACKETS];
+    unsigned n_packets, idx;
+
+    /* The largest packet seen so far */
+    size_t max_size;
+
+    /* Whatever of a packet doesn't fit into its slot ends up here, one
+     * MAX_PACKET_SIZE area per packet. Only the pages that are
+     * actually written to take up memory. */
+    uint8_t *spill;
+};
+
+struct send_packet {
+    uint32_t header[3];
     struct iovec iov[MAX_IOVECS];
-    pa_memblock* mb[MAX_IOVECS];
-    int iov_idx = 1;
-    size_t n = 0;
+    pa_memblock *mb[MAX_IOVECS];
+};
+
+/* Sends the packets and releases their memblocks, whether that
+ * worked or not */
+static int send_packets(pa_rtp_context *c, rtp_mmsghdr *m, struct send_packet *packets, unsigned n) {
+    unsigned i, j, sent = 0;
+    int r = 0;
+
+    while (sent < n) {
+        int k;
+
+        if ((k = rtp_sendmmsg(c->fd, m + sent, n - sent)) < 0) {
+            if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
+                pa_log("sendmmsg() failed: %s", pa_cstrerror(errno));
+            r = -1;
+            break;
+        }
+
+        sent += (unsigned) k;
+    }
+
+    for (i = 0; i < n; i++)
+        for (j = 1; j < m[i].msg_hdr.msg_iovlen; j++) {
+            pa_memblock_release(packets[i].mb[j]);
+            pa_memblock_unref(packets[i].mb[j]);
+        }
+
+    return r;
+}
+
+int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
+    rtp_mmsghdr m[MAX_BATCH_PACKETS];
+    struct send_packet packets[MAX_BATCH_PACKETS];
+    unsigned n_packets = 0;
 
     pa_assert(c);
     pa_assert(size > 0);
@@ -77,75 +198,65 @@ int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q) {
         return 0;
 
     for (;;) {
-        int r;
-        pa_memchunk chunk;
+        struct send_packet *p = &packets[n_packets];
+        int iov_idx = 1;
+        size_t n = 0;
+        pa_bool_t done;
+        int r = 0;
+
+        while (n < size && iov_idx < MAX_IOVECS) {
+            pa_memchunk chunk;
+            size_t k;
 
-        pa_memchunk_reset(&chunk);
+            pa_memchunk_reset(&chunk);
 
-        if ((r = pa_memblockq_peek(q, &chunk)) >= 0) {
+            if ((r = pa_memblockq_peek(q, &chunk)) < 0)
+                break;
 
-            size_t k = n + chunk.length > size ? size - n : chunk.length;
+            k = n + chunk.length > size ? size - n : chunk.length;
 
             pa_assert(chunk.memblock);
 
-            iov[iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
-            iov[iov_idx].iov_len = k;
-            mb[iov_idx] = chunk.memblock;
+            p->iov[iov_idx].iov_base = pa_memblock_acquire_chunk(&chunk);
+            p->iov[iov_idx].iov_len = k;
+            p->mb[iov_idx] = chunk.memblock;
             iov_idx ++;
 
             n += k;
             pa_memblockq_drop(q, k);
-        }
-
-        pa_assert(n % c->frame_size == 0);
-
-        if (r < 0 || n >= size || iov_idx >= MAX_IOVECS) {
-            uint32_t header[3];
-            struct msghdr m;
-            ssize_t k;
-            int i;
 
-            if (n > 0) {
-                header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
-                header[1] = htonl(c->timestamp);
-                header[2] = htonl(c->ssrc);
+            pa_assert(n % c->frame_size == 0);
+        }
 
-                iov[0].iov_base = (void*)header;
-                iov[0].iov_len = sizeof(header);
+        if (n > 0) {
+            p->header[0] = htonl(((uint32_t) 2 << 30) | ((uint32_t) c->payload << 16) | ((uint32_t) c->sequence));
+            p->header[1] = htonl(c->timestamp);
+            p->header[2] = htonl(c->ssrc);
 
-                m.msg_name = NULL;
-                m.msg_namelen = 0;
-                m.msg_iov = iov;
-                m.msg_iovlen = (size_t) iov_idx;
-                m.msg_control = NULL;
-                m.msg_controllen = 0;
-                m.msg_flags = 0;
+            p->iov[0].iov_base = (void*) p->header;
+            p->iov[0].iov_len = sizeof(p->header);
 
-                k = sendmsg(c->fd, &m, MSG_DONTWAIT);
+            pa_zero(m[n_packets]);
+            m[n_packets].msg_hdr.msg_iov = p->iov;
+            m[n_packets].msg_hdr.msg_iovlen = (size_t) iov_idx;
 
-                for (i = 1; i < iov_idx; i++) {
-                    pa_memblock_release(mb[i]);
-                    pa_memblock_unref(mb[i]);
-                }
+            n_packets++;
+            c->sequence++;
+        }
 
-                c->sequence++;
-            } else
-                k = 0;
+        c->timestamp += (unsigned) (n/c->frame_size);
 
-            c->timestamp += (unsigned) (n/c->frame_size);
+        done = r < 0 || pa_memblockq_get_length(q) < size;
 
-            if (k < 0) {
-                if (errno != EAGAIN && errno != EINTR) /* If the queue is full, just ignore it */
-                    pa_log("sendmsg() failed: %s", pa_cstrerror(errno));
+        if (n_packets > 0 && (done || n_packets >= MAX_BATCH_PACKETS)) {
+            if (send_packets(c, m, packets, n_packets) < 0)
                 return -1;
-            }
-
-            if (r < 0 || pa_memblockq_get_length(q) < size)
-                break;
 
-            n = 0;
-            iov_idx = 1;
+            n_packets = 0;
         }
+
+        if (done)
+            break;
     }
 
     return 0;
@@ -158,144 +269,432 @@ pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame
     c->frame_size = frame_size;
 
     pa_memchunk_reset(&c->memchunk);
+    c->recv_batch = pa_xnew0(struct pa_rtp_recv_batch, 1);
+    c->recv_batch->spill = pa_xmalloc(MAX_BATCH_PACKETS * MAX_PACKET_SIZE);
+
     return c;
 }
 
-int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
-    int size;
-    struct msghdr m;
+/* Returns FALSE if the packet is to be skipped */
+static pa_bool_t parse_packet(pa_rtp_context *c, rtp_mmsghdr *m, struct recv_packet *p) {
     struct cmsghdr *cm;
-    struct iovec iov;
+    uint8_t *d;
     uint32_t header;
+    size_t size;
     unsigned cc;
-    ssize_t r;
-    uint8_t aux[1024];
     pa_bool_t found_tstamp = FALSE;
 
-    pa_assert(c);
-    pa_assert(chunk);
+    size = m->msg_len;
+    d = (uint8_t*) m->msg_hdr.msg_iov[0].iov_base;
 
-    pa_memchunk_reset(chunk);
+    if (m->msg_hdr.msg_flags & MSG_TRUNC) {
+        pa_log_warn("RTP packet too large.");
+        return FALSE;
+    }
+
+    if (size < 12) {
+        pa_log_warn("RTP packet too short.");
+        return FALSE;
+    }
+
+    memcpy(&header, d, sizeof(uint32_t));
+    memcpy(&p->timestamp, d + 4, sizeof(uint32_t));
+    memcpy(&p->ssrc, d + 8, sizeof(uint32_t));
+
+    header = ntohl(header);
+    p->timestamp = ntohl(p->timestamp);
+    p->ssrc = ntohl(p->ssrc);
+
+    if ((header >> 30) != 2) {
+        pa_log_warn("Unsupported RTP version.");
+        return FALSE;
+    }
+
+    if ((header >> 29) & 1) {
+        pa_log_warn("RTP padding not supported.");
+        return FALSE;
+    }
+
+    if ((header >> 28) & 1) {
+        pa_log_warn("RTP header extensions not supported.");
+        return FALSE;
+    }
+
+    cc = (header >> 24) & 0xF;
+    p->payload = (uint8_t) ((header >> 16) & 127U);
+    p->sequence = (uint16_t) (header & 0xFFFFU);
+
+    if (12 + cc*4 > size) {
+        pa_log_warn("RTP packet too short. (CSRC)");
+        return FALSE;
+    }
+
+    p->chunk.index += 12 + cc*4;
+    p->chunk.length = size - (12 + cc*4);
+
+    if (p->chunk.length % c->frame_size != 0) {
+        pa_log_warn("Bad RTP packet size.");
+        return FALSE;
+    }
+
+    for (cm = CMSG_FIRSTHDR(&m->msg_hdr); cm; cm = CMSG_NXTHDR(&m->msg_hdr, cm))
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
+            memcpy(&p->tstamp, CMSG_DATA(cm), sizeof(struct timeval));
+            found_tstamp = TRUE;
+            break;
+        }
+
+    if (!found_tstamp) {
+        pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
+        memset(&p->tstamp, 0, sizeof(p->tstamp));
+    }
+
+    return TRUE;
+}
+
+/* Reads as many packets as are waiting and fit into the current
+ * memblock. Each of them gets a slot that is as large as the largest
+ * packet seen so far. A packet that is larger than that continues in
+ * the spill area and is copied into a memblock of its own, so nothing
+ * is truncated. */
+static int recv_packets(pa_rtp_context *c, pa_mempool *pool) {
+    struct pa_rtp_recv_batch *b = c->recv_batch;
+    size_t slot;
+    unsigned i, n;
+    uint8_t *d;
+    int size, r;
 
     if (ioctl(c->fd, FIONREAD, &size) < 0) {
         pa_log_warn("FIONREAD failed: %s", pa_cstrerror(errno));
-        goto fail;
+        return -1;
     }
 
     if (size <= 0)
         return 0;
 
-    if (c->memchunk.length < (unsigned) size) {
+    slot = b->max_size = PA_MAX(b->max_size, (size_t) size);
+
+    if (c->memchunk.length < slot) {
         size_t l;
 
         if (c->memchunk.memblock)
             pa_memblock_unref(c->memchunk.memblock);
 
-        l = PA_MAX((size_t) size, pa_mempool_block_size_max(pool));
+        l = PA_MAX(slot, pa_mempool_block_size_max(pool));
 
         c->memchunk.memblock = pa_memblock_new(pool, l);
         c->memchunk.index = 0;
         c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock);
     }
 
-    pa_assert(c->memchunk.length >= (size_t) size);
+    n = (unsigned) PA_MIN(c->memchunk.length / slot, (size_t) MAX_BATCH_PACKETS);
+    pa_assert(n > 0);
 
-    chunk->memblock = pa_memblock_ref(c->memchunk.memblock);
-    chunk->index = c->memchunk.index;
+    d = pa_memblock_acquire_chunk(&c->memchunk);
 
-    iov.iov_base = pa_memblock_acquire_chunk(chunk);
-    iov.iov_len = (size_t) size;
+    for (i = 0; i < n; i++) {
+        b->iov[i][0].iov_base = d + i * slot;
+        b->iov[i][0].iov_len = slot;
+        b->iov[i][1].iov_base = b->spill + i * MAX_PACKET_SIZE;
+        b->iov[i][1].iov_len = MAX_PACKET_SIZE;
 
-    m.msg_name = NULL;
-    m.msg_namelen = 0;
-    m.msg_iov = &iov;
-    m.msg_iovlen = 1;
-    m.msg_control = aux;
-    m.msg_controllen = sizeof(aux);
-    m.msg_flags = 0;
+        pa_zero(b->msgs[i]);
+        b->msgs[i].msg_hdr.msg_iov = b->iov[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 2;
+        b->msgs[i].msg_hdr.msg_control = b->aux[i];
+        b->msgs[i].msg_hdr.msg_controllen = sizeof(b->aux[i]);
+    }
 
-    r = recvmsg(c->fd, &m, 0);
-    pa_memblock_release(chunk->memblock);
+    r = rtp_recvmmsg(c->fd, b->msgs, n);
 
-    if (r != size) {
-        if (r < 0 && errno != EAGAIN && errno != EINTR)
-            pa_log_warn("recvmsg() failed: %s", r < 0 ? pa_cstrerror(errno) : "size mismatch");
+    pa_memblock_release(c->memchunk.memblock);
 
-        goto fail;
-    }
+    if (r <= 0) {
+        if (r < 0 && errno != EAGAIN && errno != EINTR) {
+            pa_log_warn("recvmmsg() failed: %s", pa_cstrerror(errno));
+            return -1;
+        }
 
-    if (size < 12) {
-        pa_log_warn("RTP packet too short.");
-        goto fail;
+        return 0;
     }
 
-    memcpy(&header, iov.iov_base, sizeof(uint32_t));
-    memcpy(&c->timestamp, (uint8_t*) iov.iov_base + 4, sizeof(uint32_t));
-    memcpy(&c->ssrc, (uint8_t*) iov.iov_base + 8, sizeof(uint32_t));
+    b->n_packets = b->idx = 0;
 
-    header = ntohl(header);
-    c->timestamp = ntohl(c->timestamp);
-    c->ssrc = ntohl(c->ssrc);
+    for (i = 0; i < (unsigned) r; i++) {
+        struct recv_packet *p = &b->packets[b->n_packets];
+        rtp_mmsghdr *m = &b->msgs[i];
 
-    if ((header >> 30) != 2) {
-        pa_log_warn("Unsupported RTP version.");
-        goto fail;
-    }
+        if (m->msg_len > slot) {
+            uint8_t *e;
 
-    if ((header >> 29) & 1) {
-        pa_log_warn("RTP padding not supported.");
-        goto fail;
-    }
+            p->chunk.memblock = pa_memblock_new(pool, m->msg_len);
+            p->chunk.index = 0;
 
-    if ((header >> 28) & 1) {
-        pa_log_warn("RTP header extensions not supported.");
-        goto fail;
+            e = pa_memblock_acquire(p->chunk.memblock);
+            memcpy(e, b->iov[i][0].iov_base, slot);
+            memcpy(e + slot, b->iov[i][1].iov_base, m->msg_len - slot);
+            pa_memblock_release(p->chunk.memblock);
+
+            b->iov[i][0].iov_base = e;
+            b->max_size = PA_MAX(b->max_size, (size_t) m->msg_len);
+        } else {
+            p->chunk.memblock = pa_memblock_ref(c->memchunk.memblock);
+            p->chunk.index = c->memchunk.index + i * slot;
+        }
+
+        if (parse_packet(c, m, p))
+            b->n_packets++;
+        else
+            pa_memblock_unref(p->chunk.memblock);
     }
 
-    cc = (header >> 24) & 0xF;
-    c->payload = (uint8_t) ((header >> 16) & 127U);
-    c->sequence = (uint16_t) (header & 0xFFFFU);
+    c->memchunk.index += (unsigned) r * slot;
+    c->memchunk.length -= (unsigned) r * slot;
 
-    if (12 + cc*4 > (unsigned) size) {
-        pa_log_warn("RTP packet too short. (CSRC)");
-        goto fail;
+    if (c->memchunk.length <= 0) {
+        pa_memblock_unref(c->memchunk.memblock);
+        pa_memchunk_reset(&c->memchunk);
     }
 
-    chunk->index += 12 + cc*4;
-    chunk->length = (size_t) size - 12 + cc*4;
+    return 1;
+}
 
-    if (chunk->length % c->frame_size != 0) {
-        pa_log_warn("Bad RTP packet size.");
-        goto fail;
+int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp) {
+    struct pa_rtp_recv_batch *b;
+    struct recv_packet *p;
+
+    pa_assert(c);
+    pa_assert(chunk);
+    pa_assert_se(b = c->recv_batch);
+
+    pa_memchunk_reset(chunk);
+
+    while (b->idx >= b->n_packets) {
+        int r;
+
+        if ((r = recv_packets(c, pool)) <= 0)
+            return r;
     }
 
-    c->memchunk.index = chunk->index + chunk->length;
-    c->memchunk.length = pa_memblock_get_length(c->memchunk.memblock) - c->memchunk.index;
+    p = &b->packets[b->idx++];
 
-    if (c->memchunk.length <= 0) {
-        pa_memblock_unref(c->memchunk.memblock);
-        pa_memchunk_reset(&c->memchunk);
+    *chunk = p->chunk;
+    *tstamp = p->tstamp;
+    c->timestamp = p->timestamp;
+    c->ssrc = p->ssrc;
+    c->payload = p->payload;
+    c->sequence = p->sequence;
+
+    return 1;
+}
+
+/* Give up on the same gap after this many concealed packets, and let
+ * the rest of it be silence */
+#define MAX_CONCEALED_PACKETS 4
+
+/* This many late packets in a row mean that the sender jumped to other
+ * sequence numbers, so start over with them */
+#define MAX_LATE_PACKETS 16
+
+struct jitter_packet {
+    pa_memchunk chunk;
+    uint16_t sequence;
+    uint32_t timestamp;
+};
+
+struct pa_rtp_jitter_buffer {
+    pa_sample_spec sample_spec;
+    size_t frame_size;
+
+    /* Sorted by sequence number, starting with the oldest */
+    struct jitter_packet *packets;
+    unsigned n_packets, max_packets;
+
+    pa_bool_t started;
+    uint16_t next_sequence;
+    uint32_t next_timestamp;
+
+    /* What was returned last, the source for concealment */
+    pa_memchunk last;
+    unsigned n_concealed;
+
+    unsigned n_late;
+};
+
+pa_rtp_jitter_buffer* pa_rtp_jitter_buffer_new(const pa_sample_spec *ss, unsigned max_packets) {
+    pa_rtp_jitter_buffer *b;
+
+    pa_assert(ss);
+    pa_assert(max_packets > 0);
+
+    b = pa_xnew0(pa_rtp_jitter_buffer, 1);
+    b->sample_spec = *ss;
+    b->frame_size = pa_frame_size(ss);
+    b->max_packets = max_packets;
+
+    /* One more than max_packets, for the one that is pushed into a
+     * full buffer */
+    b->packets = pa_xnew(struct jitter_packet, max_packets + 1);
+
+    return b;
+}
+
+void pa_rtp_jitter_buffer_reset(pa_rtp_jitter_buffer *b) {
+    unsigned i;
+
+    pa_assert(b);
+
+    for (i = 0; i < b->n_packets; i++)
+        pa_memblock_unref(b->packets[i].chunk.memblock);
+
+    b->n_packets = 0;
+    b->started = FALSE;
+
+    if (b->last.memblock)
+        pa_memblock_unref(b->last.memblock);
+
+    pa_memchunk_reset(&b->last);
+    b->n_concealed = 0;
+    b->n_late = 0;
+}
+
+void pa_rtp_jitter_buffer_free(pa_rtp_jitter_buffer *b) {
+    pa_assert(b);
+
+    pa_rtp_jitter_buffer_reset(b);
+
+    pa_xfree(b->packets);
+    pa_xfree(b);
+}
+
+void pa_rtp_jitter_buffer_push(pa_rtp_jitter_buffer *b, uint16_t sequence, uint32_t timestamp, const pa_memchunk *chunk) {
+    int16_t d;
+    unsigned i;
+
+    pa_assert(b);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(b->n_packets <= b->max_packets);
+
+    if (!b->started) {
+        b->started = TRUE;
+        b->next_sequence = sequence;
+        b->next_timestamp = timestamp;
     }
 
-    for (cm = CMSG_FIRSTHDR(&m); cm; cm = CMSG_NXTHDR(&m, cm))
-        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMP) {
-            memcpy(tstamp, CMSG_DATA(cm), sizeof(struct timeval));
-            found_tstamp = TRUE;
+    /* Sequence numbers wrap around, so only their distance counts */
+    if ((d = (int16_t) (sequence - b->next_sequence)) < 0) {
+
+        if (++b->n_late < MAX_LATE_PACKETS) {
+            pa_log_debug("Dropping late RTP packet %u.", sequence);
+            return;
+        }
+
+        pa_log_info("Too many late RTP packets, resynchronizing at %u.", sequence);
+        pa_rtp_jitter_buffer_reset(b);
+
+        b->started = TRUE;
+        b->next_sequence = sequence;
+        b->next_timestamp = timestamp;
+        d = 0;
+    } else
+        b->n_late = 0;
+
+    for (i = b->n_packets; i > 0; i--) {
+        int16_t e = (int16_t) (b->packets[i-1].sequence - b->next_sequence);
+
+        if (e == d) {
+            pa_log_debug("Dropping duplicate RTP packet %u.", sequence);
+            return;
+        }
+
+        if (e < d)
             break;
+    }
+
+    memmove(b->packets + i + 1, b->packets + i, (b->n_packets - i) * sizeof(struct jitter_packet));
+
+    b->packets[i].chunk = *chunk;
+    pa_memblock_ref(chunk->memblock);
+    b->packets[i].sequence = sequence;
+    b->packets[i].timestamp = timestamp;
+    b->n_packets++;
+}
+
+/* Returns a copy of the previous chunk at a lower volume, no longer
+ * than the gap of n frames */
+static void conceal(pa_rtp_jitter_buffer *b, pa_memchunk *chunk, size_t n) {
+    pa_cvolume v;
+
+    *chunk = b->last;
+    chunk->length = PA_MIN(chunk->length, n * b->frame_size);
+    pa_memblock_ref(chunk->memblock);
+
+    pa_memchunk_make_writable(chunk, 0);
+
+    pa_cvolume_set(&v, b->sample_spec.channels, pa_sw_volume_from_linear(0.5));
+    pa_volume_memchunk(chunk, &b->sample_spec, &v);
+}
+
+static void set_last(pa_rtp_jitter_buffer *b, const pa_memchunk *chunk) {
+    if (b->last.memblock)
+        pa_memblock_unref(b->last.memblock);
+
+    b->last = *chunk;
+    pa_memblock_ref(b->last.memblock);
+}
+
+pa_bool_t pa_rtp_jitter_buffer_pop(pa_rtp_jitter_buffer *b, pa_memchunk *chunk, uint32_t *timestamp) {
+    struct jitter_packet *p;
+
+    pa_assert(b);
+    pa_assert(chunk);
+    pa_assert(timestamp);
+
+    if (b->n_packets <= 0)
+        return FALSE;
+
+    p = &b->packets[0];
+
+    if (p->sequence != b->next_sequence) {
+        int32_t gap;
+
+        /* Maybe the missing packet is just late */
+        if (b->n_packets < b->max_packets)
+            return FALSE;
+
+        gap = (int32_t) (p->timestamp - b->next_timestamp);
+
+        if (gap > 0 && b->last.memblock && b->n_concealed < MAX_CONCEALED_PACKETS) {
+            conceal(b, chunk, (size_t) gap);
+
+            *timestamp = b->next_timestamp;
+            b->next_timestamp += (uint32_t) (chunk->length / b->frame_size);
+
+            /* Concealing the next part of the gap starts from this,
+             * so that it fades out */
+            set_last(b, chunk);
+            b->n_concealed++;
+
+            return TRUE;
         }
 
-    if (!found_tstamp) {
-        pa_log_warn("Couldn't find SCM_TIMESTAMP data in auxiliary recvmsg() data!");
-        memset(tstamp, 0, sizeof(tstamp));
+        pa_log_debug("Lost %u RTP packets.", (unsigned) (uint16_t) (p->sequence - b->next_sequence));
     }
 
-    return 0;
+    *chunk = p->chunk;
+    *timestamp = p->timestamp;
 
-fail:
-    if (chunk->memblock)
-        pa_memblock_unref(chunk->memblock);
+    b->next_sequence = (uint16_t) (p->sequence + 1);
+    b->next_timestamp = p->timestamp + (uint32_t) (chunk->length / b->frame_size);
 
-    return -1;
+    b->n_packets--;
+    memmove(b->packets, b->packets + 1, b->n_packets * sizeof(struct jitter_packet));
+
+    set_last(b, chunk);
+    b->n_concealed = 0;
+
+    return TRUE;
 }
 
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss) {
@@ -378,6 +777,16 @@ void pa_rtp_context_destroy(pa_rtp_context *c) {
 
     if (c->memchunk.memblock)
         pa_memblock_unref(c->memchunk.memblock);
+
+    if (c->recv_batch) {
+        struct pa_rtp_recv_batch *b = c->recv_batch;
+
+        for (; b->idx < b->n_packets; b->idx++)
+            pa_memblock_unref(b->packets[b->idx].chunk.memblock);
+
+        pa_xfree(b->spill);
+        pa_xfree(b);
+    }
 }
 
 const char* pa_rtp_format_to_string(pa_sample_format_t f) {
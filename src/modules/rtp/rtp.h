@@ -28,6 +28,8 @@
 #include <pulsecore/memblockq.h>
 #include <pulsecore/memchunk.h>
 
+struct pa_rtp_recv_batch;
+
 typedef struct pa_rtp_context {
     int fd;
     uint16_t sequence;
@@ -37,15 +39,26 @@ typedef struct pa_rtp_context {
     size_t frame_size;
 
     pa_memchunk memchunk;
+
+    /* Packets that were received in one go but not returned yet */
+    struct pa_rtp_recv_batch *recv_batch;
 } pa_rtp_context;
 
 pa_rtp_context* pa_rtp_context_init_send(pa_rtp_context *c, int fd, uint32_t ssrc, uint8_t payload, size_t frame_size);
 
-/* If the memblockq doesn't have a silence memchunk set, then the caller must
+/* Sends as many packets of the given size as there is data in the
+ * queue, several at a time if the system supports sendmmsg().
+ * If the memblockq doesn't have a silence memchunk set, then the caller must
  * guarantee that the current read index doesn't point to a hole. */
 int pa_rtp_send(pa_rtp_context *c, size_t size, pa_memblockq *q);
 
 pa_rtp_context* pa_rtp_context_init_recv(pa_rtp_context *c, int fd, size_t frame_size);
+
+/* Returns 1 and the payload of the next packet, whose header fields
+ * are stored in the context, 0 if no packet is available right now,
+ * or -1 on error. The socket is read with recvmmsg() where available,
+ * so keep calling this until it returns 0 to get all the packets that
+ * arrived. */
 int pa_rtp_recv(pa_rtp_context *c, pa_memchunk *chunk, pa_mempool *pool, struct timeval *tstamp);
 
 void pa_rtp_context_destroy(pa_rtp_context *c);
@@ -56,6 +69,28 @@ int pa_rtp_sample_spec_valid(const pa_sample_spec *ss);
 uint8_t pa_rtp_payload_from_sample_spec(const pa_sample_spec *ss);
 pa_sample_spec *pa_rtp_sample_spec_from_payload(uint8_t payload, pa_sample_spec *ss);
 
+/* Puts received packets back into sequence order. Late and duplicate
+ * packets are dropped. A missing packet is given up on once
+ * max_packets later ones have arrived, and the gap it left is
+ * concealed by repeating the previous packet at a lower volume. */
+typedef struct pa_rtp_jitter_buffer pa_rtp_jitter_buffer;
+
+pa_rtp_jitter_buffer* pa_rtp_jitter_buffer_new(const pa_sample_spec *ss, unsigned max_packets);
+void pa_rtp_jitter_buffer_free(pa_rtp_jitter_buffer *b);
+
+/* Drops all queued packets and starts over with the next one pushed */
+void pa_rtp_jitter_buffer_reset(pa_rtp_jitter_buffer *b);
+
+/* Takes a reference to the chunk. Packets that are too late to be
+ * played are dropped, unless a run of them suggests that the sender
+ * jumped to other sequence numbers, in which case the buffer is reset
+ * and starts over with them. */
+void pa_rtp_jitter_buffer_push(pa_rtp_jitter_buffer *b, uint16_t sequence, uint32_t timestamp, const pa_memchunk *chunk);
+
+/* Returns TRUE and the next chunk to play at the given RTP timestamp,
+ * or FALSE if there is none yet. The caller must unref the chunk. */
+pa_bool_t pa_rtp_jitter_buffer_pop(pa_rtp_jitter_buffer *b, pa_memchunk *chunk, uint32_t *timestamp);
+
 const char* pa_rtp_format_to_string(pa_sample_format_t f);
 pa_sample_format_t pa_rtp_string_to_format(const char *s);
 
@@ -90,7 +90,8 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_RECORD_STREAM_EVENT] = pa_command_stream_event,
     [PA_COMMAND_CLIENT_EVENT] = pa_command_client_event,
     [PA_COMMAND_PLAYBACK_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr,
-    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr
+    [PA_COMMAND_RECORD_BUFFER_ATTR_CHANGED] = pa_command_stream_buffer_attr,
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = pa_command_enable_srbchannel
 };
 static void context_free(pa_context *c);
 
@@ -323,7 +324,7 @@ static void pstream_die_callback(pa_pstream *p, void *userdata) {
     pa_context_fail(c, PA_ERR_CONNECTIONTERMINATED);
 }
 
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_context *c = userdata;
 
     pa_assert(p);
@@ -332,7 +333,7 @@ static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_c
 
     pa_context_ref(c);
 
-    if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0)
+    if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0)
         pa_context_fail(c, PA_ERR_PROTOCOL);
 
     pa_context_unref(c);
@@ -1406,6 +1407,52 @@ finish:
         pa_proplist_free(pl);
 }
 
+void pa_command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_context *c = userdata;
+    pa_srbchannel *srb = NULL;
+    pa_tagstruct *reply;
+
+    pa_assert(pd);
+    pa_assert(command == PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_assert(t);
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    if (c->version < 28 || !pa_tagstruct_eof(t)) {
+        pa_context_fail(c, PA_ERR_PROTOCOL);
+        return;
+    }
+
+#ifdef HAVE_CREDS
+    /* The ring buffer is just as private as our SHM blocks */
+    if (c->do_shm) {
+        pa_srbchannel_template srbt;
+        const int *fds;
+        int nfd;
+
+        if ((fds = pa_pdispatch_fds(pd, &nfd)) && nfd == 3) {
+            srbt.memfd = fds[0];
+            srbt.readfd = fds[1];
+            srbt.writefd = fds[2];
+
+            srb = pa_srbchannel_new_from_template(c->mainloop, &srbt);
+        }
+    }
+#endif
+
+    pa_log_debug("Shared ring buffer channel: %s", pa_yes_no(srb));
+
+    /* The server switches over once it got our answer, we do so for
+     * everything we send after it */
+    reply = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(reply, srb ? PA_COMMAND_ENABLE_SRBCHANNEL : PA_COMMAND_DISABLE_SRBCHANNEL);
+    pa_tagstruct_putu32(reply, tag);
+    pa_pstream_send_tagstruct(c->pstream, reply);
+
+    if (srb)
+        pa_pstream_set_srbchannel(c->pstream, srb);
+}
+
 pa_time_event* pa_context_rttime_new(pa_context *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata) {
     struct timeval tv;
 
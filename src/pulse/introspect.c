@@ -1898,6 +1898,155 @@ pa_operation* pa_context_set_port_latency_offset(pa_context *c, const char *card
     return o;
 }
 
+/*** Incremental queries ***/
+
+static pa_pdispatch_cb_t info_list_callback(uint32_t list_command) {
+    switch (list_command) {
+        case PA_COMMAND_GET_SINK_INFO_LIST:
+            return context_get_sink_info_callback;
+        case PA_COMMAND_GET_SOURCE_INFO_LIST:
+            return context_get_source_info_callback;
+        case PA_COMMAND_GET_CLIENT_INFO_LIST:
+            return context_get_client_info_callback;
+        case PA_COMMAND_GET_CARD_INFO_LIST:
+            return context_get_card_info_callback;
+        case PA_COMMAND_GET_MODULE_INFO_LIST:
+            return context_get_module_info_callback;
+        case PA_COMMAND_GET_SINK_INPUT_INFO_LIST:
+            return context_get_sink_input_info_callback;
+        case PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST:
+            return context_get_source_output_info_callback;
+        default:
+            pa_assert(list_command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+            return context_get_sample_info_callback;
+    }
+}
+
+/* Parses the generation and the index list in front of the records and
+ * hands the rest of the reply to the callback of the plain list query.
+ * The upper 32 bits of a generation identify the server instance, the
+ * records are useless if the one passed in came from another one. */
+static void context_get_info_list_since_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_operation *o = userdata;
+    pa_pdispatch_cb_t list_cb;
+
+    pa_assert(pd);
+    pa_assert(o);
+    pa_assert(PA_REFCNT_VALUE(o) >= 1);
+
+    list_cb = info_list_callback(PA_PTR_TO_UINT(o->private));
+
+    if (o->context && command == PA_COMMAND_REPLY) {
+        uint64_t generation;
+        uint32_t *indexes, n, j;
+        size_t l;
+
+        /* Each index takes at least five bytes on the wire */
+        pa_tagstruct_data(t, &l);
+
+        if (pa_tagstruct_getu64(t, &generation) < 0 ||
+            pa_tagstruct_getu32(t, &n) < 0 ||
+            n > l / 5) {
+            pa_context_fail(o->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+
+        if (o->since_generation != 0 && (o->since_generation >> 32) != (generation >> 32)) {
+            pa_context_set_error(o->context, PA_ERR_NOENTITY);
+
+            if (o->callback) {
+                void (*cb)(pa_context *c, const void *i, int eol, void *userdata);
+
+                cb = (void (*)(pa_context *, const void *, int, void *)) o->callback;
+                cb(o->context, NULL, -1, o->userdata);
+            }
+
+            goto finish;
+        }
+
+        indexes = pa_xnew(uint32_t, PA_MAX(n, 1U));
+
+        for (j = 0; j < n; j++)
+            if (pa_tagstruct_getu32(t, &indexes[j]) < 0) {
+                pa_xfree(indexes);
+                pa_context_fail(o->context, PA_ERR_PROTOCOL);
+                goto finish;
+            }
+
+        if (o->generation_callback) {
+            pa_info_list_generation_cb_t cb = (pa_info_list_generation_cb_t) o->generation_callback;
+            cb(o->context, generation, indexes, n, o->userdata);
+        }
+
+        pa_xfree(indexes);
+    }
+
+    list_cb(pd, command, tag, t, userdata);
+    return;
+
+finish:
+    pa_operation_done(o);
+    pa_operation_unref(o);
+}
+
+static pa_operation* get_info_list_since(pa_context *c, uint32_t list_command, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_operation_cb_t cb, void *userdata) {
+    pa_tagstruct *t;
+    pa_operation *o;
+    uint32_t tag;
+
+    pa_assert(c);
+    pa_assert(PA_REFCNT_VALUE(c) >= 1);
+
+    PA_CHECK_VALIDITY_RETURN_NULL(c, !pa_detect_fork(), PA_ERR_FORKED);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->state == PA_CONTEXT_READY, PA_ERR_BADSTATE);
+    PA_CHECK_VALIDITY_RETURN_NULL(c, c->version >= 29, PA_ERR_NOTSUPPORTED);
+
+    o = pa_operation_new(c, NULL, cb, userdata);
+    o->generation_callback = (pa_operation_cb_t) gen_cb;
+    o->since_generation = generation;
+    o->private = PA_UINT_TO_PTR(list_command);
+
+    t = pa_tagstruct_command(c, PA_COMMAND_GET_INFO_LIST_SINCE, &tag);
+    pa_tagstruct_putu32(t, list_command);
+    pa_tagstruct_putu64(t, generation);
+    pa_pstream_send_tagstruct(c->pstream, t);
+    pa_pdispatch_register_reply(c->pdispatch, tag, DEFAULT_TIMEOUT, context_get_info_list_since_callback, pa_operation_ref(o), (pa_free_cb_t) pa_operation_unref);
+
+    return o;
+}
+
+pa_operation* pa_context_get_sink_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_sink_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_SINK_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_source_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_source_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_SOURCE_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_client_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_client_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_CLIENT_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_card_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_card_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_CARD_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_module_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_module_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_MODULE_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_sink_input_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_sink_input_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_SINK_INPUT_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_source_output_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_source_output_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
+pa_operation* pa_context_get_sample_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_sample_info_cb_t cb, void *userdata) {
+    return get_info_list_since(c, PA_COMMAND_GET_SAMPLE_INFO_LIST, generation, gen_cb, (pa_operation_cb_t) cb, userdata);
+}
+
 /*** Autoload stuff ***/
 
 PA_WARN_REFERENCE(pa_context_get_autoload_info_by_name, "Module auto-loading no longer supported.");
@@ -67,6 +67,25 @@
  * duration of the callback. If they are required after the callback is
  * finished, a deep copy of the information structure must be performed.
  *
+ * \subsection since_subsec Incremental Queries
+ *
+ * Clients that poll the lists regularly can use the
+ * pa_context_get_xxx_info_list_since() functions instead, e.g.
+ * pa_context_get_sink_input_info_list_since(). These only return the
+ * objects that were created or changed after the generation passed in.
+ * Before the information callback is called, a pa_info_list_generation_cb_t
+ * callback receives the current generation, to be passed to the next
+ * query, and the indexes of all objects in the list. Objects that are
+ * missing from that list have been removed. Passing 0 as generation
+ * returns all objects. A generation is only valid for the server
+ * instance that handed it out. If the server has been restarted in the
+ * meantime the query fails with PA_ERR_NOENTITY, and the client has to
+ * start over with 0.
+ *
+ * The server only considers changes that it signals with subscription
+ * events, so values that change continuously, like latencies, are not
+ * refreshed by these queries.
+ *
  * \subsection server_subsec Server Information
  *
  * The server can be queried about its name, the environment it's running on
@@ -193,6 +212,12 @@
 
 PA_C_DECL_BEGIN
 
+/** Callback prototype for the pa_context_get_xxx_info_list_since()
+ * functions. It is called before the information callback, with the
+ * generation to pass to the next query and the indexes of all objects in
+ * the list. \since 5.0 */
+typedef void (*pa_info_list_generation_cb_t)(pa_context *c, uint64_t generation, const uint32_t *indexes, uint32_t n_indexes, void *userdata);
+
 /** @{ \name Sinks */
 
 /** Stores information about a specific port of a sink.  Please
@@ -247,6 +272,10 @@ pa_operation* pa_context_get_sink_info_by_index(pa_context *c, uint32_t idx, pa_
 /** Get the complete sink list */
 pa_operation* pa_context_get_sink_info_list(pa_context *c, pa_sink_info_cb_t cb, void *userdata);
 
+/** Get the sinks that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_sink_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_sink_info_cb_t cb, void *userdata);
+
 /** Set the volume of a sink device specified by its index */
 pa_operation* pa_context_set_sink_volume_by_index(pa_context *c, uint32_t idx, const pa_cvolume *volume, pa_context_success_cb_t cb, void *userdata);
 
@@ -327,6 +356,10 @@ pa_operation* pa_context_get_source_info_by_index(pa_context *c, uint32_t idx, p
 /** Get the complete source list */
 pa_operation* pa_context_get_source_info_list(pa_context *c, pa_source_info_cb_t cb, void *userdata);
 
+/** Get the sources that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_source_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_source_info_cb_t cb, void *userdata);
+
 /** Set the volume of a source device specified by its index */
 pa_operation* pa_context_set_source_volume_by_index(pa_context *c, uint32_t idx, const pa_cvolume *volume, pa_context_success_cb_t cb, void *userdata);
 
@@ -403,6 +436,10 @@ pa_operation* pa_context_get_module_info(pa_context *c, uint32_t idx, pa_module_
 /** Get the complete list of currently loaded modules */
 pa_operation* pa_context_get_module_info_list(pa_context *c, pa_module_info_cb_t cb, void *userdata);
 
+/** Get the modules that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_module_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_module_info_cb_t cb, void *userdata);
+
 /** Callback prototype for pa_context_load_module() */
 typedef void (*pa_context_index_cb_t)(pa_context *c, uint32_t idx, void *userdata);
 
@@ -436,6 +473,10 @@ pa_operation* pa_context_get_client_info(pa_context *c, uint32_t idx, pa_client_
 /** Get the complete client list */
 pa_operation* pa_context_get_client_info_list(pa_context *c, pa_client_info_cb_t cb, void *userdata);
 
+/** Get the clients that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_client_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_client_info_cb_t cb, void *userdata);
+
 /** Kill a client. */
 pa_operation* pa_context_kill_client(pa_context *c, uint32_t idx, pa_context_success_cb_t cb, void *userdata);
 
@@ -497,6 +538,10 @@ pa_operation* pa_context_get_card_info_by_name(pa_context *c, const char *name,
 /** Get the complete card list \since 0.9.15 */
 pa_operation* pa_context_get_card_info_list(pa_context *c, pa_card_info_cb_t cb, void *userdata);
 
+/** Get the cards that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_card_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_card_info_cb_t cb, void *userdata);
+
 /** Change the profile of a card. \since 0.9.15 */
 pa_operation* pa_context_set_card_profile_by_index(pa_context *c, uint32_t idx, const char*profile, pa_context_success_cb_t cb, void *userdata);
 
@@ -543,6 +588,10 @@ pa_operation* pa_context_get_sink_input_info(pa_context *c, uint32_t idx, pa_sin
 /** Get the complete sink input list */
 pa_operation* pa_context_get_sink_input_info_list(pa_context *c, pa_sink_input_info_cb_t cb, void *userdata);
 
+/** Get the sink inputs that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_sink_input_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_sink_input_info_cb_t cb, void *userdata);
+
 /** Move the specified sink input to a different sink. \since 0.9.5 */
 pa_operation* pa_context_move_sink_input_by_name(pa_context *c, uint32_t idx, const char *sink_name, pa_context_success_cb_t cb, void* userdata);
 
@@ -595,6 +644,10 @@ pa_operation* pa_context_get_source_output_info(pa_context *c, uint32_t idx, pa_
 /** Get the complete list of source outputs */
 pa_operation* pa_context_get_source_output_info_list(pa_context *c, pa_source_output_info_cb_t cb, void *userdata);
 
+/** Get the source outputs that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_source_output_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_source_output_info_cb_t cb, void *userdata);
+
 /** Move the specified source output to a different source. \since 0.9.5 */
 pa_operation* pa_context_move_source_output_by_name(pa_context *c, uint32_t idx, const char *source_name, pa_context_success_cb_t cb, void* userdata);
 
@@ -663,6 +716,10 @@ pa_operation* pa_context_get_sample_info_by_index(pa_context *c, uint32_t idx, p
 /** Get the complete list of samples stored in the daemon. */
 pa_operation* pa_context_get_sample_info_list(pa_context *c, pa_sample_info_cb_t cb, void *userdata);
 
+/** Get the samples that were created or changed after the specified
+ * generation. See \ref since_subsec. \since 5.0 */
+pa_operation* pa_context_get_sample_info_list_since(pa_context *c, uint64_t generation, pa_info_list_generation_cb_t gen_cb, pa_sample_info_cb_t cb, void *userdata);
+
 /** @} */
 
 /** \cond fulldocs */
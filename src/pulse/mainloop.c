@@ -34,6 +34,10 @@
 #include <pulsecore/pipe.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
 #include <pulse/xmalloc.h>
@@ -57,7 +61,15 @@ struct pa_io_event {
 
     int fd;
     pa_io_event_flags_t events;
-    struct pollfd *pollfd;
+
+    /* Index into pollfds, or INVALID_INDEX if not added yet */
+    unsigned pollfd_idx;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* A dup() of fd if fd was already registered with epoll by
+     * another event, -1 otherwise */
+    int epoll_dup_fd;
+#endif
 
     pa_io_event_cb_t callback;
     void *userdata;
@@ -72,8 +84,13 @@ struct pa_time_event {
 
     pa_bool_t enabled:1;
     pa_bool_t use_rtclock:1;
+    pa_bool_t expired:1;
     pa_usec_t time;
 
+    /* Index into time_heap while enabled */
+    unsigned heap_idx;
+    pa_time_event *next_expired;
+
     pa_time_event_cb_t callback;
     void *userdata;
     pa_time_event_destroy_cb_t destroy_callback;
@@ -102,12 +119,23 @@ struct pa_mainloop {
     unsigned n_enabled_defer_events, n_enabled_time_events, n_io_events;
     unsigned io_events_please_scan, time_events_please_scan, defer_events_please_scan;
 
-    pa_bool_t rebuild_pollfds:1;
+    /* The first entry is for the wakeup pipe, io events are added
+     * lazily in pa_mainloop_prepare() and removed when cleaned up */
     struct pollfd *pollfds;
+    pa_io_event **pollfd_events;
     unsigned max_pollfds, n_pollfds;
 
+    /* Enabled time events, ordered by time */
+    pa_time_event **time_heap;
+    unsigned max_time_heap, n_time_heap;
+
     pa_usec_t prepared_timeout;
-    pa_time_event *cached_next_time_event;
+
+#ifdef HAVE_SYS_EPOLL_H
+    int epoll_fd;
+    struct epoll_event *epoll_events;
+    unsigned max_epoll_events;
+#endif
 
     pa_mainloop_api api;
 
@@ -147,6 +175,142 @@ static pa_io_event_flags_t map_flags_from_libc(short flags) {
         (flags & POLLHUP ? PA_IO_EVENT_HANGUP : 0);
 }
 
+#define INVALID_INDEX ((unsigned) -1)
+
+#ifdef HAVE_SYS_EPOLL_H
+static uint32_t map_flags_to_epoll(pa_io_event_flags_t flags) {
+    return
+        (flags & PA_IO_EVENT_INPUT ? EPOLLIN : 0) |
+        (flags & PA_IO_EVENT_OUTPUT ? EPOLLOUT : 0) |
+        (flags & PA_IO_EVENT_ERROR ? EPOLLERR : 0) |
+        (flags & PA_IO_EVENT_HANGUP ? EPOLLHUP : 0);
+}
+
+static pa_io_event_flags_t map_flags_from_epoll(uint32_t flags) {
+    return
+        (flags & EPOLLIN ? PA_IO_EVENT_INPUT : 0) |
+        (flags & EPOLLOUT ? PA_IO_EVENT_OUTPUT : 0) |
+        (flags & EPOLLERR ? PA_IO_EVENT_ERROR : 0) |
+        (flags & EPOLLHUP ? PA_IO_EVENT_HANGUP : 0);
+}
+
+static void disable_epoll(pa_mainloop *m) {
+    pa_io_event *e;
+
+    pa_assert(m->epoll_fd >= 0);
+
+    PA_LLIST_FOREACH(e, m->io_events)
+        if (e->epoll_dup_fd >= 0) {
+            pa_close(e->epoll_dup_fd);
+            e->epoll_dup_fd = -1;
+        }
+
+    pa_close(m->epoll_fd);
+    m->epoll_fd = -1;
+}
+
+/* Unlike the pollfds, epoll is updated right away, because the fd
+ * may be closed right after the event is freed */
+static void epoll_add(pa_mainloop *m, pa_io_event *e) {
+    struct epoll_event ev;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.ptr = e;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, e->fd, &ev) >= 0)
+        return;
+
+    /* Every fd can only be added once, but there may be several
+     * events for it */
+    if (errno == EEXIST &&
+        (e->epoll_dup_fd = fcntl(e->fd, F_DUPFD_CLOEXEC, 0)) >= 0 &&
+        epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, e->epoll_dup_fd, &ev) >= 0)
+        return;
+
+    /* E.g. regular files can't be used with epoll */
+    pa_log_debug("Failed to add fd %i to epoll, falling back to poll(): %s", e->fd, pa_cstrerror(errno));
+    disable_epoll(m);
+}
+
+static void epoll_modify(pa_mainloop *m, pa_io_event *e) {
+    struct epoll_event ev;
+
+    if (m->epoll_fd < 0)
+        return;
+
+    pa_zero(ev);
+    ev.events = map_flags_to_epoll(e->events);
+    ev.data.ptr = e;
+
+    if (epoll_ctl(m->epoll_fd, EPOLL_CTL_MOD, e->epoll_dup_fd >= 0 ? e->epoll_dup_fd : e->fd, &ev) < 0) {
+        pa_log_debug("Failed to modify fd %i in epoll, falling back to poll(): %s", e->fd, pa_cstrerror(errno));
+        disable_epoll(m);
+    }
+}
+
+static void epoll_remove(pa_mainloop *m, pa_io_event *e) {
+    if (m->epoll_fd < 0)
+        return;
+
+    if (e->epoll_dup_fd >= 0) {
+        pa_close(e->epoll_dup_fd);
+        e->epoll_dup_fd = -1;
+    } else
+        epoll_ctl(m->epoll_fd, EPOLL_CTL_DEL, e->fd, NULL);
+}
+#endif
+
+static void add_pollfds(pa_mainloop *m) {
+    pa_io_event *e;
+
+    /* New events are prepended, so we can stop at the first one
+     * that was added already */
+    PA_LLIST_FOREACH(e, m->io_events) {
+        struct pollfd *p;
+
+        if (e->pollfd_idx != INVALID_INDEX)
+            break;
+
+        if (e->dead)
+            continue;
+
+        if (m->n_pollfds >= m->max_pollfds) {
+            m->max_pollfds *= 2;
+            m->pollfds = pa_xrenew(struct pollfd, m->pollfds, m->max_pollfds);
+            m->pollfd_events = pa_xrenew(pa_io_event*, m->pollfd_events, m->max_pollfds);
+        }
+
+        e->pollfd_idx = m->n_pollfds++;
+        m->pollfd_events[e->pollfd_idx] = e;
+
+        p = &m->pollfds[e->pollfd_idx];
+        p->fd = e->fd;
+        p->events = map_flags_to_libc(e->events);
+        p->revents = 0;
+    }
+}
+
+static void remove_pollfd(pa_mainloop *m, pa_io_event *e) {
+    unsigned last;
+
+    if (e->pollfd_idx == INVALID_INDEX)
+        return;
+
+    last = --m->n_pollfds;
+
+    if (e->pollfd_idx != last) {
+        m->pollfds[e->pollfd_idx] = m->pollfds[last];
+        m->pollfd_events[e->pollfd_idx] = m->pollfd_events[last];
+        m->pollfd_events[e->pollfd_idx]->pollfd_idx = e->pollfd_idx;
+    }
+
+    e->pollfd_idx = INVALID_INDEX;
+}
+
 /* IO events */
 static pa_io_event* mainloop_io_new(
         pa_mainloop_api *a,
@@ -171,14 +335,19 @@ static pa_io_event* mainloop_io_new(
 
     e->fd = fd;
     e->events = events;
+    e->pollfd_idx = INVALID_INDEX;
 
     e->callback = callback;
     e->userdata = userdata;
 
     PA_LLIST_PREPEND(pa_io_event, m->io_events, e);
-    m->rebuild_pollfds = TRUE;
     m->n_io_events ++;
 
+#ifdef HAVE_SYS_EPOLL_H
+    e->epoll_dup_fd = -1;
+    epoll_add(m, e);
+#endif
+
     pa_mainloop_wakeup(m);
 
     return e;
@@ -193,10 +362,12 @@ static void mainloop_io_enable(pa_io_event *e, pa_io_event_flags_t events) {
 
     e->events = events;
 
-    if (e->pollfd)
-        e->pollfd->events = map_flags_to_libc(events);
-    else
-        e->mainloop->rebuild_pollfds = TRUE;
+    if (e->pollfd_idx != INVALID_INDEX)
+        e->mainloop->pollfds[e->pollfd_idx].events = map_flags_to_libc(events);
+
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_modify(e->mainloop, e);
+#endif
 
     pa_mainloop_wakeup(e->mainloop);
 }
@@ -209,7 +380,10 @@ static void mainloop_io_free(pa_io_event *e) {
     e->mainloop->io_events_please_scan ++;
 
     e->mainloop->n_io_events --;
-    e->mainloop->rebuild_pollfds = TRUE;
+
+#ifdef HAVE_SYS_EPOLL_H
+    epoll_remove(e->mainloop, e);
+#endif
 
     pa_mainloop_wakeup(e->mainloop);
 }
@@ -289,6 +463,78 @@ static void mainloop_defer_set_destroy(pa_defer_event *e, pa_defer_event_destroy
 }
 
 /* Time events */
+static void time_heap_swap(pa_mainloop *m, unsigned a, unsigned b) {
+    pa_time_event *e;
+
+    e = m->time_heap[a];
+    m->time_heap[a] = m->time_heap[b];
+    m->time_heap[b] = e;
+
+    m->time_heap[a]->heap_idx = a;
+    m->time_heap[b]->heap_idx = b;
+}
+
+static void time_heap_up(pa_mainloop *m, unsigned i) {
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+
+        if (m->time_heap[parent]->time <= m->time_heap[i]->time)
+            break;
+
+        time_heap_swap(m, i, parent);
+        i = parent;
+    }
+}
+
+static void time_heap_down(pa_mainloop *m, unsigned i) {
+    for (;;) {
+        unsigned l = 2 * i + 1, r = l + 1, n = i;
+
+        if (l < m->n_time_heap && m->time_heap[l]->time < m->time_heap[n]->time)
+            n = l;
+        if (r < m->n_time_heap && m->time_heap[r]->time < m->time_heap[n]->time)
+            n = r;
+
+        if (n == i)
+            break;
+
+        time_heap_swap(m, i, n);
+        i = n;
+    }
+}
+
+static void time_event_queue(pa_mainloop *m, pa_time_event *e) {
+    pa_assert(e->heap_idx == INVALID_INDEX);
+
+    if (m->n_time_heap >= m->max_time_heap) {
+        m->max_time_heap = PA_MAX(16U, m->max_time_heap * 2);
+        m->time_heap = pa_xrenew(pa_time_event*, m->time_heap, m->max_time_heap);
+    }
+
+    e->heap_idx = m->n_time_heap++;
+    m->time_heap[e->heap_idx] = e;
+    time_heap_up(m, e->heap_idx);
+}
+
+static void time_event_unqueue(pa_mainloop *m, pa_time_event *e) {
+    unsigned i;
+
+    e->expired = FALSE;
+
+    if ((i = e->heap_idx) == INVALID_INDEX)
+        return;
+
+    e->heap_idx = INVALID_INDEX;
+
+    if (i == --m->n_time_heap)
+        return;
+
+    m->time_heap[i] = m->time_heap[m->n_time_heap];
+    m->time_heap[i]->heap_idx = i;
+    time_heap_up(m, i);
+    time_heap_down(m, m->time_heap[i]->heap_idx);
+}
+
 static pa_usec_t make_rt(const struct timeval *tv, pa_bool_t *use_rtclock) {
     struct timeval ttv;
 
@@ -330,19 +576,14 @@ static pa_time_event* mainloop_time_new(
 
     e = pa_xnew0(pa_time_event, 1);
     e->mainloop = m;
+    e->heap_idx = INVALID_INDEX;
 
     if ((e->enabled = (t != PA_USEC_INVALID))) {
         e->time = t;
         e->use_rtclock = use_rtclock;
 
         m->n_enabled_time_events++;
-
-        if (m->cached_next_time_event) {
-            pa_assert(m->cached_next_time_event->enabled);
-
-            if (t < m->cached_next_time_event->time)
-                m->cached_next_time_event = e;
-        }
+        time_event_queue(m, e);
     }
 
     e->callback = callback;
@@ -373,19 +614,14 @@ static void mainloop_time_restart(pa_time_event *e, const struct timeval *tv) {
     } else if (!e->enabled && valid)
         e->mainloop->n_enabled_time_events++;
 
+    time_event_unqueue(e->mainloop, e);
+
     if ((e->enabled = valid)) {
         e->time = t;
         e->use_rtclock = use_rtclock;
+        time_event_queue(e->mainloop, e);
         pa_mainloop_wakeup(e->mainloop);
     }
-
-    if (e->mainloop->cached_next_time_event && e->enabled) {
-        pa_assert(e->mainloop->cached_next_time_event->enabled);
-
-        if (t < e->mainloop->cached_next_time_event->time)
-            e->mainloop->cached_next_time_event = e;
-    } else if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
 }
 
 static void mainloop_time_free(pa_time_event *e) {
@@ -401,8 +637,7 @@ static void mainloop_time_free(pa_time_event *e) {
         e->enabled = FALSE;
     }
 
-    if (e->mainloop->cached_next_time_event == e)
-        e->mainloop->cached_next_time_event = NULL;
+    time_event_unqueue(e->mainloop, e);
 
     /* no wakeup needed here. Think about it! */
 }
@@ -450,6 +685,9 @@ static const pa_mainloop_api vtable = {
 
 pa_mainloop *pa_mainloop_new(void) {
     pa_mainloop *m;
+#ifdef HAVE_SYS_EPOLL_H
+    const char *e;
+#endif
 
     pa_init_i18n();
 
@@ -464,7 +702,35 @@ pa_mainloop *pa_mainloop_new(void) {
     pa_make_fd_nonblock(m->wakeup_pipe[0]);
     pa_make_fd_nonblock(m->wakeup_pipe[1]);
 
-    m->rebuild_pollfds = TRUE;
+    m->max_pollfds = 16;
+    m->pollfds = pa_xnew(struct pollfd, m->max_pollfds);
+    m->pollfd_events = pa_xnew(pa_io_event*, m->max_pollfds);
+
+    m->pollfds[0].fd = m->wakeup_pipe[0];
+    m->pollfds[0].events = POLLIN;
+    m->pollfds[0].revents = 0;
+    m->pollfd_events[0] = NULL;
+    m->n_pollfds = 1;
+
+#ifdef HAVE_SYS_EPOLL_H
+    m->epoll_fd = -1;
+
+    if ((e = getenv("PULSE_MAINLOOP_EPOLL")) && pa_parse_boolean(e) > 0) {
+        struct epoll_event ev;
+
+        pa_zero(ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+
+        if ((m->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+            pa_log_warn("epoll_create1() failed: %s", pa_cstrerror(errno));
+        else if (epoll_ctl(m->epoll_fd, EPOLL_CTL_ADD, m->wakeup_pipe[0], &ev) < 0) {
+            pa_log_warn("Failed to add wakeup pipe to epoll: %s", pa_cstrerror(errno));
+            pa_close(m->epoll_fd);
+            m->epoll_fd = -1;
+        }
+    }
+#endif
 
     m->api = vtable;
     m->api.userdata = m;
@@ -491,13 +757,17 @@ static void cleanup_io_events(pa_mainloop *m, pa_bool_t force) {
                 pa_assert(m->io_events_please_scan > 0);
                 m->io_events_please_scan--;
             }
+#ifdef HAVE_SYS_EPOLL_H
+            else
+                epoll_remove(m, e);
+#endif
+
+            remove_pollfd(m, e);
 
             if (e->destroy_callback)
                 e->destroy_callback(&m->api, e, e->userdata);
 
             pa_xfree(e);
-
-            m->rebuild_pollfds = TRUE;
         }
     }
 
@@ -524,6 +794,7 @@ static void cleanup_time_events(pa_mainloop *m, pa_bool_t force) {
                 pa_assert(m->n_enabled_time_events > 0);
                 m->n_enabled_time_events--;
                 e->enabled = FALSE;
+                time_event_unqueue(m, e);
             }
 
             if (e->destroy_callback)
@@ -577,6 +848,14 @@ void pa_mainloop_free(pa_mainloop *m) {
     cleanup_time_events(m, TRUE);
 
     pa_xfree(m->pollfds);
+    pa_xfree(m->pollfd_events);
+    pa_xfree(m->time_heap);
+
+#ifdef HAVE_SYS_EPOLL_H
+    if (m->epoll_fd >= 0)
+        pa_close(m->epoll_fd);
+    pa_xfree(m->epoll_events);
+#endif
 
     pa_close_pipe(m->wakeup_pipe);
 
@@ -596,70 +875,60 @@ static void scan_dead(pa_mainloop *m) {
         cleanup_defer_events(m, FALSE);
 }
 
-static void rebuild_pollfds(pa_mainloop *m) {
-    pa_io_event*e;
-    struct pollfd *p;
-    unsigned l;
-
-    l = m->n_io_events + 1;
-    if (m->max_pollfds < l) {
-        l *= 2;
-        m->pollfds = pa_xrealloc(m->pollfds, sizeof(struct pollfd)*l);
-        m->max_pollfds = l;
-    }
+static unsigned dispatch_pollfds(pa_mainloop *m) {
+    unsigned r = 0, k, i;
 
-    m->n_pollfds = 0;
-    p = m->pollfds;
+    pa_assert(m->poll_func_ret > 0);
 
-    if (m->wakeup_pipe[0] >= 0) {
-        m->pollfds[0].fd = m->wakeup_pipe[0];
-        m->pollfds[0].events = POLLIN;
-        m->pollfds[0].revents = 0;
-        p++;
-        m->n_pollfds++;
-    }
+    k = m->poll_func_ret;
 
-    PA_LLIST_FOREACH(e, m->io_events) {
-        if (e->dead) {
-            e->pollfd = NULL;
-            continue;
-        }
+#ifdef HAVE_SYS_EPOLL_H
+    if (m->epoll_fd >= 0 && !m->poll_func) {
+        for (i = 0; i < k && !m->quit; i++) {
+            pa_io_event *e;
 
-        e->pollfd = p;
-        p->fd = e->fd;
-        p->events = map_flags_to_libc(e->events);
-        p->revents = 0;
+            /* Events freed in the meantime are only marked dead, so
+             * the pointers are still valid */
+            if (!(e = m->epoll_events[i].data.ptr) || e->dead)
+                continue;
 
-        p++;
-        m->n_pollfds++;
-    }
+            pa_assert(e->callback);
 
-    m->rebuild_pollfds = FALSE;
-}
+            e->callback(&m->api, e, e->fd, map_flags_from_epoll(m->epoll_events[i].events), e->userdata);
+            r++;
+        }
 
-static unsigned dispatch_pollfds(pa_mainloop *m) {
-    pa_io_event *e;
-    unsigned r = 0, k;
+        return r;
+    }
+#endif
 
-    pa_assert(m->poll_func_ret > 0);
+    if (m->pollfds[0].revents) {
+        m->pollfds[0].revents = 0;
+        k--;
+    }
 
-    k = m->poll_func_ret;
+    /* New events aren't added to the pollfds before the next
+     * iteration and dead ones aren't removed, so the indexes stay
+     * valid while we dispatch */
+    for (i = 1; i < m->n_pollfds && k > 0 && !m->quit; i++) {
+        pa_io_event *e;
+        short revents;
 
-    PA_LLIST_FOREACH(e, m->io_events) {
+        if (!(revents = m->pollfds[i].revents))
+            continue;
 
-        if (k <= 0 || m->quit)
-            break;
+        m->pollfds[i].revents = 0;
+        k--;
 
-        if (e->dead || !e->pollfd || !e->pollfd->revents)
+        e = m->pollfd_events[i];
+        if (e->dead)
             continue;
 
-        pa_assert(e->pollfd->fd == e->fd);
+        pa_assert(e->fd == m->pollfds[i].fd);
         pa_assert(e->callback);
 
-        e->callback(&m->api, e, e->fd, map_flags_from_libc(e->pollfd->revents), e->userdata);
-        e->pollfd->revents = 0;
+        e->callback(&m->api, e, e->fd, map_flags_from_libc(revents), e->userdata);
         r++;
-        k--;
     }
 
     return r;
@@ -688,31 +957,6 @@ static unsigned dispatch_defer(pa_mainloop *m) {
     return r;
 }
 
-static pa_time_event* find_next_time_event(pa_mainloop *m) {
-    pa_time_event *t, *n = NULL;
-    pa_assert(m);
-
-    if (m->cached_next_time_event)
-        return m->cached_next_time_event;
-
-    PA_LLIST_FOREACH(t, m->time_events) {
-
-        if (t->dead || !t->enabled)
-            continue;
-
-        if (!n || t->time < n->time) {
-            n = t;
-
-            /* Shortcut for time == 0 */
-            if (n->time == 0)
-                break;
-        }
-    }
-
-    m->cached_next_time_event = n;
-    return n;
-}
-
 static pa_usec_t calc_next_timeout(pa_mainloop *m) {
     pa_time_event *t;
     pa_usec_t clock_now;
@@ -720,7 +964,8 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
     if (m->n_enabled_time_events <= 0)
         return PA_USEC_INVALID;
 
-    pa_assert_se(t = find_next_time_event(m));
+    pa_assert(m->n_time_heap > 0);
+    t = m->time_heap[0];
 
     if (t->time <= 0)
         return 0;
@@ -734,7 +979,7 @@ static pa_usec_t calc_next_timeout(pa_mainloop *m) {
 }
 
 static unsigned dispatch_timeout(pa_mainloop *m) {
-    pa_time_event *e;
+    pa_time_event *e, *expired = NULL, **tail = &expired;
     pa_usec_t now;
     unsigned r = 0;
     pa_assert(m);
@@ -744,25 +989,40 @@ static unsigned dispatch_timeout(pa_mainloop *m) {
 
     now = pa_rtclock_now();
 
-    PA_LLIST_FOREACH(e, m->time_events) {
+    /* Take all elapsed events off the heap first, so that events the
+     * callbacks restart aren't dispatched again right away */
+    while (m->n_time_heap > 0 && m->time_heap[0]->time <= now) {
+        e = m->time_heap[0];
+        time_event_unqueue(m, e);
 
-        if (m->quit)
-            break;
+        e->expired = TRUE;
+        e->next_expired = NULL;
+        *tail = e;
+        tail = &e->next_expired;
+    }
 
-        if (e->dead || !e->enabled)
+    for (e = expired; e; e = e->next_expired) {
+        struct timeval tv;
+
+        /* Restarted or freed by one of the callbacks */
+        if (!e->expired)
             continue;
 
-        if (e->time <= now) {
-            struct timeval tv;
-            pa_assert(e->callback);
+        if (m->quit) {
+            /* Leave the rest for later */
+            e->expired = FALSE;
+            time_event_queue(m, e);
+            continue;
+        }
+
+        pa_assert(e->callback);
 
-            /* Disable time event */
-            mainloop_time_restart(e, NULL);
+        /* Disable time event */
+        mainloop_time_restart(e, NULL);
 
-            e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
+        e->callback(&m->api, e, pa_timeval_rtstore(&tv, e->time, e->use_rtclock), e->userdata);
 
-            r++;
-        }
+        r++;
     }
 
     return r;
@@ -805,8 +1065,14 @@ int pa_mainloop_prepare(pa_mainloop *m, int timeout) {
 
     if (m->n_enabled_defer_events <= 0) {
 
-        if (m->rebuild_pollfds)
-            rebuild_pollfds(m);
+        add_pollfds(m);
+
+#ifdef HAVE_SYS_EPOLL_H
+        if (m->epoll_fd >= 0 && m->max_epoll_events < m->n_io_events + 1) {
+            m->max_epoll_events = PA_MAX(16U, (m->n_io_events + 1) * 2);
+            m->epoll_events = pa_xrenew(struct epoll_event, m->epoll_events, m->max_epoll_events);
+        }
+#endif
 
         m->prepared_timeout = calc_next_timeout(m);
         if (timeout >= 0) {
@@ -849,8 +1115,13 @@ int pa_mainloop_poll(pa_mainloop *m) {
     if (m->n_enabled_defer_events )
         m->poll_func_ret = 0;
     else {
-        pa_assert(!m->rebuild_pollfds);
-
+#ifdef HAVE_SYS_EPOLL_H
+        if (m->epoll_fd >= 0 && !m->poll_func)
+            m->poll_func_ret = epoll_wait(
+                    m->epoll_fd, m->epoll_events, (int) m->max_epoll_events,
+                    usec_to_timeout(m->prepared_timeout));
+        else
+#endif
         if (m->poll_func)
             m->poll_func_ret = m->poll_func(
                     m->pollfds, m->n_pollfds,
@@ -982,6 +1253,12 @@ void pa_mainloop_set_poll_func(pa_mainloop *m, pa_poll_func poll_func, void *use
 
     m->poll_func = poll_func;
     m->poll_func_userdata = userdata;
+
+#ifdef HAVE_SYS_EPOLL_H
+    /* The poll function needs the pollfds */
+    if (poll_func && m->epoll_fd >= 0)
+        disable_epoll(m);
+#endif
 }
 
 pa_bool_t pa_mainloop_is_our_api(pa_mainloop_api *m) {
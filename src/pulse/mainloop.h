@@ -38,6 +38,12 @@ struct pollfd;
  * It supports the functions defined in the main loop abstraction and very
  * little else.
  *
+ * On Linux, epoll can be used instead of poll() by setting the
+ * environment variable $PULSE_MAINLOOP_EPOLL to 1. This scales better
+ * with many file descriptors. It is not used when a custom poll
+ * function is set with pa_mainloop_set_poll_func(), or when one of the
+ * file descriptors doesn't support epoll.
+ *
  * The main loop is created using pa_mainloop_new() and destroyed using
  * pa_mainloop_free(). To get access to the main loop abstraction,
  * pa_mainloop_get_api() is used.
@@ -43,6 +43,8 @@ pa_operation *pa_operation_new(pa_context *c, pa_stream *s, pa_operation_cb_t cb
     o->context = c;
     o->stream = s;
     o->private = NULL;
+    o->generation_callback = NULL;
+    o->since_generation = 0;
 
     o->state = PA_OPERATION_RUNNING;
     o->callback = cb;
@@ -90,6 +92,7 @@ static void operation_unlink(pa_operation *o) {
 
     o->stream = NULL;
     o->callback = NULL;
+    o->generation_callback = NULL;
     o->userdata = NULL;
 }
 
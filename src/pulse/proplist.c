@@ -29,20 +29,114 @@
 #include <pulse/xmalloc.h>
 #include <pulse/utf8.h>
 
-#include <pulsecore/hashmap.h>
 #include <pulsecore/strbuf.h>
 #include <pulsecore/core-util.h>
 
 #include "proplist.h"
 
+/* A proplist is an array of properties sorted by key. Most proplists
+ * have a few dozen entries at most, and are built in key order when
+ * they are copied or received from the server, which makes adding
+ * properties cheap.
+ *
+ * Removing a property only marks it as removed, since the current
+ * entry may be removed while iterating. The removed entries are
+ * dropped the next time a property is added. */
+
 struct property {
-    char *key;
+    const char *key;
     void *value;
     size_t nbytes;
+    pa_bool_t interned:1; /* key is one of well_known_keys[] */
+    pa_bool_t removed:1;
+};
+
+struct pa_proplist {
+    struct property *properties;
+    unsigned n_properties, n_allocated;
+    unsigned n_removed;
 };
 
-#define MAKE_HASHMAP(p) ((pa_hashmap*) (p))
-#define MAKE_PROPLIST(p) ((pa_proplist*) (p))
+/* The PA_PROP_xxx keys, sorted by strcmp(). Properties with these keys
+ * point to the strings here instead of having their own copy. */
+static const char * const well_known_keys[] = {
+    PA_PROP_APPLICATION_ICON,
+    PA_PROP_APPLICATION_ICON_NAME,
+    PA_PROP_APPLICATION_ID,
+    PA_PROP_APPLICATION_LANGUAGE,
+    PA_PROP_APPLICATION_NAME,
+    PA_PROP_APPLICATION_PROCESS_BINARY,
+    PA_PROP_APPLICATION_PROCESS_HOST,
+    PA_PROP_APPLICATION_PROCESS_ID,
+    PA_PROP_APPLICATION_PROCESS_MACHINE_ID,
+    PA_PROP_APPLICATION_PROCESS_SESSION_ID,
+    PA_PROP_APPLICATION_PROCESS_USER,
+    PA_PROP_APPLICATION_VERSION,
+    PA_PROP_DEVICE_ACCESS_MODE,
+    PA_PROP_DEVICE_API,
+    PA_PROP_DEVICE_BUFFERING_BUFFER_SIZE,
+    PA_PROP_DEVICE_BUFFERING_FRAGMENT_SIZE,
+    PA_PROP_DEVICE_BUS,
+    PA_PROP_DEVICE_BUS_PATH,
+    PA_PROP_DEVICE_CLASS,
+    PA_PROP_DEVICE_DESCRIPTION,
+    PA_PROP_DEVICE_FORM_FACTOR,
+    PA_PROP_DEVICE_ICON,
+    PA_PROP_DEVICE_ICON_NAME,
+    PA_PROP_DEVICE_INTENDED_ROLES,
+    PA_PROP_DEVICE_MASTER_DEVICE,
+    PA_PROP_DEVICE_PRODUCT_ID,
+    PA_PROP_DEVICE_PRODUCT_NAME,
+    PA_PROP_DEVICE_PROFILE_DESCRIPTION,
+    PA_PROP_DEVICE_PROFILE_NAME,
+    PA_PROP_DEVICE_SERIAL,
+    PA_PROP_DEVICE_STRING,
+    PA_PROP_DEVICE_VENDOR_ID,
+    PA_PROP_DEVICE_VENDOR_NAME,
+    PA_PROP_EVENT_DESCRIPTION,
+    PA_PROP_EVENT_ID,
+    PA_PROP_EVENT_MOUSE_BUTTON,
+    PA_PROP_EVENT_MOUSE_HPOS,
+    PA_PROP_EVENT_MOUSE_VPOS,
+    PA_PROP_EVENT_MOUSE_X,
+    PA_PROP_EVENT_MOUSE_Y,
+    PA_PROP_FILTER_APPLY,
+    PA_PROP_FILTER_SUPPRESS,
+    PA_PROP_FILTER_WANT,
+    PA_PROP_FORMAT_CHANNEL_MAP,
+    PA_PROP_FORMAT_CHANNELS,
+    PA_PROP_FORMAT_RATE,
+    PA_PROP_FORMAT_SAMPLE_FORMAT,
+    PA_PROP_MEDIA_ARTIST,
+    PA_PROP_MEDIA_COPYRIGHT,
+    PA_PROP_MEDIA_FILENAME,
+    PA_PROP_MEDIA_ICON,
+    PA_PROP_MEDIA_ICON_NAME,
+    PA_PROP_MEDIA_LANGUAGE,
+    PA_PROP_MEDIA_NAME,
+    PA_PROP_MEDIA_ROLE,
+    PA_PROP_MEDIA_SOFTWARE,
+    PA_PROP_MEDIA_TITLE,
+    PA_PROP_MODULE_AUTHOR,
+    PA_PROP_MODULE_DESCRIPTION,
+    PA_PROP_MODULE_USAGE,
+    PA_PROP_MODULE_VERSION,
+    PA_PROP_WINDOW_DESKTOP,
+    PA_PROP_WINDOW_HEIGHT,
+    PA_PROP_WINDOW_HPOS,
+    PA_PROP_WINDOW_ICON,
+    PA_PROP_WINDOW_ICON_NAME,
+    PA_PROP_WINDOW_ID,
+    PA_PROP_WINDOW_NAME,
+    PA_PROP_WINDOW_VPOS,
+    PA_PROP_WINDOW_WIDTH,
+    PA_PROP_WINDOW_X,
+    PA_PROP_WINDOW_X11_DISPLAY,
+    PA_PROP_WINDOW_X11_MONITOR,
+    PA_PROP_WINDOW_X11_SCREEN,
+    PA_PROP_WINDOW_X11_XID,
+    PA_PROP_WINDOW_Y
+};
 
 int pa_proplist_key_valid(const char *key) {
 
@@ -55,30 +149,166 @@ int pa_proplist_key_valid(const char *key) {
     return 1;
 }
 
-static void property_free(struct property *prop) {
+static const char *intern_key(const char *key) {
+    unsigned l = 0, r = PA_ELEMENTSOF(well_known_keys);
+
+    while (l < r) {
+        unsigned m = (l + r) / 2;
+        int c = strcmp(key, well_known_keys[m]);
+
+        if (c == 0)
+            return well_known_keys[m];
+
+        if (c < 0)
+            r = m;
+        else
+            l = m + 1;
+    }
+
+    return NULL;
+}
+
+static void property_done(struct property *prop) {
     pa_assert(prop);
 
-    pa_xfree(prop->key);
+    if (!prop->interned)
+        pa_xfree((char*) prop->key);
     pa_xfree(prop->value);
-    pa_xfree(prop);
+}
+
+/* Looks up key, and stores its position or the position it would have
+ * to be inserted at in *idx */
+static pa_bool_t find(const pa_proplist *p, const char *key, unsigned *idx) {
+    unsigned l = 0, r = p->n_properties;
+
+    while (l < r) {
+        unsigned m = (l + r) / 2;
+        int c = strcmp(key, p->properties[m].key);
+
+        if (c == 0) {
+            *idx = m;
+            return TRUE;
+        }
+
+        if (c < 0)
+            r = m;
+        else
+            l = m + 1;
+    }
+
+    *idx = l;
+    return FALSE;
+}
+
+static struct property *get_property(const pa_proplist *p, const char *key) {
+    unsigned idx;
+
+    if (!find(p, key, &idx) || p->properties[idx].removed)
+        return NULL;
+
+    return p->properties + idx;
+}
+
+static void drop_removed(pa_proplist *p) {
+    unsigned i, j;
+
+    if (p->n_removed <= 0)
+        return;
+
+    for (i = 0, j = 0; i < p->n_properties; i++) {
+        if (p->properties[i].removed) {
+            property_done(p->properties + i);
+            continue;
+        }
+
+        if (i != j)
+            p->properties[j] = p->properties[i];
+        j++;
+    }
+
+    p->n_properties = j;
+    p->n_removed = 0;
+}
+
+static void reserve(pa_proplist *p, unsigned n) {
+    unsigned m;
+
+    if (n <= p->n_allocated)
+        return;
+
+    m = PA_MAX(8U, n);
+    p->n_allocated = PA_MAX(m, p->n_allocated * 2);
+    p->properties = pa_xrenew(struct property, p->properties, p->n_allocated);
+}
+
+/* Returns the property for key, adding one without a value if there is
+ * none yet. If key_copy is not NULL, it is a copy of key that we take
+ * ownership of. */
+static struct property *lookup_or_add(pa_proplist *p, const char *key, char *key_copy) {
+    struct property *prop;
+    unsigned idx;
+
+    /* Adding in key order is the common case, so check that first */
+    if (p->n_properties > 0 && strcmp(key, p->properties[p->n_properties-1].key) > 0)
+        idx = p->n_properties;
+    else if (find(p, key, &idx)) {
+        prop = p->properties + idx;
+        pa_xfree(key_copy);
+
+        if (prop->removed) {
+            prop->removed = FALSE;
+            p->n_removed--;
+        }
+
+        return prop;
+    }
+
+    if (p->n_removed > 0) {
+        drop_removed(p);
+        find(p, key, &idx);
+    }
+
+    reserve(p, p->n_properties + 1);
+
+    prop = p->properties + idx;
+    memmove(prop + 1, prop, (p->n_properties - idx) * sizeof(struct property));
+    p->n_properties++;
+
+    if ((prop->key = intern_key(key))) {
+        prop->interned = TRUE;
+        pa_xfree(key_copy);
+    } else {
+        prop->interned = FALSE;
+        prop->key = key_copy ? key_copy : pa_xstrdup(key);
+    }
+
+    prop->removed = FALSE;
+    prop->value = NULL;
+    prop->nbytes = 0;
+
+    return prop;
+}
+
+static void set_value(struct property *prop, void *value, size_t nbytes) {
+    pa_xfree(prop->value);
+    prop->value = value;
+    prop->nbytes = nbytes;
 }
 
 pa_proplist* pa_proplist_new(void) {
-    return MAKE_PROPLIST(pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func));
+    return pa_xnew0(pa_proplist, 1);
 }
 
 void pa_proplist_free(pa_proplist* p) {
     pa_assert(p);
 
     pa_proplist_clear(p);
-    pa_hashmap_free(MAKE_HASHMAP(p), NULL, NULL);
+    pa_xfree(p->properties);
+    pa_xfree(p);
 }
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
-
     pa_assert(p);
     pa_assert(key);
     pa_assert(value);
@@ -86,26 +316,13 @@ int pa_proplist_sets(pa_proplist *p, const char *key, const char *value) {
     if (!pa_proplist_key_valid(key) || !pa_utf8_valid(value))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = TRUE;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xstrdup(value);
-    prop->nbytes = strlen(value)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_value(lookup_or_add(p, key, NULL), pa_xstrdup(value), strlen(value)+1);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
     char *k, *v;
 
     pa_assert(p);
@@ -121,20 +338,7 @@ static int proplist_setn(pa_proplist *p, const char *key, size_t key_length, con
         return -1;
     }
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = TRUE;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_value(lookup_or_add(p, k, k), v, strlen(v)+1);
 
     return 0;
 }
@@ -155,8 +359,6 @@ int pa_proplist_setp(pa_proplist *p, const char *pair) {
 }
 
 static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, const char *value, size_t value_length) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
     char *k, *v;
     uint8_t *d;
     size_t dn;
@@ -184,29 +386,14 @@ static int proplist_sethex(pa_proplist *p, const char *key, size_t key_length, c
 
     pa_xfree(v);
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), k))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = k;
-        add = TRUE;
-    } else {
-        pa_xfree(prop->value);
-        pa_xfree(k);
-    }
-
     d[dn] = 0;
-    prop->value = d;
-    prop->nbytes = dn;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_value(lookup_or_add(p, k, k), d, dn);
 
     return 0;
 }
 
 /** Will accept only valid UTF-8 */
 int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
     va_list ap;
     char *v;
 
@@ -224,18 +411,7 @@ int pa_proplist_setf(pa_proplist *p, const char *key, const char *format, ...) {
     if (!pa_utf8_valid(v))
         goto fail;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = TRUE;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = v;
-    prop->nbytes = strlen(v)+1;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_value(lookup_or_add(p, key, NULL), v, strlen(v)+1);
 
     return 0;
 
@@ -244,10 +420,18 @@ fail:
     return -1;
 }
 
-int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nbytes) {
-    struct property *prop;
-    pa_bool_t add = FALSE;
+static void *copy_value(const void *data, size_t nbytes) {
+    char *v;
+
+    v = pa_xmalloc(nbytes+1);
+    if (nbytes > 0)
+        memcpy(v, data, nbytes);
+    v[nbytes] = 0;
 
+    return v;
+}
+
+int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nbytes) {
     pa_assert(p);
     pa_assert(key);
     pa_assert(data || nbytes == 0);
@@ -255,21 +439,7 @@ int pa_proplist_set(pa_proplist *p, const char *key, const void *data, size_t nb
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key))) {
-        prop = pa_xnew(struct property, 1);
-        prop->key = pa_xstrdup(key);
-        add = TRUE;
-    } else
-        pa_xfree(prop->value);
-
-    prop->value = pa_xmalloc(nbytes+1);
-    if (nbytes > 0)
-        memcpy(prop->value, data, nbytes);
-    ((char*) prop->value)[nbytes] = 0;
-    prop->nbytes = nbytes;
-
-    if (add)
-        pa_hashmap_put(MAKE_HASHMAP(p), prop->key, prop);
+    set_value(lookup_or_add(p, key, NULL), copy_value(data, nbytes), nbytes);
 
     return 0;
 }
@@ -283,7 +453,7 @@ const char *pa_proplist_gets(pa_proplist *p, const char *key) {
     if (!pa_proplist_key_valid(key))
         return NULL;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key)))
+    if (!(prop = get_property(p, key)))
         return NULL;
 
     if (prop->nbytes <= 0)
@@ -312,7 +482,7 @@ int pa_proplist_get(pa_proplist *p, const char *key, const void **data, size_t *
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(prop = pa_hashmap_get(MAKE_HASHMAP(p), key)))
+    if (!(prop = get_property(p, key)))
         return -1;
 
     *data = prop->value;
@@ -321,25 +491,58 @@ int pa_proplist_get(pa_proplist *p, const char *key, const void **data, size_t *
     return 0;
 }
 
+/* Appends a copy of prop, which has to sort after all properties in p */
+static void append_copy(pa_proplist *p, const struct property *prop) {
+    struct property *n;
+
+    pa_assert(p->n_properties < p->n_allocated);
+
+    n = p->properties + p->n_properties++;
+    n->interned = prop->interned;
+    n->removed = FALSE;
+    n->key = prop->interned ? prop->key : pa_xstrdup(prop->key);
+    n->value = copy_value(prop->value, prop->nbytes);
+    n->nbytes = prop->nbytes;
+}
+
 void pa_proplist_update(pa_proplist *p, pa_update_mode_t mode, const pa_proplist *other) {
-    struct property *prop;
-    void *state = NULL;
+    unsigned i;
 
     pa_assert(p);
     pa_assert(mode == PA_UPDATE_SET || mode == PA_UPDATE_MERGE || mode == PA_UPDATE_REPLACE);
     pa_assert(other);
 
+    if (p == other && mode != PA_UPDATE_SET)
+        return;
+
     if (mode == PA_UPDATE_SET)
         pa_proplist_clear(p);
 
-    /* MAKE_HASHMAP turns the const pointer into a non-const pointer, but
-     * that's ok, because we don't modify the hashmap contents. */
-    while ((prop = pa_hashmap_iterate(MAKE_HASHMAP(other), &state, NULL))) {
+    /* Into an empty list the properties can simply be copied over, since
+     * they are sorted already */
+    if (p->n_properties == p->n_removed) {
+        pa_proplist_clear(p);
+        reserve(p, other->n_properties - other->n_removed);
 
-        if (mode == PA_UPDATE_MERGE && pa_proplist_contains(p, prop->key))
+        for (i = 0; i < other->n_properties; i++)
+            if (!other->properties[i].removed)
+                append_copy(p, other->properties + i);
+
+        return;
+    }
+
+    for (i = 0; i < other->n_properties; i++) {
+        const struct property *prop = other->properties + i;
+        struct property *n;
+
+        if (prop->removed)
             continue;
 
-        pa_assert_se(pa_proplist_set(p, prop->key, prop->value, prop->nbytes) == 0);
+        if (mode == PA_UPDATE_MERGE && get_property(p, prop->key))
+            continue;
+
+        n = lookup_or_add(p, prop->key, NULL);
+        set_value(n, copy_value(prop->value, prop->nbytes), prop->nbytes);
     }
 }
 
@@ -352,10 +555,15 @@ int pa_proplist_unset(pa_proplist *p, const char *key) {
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(prop = pa_hashmap_remove(MAKE_HASHMAP(p), key)))
+    if (!(prop = get_property(p, key)))
         return -2;
 
-    property_free(prop);
+    pa_xfree(prop->value);
+    prop->value = NULL;
+    prop->nbytes = 0;
+    prop->removed = TRUE;
+    p->n_removed++;
+
     return 0;
 }
 
@@ -378,12 +586,19 @@ int pa_proplist_unset_many(pa_proplist *p, const char * const keys[]) {
 }
 
 const char *pa_proplist_iterate(pa_proplist *p, void **state) {
-    struct property *prop;
+    unsigned idx;
 
-    if (!(prop = pa_hashmap_iterate(MAKE_HASHMAP(p), state, NULL)))
-        return NULL;
+    pa_assert(p);
+    pa_assert(state);
 
-    return prop->key;
+    for (idx = PA_PTR_TO_UINT(*state); idx < p->n_properties; idx++)
+        if (!p->properties[idx].removed) {
+            *state = PA_UINT_TO_PTR(idx + 1);
+            return p->properties[idx].key;
+        }
+
+    *state = PA_UINT_TO_PTR(idx);
+    return NULL;
 }
 
 char *pa_proplist_to_string_sep(pa_proplist *p, const char *sep) {
@@ -632,7 +847,7 @@ pa_proplist *pa_proplist_from_string(const char *s) {
     }
 
 success:
-    return MAKE_PROPLIST(pl);
+    return pl;
 
 fail:
     pa_proplist_free(pl);
@@ -646,18 +861,21 @@ int pa_proplist_contains(pa_proplist *p, const char *key) {
     if (!pa_proplist_key_valid(key))
         return -1;
 
-    if (!(pa_hashmap_get(MAKE_HASHMAP(p), key)))
+    if (!get_property(p, key))
         return 0;
 
     return 1;
 }
 
 void pa_proplist_clear(pa_proplist *p) {
-    struct property *prop;
+    unsigned i;
     pa_assert(p);
 
-    while ((prop = pa_hashmap_steal_first(MAKE_HASHMAP(p))))
-        property_free(prop);
+    for (i = 0; i < p->n_properties; i++)
+        property_done(p->properties + i);
+
+    p->n_properties = 0;
+    p->n_removed = 0;
 }
 
 pa_proplist* pa_proplist_copy(const pa_proplist *p) {
@@ -674,20 +892,17 @@ pa_proplist* pa_proplist_copy(const pa_proplist *p) {
 unsigned pa_proplist_size(pa_proplist *p) {
     pa_assert(p);
 
-    return pa_hashmap_size(MAKE_HASHMAP(p));
+    return p->n_properties - p->n_removed;
 }
 
 int pa_proplist_isempty(pa_proplist *p) {
     pa_assert(p);
 
-    return pa_hashmap_isempty(MAKE_HASHMAP(p));
+    return p->n_properties == p->n_removed;
 }
 
 int pa_proplist_equal(pa_proplist *a, pa_proplist *b) {
-    const void *key = NULL;
-    struct property *a_prop = NULL;
-    struct property *b_prop = NULL;
-    void *state = NULL;
+    unsigned i, j;
 
     pa_assert(a);
     pa_assert(b);
@@ -698,8 +913,23 @@ int pa_proplist_equal(pa_proplist *a, pa_proplist *b) {
     if (pa_proplist_size(a) != pa_proplist_size(b))
         return 0;
 
-    while ((a_prop = pa_hashmap_iterate(MAKE_HASHMAP(a), &state, &key))) {
-        if (!(b_prop = pa_hashmap_get(MAKE_HASHMAP(b), key)))
+    /* Both are sorted by key, so equal lists have equal entries in the
+     * same order */
+    for (i = 0, j = 0;; i++, j++) {
+        const struct property *a_prop, *b_prop;
+
+        while (i < a->n_properties && a->properties[i].removed)
+            i++;
+        while (j < b->n_properties && b->properties[j].removed)
+            j++;
+
+        if (i >= a->n_properties || j >= b->n_properties)
+            break;
+
+        a_prop = a->properties + i;
+        b_prop = b->properties + j;
+
+        if (a_prop->key != b_prop->key && !pa_streq(a_prop->key, b_prop->key))
             return 0;
 
         if (a_prop->nbytes != b_prop->nbytes)
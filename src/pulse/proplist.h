@@ -365,7 +365,9 @@ int pa_proplist_unset_many(pa_proplist *p, const char * const keys[]);
  * which should be called in a loop until it returns NULL which
  * signifies EOL. The property list should not be modified during
  * iteration through the list -- with the exception of deleting the
- * current entry. On each invocation this function will return the
+ * current entry and changing the value of an existing entry. Adding
+ * entries may move the others around, so that keys are skipped or
+ * returned twice. On each invocation this function will return the
  * key string for the next entry. The keys in the property list do not
  * have any particular order. \since 0.9.11 */
 const char *pa_proplist_iterate(pa_proplist *p, void **state);
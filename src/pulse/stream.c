@@ -1132,6 +1132,16 @@ void pa_create_stream_callback(pa_pdispatch *pd, uint32_t command, uint32_t tag,
         }
     }
 
+    if (s->context->version >= 30 && s->direction != PA_STREAM_UPLOAD) {
+        uint32_t compression;
+
+        /* We never ask for compression */
+        if (pa_tagstruct_getu32(t, &compression) < 0 || compression != 0) {
+            pa_context_fail(s->context, PA_ERR_PROTOCOL);
+            goto finish;
+        }
+    }
+
     if (!pa_tagstruct_eof(t)) {
         pa_context_fail(s->context, PA_ERR_PROTOCOL);
         goto finish;
@@ -1363,6 +1373,9 @@ static int create_stream(
         pa_tagstruct_put_boolean(t, flags & (PA_STREAM_PASSTHROUGH));
     }
 
+    if (s->context->version >= 30 && s->direction != PA_STREAM_UPLOAD)
+        pa_tagstruct_putu32(t, 0); /* compression */
+
     pa_pstream_send_tagstruct(s->context->pstream, t);
     pa_pdispatch_register_reply(s->context->pdispatch, tag, DEFAULT_TIMEOUT, pa_create_stream_callback, s, NULL);
 
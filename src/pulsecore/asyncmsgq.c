@@ -54,7 +54,7 @@ struct asyncmsgq_item {
 struct pa_asyncmsgq {
     PA_REFCNT_DECLARE;
     pa_asyncq *asyncq;
-    pa_mutex *mutex; /* only for the writer side */
+    pa_mutex *mutex; /* only for the writer side, NULL if the asyncq is multiple-writer safe */
 
     struct asyncmsgq_item *current;
 };
@@ -72,6 +72,19 @@ pa_asyncmsgq *pa_asyncmsgq_new(unsigned size) {
     return a;
 }
 
+pa_asyncmsgq *pa_asyncmsgq_new_mpsc(unsigned size) {
+    pa_asyncmsgq *a;
+
+    a = pa_xnew(pa_asyncmsgq, 1);
+
+    PA_REFCNT_INIT(a);
+    pa_assert_se(a->asyncq = pa_asyncq_new_mpsc(size));
+    a->mutex = NULL;
+    a->current = NULL;
+
+    return a;
+}
+
 static void asyncmsgq_free(pa_asyncmsgq *a) {
     struct asyncmsgq_item *i;
     pa_assert(a);
@@ -94,7 +107,9 @@ static void asyncmsgq_free(pa_asyncmsgq *a) {
     }
 
     pa_asyncq_free(a->asyncq, NULL);
-    pa_mutex_free(a->mutex);
+
+    if (a->mutex)
+        pa_mutex_free(a->mutex);
     pa_xfree(a);
 }
 
@@ -133,9 +148,13 @@ void pa_asyncmsgq_post(pa_asyncmsgq *a, pa_msgobject *object, int code, const vo
     i->semaphore = NULL;
 
     /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
+    if (a->mutex)
+        pa_mutex_lock(a->mutex);
+
     pa_asyncq_post(a->asyncq, i);
-    pa_mutex_unlock(a->mutex);
+
+    if (a->mutex)
+        pa_mutex_unlock(a->mutex);
 }
 
 int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const void *userdata, int64_t offset, const pa_memchunk *chunk) {
@@ -160,9 +179,13 @@ int pa_asyncmsgq_send(pa_asyncmsgq *a, pa_msgobject *object, int code, const voi
     pa_assert_se(i.semaphore);
 
     /* This mutex makes the queue multiple-writer safe. This lock is only used on the writing side */
-    pa_mutex_lock(a->mutex);
+    if (a->mutex)
+        pa_mutex_lock(a->mutex);
+
     pa_assert_se(pa_asyncq_push(a->asyncq, &i, TRUE) == 0);
-    pa_mutex_unlock(a->mutex);
+
+    if (a->mutex)
+        pa_mutex_unlock(a->mutex);
 
     pa_semaphore_wait(i.semaphore);
 
@@ -34,7 +34,9 @@
  * for controlling real-time threads from normal-priority
  * threads. Multiple-writer-safety is accomplished by using a mutex on
  * the writer side. This queue is thus not useful for communication
- * between several real-time threads.
+ * between several real-time threads. Queues created with
+ * pa_asyncmsgq_new_mpsc() are based on a multiple-writer safe
+ * pa_asyncq instead and don't need the mutex.
  *
  * The queue takes messages consisting of:
  *    "Object" for which this messages is intended (may be NULL)
@@ -53,6 +55,7 @@ enum {
 typedef struct pa_asyncmsgq pa_asyncmsgq;
 
 pa_asyncmsgq* pa_asyncmsgq_new(unsigned size);
+pa_asyncmsgq* pa_asyncmsgq_new_mpsc(unsigned size);
 pa_asyncmsgq* pa_asyncmsgq_ref(pa_asyncmsgq *q);
 
 void pa_asyncmsgq_unref(pa_asyncmsgq* q);
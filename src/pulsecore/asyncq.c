@@ -36,6 +36,7 @@
 #include <pulsecore/llist.h>
 #include <pulsecore/flist.h>
 #include <pulsecore/fdsem.h>
+#include <pulsecore/mutex.h>
 
 #include "asyncq.h"
 
@@ -57,6 +58,15 @@ struct localq {
     PA_LLIST_FIELDS(struct localq);
 };
 
+/* For queues with multiple writers every cell carries a sequence
+ * number. A cell at position n may be written when its sequence
+ * number is n, and read when it is n+1. After reading it is set to
+ * n+size, i.e. the position the cell will have in the next round. */
+struct mpsc_cell {
+    pa_atomic_t seq;
+    pa_atomic_ptr_t data;
+};
+
 struct pa_asyncq {
     unsigned size;
     unsigned read_idx;
@@ -66,17 +76,26 @@ struct pa_asyncq {
     PA_LLIST_HEAD(struct localq, localq);
     struct localq *last_localq;
     pa_bool_t waiting_for_post;
+
+    /* Only used if there are multiple writers. The writers claim
+     * cells by incrementing mpsc_write_idx, the local queue for
+     * pa_asyncq_post() is protected by the mutex. */
+    pa_bool_t multiple_writers;
+    pa_atomic_t mpsc_write_idx;
+    pa_atomic_t n_localq;
+    pa_mutex *mutex;
 };
 
 PA_STATIC_FLIST_DECLARE(localq, 0, pa_xfree);
 
 #define PA_ASYNCQ_CELLS(x) ((pa_atomic_ptr_t*) ((uint8_t*) (x) + PA_ALIGN(sizeof(struct pa_asyncq))))
+#define PA_ASYNCQ_MPSC_CELLS(x) ((struct mpsc_cell*) ((uint8_t*) (x) + PA_ALIGN(sizeof(struct pa_asyncq))))
 
 static unsigned reduce(pa_asyncq *l, unsigned value) {
     return value & (unsigned) (l->size - 1);
 }
 
-pa_asyncq *pa_asyncq_new(unsigned size) {
+static pa_asyncq *asyncq_new(unsigned size, pa_bool_t multiple_writers) {
     pa_asyncq *l;
 
     if (!size)
@@ -84,7 +103,7 @@ pa_asyncq *pa_asyncq_new(unsigned size) {
 
     pa_assert(pa_is_power_of_two(size));
 
-    l = pa_xmalloc0(PA_ALIGN(sizeof(pa_asyncq)) + (sizeof(pa_atomic_ptr_t) * size));
+    l = pa_xmalloc0(PA_ALIGN(sizeof(pa_asyncq)) + ((multiple_writers ? sizeof(struct mpsc_cell) : sizeof(pa_atomic_ptr_t)) * size));
 
     l->size = size;
 
@@ -103,9 +122,29 @@ pa_asyncq *pa_asyncq_new(unsigned size) {
         return NULL;
     }
 
+    if ((l->multiple_writers = multiple_writers)) {
+        struct mpsc_cell *cells = PA_ASYNCQ_MPSC_CELLS(l);
+        unsigned i;
+
+        for (i = 0; i < size; i++)
+            pa_atomic_store(&cells[i].seq, (int) i);
+
+        pa_atomic_store(&l->mpsc_write_idx, 0);
+        pa_atomic_store(&l->n_localq, 0);
+        pa_assert_se(l->mutex = pa_mutex_new(FALSE, FALSE));
+    }
+
     return l;
 }
 
+pa_asyncq *pa_asyncq_new(unsigned size) {
+    return asyncq_new(size, FALSE);
+}
+
+pa_asyncq *pa_asyncq_new_mpsc(unsigned size) {
+    return asyncq_new(size, TRUE);
+}
+
 void pa_asyncq_free(pa_asyncq *l, pa_free_cb_t free_cb) {
     struct localq *q;
     pa_assert(l);
@@ -127,11 +166,57 @@ void pa_asyncq_free(pa_asyncq *l, pa_free_cb_t free_cb) {
             pa_xfree(q);
     }
 
+    if (l->mutex)
+        pa_mutex_free(l->mutex);
+
     pa_fdsem_free(l->read_fdsem);
     pa_fdsem_free(l->write_fdsem);
     pa_xfree(l);
 }
 
+static int push_mpsc(pa_asyncq*l, void *p, pa_bool_t wait_op) {
+    struct mpsc_cell *cells;
+
+    cells = PA_ASYNCQ_MPSC_CELLS(l);
+
+    for (;;) {
+        unsigned idx;
+        struct mpsc_cell *c;
+        int d;
+
+        _Y;
+        idx = (unsigned) pa_atomic_load(&l->mpsc_write_idx);
+        c = &cells[reduce(l, idx)];
+        d = (int) ((unsigned) pa_atomic_load(&c->seq) - idx);
+
+        if (d == 0) {
+            /* The cell is free, try to claim it */
+            if (pa_atomic_cmpxchg(&l->mpsc_write_idx, (int) idx, (int) (idx + 1))) {
+                pa_atomic_ptr_store(&c->data, p);
+
+                _Y;
+                pa_atomic_store(&c->seq, (int) (idx + 1));
+                break;
+            }
+
+        } else if (d < 0) {
+            /* The reader hasn't taken the item from the last round
+             * yet, i.e. the queue is full */
+
+            if (!wait_op)
+                return -1;
+
+            pa_fdsem_wait(l->read_fdsem);
+        }
+
+        /* Otherwise another writer claimed the cell in the meantime */
+    }
+
+    pa_fdsem_post(l->write_fdsem);
+
+    return 0;
+}
+
 static int push(pa_asyncq*l, void *p, pa_bool_t wait_op) {
     unsigned idx;
     pa_atomic_ptr_t *cells;
@@ -139,6 +224,9 @@ static int push(pa_asyncq*l, void *p, pa_bool_t wait_op) {
     pa_assert(l);
     pa_assert(p);
 
+    if (l->multiple_writers)
+        return push_mpsc(l, p, wait_op);
+
     cells = PA_ASYNCQ_CELLS(l);
 
     _Y;
@@ -164,7 +252,8 @@ static int push(pa_asyncq*l, void *p, pa_bool_t wait_op) {
     return 0;
 }
 
-static pa_bool_t flush_postq(pa_asyncq *l, pa_bool_t wait_op) {
+/* With multiple writers the caller needs to hold the mutex */
+static pa_bool_t flush_postq_unlocked(pa_asyncq *l, pa_bool_t wait_op) {
     struct localq *q;
 
     pa_assert(l);
@@ -180,11 +269,33 @@ static pa_bool_t flush_postq(pa_asyncq *l, pa_bool_t wait_op) {
 
         if (pa_flist_push(PA_STATIC_FLIST_GET(localq), q) < 0)
             pa_xfree(q);
+
+        if (l->multiple_writers)
+            pa_atomic_dec(&l->n_localq);
     }
 
     return TRUE;
 }
 
+static pa_bool_t flush_postq(pa_asyncq *l, pa_bool_t wait_op) {
+    pa_bool_t ret;
+
+    pa_assert(l);
+
+    if (!l->multiple_writers)
+        return flush_postq_unlocked(l, wait_op);
+
+    /* Don't bother with the mutex if nothing is queued locally */
+    if (pa_atomic_load(&l->n_localq) <= 0)
+        return TRUE;
+
+    pa_mutex_lock(l->mutex);
+    ret = flush_postq_unlocked(l, wait_op);
+    pa_mutex_unlock(l->mutex);
+
+    return ret;
+}
+
 int pa_asyncq_push(pa_asyncq*l, void *p, pa_bool_t wait_op) {
     pa_assert(l);
 
@@ -200,9 +311,22 @@ void pa_asyncq_post(pa_asyncq*l, void *p) {
     pa_assert(l);
     pa_assert(p);
 
-    if (flush_postq(l, FALSE))
-        if (pa_asyncq_push(l, p, FALSE) >= 0)
-            return;
+    if (l->multiple_writers) {
+
+        /* If nothing is queued locally we don't need to care about
+         * the order and can push directly without locking. Items
+         * queued locally by the calling thread or before it was
+         * signalled by another thread are always counted here. */
+        if (pa_atomic_load(&l->n_localq) <= 0)
+            if (push(l, p, FALSE) >= 0)
+                return;
+
+        pa_mutex_lock(l->mutex);
+    }
+
+    if (flush_postq_unlocked(l, FALSE))
+        if (push(l, p, FALSE) >= 0)
+            goto finish;
 
     /* OK, we couldn't push anything in the queue. So let's queue it
      * locally and push it later */
@@ -219,22 +343,37 @@ void pa_asyncq_post(pa_asyncq*l, void *p) {
     if (!l->last_localq)
         l->last_localq = q;
 
-    return;
+    if (l->multiple_writers)
+        pa_atomic_inc(&l->n_localq);
+
+finish:
+    if (l->multiple_writers)
+        pa_mutex_unlock(l->mutex);
+}
+
+/* Returns the item at the read index, or NULL if there is none (yet) */
+static void* peek(pa_asyncq *l) {
+
+    if (l->multiple_writers) {
+        struct mpsc_cell *c = &PA_ASYNCQ_MPSC_CELLS(l)[reduce(l, l->read_idx)];
+
+        if ((unsigned) pa_atomic_load(&c->seq) != l->read_idx + 1)
+            return NULL;
+
+        return pa_atomic_ptr_load(&c->data);
+    }
+
+    return pa_atomic_ptr_load(&PA_ASYNCQ_CELLS(l)[reduce(l, l->read_idx)]);
 }
 
 void* pa_asyncq_pop(pa_asyncq*l, pa_bool_t wait_op) {
-    unsigned idx;
     void *ret;
-    pa_atomic_ptr_t *cells;
 
     pa_assert(l);
 
-    cells = PA_ASYNCQ_CELLS(l);
-
     _Y;
-    idx = reduce(l, l->read_idx);
 
-    if (!(ret = pa_atomic_ptr_load(&cells[idx]))) {
+    if (!(ret = peek(l))) {
 
         if (!wait_op)
             return NULL;
@@ -243,13 +382,21 @@ void* pa_asyncq_pop(pa_asyncq*l, pa_bool_t wait_op) {
 
         do {
             pa_fdsem_wait(l->write_fdsem);
-        } while (!(ret = pa_atomic_ptr_load(&cells[idx])));
+        } while (!(ret = peek(l)));
     }
 
     pa_assert(ret);
 
-    /* Guaranteed to succeed if we only have a single reader */
-    pa_assert_se(pa_atomic_ptr_cmpxchg(&cells[idx], ret, NULL));
+    if (l->multiple_writers) {
+        struct mpsc_cell *c = &PA_ASYNCQ_MPSC_CELLS(l)[reduce(l, l->read_idx)];
+
+        pa_assert_se(pa_atomic_ptr_cmpxchg(&c->data, ret, NULL));
+
+        /* Hand the cell over to the writers of the next round */
+        pa_atomic_store(&c->seq, (int) (l->read_idx + l->size));
+    } else
+        /* Guaranteed to succeed if we only have a single reader */
+        pa_assert_se(pa_atomic_ptr_cmpxchg(&PA_ASYNCQ_CELLS(l)[reduce(l, l->read_idx)], ret, NULL));
 
     _Y;
     l->read_idx++;
@@ -266,18 +413,12 @@ int pa_asyncq_read_fd(pa_asyncq *q) {
 }
 
 int pa_asyncq_read_before_poll(pa_asyncq *l) {
-    unsigned idx;
-    pa_atomic_ptr_t *cells;
-
     pa_assert(l);
 
-    cells = PA_ASYNCQ_CELLS(l);
-
     _Y;
-    idx = reduce(l, l->read_idx);
 
     for (;;) {
-        if (pa_atomic_ptr_load(&cells[idx]))
+        if (peek(l))
             return -1;
 
         if (pa_fdsem_before_poll(l->write_fdsem) >= 0)
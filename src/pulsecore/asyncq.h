@@ -40,9 +40,21 @@
  * however is probably not problematic, because we do it only on
  * starvation or overload in which case we have to block anyway.  */
 
+/* pa_asyncq_new_mpsc() creates a queue that is safe for multiple
+ * writers without any locking on the writer side, while still being
+ * single-reader only. Writers claim a cell with an atomic
+ * compare-and-swap, so contending writers just retry. Only when the
+ * queue is full pa_asyncq_post() falls back to a mutex protected
+ * local queue. The write_before_poll()/write_after_poll() functions
+ * should still be called from a single thread only.
+ *
+ * The size of the queue needs to be a power of two, or 0 for the
+ * default size. */
+
 typedef struct pa_asyncq pa_asyncq;
 
 pa_asyncq* pa_asyncq_new(unsigned size);
+pa_asyncq* pa_asyncq_new_mpsc(unsigned size);
 void pa_asyncq_free(pa_asyncq* q, pa_free_cb_t free_cb);
 
 void* pa_asyncq_pop(pa_asyncq *q, pa_bool_t wait);
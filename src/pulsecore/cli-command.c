@@ -384,6 +384,11 @@ static int pa_cli_command_stat(pa_core *c, pa_tokenizer *t, pa_strbuf *buf, pa_b
     pa_strbuf_printf(buf, "Total sample cache size: %s.\n",
                      pa_bytes_snprint(bytes, sizeof(bytes), (unsigned) pa_scache_total_size(c)));
 
+    pa_strbuf_printf(buf, "Subscription events posted: %llu, dropped as redundant: %llu, delivered: %llu.\n",
+                     (unsigned long long) c->n_subscription_events_posted,
+                     (unsigned long long) c->n_subscription_events_dropped,
+                     (unsigned long long) c->n_subscription_events_delivered);
+
     pa_strbuf_printf(buf, "Default sample spec: %s\n",
                      pa_sample_spec_snprint(ss, sizeof(ss), &c->default_sample_spec));
 
@@ -54,16 +54,55 @@
 #include <pulsecore/core-subscribe.h>
 #include <pulsecore/namereg.h>
 #include <pulsecore/sound-file.h>
+#include <pulsecore/sound-file-cache.h>
 #include <pulsecore/core-rtclock.h>
 #include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
 #include <pulsecore/core-error.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
 
 #include "core-scache.h"
 
 #define UNLOAD_POLL_TIME (60 * PA_USEC_PER_SEC)
 
+/* Decodes lazily loaded samples in a thread of its own, so that the
+ * main loop doesn't stall on it when they are first played. Also
+ * owns the directory of the on-disk cache of decoded samples. */
+typedef struct pa_scache_loader {
+    pa_msgobject parent;
+
+    pa_core *core;
+    char *cache_dir;
+
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+} pa_scache_loader;
+
+PA_DEFINE_PRIVATE_CLASS(pa_scache_loader, pa_msgobject);
+#define PA_SCACHE_LOADER(o) (pa_scache_loader_cast(o))
+
+enum {
+    SCACHE_LOADER_MESSAGE_LOAD,
+    SCACHE_LOADER_MESSAGE_LOADED
+};
+
+struct pa_scache_load_job {
+    /* Only touched from main context, NULL if the entry went away or
+     * was replaced in the meantime */
+    pa_scache_entry *entry;
+
+    char *filename;
+    int ret;
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    pa_memchunk memchunk;
+};
+
 static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct timeval *t, void *userdata) {
     pa_core *c = userdata;
 
@@ -76,9 +115,240 @@ static void timeout_callback(pa_mainloop_api *m, pa_time_event *e, const struct
     pa_core_rttime_restart(c, e, pa_rtclock_now() + UNLOAD_POLL_TIME);
 }
 
+/* Called from main context or the loader thread */
+static int load_file(pa_mempool *pool, const char *cache_dir, const char *filename, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    pa_proplist *q;
+
+    pa_assert(pool);
+    pa_assert(filename);
+
+    if (cache_dir && pa_sound_file_cache_load(pool, cache_dir, filename, ss, map, chunk, p) >= 0)
+        return 0;
+
+    /* The cache needs the properties of the file even if our caller
+     * doesn't */
+    q = pa_proplist_new();
+
+    if (pa_sound_file_load(pool, filename, ss, map, chunk, q) < 0) {
+        pa_proplist_free(q);
+        return -1;
+    }
+
+    if (cache_dir)
+        pa_sound_file_cache_save(cache_dir, filename, ss, map, chunk, q);
+
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, q);
+
+    pa_proplist_free(q);
+
+    return 0;
+}
+
+/* Takes over the reference to chunk */
+static void entry_loaded(pa_scache_entry *e, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk) {
+    pa_channel_map old_channel_map;
+
+    pa_assert(e);
+    pa_assert(!e->memchunk.memblock);
+
+    old_channel_map = e->channel_map;
+
+    e->sample_spec = *ss;
+    e->channel_map = *map;
+    e->memchunk = *chunk;
+
+    pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
+
+    if (e->volume_is_set) {
+        if (pa_cvolume_valid(&e->volume))
+            pa_cvolume_remap(&e->volume, &old_channel_map, &e->channel_map);
+        else
+            pa_cvolume_reset(&e->volume, e->sample_spec.channels);
+    }
+}
+
+static void job_done(struct pa_scache_load_job *j) {
+    pa_scache_entry *e;
+
+    pa_assert(j);
+
+    if ((e = j->entry)) {
+        pa_assert(e->load_job == j);
+        e->load_job = NULL;
+
+        if (j->ret < 0)
+            pa_log_warn("Failed to load sample \"%s\" from '%s'.", e->name, j->filename);
+        else if (!e->memchunk.memblock) {
+            pa_log_debug("Loaded sample \"%s\" in the background", e->name);
+
+            entry_loaded(e, &j->sample_spec, &j->channel_map, &j->memchunk);
+            pa_memchunk_reset(&j->memchunk);
+
+            /* Count this as a use, so that the sample isn't unloaded
+             * again right away */
+            time(&e->last_used_time);
+        }
+    }
+
+    if (j->memchunk.memblock)
+        pa_memblock_unref(j->memchunk.memblock);
+
+    pa_xfree(j->filename);
+    pa_xfree(j);
+}
+
+static int loader_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_scache_loader *l = PA_SCACHE_LOADER(o);
+    struct pa_scache_load_job *j = data;
+
+    switch (code) {
+
+        case SCACHE_LOADER_MESSAGE_LOAD:
+            /* Called from the loader thread */
+            j->ret = load_file(l->core->mempool, l->cache_dir, j->filename, &j->sample_spec, &j->channel_map, &j->memchunk, NULL);
+            pa_asyncmsgq_post(l->thread_mq.outq, PA_MSGOBJECT(l), SCACHE_LOADER_MESSAGE_LOADED, j, 0, NULL, NULL);
+            return 0;
+
+        case SCACHE_LOADER_MESSAGE_LOADED:
+            /* Called from main context */
+            job_done(j);
+            return 0;
+    }
+
+    return 0;
+}
+
+static void loader_thread_func(void *userdata) {
+    pa_scache_loader *l = userdata;
+
+    pa_assert(l);
+
+    pa_log_debug("Sample loader thread starting up");
+
+    pa_thread_mq_install(&l->thread_mq);
+
+    for (;;) {
+        int ret;
+
+        if ((ret = pa_rtpoll_run(l->rtpoll, TRUE)) < 0)
+            goto fail;
+
+        if (ret == 0)
+            goto finish;
+    }
+
+fail:
+    /* We have to continue processing messages until we receive the
+     * SHUTDOWN message */
+    pa_asyncmsgq_wait_for(l->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+
+finish:
+    pa_log_debug("Sample loader thread shutting down");
+}
+
+static pa_scache_loader *get_loader(pa_core *c) {
+    pa_scache_loader *l;
+
+    pa_assert(c);
+
+    if (c->scache_loader)
+        return c->scache_loader;
+
+    l = pa_msgobject_new(pa_scache_loader);
+    l->parent.process_msg = loader_process_msg;
+    l->core = c;
+    l->cache_dir = NULL;
+    l->thread = NULL;
+    l->rtpoll = NULL;
+
+    if (c->scache_disk_cache) {
+        if (!(l->cache_dir = pa_state_path("sample-cache", TRUE)) ||
+            pa_make_secure_dir(l->cache_dir, 0700, (uid_t) -1, (gid_t) -1, FALSE) < 0) {
+            pa_log_warn("Failed to create sample cache directory, not caching decoded samples.");
+            pa_xfree(l->cache_dir);
+            l->cache_dir = NULL;
+        }
+    }
+
+    c->scache_loader = l;
+    return l;
+}
+
+static void free_loader(pa_scache_loader *l) {
+    pa_assert(l);
+
+    if (l->thread) {
+        pa_asyncmsgq_send(l->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+        pa_thread_free(l->thread);
+    }
+
+    /* This dispatches the results of the jobs that were still queued */
+    if (l->rtpoll) {
+        pa_thread_mq_done(&l->thread_mq);
+        pa_rtpoll_free(l->rtpoll);
+    }
+
+    pa_xfree(l->cache_dir);
+    pa_msgobject_unref(PA_MSGOBJECT(l));
+}
+
+static const char *get_cache_dir(pa_core *c) {
+    pa_assert(c);
+
+    if (!c->scache_disk_cache)
+        return NULL;
+
+    return get_loader(c)->cache_dir;
+}
+
+static void queue_load(pa_scache_entry *e) {
+    pa_scache_loader *l;
+    struct pa_scache_load_job *j;
+
+    pa_assert(e);
+    pa_assert(e->filename);
+    pa_assert(!e->load_job);
+
+    l = get_loader(e->core);
+
+    if (!l->thread) {
+        l->rtpoll = pa_rtpoll_new();
+        pa_thread_mq_init(&l->thread_mq, e->core->mainloop, l->rtpoll);
+
+        if (!(l->thread = pa_thread_new("scache-loader", loader_thread_func, l))) {
+            pa_log("Failed to create sample loader thread.");
+            pa_thread_mq_done(&l->thread_mq);
+            pa_rtpoll_free(l->rtpoll);
+            l->rtpoll = NULL;
+            return;
+        }
+    }
+
+    j = pa_xnew0(struct pa_scache_load_job, 1);
+    j->entry = e;
+    j->filename = pa_xstrdup(e->filename);
+    e->load_job = j;
+
+    pa_asyncmsgq_post(l->thread_mq.inq, PA_MSGOBJECT(l), SCACHE_LOADER_MESSAGE_LOAD, j, 0, NULL, NULL);
+}
+
+static void cancel_load(pa_scache_entry *e) {
+    pa_assert(e);
+
+    if (!e->load_job)
+        return;
+
+    /* The loader thread still owns the job, it is freed once it is done */
+    e->load_job->entry = NULL;
+    e->load_job = NULL;
+}
+
 static void free_entry(pa_scache_entry *e) {
     pa_assert(e);
 
+    cancel_load(e);
+
     pa_namereg_unregister(e->core, e->name);
     pa_subscription_post(e->core, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_REMOVE, e->index);
     pa_xfree(e->name);
@@ -97,6 +367,8 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
     pa_assert(name);
 
     if ((e = pa_namereg_get(c, name, PA_NAMEREG_SAMPLE))) {
+        cancel_load(e);
+
         if (e->memchunk.memblock)
             pa_memblock_unref(e->memchunk.memblock);
 
@@ -117,6 +389,7 @@ static pa_scache_entry* scache_add_item(pa_core *c, const char *name) {
         e->name = pa_xstrdup(name);
         e->core = c;
         e->proplist = pa_proplist_new();
+        e->load_job = NULL;
 
         pa_idxset_put(c->scache, e, &e->index);
 
@@ -254,6 +527,9 @@ int pa_scache_add_file_lazy(pa_core *c, const char *name, const char *filename,
 
     pa_proplist_sets(e->proplist, PA_PROP_MEDIA_FILENAME, filename);
 
+    if (c->scache_preload)
+        queue_load(e);
+
     if (!c->scache_auto_unload_event)
         c->scache_auto_unload_event = pa_core_rttime_new(c, pa_rtclock_now() + UNLOAD_POLL_TIME, timeout_callback, c);
 
@@ -293,6 +569,11 @@ void pa_scache_free_all(pa_core *c) {
         c->mainloop->time_free(c->scache_auto_unload_event);
         c->scache_auto_unload_event = NULL;
     }
+
+    if (c->scache_loader) {
+        free_loader(c->scache_loader);
+        c->scache_loader = NULL;
+    }
 }
 
 int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t volume, pa_proplist *p, uint32_t *sink_input_idx) {
@@ -312,20 +593,18 @@ int pa_scache_play_item(pa_core *c, const char *name, pa_sink *sink, pa_volume_t
     pa_proplist_sets(merged, PA_PROP_MEDIA_NAME, name);
     pa_proplist_sets(merged, PA_PROP_EVENT_ID, name);
 
+    /* If the sample is still being loaded in the background we don't
+     * wait for that, but load it right here. The result of the
+     * background job is then simply dropped. */
     if (e->lazy && !e->memchunk.memblock) {
-        pa_channel_map old_channel_map = e->channel_map;
+        pa_sample_spec ss;
+        pa_channel_map map;
+        pa_memchunk chunk;
 
-        if (pa_sound_file_load(c->mempool, e->filename, &e->sample_spec, &e->channel_map, &e->memchunk, merged) < 0)
+        if (load_file(c->mempool, get_cache_dir(c), e->filename, &ss, &map, &chunk, merged) < 0)
             goto fail;
 
-        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE|PA_SUBSCRIPTION_EVENT_CHANGE, e->index);
-
-        if (e->volume_is_set) {
-            if (pa_cvolume_valid(&e->volume))
-                pa_cvolume_remap(&e->volume, &old_channel_map, &e->channel_map);
-            else
-                pa_cvolume_reset(&e->volume, e->sample_spec.channels);
-        }
+        entry_loaded(e, &ss, &map, &chunk);
     }
 
     if (!e->memchunk.memblock)
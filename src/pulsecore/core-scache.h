@@ -46,6 +46,9 @@ typedef struct pa_scache_entry {
     pa_bool_t lazy;
     time_t last_used_time;
 
+    /* Set while the sample is being loaded in the background */
+    struct pa_scache_load_job *load_job;
+
     pa_proplist *proplist;
 } pa_scache_entry;
 
@@ -37,7 +37,25 @@
  * register a callback function that is called whenever an event
  * matching a subscription mask happens. The execution of the callback
  * function is postponed to the next main loop iteration, i.e. is not
- * called from within the stack frame the entity was created in. */
+ * called from within the stack frame the entity was created in.
+ *
+ * Events that are still queued are coalesced per object: a CHANGE
+ * event is dropped if a NEW or CHANGE event for the same object is
+ * still pending, and a REMOVE event drops all pending events for the
+ * object. To find those quickly, the newest pending event of each
+ * object is kept in a hash table, and the pending events of an object
+ * are linked with each other.
+ *
+ * Independently of whether anyone is subscribed, every event bumps a
+ * global generation counter and stores it as the generation of the
+ * object it refers to. That way clients can ask for the objects that
+ * changed since a generation they have seen before. The upper 32 bits
+ * of the counter are the cookie of the core, so that generations from
+ * an earlier server instance, whose indexes may have been reused, can
+ * be recognized. */
+
+/* One more than the highest facility value */
+#define N_FACILITIES (PA_SUBSCRIPTION_EVENT_FACILITY_MASK + 1)
 
 struct pa_subscription {
     pa_core *core;
@@ -57,6 +75,15 @@ struct pa_subscription_event {
     uint32_t index;
 
     PA_LLIST_FIELDS(pa_subscription_event);
+
+    /* The older and newer pending events for the same object */
+    pa_subscription_event *object_prev, *object_next;
+};
+
+struct object_generation {
+    pa_subscription_event_type_t type;
+    uint32_t index;
+    uint64_t generation;
 };
 
 static void sched_event(pa_core *c);
@@ -77,6 +104,9 @@ pa_subscription* pa_subscription_new(pa_core *c, pa_subscription_mask_t m, pa_su
     s->mask = m;
 
     PA_LLIST_PREPEND(pa_subscription, c->subscriptions, s);
+    c->n_subscriptions++;
+    c->subscriptions_by_facility_dirty = TRUE;
+
     return s;
 }
 
@@ -94,17 +124,78 @@ static void free_subscription(pa_subscription *s) {
     pa_assert(s->core);
 
     PA_LLIST_REMOVE(pa_subscription, s->core->subscriptions, s);
+    s->core->n_subscriptions--;
+    s->core->subscriptions_by_facility_dirty = TRUE;
+
     pa_xfree(s);
 }
 
-static void free_event(pa_subscription_event *s) {
+/* Events are looked up by facility and index, not by type */
+static unsigned event_hash_func(const void *p) {
+    const pa_subscription_event *e = p;
+
+    return (unsigned) e->index * N_FACILITIES + (unsigned) (e->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static int event_compare_func(const void *a, const void *b) {
+    const pa_subscription_event *x = a, *y = b;
+
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+
+    return (int) (x->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) - (int) (y->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static unsigned generation_hash_func(const void *p) {
+    const struct object_generation *g = p;
+
+    return (unsigned) g->index * N_FACILITIES + (unsigned) (g->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static int generation_compare_func(const void *a, const void *b) {
+    const struct object_generation *x = a, *y = b;
+
+    if (x->index != y->index)
+        return x->index < y->index ? -1 : 1;
+
+    return (int) (x->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) - (int) (y->type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK);
+}
+
+static void free_generation(void *p, void *userdata) {
+    pa_xfree(p);
+}
+
+/* Remove an event from the queue and the per object lookup */
+static void unlink_event(pa_subscription_event *s) {
+    pa_core *c;
+
     pa_assert(s);
-    pa_assert(s->core);
+    pa_assert_se(c = s->core);
 
     if (!s->next)
-        s->core->subscription_event_last = s->prev;
+        c->subscription_event_last = s->prev;
+
+    PA_LLIST_REMOVE(pa_subscription_event, c->subscription_event_queue, s);
+
+    if (s->object_next)
+        s->object_next->object_prev = s->object_prev;
+    else {
+        /* This is the newest event of the object, i.e. the one in the
+         * lookup table, so replace it by its predecessor */
+        pa_assert_se(pa_hashmap_remove(c->subscription_events_by_object, s) == s);
+
+        if (s->object_prev)
+            pa_hashmap_put(c->subscription_events_by_object, s->object_prev, s->object_prev);
+    }
+
+    if (s->object_prev)
+        s->object_prev->object_next = s->object_next;
+
+    s->object_prev = s->object_next = NULL;
+}
 
-    PA_LLIST_REMOVE(pa_subscription_event, s->core->subscription_event_queue, s);
+static void free_event(pa_subscription_event *s) {
+    unlink_event(s);
     pa_xfree(s);
 }
 
@@ -118,6 +209,20 @@ void pa_subscription_free_all(pa_core *c) {
     while (c->subscription_event_queue)
         free_event(c->subscription_event_queue);
 
+    if (c->subscription_events_by_object) {
+        pa_hashmap_free(c->subscription_events_by_object, NULL, NULL);
+        c->subscription_events_by_object = NULL;
+    }
+
+    if (c->object_generations) {
+        pa_hashmap_free(c->object_generations, free_generation, NULL);
+        c->object_generations = NULL;
+    }
+
+    pa_xfree(c->subscriptions_by_facility);
+    c->subscriptions_by_facility = NULL;
+    c->subscriptions_by_facility_dirty = TRUE;
+
     if (c->subscription_defer_event) {
         c->mainloop->defer_free(c->subscription_defer_event);
         c->subscription_defer_event = NULL;
@@ -152,6 +257,39 @@ static void dump_event(const char * prefix, pa_subscription_event*e) {
 }
 #endif
 
+/* Returns the NULL terminated list of subscriptions interested in
+ * the given facility, in the order in which they shall be called. The
+ * lists are rebuilt lazily whenever subscriptions were added or
+ * removed, which is rare compared to events. Subscriptions which are
+ * marked dead stay in the lists until they are actually freed. */
+static pa_subscription **get_subscriptions_by_facility(pa_core *c, pa_subscription_event_type_t t) {
+    pa_subscription *s;
+    unsigned n, f;
+
+    pa_assert(c);
+
+    n = c->n_subscriptions;
+
+    if (c->subscriptions_by_facility_dirty) {
+        pa_xfree(c->subscriptions_by_facility);
+        c->subscriptions_by_facility = pa_xnew(pa_subscription*, N_FACILITIES * (n + 1));
+
+        for (f = 0; f < N_FACILITIES; f++) {
+            pa_subscription **p = c->subscriptions_by_facility + f * (n + 1);
+
+            for (s = c->subscriptions; s; s = s->next)
+                if (!s->dead && pa_subscription_match_flags(s->mask, f))
+                    *(p++) = s;
+
+            *p = NULL;
+        }
+
+        c->subscriptions_by_facility_dirty = FALSE;
+    }
+
+    return c->subscriptions_by_facility + (t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) * (n + 1);
+}
+
 /* Deferred callback for dispatching subscription events */
 static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
     pa_core *c = userdata;
@@ -167,17 +305,28 @@ static void defer_cb(pa_mainloop_api *m, pa_defer_event *de, void *userdata) {
 
     while (c->subscription_event_queue) {
         pa_subscription_event *e = c->subscription_event_queue;
+        pa_subscription **p;
+
+        /* Take the event out of the queue first, so that events
+         * posted by the callbacks aren't coalesced with it */
+        unlink_event(e);
 
-        for (s = c->subscriptions; s; s = s->next) {
+        /* Subscriptions created by the callbacks don't show up in
+         * this list, but will get the next event */
+        for (p = get_subscriptions_by_facility(c, e->type); *p; p++) {
+            s = *p;
 
-            if (!s->dead && pa_subscription_match_flags(s->mask, e->type))
-                s->callback(c, e->type, e->index, s->userdata);
+            if (s->dead)
+                continue;
+
+            s->callback(c, e->type, e->index, s->userdata);
+            c->n_subscription_events_delivered++;
         }
 
 #ifdef DEBUG
         dump_event("Dispatched", e);
 #endif
-        free_event(e);
+        pa_xfree(e);
     }
 
     /* Remove dead subscriptions */
@@ -203,47 +352,92 @@ static void sched_event(pa_core *c) {
     c->mainloop->defer_enable(c->subscription_defer_event, 1);
 }
 
+/* Remember the generation at which the object was last created or
+ * changed */
+static void update_generation(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
+    struct object_generation key, *g;
+
+    pa_assert(c);
+
+    c->generation++;
+
+    if (!c->object_generations)
+        c->object_generations = pa_hashmap_new(generation_hash_func, generation_compare_func);
+
+    key.type = t;
+    key.index = idx;
+
+    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+        if ((g = pa_hashmap_remove(c->object_generations, &key)))
+            pa_xfree(g);
+
+        return;
+    }
+
+    if (!(g = pa_hashmap_get(c->object_generations, &key))) {
+        g = pa_xnew(struct object_generation, 1);
+        g->type = t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK;
+        g->index = idx;
+        pa_assert_se(pa_hashmap_put(c->object_generations, g, g) == 0);
+    }
+
+    g->generation = c->generation;
+}
+
+/* Returns the generation at which the specified object was last
+ * created or changed. Objects we never saw an event for are treated as
+ * changed in every generation, so that they are never missed. */
+uint64_t pa_subscription_get_generation(pa_core *c, pa_subscription_event_type_t facility, uint32_t idx) {
+    struct object_generation key, *g;
+
+    pa_assert(c);
+
+    key.type = facility;
+    key.index = idx;
+
+    if (c->object_generations && (g = pa_hashmap_get(c->object_generations, &key)))
+        return g->generation;
+
+    return (uint64_t) -1;
+}
+
 /* Append a new subscription event to the subscription event queue and schedule a main loop event */
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx) {
-    pa_subscription_event *e;
+    pa_subscription_event *e, key, *i;
     pa_assert(c);
 
+    c->n_subscription_events_posted++;
+    update_generation(c, t, idx);
+
     /* No need for queuing subscriptions of no one is listening */
     if (!c->subscriptions)
         return;
 
-    if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_NEW) {
-        pa_subscription_event *i, *n;
+    if (!c->subscription_events_by_object)
+        c->subscription_events_by_object = pa_hashmap_new(event_hash_func, event_compare_func);
 
-        /* Check for duplicates */
-        for (i = c->subscription_event_last; i; i = n) {
-            n = i->prev;
-
-            /* not the same object type */
-            if (((t ^ i->type) & PA_SUBSCRIPTION_EVENT_FACILITY_MASK))
-                continue;
+    key.type = t;
+    key.index = idx;
 
-            /* not the same object */
-            if (i->index != idx)
-                continue;
+    if ((i = pa_hashmap_get(c->subscription_events_by_object, &key))) {
 
-            if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
-                /* This object is being removed, hence there is no
-                 * point in keeping the old events regarding this
-                 * entry in the queue. */
+        if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_REMOVE) {
+            /* This object is being removed, hence there is no
+             * point in keeping the old events regarding this
+             * entry in the queue. */
 
+            do {
                 free_event(i);
-                pa_log_debug("Dropped redundant event due to remove event.");
-                continue;
-            }
+                c->n_subscription_events_dropped++;
+            } while ((i = pa_hashmap_get(c->subscription_events_by_object, &key)));
 
-            if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE) {
-                /* This object has changed. If a "new" or "change" event for
-                 * this object is still in the queue we can exit. */
+        } else if ((t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) == PA_SUBSCRIPTION_EVENT_CHANGE &&
+                   (i->type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) != PA_SUBSCRIPTION_EVENT_REMOVE) {
+            /* This object has changed. If a "new" or "change" event for
+             * this object is still in the queue we can exit. */
 
-                pa_log_debug("Dropped redundant event due to change event.");
-                return;
-            }
+            c->n_subscription_events_dropped++;
+            return;
         }
     }
 
@@ -251,10 +445,18 @@ void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t i
     e->core = c;
     e->type = t;
     e->index = idx;
+    e->object_next = NULL;
 
     PA_LLIST_INSERT_AFTER(pa_subscription_event, c->subscription_event_queue, c->subscription_event_last, e);
     c->subscription_event_last = e;
 
+    if ((e->object_prev = i)) {
+        pa_assert_se(pa_hashmap_remove(c->subscription_events_by_object, i) == i);
+        i->object_next = e;
+    }
+
+    pa_assert_se(pa_hashmap_put(c->subscription_events_by_object, e, e) == 0);
+
 #ifdef DEBUG
     dump_event("Queued", e);
 #endif
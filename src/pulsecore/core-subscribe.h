@@ -36,4 +36,6 @@ void pa_subscription_free_all(pa_core *c);
 
 void pa_subscription_post(pa_core *c, pa_subscription_event_type_t t, uint32_t idx);
 
+uint64_t pa_subscription_get_generation(pa_core *c, pa_subscription_event_type_t facility, uint32_t idx);
+
 #endif
@@ -274,6 +274,7 @@ const char *pa_get_temp_dir(void);
 int pa_open_cloexec(const char *fn, int flags, mode_t mode);
 int pa_socket_cloexec(int domain, int type, int protocol);
 int pa_pipe_cloexec(int pipefd[2]);
+int pa_dup_cloexec(int fd);
 int pa_accept_cloexec(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 FILE* pa_fopen_cloexec(const char *path, const char *mode);
 
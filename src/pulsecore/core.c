@@ -37,6 +37,7 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-scache.h>
 #include <pulsecore/core-subscribe.h>
+#include <pulsecore/io-thread-pool.h>
 #include <pulsecore/random.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
@@ -63,7 +64,7 @@ static int core_process_msg(pa_msgobject *o, int code, void *userdata, int64_t o
 
 static void core_free(pa_object *o);
 
-pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
+pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size, size_t shm_slot_size, pa_bool_t huge_pages) {
     pa_core* c;
     pa_mempool *pool;
     int j;
@@ -71,14 +72,14 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     pa_assert(m);
 
     if (shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+        if (!(pool = pa_mempool_new_full(shared, shm_size, shm_slot_size, huge_pages))) {
             pa_log_warn("failed to allocate shared memory pool. Falling back to a normal memory pool.");
             shared = FALSE;
         }
     }
 
     if (!shared) {
-        if (!(pool = pa_mempool_new(shared, shm_size))) {
+        if (!(pool = pa_mempool_new_full(shared, shm_size, shm_slot_size, huge_pages))) {
             pa_log("pa_mempool_new() failed.");
             return NULL;
         }
@@ -118,11 +119,19 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
 
     c->module_defer_unload_event = NULL;
     c->scache_auto_unload_event = NULL;
+    c->scache_loader = NULL;
+    c->io_thread_pool = NULL;
 
     c->subscription_defer_event = NULL;
     PA_LLIST_HEAD_INIT(pa_subscription, c->subscriptions);
     PA_LLIST_HEAD_INIT(pa_subscription_event, c->subscription_event_queue);
     c->subscription_event_last = NULL;
+    c->subscription_events_by_object = NULL;
+    c->subscriptions_by_facility = NULL;
+    c->n_subscriptions = 0;
+    c->subscriptions_by_facility_dirty = TRUE;
+    c->n_subscription_events_posted = c->n_subscription_events_dropped = c->n_subscription_events_delivered = 0;
+    c->object_generations = NULL;
 
     c->mempool = pool;
     pa_silence_cache_init(&c->silence_cache);
@@ -141,6 +150,8 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
     c->disable_remixing = FALSE;
     c->disable_lfe_remixing = FALSE;
     c->deferred_volume = TRUE;
+    c->scache_preload = FALSE;
+    c->scache_disk_cache = FALSE;
     c->resample_method = PA_RESAMPLER_SPEEX_FLOAT_BASE + 3;
 
     for (j = 0; j < PA_CORE_HOOK_MAX; j++)
@@ -148,6 +159,10 @@ pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size) {
 
     pa_random(&c->cookie, sizeof(c->cookie));
 
+    /* The cookie tells generations of different server instances
+     * apart */
+    c->generation = (uint64_t) c->cookie << 32;
+
 #ifdef SIGPIPE
     pa_check_signal_is_blocked(SIGPIPE);
 #endif
@@ -171,10 +186,14 @@ static void core_free(pa_object *o) {
 
     pa_assert(pa_idxset_isempty(c->scache));
     pa_idxset_free(c->scache, NULL, NULL);
+    pa_assert(!c->scache_loader);
 
     pa_assert(pa_idxset_isempty(c->modules));
     pa_idxset_free(c->modules, NULL, NULL);
 
+    if (c->io_thread_pool)
+        pa_io_thread_pool_free(c->io_thread_pool);
+
     pa_assert(pa_idxset_isempty(c->clients));
     pa_idxset_free(c->clients, NULL, NULL);
 
@@ -275,6 +294,15 @@ void pa_core_maybe_vacuum(pa_core *c) {
     }
 }
 
+pa_io_thread_pool *pa_core_get_io_thread_pool(pa_core *c) {
+    pa_assert(c);
+
+    if (!c->io_thread_pool)
+        c->io_thread_pool = pa_io_thread_pool_new(c->mainloop, pa_ncpus(), c->realtime_scheduling ? c->realtime_priority : 0);
+
+    return c->io_thread_pool;
+}
+
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata) {
     struct timeval tv;
 
@@ -157,12 +157,25 @@ struct pa_core {
     PA_LLIST_HEAD(pa_subscription, subscriptions);
     PA_LLIST_HEAD(pa_subscription_event, subscription_event_queue);
     pa_subscription_event *subscription_event_last;
+    pa_hashmap *subscription_events_by_object;
+    pa_subscription **subscriptions_by_facility;
+    unsigned n_subscriptions;
+    pa_bool_t subscriptions_by_facility_dirty;
+    uint64_t n_subscription_events_posted, n_subscription_events_dropped, n_subscription_events_delivered;
+
+    /* Bumped on every subscription event, see core-subscribe.c */
+    uint64_t generation;
+    pa_hashmap *object_generations;
 
     pa_mempool *mempool;
     pa_silence_cache silence_cache;
 
     pa_time_event *exit_event;
     pa_time_event *scache_auto_unload_event;
+    struct pa_scache_loader *scache_loader;
+
+    /* Shared IO threads, see io-thread-pool.h */
+    struct pa_io_thread_pool *io_thread_pool;
 
     int exit_idle_time, scache_idle_time;
 
@@ -174,6 +187,8 @@ struct pa_core {
     pa_bool_t disable_remixing:1;
     pa_bool_t disable_lfe_remixing:1;
     pa_bool_t deferred_volume:1;
+    pa_bool_t scache_preload:1;
+    pa_bool_t scache_disk_cache:1;
 
     pa_resample_method_t resample_method;
     int realtime_priority;
@@ -193,7 +208,7 @@ enum {
     PA_CORE_MESSAGE_MAX
 };
 
-pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size);
+pa_core* pa_core_new(pa_mainloop_api *m, pa_bool_t shared, size_t shm_size, size_t shm_slot_size, pa_bool_t huge_pages);
 
 /* Check whether no one is connected to this core */
 void pa_core_check_idle(pa_core *c);
@@ -202,6 +217,10 @@ int pa_core_exit(pa_core *c, pa_bool_t force, int retval);
 
 void pa_core_maybe_vacuum(pa_core *c);
 
+/* Returns the IO thread pool, creating it with one thread per CPU
+ * when first used */
+struct pa_io_thread_pool *pa_core_get_io_thread_pool(pa_core *c);
+
 /* wrapper for c->mainloop->time_*() RT time events */
 pa_time_event* pa_core_rttime_new(pa_core *c, pa_usec_t usec, pa_time_event_cb_t cb, void *userdata);
 void pa_core_rttime_restart(pa_core *c, pa_time_event *e, pa_usec_t usec);
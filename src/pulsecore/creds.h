@@ -29,8 +29,13 @@
 #endif
 
 #include <pulsecore/socket.h>
+#include <pulsecore/macro.h>
+
+/* Maximum number of file descriptors passed along with a single packet */
+#define PA_CMSG_FDS_MAX 4
 
 typedef struct pa_creds pa_creds;
+typedef struct pa_cmsg_ancil_data pa_cmsg_ancil_data;
 
 #if defined(SCM_CREDENTIALS)
 
@@ -41,6 +46,15 @@ struct pa_creds {
     uid_t uid;
 };
 
+/* Ancillary data sent and received along with packets on a unix
+ * socket. File descriptors are passed with SCM_RIGHTS. */
+struct pa_cmsg_ancil_data {
+    pa_creds creds;
+    pa_bool_t creds_valid;
+    int nfd;
+    int fds[PA_CMSG_FDS_MAX];
+};
+
 #else
 #undef HAVE_CREDS
 #endif
@@ -0,0 +1,677 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/llist.h>
+
+#include "database.h"
+
+/* Like the simple backend this keeps all entries in memory, but
+ * instead of writing the whole file on every sync, only the changes
+ * since the last sync are appended to it, as a log of records:
+ *
+ *   file   := magic record*
+ *   record := op key_size data_size checksum key data
+ *
+ * All numbers are 32 bit little endian values, the checksum is the
+ * CRC-32 of the record without the checksum itself. When the file is
+ * loaded the records are replayed, stopping at the first one that is
+ * incomplete or damaged, e.g. because we crashed while writing it.
+ * Once the log has grown much larger than the entries it describes,
+ * it is compacted by writing a fresh copy and renaming it into place,
+ * like the simple backend does every time. */
+
+#define JOURNAL_MAGIC "PAJOURN1"
+#define JOURNAL_MAGIC_SIZE 8
+#define RECORD_HEADER_SIZE 16
+
+/* Compact when more than half of the file is obsolete, but don't
+ * bother with small files */
+#define COMPACT_MIN_SIZE (64*1024)
+
+enum {
+    OP_SET = 1,
+    OP_UNSET = 2,
+    OP_CLEAR = 3
+};
+
+typedef struct record_buffer {
+    uint8_t *data;
+    size_t length, allocated;
+} record_buffer;
+
+typedef struct entry {
+    pa_datum key;
+    pa_datum data;
+
+    PA_LLIST_FIELDS(struct entry);
+} entry;
+
+typedef struct journal_data {
+    char *filename;
+    char *tmp_filename;
+    int fd;
+    pa_bool_t read_only;
+
+    /* The entries, indexed by key and in insertion order */
+    pa_hashmap *map;
+    PA_LLIST_HEAD(entry, entries);
+    entry *entries_last;
+
+    /* Records that haven't been written yet */
+    record_buffer pending;
+
+    /* The size of the file and of the records in it that still
+     * describe the current entries */
+    size_t file_size;
+    size_t live_size;
+} journal_data;
+
+void pa_datum_free(pa_datum *d) {
+    pa_assert(d);
+
+    pa_xfree(d->data);
+    d->data = NULL;
+    d->size = 0;
+}
+
+static int compare_func(const void *a, const void *b) {
+    const pa_datum *aa, *bb;
+
+    aa = (const pa_datum*)a;
+    bb = (const pa_datum*)b;
+
+    if (aa->size != bb->size)
+        return aa->size > bb->size ? 1 : -1;
+
+    return memcmp(aa->data, bb->data, aa->size);
+}
+
+/* pa_idxset_string_hash_func modified for our use */
+static unsigned hash_func(const void *p) {
+    const pa_datum *d;
+    unsigned hash = 0;
+    const char *c;
+    unsigned i;
+
+    d = (const pa_datum*)p;
+    c = d->data;
+
+    for (i = 0; i < d->size; i++) {
+        hash = 31 * hash + (unsigned) *c;
+        c++;
+    }
+
+    return hash;
+}
+
+static uint32_t crc32_update(uint32_t crc, const void *p, size_t length) {
+    const uint8_t *d = p;
+
+    crc = ~crc;
+
+    while (length-- > 0) {
+        unsigned k;
+
+        crc ^= *(d++);
+
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320U & (0U - (crc & 1)));
+    }
+
+    return ~crc;
+}
+
+static void write_uint(uint8_t *p, uint32_t num) {
+    p[0] = (uint8_t) num;
+    p[1] = (uint8_t) (num >> 8);
+    p[2] = (uint8_t) (num >> 16);
+    p[3] = (uint8_t) (num >> 24);
+}
+
+static uint32_t read_uint(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static size_t record_size(const pa_datum *key, const pa_datum *data) {
+    return RECORD_HEADER_SIZE + (key ? key->size : 0) + (data ? data->size : 0);
+}
+
+static uint32_t record_checksum(const uint8_t *header, const void *key, size_t key_size, const void *data, size_t data_size) {
+    uint32_t crc;
+
+    crc = crc32_update(0, header, 12);
+    crc = crc32_update(crc, key, key_size);
+    return crc32_update(crc, data, data_size);
+}
+
+static void append_record(record_buffer *b, uint32_t op, const pa_datum *key, const pa_datum *data) {
+    size_t l;
+    uint8_t *p;
+
+    pa_assert(b);
+
+    l = record_size(key, data);
+
+    if (b->length + l > b->allocated) {
+        b->allocated = PA_MAX(2 * b->allocated, b->length + l);
+        b->data = pa_xrealloc(b->data, b->allocated);
+    }
+
+    p = b->data + b->length;
+
+    write_uint(p, op);
+    write_uint(p + 4, key ? (uint32_t) key->size : 0);
+    write_uint(p + 8, data ? (uint32_t) data->size : 0);
+
+    if (key && key->size > 0)
+        memcpy(p + RECORD_HEADER_SIZE, key->data, key->size);
+    if (data && data->size > 0)
+        memcpy(p + RECORD_HEADER_SIZE + (key ? key->size : 0), data->data, data->size);
+
+    write_uint(p + 12, record_checksum(p,
+                                       p + RECORD_HEADER_SIZE, key ? key->size : 0,
+                                       p + RECORD_HEADER_SIZE + (key ? key->size : 0), data ? data->size : 0));
+
+    b->length += l;
+}
+
+static void datum_copy(pa_datum *dst, const pa_datum *src) {
+    dst->data = src->size > 0 ? pa_xmemdup(src->data, src->size) : NULL;
+    dst->size = src->size;
+}
+
+static void free_entry(entry *e) {
+    if (e) {
+        pa_xfree(e->key.data);
+        pa_xfree(e->data.data);
+        pa_xfree(e);
+    }
+}
+
+static void remove_entry(journal_data *db, entry *e) {
+    pa_assert(db);
+    pa_assert(e);
+
+    pa_assert_se(pa_hashmap_remove(db->map, &e->key) == e);
+
+    if (db->entries_last == e)
+        db->entries_last = e->prev;
+
+    PA_LLIST_REMOVE(entry, db->entries, e);
+
+    db->live_size -= record_size(&e->key, &e->data);
+    free_entry(e);
+}
+
+static void remove_all_entries(journal_data *db) {
+    pa_assert(db);
+
+    while (db->entries)
+        remove_entry(db, db->entries);
+
+    pa_assert(db->live_size == 0);
+}
+
+/* Returns -1 if the entry exists and overwrite is FALSE */
+static int set_entry(journal_data *db, const pa_datum *key, const pa_datum *data, pa_bool_t overwrite) {
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if ((e = pa_hashmap_get(db->map, key))) {
+        if (!overwrite)
+            return -1;
+
+        db->live_size -= record_size(&e->key, &e->data);
+        pa_xfree(e->data.data);
+    } else {
+        e = pa_xnew0(entry, 1);
+        datum_copy(&e->key, key);
+
+        pa_hashmap_put(db->map, &e->key, e);
+        PA_LLIST_INSERT_AFTER(entry, db->entries, db->entries_last, e);
+        db->entries_last = e;
+    }
+
+    datum_copy(&e->data, data);
+    db->live_size += record_size(&e->key, &e->data);
+
+    return 0;
+}
+
+/* Applies the records in buf to the entries and returns how many
+ * bytes of it were valid */
+static size_t replay(journal_data *db, const uint8_t *buf, size_t length) {
+    size_t offset;
+
+    pa_assert(db);
+
+    if (length < JOURNAL_MAGIC_SIZE || memcmp(buf, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0)
+        return 0;
+
+    offset = JOURNAL_MAGIC_SIZE;
+
+    while (length - offset >= RECORD_HEADER_SIZE) {
+        const uint8_t *p = buf + offset;
+        uint32_t op, key_size, data_size;
+        pa_datum key, data;
+
+        op = read_uint(p);
+        key_size = read_uint(p + 4);
+        data_size = read_uint(p + 8);
+
+        if (key_size > length - offset - RECORD_HEADER_SIZE ||
+            data_size > length - offset - RECORD_HEADER_SIZE - key_size)
+            break;
+
+        key.data = (void*) (p + RECORD_HEADER_SIZE);
+        key.size = key_size;
+        data.data = (void*) (p + RECORD_HEADER_SIZE + key_size);
+        data.size = data_size;
+
+        if (read_uint(p + 12) != record_checksum(p, key.data, key.size, data.data, data.size))
+            break;
+
+        if (op == OP_SET)
+            set_entry(db, &key, &data, TRUE);
+        else if (op == OP_UNSET) {
+            entry *e;
+
+            if ((e = pa_hashmap_get(db->map, &key)))
+                remove_entry(db, e);
+        } else if (op == OP_CLEAR)
+            remove_all_entries(db);
+        else
+            break;
+
+        offset += record_size(&key, &data);
+    }
+
+    return offset;
+}
+
+static int load(journal_data *db, int fd) {
+    struct stat st;
+    uint8_t *buf;
+    size_t valid;
+
+    pa_assert(db);
+    pa_assert(fd >= 0);
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+
+    if (st.st_size == 0)
+        return 0;
+
+    buf = pa_xmalloc((size_t) st.st_size);
+
+    if (pa_loop_read(fd, buf, (size_t) st.st_size, NULL) != (ssize_t) st.st_size) {
+        pa_log_warn("read error. %s", pa_cstrerror(errno));
+        pa_xfree(buf);
+        return -1;
+    }
+
+    valid = replay(db, buf, (size_t) st.st_size);
+    pa_xfree(buf);
+
+    if (valid < (size_t) st.st_size)
+        pa_log_warn("Ignoring %lu bytes of damaged or incomplete data at the end of %s.",
+                    (unsigned long) ((size_t) st.st_size - valid), db->filename);
+
+    db->file_size = valid;
+    return 0;
+}
+
+/* Opens the file for appending, and drops anything that we couldn't
+ * make sense of, so that new records directly follow the valid ones */
+static int open_for_append(journal_data *db) {
+    pa_assert(db);
+    pa_assert(db->fd < 0);
+
+    if ((db->fd = pa_open_cloexec(db->filename, O_WRONLY|O_CREAT|O_APPEND, 0600)) < 0) {
+        pa_log_warn("Failed to open %s: %s", db->filename, pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(db->fd, (off_t) db->file_size) < 0) {
+        pa_log_warn("Failed to truncate %s: %s", db->filename, pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (db->file_size == 0) {
+        if (pa_loop_write(db->fd, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE, NULL) != JOURNAL_MAGIC_SIZE) {
+            pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
+            goto fail;
+        }
+
+        db->file_size = JOURNAL_MAGIC_SIZE;
+    }
+
+    return 0;
+
+fail:
+    pa_close(db->fd);
+    db->fd = -1;
+    return -1;
+}
+
+pa_database* pa_database_open(const char *fn, pa_bool_t for_write) {
+    int fd;
+    char *path;
+    journal_data *db;
+
+    pa_assert(fn);
+
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".journal", fn);
+    errno = 0;
+
+    fd = pa_open_cloexec(path, O_RDONLY, 0);
+
+    if (fd >= 0 || errno == ENOENT) { /* file not found is ok */
+        db = pa_xnew0(journal_data, 1);
+        db->map = pa_hashmap_new(hash_func, compare_func);
+        PA_LLIST_HEAD_INIT(entry, db->entries);
+        db->filename = pa_xstrdup(path);
+        db->tmp_filename = pa_sprintf_malloc("%s.tmp", db->filename);
+        db->read_only = !for_write;
+        db->fd = -1;
+
+        if (fd >= 0) {
+            int r = load(db, fd);
+
+            pa_close(fd);
+
+            /* Better fail than overwriting what we couldn't read */
+            if (r < 0) {
+                remove_all_entries(db);
+                pa_hashmap_free(db->map, NULL, NULL);
+                pa_xfree(db->filename);
+                pa_xfree(db->tmp_filename);
+                pa_xfree(db);
+                pa_xfree(path);
+
+                if (errno == 0)
+                    errno = EIO;
+                return NULL;
+            }
+        }
+
+        /* If we fail here we'll try again on the next sync */
+        if (for_write)
+            open_for_append(db);
+
+    } else {
+        if (errno == 0)
+            errno = EIO;
+        db = NULL;
+    }
+
+    pa_xfree(path);
+
+    return (pa_database*) db;
+}
+
+void pa_database_close(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+    pa_assert(db);
+
+    pa_database_sync(database);
+
+    remove_all_entries(db);
+
+    if (db->fd >= 0)
+        pa_close(db->fd);
+
+    pa_xfree(db->pending.data);
+    pa_xfree(db->filename);
+    pa_xfree(db->tmp_filename);
+    pa_hashmap_free(db->map, NULL, NULL);
+    pa_xfree(db);
+}
+
+pa_datum* pa_database_get(pa_database *database, const pa_datum *key, pa_datum* data) {
+    journal_data *db = (journal_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (!(e = pa_hashmap_get(db->map, key)))
+        return NULL;
+
+    datum_copy(data, &e->data);
+
+    return data;
+}
+
+int pa_database_set(pa_database *database, const pa_datum *key, const pa_datum* data, pa_bool_t overwrite) {
+    journal_data *db = (journal_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+    pa_assert(data);
+
+    if (db->read_only)
+        return -1;
+
+    if (set_entry(db, key, data, overwrite) < 0)
+        return -1;
+
+    append_record(&db->pending, OP_SET, key, data);
+
+    return 0;
+}
+
+int pa_database_unset(pa_database *database, const pa_datum *key) {
+    journal_data *db = (journal_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    if (!(e = pa_hashmap_get(db->map, key)))
+        return -1;
+
+    remove_entry(db, e);
+
+    if (!db->read_only)
+        append_record(&db->pending, OP_UNSET, key, NULL);
+
+    return 0;
+}
+
+int pa_database_clear(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+
+    pa_assert(db);
+
+    remove_all_entries(db);
+
+    if (!db->read_only) {
+        /* Nothing written so far matters anymore */
+        db->pending.length = 0;
+        append_record(&db->pending, OP_CLEAR, NULL, NULL);
+    }
+
+    return 0;
+}
+
+signed pa_database_size(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+    pa_assert(db);
+
+    return (signed) pa_hashmap_size(db->map);
+}
+
+static pa_datum* copy_entry(entry *e, pa_datum *key, pa_datum *data) {
+    if (!e)
+        return NULL;
+
+    datum_copy(key, &e->key);
+
+    if (data)
+        datum_copy(data, &e->data);
+
+    return key;
+}
+
+pa_datum* pa_database_first(pa_database *database, pa_datum *key, pa_datum *data) {
+    journal_data *db = (journal_data*)database;
+
+    pa_assert(db);
+    pa_assert(key);
+
+    return copy_entry(db->entries, key, data);
+}
+
+pa_datum* pa_database_next(pa_database *database, const pa_datum *key, pa_datum *next, pa_datum *data) {
+    journal_data *db = (journal_data*)database;
+    entry *e;
+
+    pa_assert(db);
+    pa_assert(next);
+
+    if (!key)
+        return pa_database_first(database, next, data);
+
+    if (!(e = pa_hashmap_get(db->map, key)))
+        return NULL;
+
+    return copy_entry(e->next, next, data);
+}
+
+/* Replaces the file by one that contains only the current entries */
+static int compact(journal_data *db) {
+    record_buffer b;
+    int fd;
+    entry *e;
+
+    pa_assert(db);
+
+    pa_zero(b);
+
+    for (e = db->entries; e; e = e->next)
+        append_record(&b, OP_SET, &e->key, &e->data);
+
+    if ((fd = pa_open_cloexec(db->tmp_filename, O_WRONLY|O_CREAT|O_TRUNC|O_APPEND, 0600)) < 0) {
+        pa_log_warn("Failed to open %s: %s", db->tmp_filename, pa_cstrerror(errno));
+        pa_xfree(b.data);
+        return -1;
+    }
+
+    if (pa_loop_write(fd, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE, NULL) != JOURNAL_MAGIC_SIZE ||
+        (b.length > 0 && pa_loop_write(fd, b.data, b.length, NULL) != (ssize_t) b.length)) {
+        pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    /* Make sure the data hits the disk before the rename does, so that
+     * we don't end up with an empty file after a crash */
+    if (fsync(fd) < 0) {
+        pa_log_warn("error while syncing file. %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (rename(db->tmp_filename, db->filename) < 0) {
+        pa_log_warn("error while renaming file. %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if (db->fd >= 0)
+        pa_close(db->fd);
+
+    db->fd = fd;
+    db->file_size = JOURNAL_MAGIC_SIZE + b.length;
+    db->pending.length = 0;
+    pa_xfree(b.data);
+
+    pa_log_debug("Compacted %s to %lu bytes.", db->filename, (unsigned long) db->file_size);
+
+    return 0;
+
+fail:
+    pa_close(fd);
+    unlink(db->tmp_filename);
+    pa_xfree(b.data);
+    return -1;
+}
+
+int pa_database_sync(pa_database *database) {
+    journal_data *db = (journal_data*)database;
+    ssize_t r;
+
+    pa_assert(db);
+
+    if (db->read_only)
+        return 0;
+
+    /* If this fails we just keep appending */
+    if (db->file_size + db->pending.length > COMPACT_MIN_SIZE &&
+        db->file_size + db->pending.length > 2 * (JOURNAL_MAGIC_SIZE + db->live_size) &&
+        compact(db) >= 0)
+        return 0;
+
+    if (db->pending.length == 0)
+        return 0;
+
+    if (db->fd < 0 && open_for_append(db) < 0)
+        return -1;
+
+    if ((r = pa_loop_write(db->fd, db->pending.data, db->pending.length, NULL)) != (ssize_t) db->pending.length) {
+        pa_log_warn("error while writing to file. %s", pa_cstrerror(errno));
+
+        /* Don't leave a partial record behind, the records we append
+         * later would be ignored when loading otherwise. pa_loop_write()
+         * returns -1 even if it got some of the data out, so we can't
+         * tell how much was written. */
+        if (ftruncate(db->fd, (off_t) db->file_size) < 0) {
+            pa_log_warn("Failed to truncate %s: %s", db->filename, pa_cstrerror(errno));
+            pa_close(db->fd);
+            db->fd = -1;
+        }
+
+        return -1;
+    }
+
+    db->file_size += db->pending.length;
+    db->pending.length = 0;
+
+    return 0;
+}
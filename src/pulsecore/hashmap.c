@@ -27,87 +27,185 @@
 
 #include <pulse/xmalloc.h>
 #include <pulsecore/idxset.h>
-#include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
 
 #include "hashmap.h"
 
-#define NBUCKETS 127
+/* The entries are stored in an array in insertion order, so iterating
+ * is a linear walk and no per-entry allocation is needed. Removing an
+ * entry only marks it as dead, the array is compacted when it runs
+ * full and at least half of it is dead. Every entry gets a serial
+ * number that grows with the insertion order, so that an iteration
+ * finds its place again after the array has been compacted. Keys are
+ * looked up through an open addressing table with linear probing that
+ * stores the hash of each entry next to its position in the array, so
+ * that a lookup usually touches only one cache line before calling
+ * compare_func(). */
+
+#define MIN_ENTRIES 4U
+#define MIN_SLOTS 8U
 
 struct hashmap_entry {
     const void *key;
     void *value;
+    unsigned hash;
+    unsigned serial;
+    pa_bool_t dead;
+};
 
-    struct hashmap_entry *bucket_next, *bucket_previous;
-    struct hashmap_entry *iterate_next, *iterate_previous;
+struct hashmap_slot {
+    unsigned hash;
+    unsigned entry; /* position in the entries array + 1, 0 if unused */
 };
 
 struct pa_hashmap {
     pa_hash_func_t hash_func;
     pa_compare_func_t compare_func;
 
-    struct hashmap_entry *iterate_list_head, *iterate_list_tail;
+    struct hashmap_entry *entries;
+    unsigned n_allocated;
+
+    /* entries[first] and entries[n_used-1] are alive if there are any
+     * entries at all */
+    unsigned first, n_used;
+
+    struct hashmap_slot *slots;
+    unsigned n_slots, slot_shift;
+
     unsigned n_entries;
-};
 
-#define BY_HASH(h) ((struct hashmap_entry**) ((uint8_t*) (h) + PA_ALIGN(sizeof(pa_hashmap))))
+    unsigned next_serial;
 
-PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
+    /* Where the last entry returned by an iteration is, usually */
+    unsigned iterate_hint;
+};
 
 pa_hashmap *pa_hashmap_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_hashmap *h;
 
-    h = pa_xmalloc0(PA_ALIGN(sizeof(pa_hashmap)) + NBUCKETS*sizeof(struct hashmap_entry*));
+    h = pa_xnew0(pa_hashmap, 1);
 
     h->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     h->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
-    h->n_entries = 0;
-    h->iterate_list_head = h->iterate_list_tail = NULL;
-
     return h;
 }
 
-static void remove_entry(pa_hashmap *h, struct hashmap_entry *e) {
-    pa_assert(h);
-    pa_assert(e);
-
-    /* Remove from iteration list */
-    if (e->iterate_next)
-        e->iterate_next->iterate_previous = e->iterate_previous;
-    else
-        h->iterate_list_tail = e->iterate_previous;
-
-    if (e->iterate_previous)
-        e->iterate_previous->iterate_next = e->iterate_next;
-    else
-        h->iterate_list_head = e->iterate_next;
-
-    /* Remove from hash table bucket list */
-    if (e->bucket_next)
-        e->bucket_next->bucket_previous = e->bucket_previous;
-
-    if (e->bucket_previous)
-        e->bucket_previous->bucket_next = e->bucket_next;
-    else {
-        unsigned hash = h->hash_func(e->key) % NBUCKETS;
-        BY_HASH(h)[hash] = e->bucket_next;
+/* Multiplicative hashing, the upper bits are mixed well even if the hash
+ * function isn't, e.g. for aligned pointers */
+static unsigned home_slot(pa_hashmap *h, unsigned hash) {
+    return (unsigned) (((uint32_t) hash * 2654435769U) >> h->slot_shift);
+}
+
+static void insert_slot(pa_hashmap *h, unsigned hash, unsigned entry) {
+    unsigned i;
+
+    for (i = home_slot(h, hash); h->slots[i].entry; i = (i + 1) & (h->n_slots - 1))
+        ;
+
+    h->slots[i].hash = hash;
+    h->slots[i].entry = entry + 1;
+}
+
+static void rebuild_slots(pa_hashmap *h, unsigned n_slots) {
+    unsigned i;
+
+    pa_assert(n_slots > h->n_entries);
+
+    pa_xfree(h->slots);
+    h->slots = pa_xnew0(struct hashmap_slot, n_slots);
+    h->n_slots = n_slots;
+
+    for (h->slot_shift = 32; n_slots > 1; n_slots >>= 1)
+        h->slot_shift--;
+
+    for (i = h->first; i < h->n_used; i++)
+        if (!h->entries[i].dead)
+            insert_slot(h, h->entries[i].hash, i);
+}
+
+/* Backward shift deletion, so that no tombstones are needed */
+static void remove_slot(pa_hashmap *h, unsigned i) {
+    unsigned j, k, mask = h->n_slots - 1;
+
+    for (j = (i + 1) & mask; h->slots[j].entry; j = (j + 1) & mask) {
+        k = home_slot(h, h->slots[j].hash);
+
+        /* Move the entry at j into the gap unless its home slot lies
+         * cyclically in (i, j] */
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+
+        h->slots[i] = h->slots[j];
+        i = j;
     }
 
-    if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
-        pa_xfree(e);
+    h->slots[i].entry = 0;
+}
+
+static struct hashmap_slot *find_slot(pa_hashmap *h, unsigned hash, const void *key) {
+    unsigned i;
+
+    if (!h->n_slots)
+        return NULL;
+
+    for (i = home_slot(h, hash); h->slots[i].entry; i = (i + 1) & (h->n_slots - 1)) {
+        struct hashmap_slot *slot = h->slots + i;
+
+        if (slot->hash == hash && h->compare_func(h->entries[slot->entry - 1].key, key) == 0)
+            return slot;
+    }
+
+    return NULL;
+}
+
+static void remove_entry(pa_hashmap *h, unsigned entry) {
+    struct hashmap_entry *e;
+    unsigned i;
+
+    pa_assert(h);
+    pa_assert(entry < h->n_used);
+
+    e = h->entries + entry;
+    pa_assert(!e->dead);
+
+    for (i = home_slot(h, e->hash); h->slots[i].entry != entry + 1; i = (i + 1) & (h->n_slots - 1))
+        pa_assert(h->slots[i].entry);
+
+    remove_slot(h, i);
+    e->dead = TRUE;
 
     pa_assert(h->n_entries >= 1);
     h->n_entries--;
+
+    if (h->n_entries == 0) {
+        /* Nothing is moved here, so this is safe while iterating */
+        pa_xfree(h->entries);
+        pa_xfree(h->slots);
+        h->entries = NULL;
+        h->slots = NULL;
+        h->n_allocated = h->n_used = h->first = 0;
+        h->n_slots = 0;
+        return;
+    }
+
+    while (h->entries[h->first].dead)
+        h->first++;
+
+    while (h->entries[h->n_used - 1].dead)
+        h->n_used--;
+
+    if (h->n_slots > MIN_SLOTS && h->n_entries * 8 < h->n_slots)
+        rebuild_slots(h, h->n_slots / 2);
 }
 
 void pa_hashmap_free(pa_hashmap*h, pa_free2_cb_t free_cb, void *userdata) {
     pa_assert(h);
 
-    while (h->iterate_list_head) {
+    while (h->n_entries > 0) {
         void *data;
-        data = h->iterate_list_head->value;
-        remove_entry(h, h->iterate_list_head);
+        data = h->entries[h->first].value;
+        remove_entry(h, h->first);
 
         if (free_cb)
             free_cb(data, userdata);
@@ -116,16 +214,39 @@ void pa_hashmap_free(pa_hashmap*h, pa_free2_cb_t free_cb, void *userdata) {
     pa_xfree(h);
 }
 
-static struct hashmap_entry *hash_scan(pa_hashmap *h, unsigned hash, const void *key) {
-    struct hashmap_entry *e;
-    pa_assert(h);
-    pa_assert(hash < NBUCKETS);
+/* Makes room for one more entry at the end of the array. Compacting
+ * moves the entries, iterations find their place again by the serial
+ * numbers. */
+static void make_room(pa_hashmap *h) {
+    unsigned i, j, n_allocated;
 
-    for (e = BY_HASH(h)[hash]; e; e = e->bucket_next)
-        if (h->compare_func(e->key, key) == 0)
-            return e;
+    if (h->n_used < h->n_allocated)
+        return;
 
-    return NULL;
+    if (h->n_allocated == 0 || h->n_entries > h->n_allocated / 2) {
+        n_allocated = PA_MAX(h->n_allocated * 2, MIN_ENTRIES);
+        h->entries = pa_xrealloc(h->entries, n_allocated * sizeof(struct hashmap_entry));
+        h->n_allocated = n_allocated;
+        return;
+    }
+
+    for (i = h->first, j = 0; i < h->n_used; i++)
+        if (!h->entries[i].dead)
+            h->entries[j++] = h->entries[i];
+
+    pa_assert(j == h->n_entries);
+    h->first = 0;
+    h->n_used = j;
+
+    for (n_allocated = h->n_allocated; n_allocated > MIN_ENTRIES && h->n_entries * 4 <= n_allocated; n_allocated /= 2)
+        ;
+
+    if (n_allocated != h->n_allocated) {
+        h->entries = pa_xrealloc(h->entries, n_allocated * sizeof(struct hashmap_entry));
+        h->n_allocated = n_allocated;
+    }
+
+    rebuild_slots(h, h->n_slots);
 }
 
 int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
@@ -134,35 +255,31 @@ int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
+    hash = h->hash_func(key);
 
-    if (hash_scan(h, hash, key))
+    if (find_slot(h, hash, key))
         return -1;
 
-    if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
-        e = pa_xnew(struct hashmap_entry, 1);
+    make_room(h);
+
+    /* Keep the load factor of the lookup table at 1/2 at most */
+    if ((h->n_entries + 1) * 2 > h->n_slots)
+        rebuild_slots(h, PA_MAX(h->n_slots * 2, MIN_SLOTS));
 
+    e = h->entries + h->n_used;
     e->key = key;
     e->value = value;
+    e->hash = hash;
+    e->dead = FALSE;
 
-    /* Insert into hash table */
-    e->bucket_next = BY_HASH(h)[hash];
-    e->bucket_previous = NULL;
-    if (BY_HASH(h)[hash])
-        BY_HASH(h)[hash]->bucket_previous = e;
-    BY_HASH(h)[hash] = e;
-
-    /* Insert into iteration list */
-    e->iterate_previous = h->iterate_list_tail;
-    e->iterate_next = NULL;
-    if (h->iterate_list_tail) {
-        pa_assert(h->iterate_list_head);
-        h->iterate_list_tail->iterate_next = e;
-    } else {
-        pa_assert(!h->iterate_list_head);
-        h->iterate_list_head = e;
-    }
-    h->iterate_list_tail = e;
+    /* These two would be taken for the initial and the final
+     * iteration state */
+    do
+        e->serial = h->next_serial++;
+    while (e->serial == 0 || e->serial == (unsigned) -1);
+
+    insert_slot(h, hash, h->n_used);
+    h->n_used++;
 
     h->n_entries++;
     pa_assert(h->n_entries >= 1);
@@ -171,39 +288,63 @@ int pa_hashmap_put(pa_hashmap *h, const void *key, void *value) {
 }
 
 void* pa_hashmap_get(pa_hashmap *h, const void *key) {
-    unsigned hash;
-    struct hashmap_entry *e;
+    struct hashmap_slot *slot;
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
-
-    if (!(e = hash_scan(h, hash, key)))
+    if (!(slot = find_slot(h, h->hash_func(key), key)))
         return NULL;
 
-    return e->value;
+    return h->entries[slot->entry - 1].value;
 }
 
 void* pa_hashmap_remove(pa_hashmap *h, const void *key) {
-    struct hashmap_entry *e;
-    unsigned hash;
+    struct hashmap_slot *slot;
     void *data;
 
     pa_assert(h);
 
-    hash = h->hash_func(key) % NBUCKETS;
-
-    if (!(e = hash_scan(h, hash, key)))
+    if (!(slot = find_slot(h, h->hash_func(key), key)))
         return NULL;
 
-    data = e->value;
-    remove_entry(h, e);
+    data = h->entries[slot->entry - 1].value;
+    remove_entry(h, slot->entry - 1);
 
     return data;
 }
 
+/* The iteration state is the serial number of the entry returned
+ * last, (void*) -1 at the end. Hence the current entry may be removed
+ * and new entries may be added while iterating. Serial numbers are
+ * compared by their distance, so that they may wrap around. */
+static int serial_cmp(unsigned a, unsigned b) {
+    return (int) (a - b);
+}
+
+/* Returns the position of the first entry, dead or alive, whose serial
+ * number is larger than serial */
+static unsigned find_after(pa_hashmap *h, unsigned serial) {
+    unsigned i, j;
+
+    /* Usually we continue right where we left off */
+    if (h->iterate_hint < h->n_used && h->entries[h->iterate_hint].serial == serial)
+        return h->iterate_hint + 1;
+
+    for (i = 0, j = h->n_used; i < j;) {
+        unsigned k = i + (j - i) / 2;
+
+        if (serial_cmp(h->entries[k].serial, serial) > 0)
+            j = k;
+        else
+            i = k + 1;
+    }
+
+    return i;
+}
+
 void *pa_hashmap_iterate(pa_hashmap *h, void **state, const void **key) {
     struct hashmap_entry *e;
+    unsigned i;
 
     pa_assert(h);
     pa_assert(state);
@@ -211,15 +352,16 @@ void *pa_hashmap_iterate(pa_hashmap *h, void **state, const void **key) {
     if (*state == (void*) -1)
         goto at_end;
 
-    if (!*state && !h->iterate_list_head)
-        goto at_end;
+    for (i = *state ? find_after(h, PA_PTR_TO_UINT(*state)) : h->first; i < h->n_used; i++)
+        if (!h->entries[i].dead)
+            break;
 
-    e = *state ? *state : h->iterate_list_head;
+    if (i >= h->n_used)
+        goto at_end;
 
-    if (e->iterate_next)
-        *state = e->iterate_next;
-    else
-        *state = (void*) -1;
+    e = h->entries + i;
+    *state = PA_UINT_TO_PTR(e->serial);
+    h->iterate_hint = i;
 
     if (key)
         *key = e->key;
@@ -237,22 +379,40 @@ at_end:
 
 void *pa_hashmap_iterate_backwards(pa_hashmap *h, void **state, const void **key) {
     struct hashmap_entry *e;
+    unsigned i;
 
     pa_assert(h);
     pa_assert(state);
 
-    if (*state == (void*) -1)
+    if (*state == (void*) -1 || h->n_entries == 0)
         goto at_beginning;
 
-    if (!*state && !h->iterate_list_tail)
-        goto at_beginning;
+    if (*state) {
+        unsigned serial = PA_PTR_TO_UINT(*state);
 
-    e = *state ? *state : h->iterate_list_tail;
+        /* Find the last entry with a smaller serial number */
+        if (h->iterate_hint < h->n_used && h->entries[h->iterate_hint].serial == serial)
+            i = h->iterate_hint;
+        else
+            for (i = find_after(h, serial); i > 0 && h->entries[i - 1].serial == serial; i--)
+                ;
+
+        if (i == 0)
+            goto at_beginning;
+
+        i--;
+    } else
+        i = h->n_used - 1;
+
+    while (i > h->first && h->entries[i].dead)
+        i--;
+
+    if (i < h->first || h->entries[i].dead)
+        goto at_beginning;
 
-    if (e->iterate_previous)
-        *state = e->iterate_previous;
-    else
-        *state = (void*) -1;
+    e = h->entries + i;
+    *state = PA_UINT_TO_PTR(e->serial);
+    h->iterate_hint = i;
 
     if (key)
         *key = e->key;
@@ -271,19 +431,19 @@ at_beginning:
 void* pa_hashmap_first(pa_hashmap *h) {
     pa_assert(h);
 
-    if (!h->iterate_list_head)
+    if (h->n_entries == 0)
         return NULL;
 
-    return h->iterate_list_head->value;
+    return h->entries[h->first].value;
 }
 
 void* pa_hashmap_last(pa_hashmap *h) {
     pa_assert(h);
 
-    if (!h->iterate_list_tail)
+    if (h->n_entries == 0)
         return NULL;
 
-    return h->iterate_list_tail->value;
+    return h->entries[h->n_used - 1].value;
 }
 
 void* pa_hashmap_steal_first(pa_hashmap *h) {
@@ -291,11 +451,11 @@ void* pa_hashmap_steal_first(pa_hashmap *h) {
 
     pa_assert(h);
 
-    if (!h->iterate_list_head)
+    if (h->n_entries == 0)
         return NULL;
 
-    data = h->iterate_list_head->value;
-    remove_entry(h, h->iterate_list_head);
+    data = h->entries[h->first].value;
+    remove_entry(h, h->first);
 
     return data;
 }
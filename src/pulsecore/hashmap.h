@@ -53,11 +53,12 @@ unsigned pa_hashmap_size(pa_hashmap *h);
 pa_bool_t pa_hashmap_isempty(pa_hashmap *h);
 
 /* May be used to iterate through the hashmap. Initially the opaque
-   pointer *state has to be set to NULL. The hashmap may not be
-   modified during iteration -- except for deleting the current entry
-   via pa_hashmap_remove(). The key of the entry is returned in *key,
-   if key is non-NULL. After the last entry in the hashmap NULL is
-   returned. */
+   pointer *state has to be set to NULL. During iteration the current
+   entry may be deleted via pa_hashmap_remove() and new entries may be
+   added with pa_hashmap_put(). Added entries are returned later by
+   the same iteration (but not when iterating backwards). Other entries
+   may not be removed. The key of the entry is returned in *key, if key
+   is non-NULL. After the last entry in the hashmap NULL is returned. */
 void *pa_hashmap_iterate(pa_hashmap *h, void **state, const void**key);
 
 /* Same as pa_hashmap_iterate() but goes backwards */
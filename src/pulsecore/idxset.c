@@ -29,20 +29,30 @@
 #include <string.h>
 
 #include <pulse/xmalloc.h>
-#include <pulsecore/flist.h>
 #include <pulsecore/macro.h>
 
 #include "idxset.h"
 
-#define NBUCKETS 127
+/* Same layout as pa_hashmap: the entries are stored in an array in
+ * insertion order, dead entries are only dropped when the array is
+ * compacted, and the data pointers are looked up through an open
+ * addressing table. Since the indexes are handed out in insertion
+ * order the array is sorted by index as well, so lookups by index are
+ * a binary search. */
+
+#define MIN_ENTRIES 4U
+#define MIN_SLOTS 8U
 
 struct idxset_entry {
-    uint32_t idx;
     void *data;
+    uint32_t idx;
+    unsigned hash;
+    pa_bool_t dead;
+};
 
-    struct idxset_entry *data_next, *data_previous;
-    struct idxset_entry *index_next, *index_previous;
-    struct idxset_entry *iterate_next, *iterate_previous;
+struct idxset_slot {
+    unsigned hash;
+    unsigned entry; /* position in the entries array + 1, 0 if unused */
 };
 
 struct pa_idxset {
@@ -51,14 +61,18 @@ struct pa_idxset {
 
     uint32_t current_index;
 
-    struct idxset_entry *iterate_list_head, *iterate_list_tail;
-    unsigned n_entries;
-};
+    struct idxset_entry *entries;
+    unsigned n_allocated;
+
+    /* entries[first] and entries[n_used-1] are alive if there are any
+     * entries at all */
+    unsigned first, n_used;
 
-#define BY_DATA(i) ((struct idxset_entry**) ((uint8_t*) (i) + PA_ALIGN(sizeof(pa_idxset))))
-#define BY_INDEX(i) (BY_DATA(i) + NBUCKETS)
+    struct idxset_slot *slots;
+    unsigned n_slots, slot_shift;
 
-PA_STATIC_FLIST_DECLARE(entries, 0, pa_xfree);
+    unsigned n_entries;
+};
 
 unsigned pa_idxset_string_hash_func(const void *p) {
     unsigned hash = 0;
@@ -85,67 +99,111 @@ int pa_idxset_trivial_compare_func(const void *a, const void *b) {
 pa_idxset* pa_idxset_new(pa_hash_func_t hash_func, pa_compare_func_t compare_func) {
     pa_idxset *s;
 
-    s = pa_xmalloc0(PA_ALIGN(sizeof(pa_idxset)) + NBUCKETS*2*sizeof(struct idxset_entry*));
+    s = pa_xnew0(pa_idxset, 1);
 
     s->hash_func = hash_func ? hash_func : pa_idxset_trivial_hash_func;
     s->compare_func = compare_func ? compare_func : pa_idxset_trivial_compare_func;
 
     s->current_index = 0;
-    s->n_entries = 0;
-    s->iterate_list_head = s->iterate_list_tail = NULL;
 
     return s;
 }
 
-static void remove_entry(pa_idxset *s, struct idxset_entry *e) {
-    pa_assert(s);
-    pa_assert(e);
-
-    /* Remove from iteration linked list */
-    if (e->iterate_next)
-        e->iterate_next->iterate_previous = e->iterate_previous;
-    else
-        s->iterate_list_tail = e->iterate_previous;
-
-    if (e->iterate_previous)
-        e->iterate_previous->iterate_next = e->iterate_next;
-    else
-        s->iterate_list_head = e->iterate_next;
-
-    /* Remove from data hash table */
-    if (e->data_next)
-        e->data_next->data_previous = e->data_previous;
-
-    if (e->data_previous)
-        e->data_previous->data_next = e->data_next;
-    else {
-        unsigned hash = s->hash_func(e->data) % NBUCKETS;
-        BY_DATA(s)[hash] = e->data_next;
+/* Multiplicative hashing, see hashmap.c */
+static unsigned home_slot(pa_idxset *s, unsigned hash) {
+    return (unsigned) (((uint32_t) hash * 2654435769U) >> s->slot_shift);
+}
+
+static void insert_slot(pa_idxset *s, unsigned hash, unsigned entry) {
+    unsigned i;
+
+    for (i = home_slot(s, hash); s->slots[i].entry; i = (i + 1) & (s->n_slots - 1))
+        ;
+
+    s->slots[i].hash = hash;
+    s->slots[i].entry = entry + 1;
+}
+
+static void rebuild_slots(pa_idxset *s, unsigned n_slots) {
+    unsigned i;
+
+    pa_assert(n_slots > s->n_entries);
+
+    pa_xfree(s->slots);
+    s->slots = pa_xnew0(struct idxset_slot, n_slots);
+    s->n_slots = n_slots;
+
+    for (s->slot_shift = 32; n_slots > 1; n_slots >>= 1)
+        s->slot_shift--;
+
+    for (i = s->first; i < s->n_used; i++)
+        if (!s->entries[i].dead)
+            insert_slot(s, s->entries[i].hash, i);
+}
+
+/* Backward shift deletion, see hashmap.c */
+static void remove_slot(pa_idxset *s, unsigned i) {
+    unsigned j, k, mask = s->n_slots - 1;
+
+    for (j = (i + 1) & mask; s->slots[j].entry; j = (j + 1) & mask) {
+        k = home_slot(s, s->slots[j].hash);
+
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+
+        s->slots[i] = s->slots[j];
+        i = j;
     }
 
-    /* Remove from index hash table */
-    if (e->index_next)
-        e->index_next->index_previous = e->index_previous;
+    s->slots[i].entry = 0;
+}
+
+static void remove_entry(pa_idxset *s, unsigned entry) {
+    struct idxset_entry *e;
+    unsigned i;
+
+    pa_assert(s);
+    pa_assert(entry < s->n_used);
 
-    if (e->index_previous)
-        e->index_previous->index_next = e->index_next;
-    else
-        BY_INDEX(s)[e->idx % NBUCKETS] = e->index_next;
+    e = s->entries + entry;
+    pa_assert(!e->dead);
 
-    if (pa_flist_push(PA_STATIC_FLIST_GET(entries), e) < 0)
-        pa_xfree(e);
+    for (i = home_slot(s, e->hash); s->slots[i].entry != entry + 1; i = (i + 1) & (s->n_slots - 1))
+        pa_assert(s->slots[i].entry);
+
+    remove_slot(s, i);
+    e->dead = TRUE;
 
     pa_assert(s->n_entries >= 1);
     s->n_entries--;
+
+    if (s->n_entries == 0) {
+        pa_xfree(s->entries);
+        pa_xfree(s->slots);
+        s->entries = NULL;
+        s->slots = NULL;
+        s->n_allocated = s->n_used = s->first = 0;
+        s->n_slots = 0;
+        return;
+    }
+
+    while (s->entries[s->first].dead)
+        s->first++;
+
+    while (s->entries[s->n_used - 1].dead)
+        s->n_used--;
+
+    if (s->n_slots > MIN_SLOTS && s->n_entries * 8 < s->n_slots)
+        rebuild_slots(s, s->n_slots / 2);
 }
 
 void pa_idxset_free(pa_idxset *s, pa_free2_cb_t free_cb, void *userdata) {
     pa_assert(s);
 
-    while (s->iterate_list_head) {
-        void *data = s->iterate_list_head->data;
+    while (s->n_entries > 0) {
+        void *data = s->entries[s->first].data;
 
-        remove_entry(s, s->iterate_list_head);
+        remove_entry(s, s->first);
 
         if (free_cb)
             free_cb(data, userdata);
@@ -154,79 +212,141 @@ void pa_idxset_free(pa_idxset *s, pa_free2_cb_t free_cb, void *userdata) {
     pa_xfree(s);
 }
 
-static struct idxset_entry* data_scan(pa_idxset *s, unsigned hash, const void *p) {
-    struct idxset_entry *e;
+static struct idxset_slot* data_scan(pa_idxset *s, unsigned hash, const void *p) {
+    unsigned i;
+
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
     pa_assert(p);
 
-    for (e = BY_DATA(s)[hash]; e; e = e->data_next)
-        if (s->compare_func(e->data, p) == 0)
-            return e;
+    if (!s->n_slots)
+        return NULL;
+
+    for (i = home_slot(s, hash); s->slots[i].entry; i = (i + 1) & (s->n_slots - 1)) {
+        struct idxset_slot *slot = s->slots + i;
+
+        if (slot->hash == hash && s->compare_func(s->entries[slot->entry - 1].data, p) == 0)
+            return slot;
+    }
 
     return NULL;
 }
 
-static struct idxset_entry* index_scan(pa_idxset *s, unsigned hash, uint32_t idx) {
-    struct idxset_entry *e;
+/* Returns the position of the first entry, dead or alive, whose index
+ * is not smaller than idx */
+static unsigned index_lower_bound(pa_idxset *s, uint32_t idx) {
+    unsigned l = s->first, r = s->n_used;
+
+    if (l >= r || idx <= s->entries[l].idx)
+        return l;
+
+    if (idx > s->entries[r - 1].idx)
+        return r;
+
+    /* The indexes are strictly increasing, so the entry can't be
+     * further away from either end than its index. Without holes this
+     * finds it right away. */
+    if (idx - s->entries[l].idx < r - l - 1)
+        r = l + (idx - s->entries[l].idx) + 1;
+
+    if (s->entries[s->n_used - 1].idx - idx < r - l - 1)
+        l = PA_MAX(l, s->n_used - 1 - (s->entries[s->n_used - 1].idx - idx));
+
+    while (l < r) {
+        unsigned m = l + (r - l) / 2;
+
+        if (s->entries[m].idx < idx)
+            l = m + 1;
+        else
+            r = m;
+    }
+
+    return l;
+}
+
+static struct idxset_entry* index_scan(pa_idxset *s, uint32_t idx) {
+    unsigned i;
+
     pa_assert(s);
-    pa_assert(hash < NBUCKETS);
 
-    for (e = BY_INDEX(s)[hash]; e; e = e->index_next)
-        if (e->idx == idx)
-            return e;
+    i = index_lower_bound(s, idx);
+
+    if (i >= s->n_used || s->entries[i].idx != idx || s->entries[i].dead)
+        return NULL;
+
+    return s->entries + i;
+}
+
+/* Returns the first entry alive at position i or later */
+static struct idxset_entry* next_alive(pa_idxset *s, unsigned i) {
+    for (; i < s->n_used; i++)
+        if (!s->entries[i].dead)
+            return s->entries + i;
 
     return NULL;
 }
 
+/* Moves entries when compacting, see make_room() in hashmap.c */
+static void make_room(pa_idxset *s) {
+    unsigned i, j, n_allocated;
+
+    if (s->n_used < s->n_allocated)
+        return;
+
+    if (s->n_allocated == 0 || s->n_entries > s->n_allocated / 2) {
+        n_allocated = PA_MAX(s->n_allocated * 2, MIN_ENTRIES);
+        s->entries = pa_xrealloc(s->entries, n_allocated * sizeof(struct idxset_entry));
+        s->n_allocated = n_allocated;
+        return;
+    }
+
+    for (i = s->first, j = 0; i < s->n_used; i++)
+        if (!s->entries[i].dead)
+            s->entries[j++] = s->entries[i];
+
+    pa_assert(j == s->n_entries);
+    s->first = 0;
+    s->n_used = j;
+
+    for (n_allocated = s->n_allocated; n_allocated > MIN_ENTRIES && s->n_entries * 4 <= n_allocated; n_allocated /= 2)
+        ;
+
+    if (n_allocated != s->n_allocated) {
+        s->entries = pa_xrealloc(s->entries, n_allocated * sizeof(struct idxset_entry));
+        s->n_allocated = n_allocated;
+    }
+
+    rebuild_slots(s, s->n_slots);
+}
+
 int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
     unsigned hash;
+    struct idxset_slot *slot;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
+    hash = s->hash_func(p);
 
-    if ((e = data_scan(s, hash, p))) {
+    if ((slot = data_scan(s, hash, p))) {
         if (idx)
-            *idx = e->idx;
+            *idx = s->entries[slot->entry - 1].idx;
 
         return -1;
     }
 
-    if (!(e = pa_flist_pop(PA_STATIC_FLIST_GET(entries))))
-        e = pa_xnew(struct idxset_entry, 1);
+    make_room(s);
 
+    if ((s->n_entries + 1) * 2 > s->n_slots)
+        rebuild_slots(s, PA_MAX(s->n_slots * 2, MIN_SLOTS));
+
+    e = s->entries + s->n_used;
     e->data = p;
     e->idx = s->current_index++;
+    e->hash = hash;
+    e->dead = FALSE;
 
-    /* Insert into data hash table */
-    e->data_next = BY_DATA(s)[hash];
-    e->data_previous = NULL;
-    if (BY_DATA(s)[hash])
-        BY_DATA(s)[hash]->data_previous = e;
-    BY_DATA(s)[hash] = e;
-
-    hash = e->idx % NBUCKETS;
-
-    /* Insert into index hash table */
-    e->index_next = BY_INDEX(s)[hash];
-    e->index_previous = NULL;
-    if (BY_INDEX(s)[hash])
-        BY_INDEX(s)[hash]->index_previous = e;
-    BY_INDEX(s)[hash] = e;
-
-    /* Insert into iteration list */
-    e->iterate_previous = s->iterate_list_tail;
-    e->iterate_next = NULL;
-    if (s->iterate_list_tail) {
-        pa_assert(s->iterate_list_head);
-        s->iterate_list_tail->iterate_next = e;
-    } else {
-        pa_assert(!s->iterate_list_head);
-        s->iterate_list_head = e;
-    }
-    s->iterate_list_tail = e;
+    insert_slot(s, hash, s->n_used);
+    s->n_used++;
 
     s->n_entries++;
     pa_assert(s->n_entries >= 1);
@@ -238,30 +358,27 @@ int pa_idxset_put(pa_idxset*s, void *p, uint32_t *idx) {
 }
 
 void* pa_idxset_get_by_index(pa_idxset*s, uint32_t idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     return e->data;
 }
 
 void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
-    unsigned hash;
+    struct idxset_slot *slot;
     struct idxset_entry *e;
 
     pa_assert(s);
 
-    hash = s->hash_func(p) % NBUCKETS;
-
-    if (!(e = data_scan(s, hash, p)))
+    if (!(slot = data_scan(s, s->hash_func(p), p)))
         return NULL;
 
+    e = s->entries + slot->entry - 1;
+
     if (idx)
         *idx = e->idx;
 
@@ -270,59 +387,53 @@ void* pa_idxset_get_by_data(pa_idxset*s, const void *p, uint32_t *idx) {
 
 void* pa_idxset_remove_by_index(pa_idxset*s, uint32_t idx) {
     struct idxset_entry *e;
-    unsigned hash;
     void *data;
 
     pa_assert(s);
 
-    hash = idx % NBUCKETS;
-
-    if (!(e = index_scan(s, hash, idx)))
+    if (!(e = index_scan(s, idx)))
         return NULL;
 
     data = e->data;
-    remove_entry(s, e);
+    remove_entry(s, (unsigned) (e - s->entries));
 
     return data;
 }
 
 void* pa_idxset_remove_by_data(pa_idxset*s, const void *data, uint32_t *idx) {
+    struct idxset_slot *slot;
     struct idxset_entry *e;
-    unsigned hash;
     void *r;
 
     pa_assert(s);
 
-    hash = s->hash_func(data) % NBUCKETS;
-
-    if (!(e = data_scan(s, hash, data)))
+    if (!(slot = data_scan(s, s->hash_func(data), data)))
         return NULL;
 
+    e = s->entries + slot->entry - 1;
     r = e->data;
 
     if (idx)
         *idx = e->idx;
 
-    remove_entry(s, e);
+    remove_entry(s, slot->entry - 1);
 
     return r;
 }
 
 void* pa_idxset_rrobin(pa_idxset *s, uint32_t *idx) {
-    unsigned hash;
     struct idxset_entry *e;
 
     pa_assert(s);
     pa_assert(idx);
 
-    hash = *idx % NBUCKETS;
+    e = index_scan(s, *idx);
 
-    e = index_scan(s, hash, *idx);
+    if (e)
+        e = next_alive(s, (unsigned) (e - s->entries) + 1);
 
-    if (e && e->iterate_next)
-        e = e->iterate_next;
-    else
-        e = s->iterate_list_head;
+    if (!e)
+        e = next_alive(s, s->first);
 
     if (!e)
         return NULL;
@@ -331,8 +442,10 @@ void* pa_idxset_rrobin(pa_idxset *s, uint32_t *idx) {
     return e->data;
 }
 
+/* The iteration state works like the one of pa_hashmap_iterate() */
 void *pa_idxset_iterate(pa_idxset *s, void **state, uint32_t *idx) {
     struct idxset_entry *e;
+    unsigned i;
 
     pa_assert(s);
     pa_assert(state);
@@ -340,15 +453,11 @@ void *pa_idxset_iterate(pa_idxset *s, void **state, uint32_t *idx) {
     if (*state == (void*) -1)
         goto at_end;
 
-    if ((!*state && !s->iterate_list_head))
+    if (!(e = next_alive(s, *state ? PA_PTR_TO_UINT(*state) - 1 : s->first)))
         goto at_end;
 
-    e = *state ? *state : s->iterate_list_head;
-
-    if (e->iterate_next)
-        *state = e->iterate_next;
-    else
-        *state = (void*) -1;
+    i = (unsigned) (e - s->entries);
+    *state = i + 1 < s->n_used ? PA_UINT_TO_PTR(i + 2) : (void*) -1;
 
     if (idx)
         *idx = e->idx;
@@ -369,15 +478,15 @@ void* pa_idxset_steal_first(pa_idxset *s, uint32_t *idx) {
 
     pa_assert(s);
 
-    if (!s->iterate_list_head)
+    if (s->n_entries == 0)
         return NULL;
 
-    data = s->iterate_list_head->data;
+    data = s->entries[s->first].data;
 
     if (idx)
-        *idx = s->iterate_list_head->idx;
+        *idx = s->entries[s->first].idx;
 
-    remove_entry(s, s->iterate_list_head);
+    remove_entry(s, s->first);
 
     return data;
 }
@@ -385,21 +494,20 @@ void* pa_idxset_steal_first(pa_idxset *s, uint32_t *idx) {
 void* pa_idxset_first(pa_idxset *s, uint32_t *idx) {
     pa_assert(s);
 
-    if (!s->iterate_list_head) {
+    if (s->n_entries == 0) {
         if (idx)
             *idx = PA_IDXSET_INVALID;
         return NULL;
     }
 
     if (idx)
-        *idx = s->iterate_list_head->idx;
+        *idx = s->entries[s->first].idx;
 
-    return s->iterate_list_head->data;
+    return s->entries[s->first].data;
 }
 
 void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     struct idxset_entry *e;
-    unsigned hash;
 
     pa_assert(s);
     pa_assert(idx);
@@ -407,38 +515,15 @@ void *pa_idxset_next(pa_idxset *s, uint32_t *idx) {
     if (*idx == PA_IDXSET_INVALID)
         return NULL;
 
-    hash = *idx % NBUCKETS;
-
-    if ((e = index_scan(s, hash, *idx))) {
-
-        e = e->iterate_next;
-
-        if (e) {
-            *idx = e->idx;
-            return e->data;
-        } else {
-            *idx = PA_IDXSET_INVALID;
-            return NULL;
-        }
-
-    } else {
-
-        /* If the entry passed doesn't exist anymore we try to find
-         * the next following */
-
-        for ((*idx)++; *idx < s->current_index; (*idx)++) {
-
-            hash = *idx % NBUCKETS;
-
-            if ((e = index_scan(s, hash, *idx))) {
-                *idx = e->idx;
-                return e->data;
-            }
-        }
-
+    /* This also finds the next following entry if the one passed
+     * doesn't exist anymore */
+    if (!(e = next_alive(s, index_lower_bound(s, *idx + 1)))) {
         *idx = PA_IDXSET_INVALID;
         return NULL;
     }
+
+    *idx = e->idx;
+    return e->data;
 }
 
 unsigned pa_idxset_size(pa_idxset*s) {
@@ -455,14 +540,15 @@ pa_bool_t pa_idxset_isempty(pa_idxset *s) {
 
 pa_idxset *pa_idxset_copy(pa_idxset *s) {
     pa_idxset *copy;
-    struct idxset_entry *i;
+    unsigned i;
 
     pa_assert(s);
 
     copy = pa_idxset_new(s->hash_func, s->compare_func);
 
-    for (i = s->iterate_list_head; i; i = i->iterate_next)
-        pa_idxset_put(copy, i->data, NULL);
+    for (i = s->first; i < s->n_used; i++)
+        if (!s->entries[i].dead)
+            pa_idxset_put(copy, s->entries[i].data, NULL);
 
     return copy;
 }
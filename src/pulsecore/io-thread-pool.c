@@ -0,0 +1,595 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/llist.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/poll.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+#include "io-thread-pool.h"
+
+typedef struct pa_io_thread_worker {
+    pa_msgobject parent;
+
+    pa_io_thread_pool *pool;
+    unsigned index;
+
+    /* Only touched from main context */
+    unsigned n_jobs;
+    pa_bool_t dead;
+
+    pa_thread *thread;
+    pa_thread_mq thread_mq;
+    pa_rtpoll *rtpoll;
+
+    /* Only touched from the worker thread. Jobs with a deadline are
+     * kept in a binary heap ordered by it, jobs with pending messages
+     * in the dirty list. */
+    PA_LLIST_HEAD(pa_io_thread_job, jobs);
+    pa_io_thread_job *dirty, *dirty_tail;
+    pa_io_thread_job **heap;
+    unsigned n_heap, n_heap_allocated;
+
+    /* Once the thread failed it only waits for messages, on this one */
+    pa_rtpoll *failed_rtpoll;
+    pa_rtpoll_item *failed_item;
+} pa_io_thread_worker;
+
+PA_DEFINE_PRIVATE_CLASS(pa_io_thread_worker, pa_msgobject);
+#define PA_IO_THREAD_WORKER(o) (pa_io_thread_worker_cast(o))
+
+enum {
+    WORKER_MESSAGE_ADD_JOB,
+    WORKER_MESSAGE_REMOVE_JOB,
+    WORKER_MESSAGE_FAILED
+};
+
+struct pa_io_thread_job {
+    pa_io_thread_worker *worker;
+    pa_module *module;
+
+    pa_io_thread_job_cb_t callback;
+    void *userdata;
+
+    pa_asyncmsgq *inq;
+    pa_bool_t started;
+
+    /* Only touched from the worker thread */
+    pa_rtpoll_item *rtpoll_item;
+    pa_usec_t deadline;
+    unsigned heap_index;
+    pa_bool_t dirty;
+    PA_LLIST_FIELDS(pa_io_thread_job);
+    pa_io_thread_job *dirty_next, *dirty_prev;
+};
+
+struct pa_io_thread_pool {
+    pa_mainloop_api *mainloop;
+    int realtime_priority;
+
+    unsigned n_workers, n_started;
+    pa_io_thread_worker **workers;
+};
+
+#define HEAP_INVALID ((unsigned) -1)
+
+/* Called from the worker thread */
+static void heap_swap(pa_io_thread_worker *w, unsigned a, unsigned b) {
+    pa_io_thread_job *j;
+
+    j = w->heap[a];
+    w->heap[a] = w->heap[b];
+    w->heap[b] = j;
+
+    w->heap[a]->heap_index = a;
+    w->heap[b]->heap_index = b;
+}
+
+static void heap_up(pa_io_thread_worker *w, unsigned i) {
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+
+        if (w->heap[parent]->deadline <= w->heap[i]->deadline)
+            break;
+
+        heap_swap(w, i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(pa_io_thread_worker *w, unsigned i) {
+    for (;;) {
+        unsigned l = 2 * i + 1, r = l + 1, m = i;
+
+        if (l < w->n_heap && w->heap[l]->deadline < w->heap[m]->deadline)
+            m = l;
+        if (r < w->n_heap && w->heap[r]->deadline < w->heap[m]->deadline)
+            m = r;
+
+        if (m == i)
+            break;
+
+        heap_swap(w, i, m);
+        i = m;
+    }
+}
+
+static void heap_insert(pa_io_thread_worker *w, pa_io_thread_job *j) {
+    pa_assert(j->heap_index == HEAP_INVALID);
+
+    if (w->n_heap >= w->n_heap_allocated) {
+        w->n_heap_allocated = PA_MAX(16U, w->n_heap_allocated * 2);
+        w->heap = pa_xrenew(pa_io_thread_job*, w->heap, w->n_heap_allocated);
+    }
+
+    j->heap_index = w->n_heap++;
+    w->heap[j->heap_index] = j;
+    heap_up(w, j->heap_index);
+}
+
+static void heap_remove(pa_io_thread_worker *w, pa_io_thread_job *j) {
+    unsigned i;
+
+    if ((i = j->heap_index) == HEAP_INVALID)
+        return;
+
+    j->heap_index = HEAP_INVALID;
+
+    if (i == --w->n_heap)
+        return;
+
+    w->heap[i] = w->heap[w->n_heap];
+    w->heap[i]->heap_index = i;
+    heap_up(w, i);
+    heap_down(w, w->heap[i]->heap_index);
+}
+
+static void mark_dirty(pa_io_thread_job *j) {
+    pa_io_thread_worker *w = j->worker;
+
+    if (j->dirty)
+        return;
+
+    /* FIFO, so that a job that keeps waking itself up can't starve
+     * the others */
+    j->dirty = TRUE;
+    j->dirty_next = NULL;
+    j->dirty_prev = w->dirty_tail;
+
+    if (w->dirty_tail)
+        w->dirty_tail->dirty_next = j;
+    else
+        w->dirty = j;
+
+    w->dirty_tail = j;
+}
+
+static void unmark_dirty(pa_io_thread_job *j) {
+    pa_io_thread_worker *w = j->worker;
+
+    if (!j->dirty)
+        return;
+
+    if (j->dirty_prev)
+        j->dirty_prev->dirty_next = j->dirty_next;
+    else
+        w->dirty = j->dirty_next;
+
+    if (j->dirty_next)
+        j->dirty_next->dirty_prev = j->dirty_prev;
+    else
+        w->dirty_tail = j->dirty_prev;
+
+    j->dirty = FALSE;
+    j->dirty_next = j->dirty_prev = NULL;
+}
+
+static void run_job(pa_io_thread_job *j, pa_usec_t now) {
+    pa_io_thread_worker *w = j->worker;
+
+    unmark_dirty(j);
+    heap_remove(w, j);
+
+    if ((j->deadline = j->callback(j, now, j->userdata)) != PA_USEC_INVALID)
+        heap_insert(w, j);
+}
+
+static void run_jobs(pa_io_thread_worker *w) {
+    pa_io_thread_job *last;
+    pa_usec_t now;
+
+    now = pa_rtclock_now();
+
+    /* Jobs that are woken up while we are at it have to wait for the
+     * next iteration */
+    if ((last = w->dirty_tail)) {
+        pa_io_thread_job *j;
+
+        do {
+            j = w->dirty;
+            run_job(j, now);
+        } while (j != last);
+    }
+
+    while (w->n_heap > 0 && w->heap[0]->deadline <= now)
+        run_job(w->heap[0], now);
+}
+
+static int job_read_before(pa_rtpoll_item *i) {
+    pa_io_thread_job *j = pa_rtpoll_item_get_userdata(i);
+
+    if (pa_asyncmsgq_read_before_poll(j->inq) < 0)
+        return 1; /* 1 means immediate restart of the loop */
+
+    return 0;
+}
+
+static void job_read_after(pa_rtpoll_item *i) {
+    pa_io_thread_job *j = pa_rtpoll_item_get_userdata(i);
+
+    pa_asyncmsgq_read_after_poll(j->inq);
+}
+
+/* Like the work callback of pa_rtpoll_item_new_asyncmsgq_read(), but
+ * makes sure that the job gets to see what the message did */
+static int job_read_work(pa_rtpoll_item *i) {
+    pa_io_thread_job *j = pa_rtpoll_item_get_userdata(i);
+    pa_msgobject *object;
+    int code;
+    void *data;
+    pa_memchunk chunk;
+    int64_t offset;
+    int ret;
+
+    if (pa_asyncmsgq_get(j->inq, &object, &code, &data, &offset, &chunk, 0) < 0)
+        return 0;
+
+    ret = object ? pa_asyncmsgq_dispatch(object, code, data, offset, &chunk) : 0;
+    pa_asyncmsgq_done(j->inq, ret);
+
+    mark_dirty(j);
+    return 1;
+}
+
+static void add_job(pa_io_thread_worker *w, pa_io_thread_job *j) {
+    struct pollfd *pollfd;
+
+    if (w->failed_rtpoll) {
+        j->rtpoll_item = pa_rtpoll_item_new_asyncmsgq_read(w->failed_rtpoll, PA_RTPOLL_EARLY, j->inq);
+        PA_LLIST_PREPEND(pa_io_thread_job, w->jobs, j);
+        return;
+    }
+
+    j->rtpoll_item = pa_rtpoll_item_new(w->rtpoll, PA_RTPOLL_EARLY, 1);
+
+    pollfd = pa_rtpoll_item_get_pollfd(j->rtpoll_item, NULL);
+    pollfd->fd = pa_asyncmsgq_read_fd(j->inq);
+    pollfd->events = POLLIN;
+
+    pa_rtpoll_item_set_before_callback(j->rtpoll_item, job_read_before);
+    pa_rtpoll_item_set_after_callback(j->rtpoll_item, job_read_after);
+    pa_rtpoll_item_set_work_callback(j->rtpoll_item, job_read_work);
+    pa_rtpoll_item_set_userdata(j->rtpoll_item, j);
+
+    PA_LLIST_PREPEND(pa_io_thread_job, w->jobs, j);
+    mark_dirty(j);
+}
+
+static void remove_job(pa_io_thread_worker *w, pa_io_thread_job *j) {
+    unmark_dirty(j);
+    heap_remove(w, j);
+    PA_LLIST_REMOVE(pa_io_thread_job, w->jobs, j);
+
+    pa_rtpoll_item_free(j->rtpoll_item);
+    j->rtpoll_item = NULL;
+}
+
+static int worker_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_io_thread_worker *w = PA_IO_THREAD_WORKER(o);
+
+    switch (code) {
+
+        case WORKER_MESSAGE_ADD_JOB:
+            add_job(w, data);
+            return 0;
+
+        case WORKER_MESSAGE_REMOVE_JOB:
+            remove_job(w, data);
+            return 0;
+
+        case WORKER_MESSAGE_FAILED:
+            /* Called from main context */
+            w->dead = TRUE;
+            return 0;
+    }
+
+    return 0;
+}
+
+/* Like a module whose IO thread fails, ask for all our users to be
+ * unloaded. Until that is done their messages still have to be
+ * processed, but the jobs aren't run anymore and nothing else is
+ * polled. */
+static void worker_fail(pa_io_thread_worker *w) {
+    pa_io_thread_job *j;
+
+    pa_log_error("IO worker thread %u failed, unloading the modules using it.", w->index);
+
+    w->failed_rtpoll = pa_rtpoll_new();
+    w->failed_item = pa_rtpoll_item_new_asyncmsgq_read(w->failed_rtpoll, PA_RTPOLL_EARLY, w->thread_mq.inq);
+
+    pa_asyncmsgq_post(w->thread_mq.outq, PA_MSGOBJECT(w), WORKER_MESSAGE_FAILED, NULL, 0, NULL, NULL);
+
+    PA_LLIST_FOREACH(j, w->jobs) {
+        unmark_dirty(j);
+        heap_remove(w, j);
+
+        pa_rtpoll_item_free(j->rtpoll_item);
+        j->rtpoll_item = pa_rtpoll_item_new_asyncmsgq_read(w->failed_rtpoll, PA_RTPOLL_EARLY, j->inq);
+
+        if (j->module)
+            pa_asyncmsgq_post(w->thread_mq.outq, PA_MSGOBJECT(j->module->core), PA_CORE_MESSAGE_UNLOAD_MODULE, j->module, 0, NULL, NULL);
+    }
+}
+
+static void worker_thread_func(void *userdata) {
+    pa_io_thread_worker *w = userdata;
+
+    pa_assert(w);
+
+    pa_log_debug("IO worker thread %u starting up", w->index);
+
+    if (w->pool->realtime_priority > 0)
+        pa_make_realtime(w->pool->realtime_priority);
+
+    pa_thread_mq_install(&w->thread_mq);
+
+    for (;;) {
+        int ret;
+
+        if (w->failed_rtpoll) {
+            if ((ret = pa_rtpoll_run(w->failed_rtpoll, TRUE)) == 0)
+                break;
+
+            if (ret < 0) {
+                pa_log_error("IO worker thread %u failed again, waiting for shutdown.", w->index);
+                pa_asyncmsgq_wait_for(w->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+                break;
+            }
+
+            continue;
+        }
+
+        run_jobs(w);
+
+        if (w->dirty)
+            pa_rtpoll_set_timer_absolute(w->rtpoll, 0);
+        else if (w->n_heap > 0)
+            pa_rtpoll_set_timer_absolute(w->rtpoll, w->heap[0]->deadline);
+        else
+            pa_rtpoll_set_timer_disabled(w->rtpoll);
+
+        if ((ret = pa_rtpoll_run(w->rtpoll, TRUE)) == 0)
+            break;
+
+        if (ret < 0)
+            worker_fail(w);
+    }
+
+    if (w->failed_rtpoll) {
+        pa_rtpoll_item_free(w->failed_item);
+        pa_rtpoll_free(w->failed_rtpoll);
+    }
+
+    pa_log_debug("IO worker thread %u shutting down", w->index);
+}
+
+/* Called from main context */
+static pa_io_thread_worker *worker_new(pa_io_thread_pool *p, unsigned idx) {
+    pa_io_thread_worker *w;
+    char name[16];
+
+    w = pa_msgobject_new(pa_io_thread_worker);
+    w->parent.process_msg = worker_process_msg;
+    w->pool = p;
+    w->index = idx;
+    w->n_jobs = 0;
+    w->dead = FALSE;
+    PA_LLIST_HEAD_INIT(pa_io_thread_job, w->jobs);
+    w->dirty = w->dirty_tail = NULL;
+    w->heap = NULL;
+    w->n_heap = w->n_heap_allocated = 0;
+    w->failed_rtpoll = NULL;
+    w->failed_item = NULL;
+
+    w->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&w->thread_mq, p->mainloop, w->rtpoll);
+
+    pa_snprintf(name, sizeof(name), "io-worker-%u", idx);
+
+    if (!(w->thread = pa_thread_new(name, worker_thread_func, w))) {
+        pa_log("Failed to create IO worker thread.");
+        pa_thread_mq_done(&w->thread_mq);
+        pa_rtpoll_free(w->rtpoll);
+        pa_msgobject_unref(PA_MSGOBJECT(w));
+        return NULL;
+    }
+
+    return w;
+}
+
+static void worker_free(pa_io_thread_worker *w) {
+    pa_assert(w);
+    pa_assert(w->n_jobs == 0);
+
+    pa_asyncmsgq_send(w->thread_mq.inq, NULL, PA_MESSAGE_SHUTDOWN, NULL, 0, NULL);
+    pa_thread_free(w->thread);
+
+    pa_thread_mq_done(&w->thread_mq);
+    pa_rtpoll_free(w->rtpoll);
+
+    pa_assert(!w->jobs);
+    pa_xfree(w->heap);
+    pa_msgobject_unref(PA_MSGOBJECT(w));
+}
+
+pa_io_thread_pool *pa_io_thread_pool_new(pa_mainloop_api *m, unsigned n_threads, int realtime_priority) {
+    pa_io_thread_pool *p;
+
+    pa_assert(m);
+    pa_assert(n_threads > 0);
+
+    p = pa_xnew0(pa_io_thread_pool, 1);
+    p->mainloop = m;
+    p->realtime_priority = realtime_priority;
+    p->n_workers = n_threads;
+    p->workers = pa_xnew0(pa_io_thread_worker*, n_threads);
+
+    return p;
+}
+
+void pa_io_thread_pool_free(pa_io_thread_pool *p) {
+    unsigned i;
+
+    pa_assert(p);
+
+    for (i = 0; i < p->n_started; i++)
+        worker_free(p->workers[i]);
+
+    pa_xfree(p->workers);
+    pa_xfree(p);
+}
+
+/* Spread the jobs evenly, but don't start a new thread as long as
+ * one of the running ones is idle. Threads that failed get no new
+ * jobs, and are replaced once all of their jobs are gone. */
+static pa_io_thread_worker *pick_worker(pa_io_thread_pool *p) {
+    pa_io_thread_worker *best = NULL;
+    unsigned i;
+
+    for (i = 0; i < p->n_started; i++) {
+        pa_io_thread_worker *w = p->workers[i];
+
+        if (w->dead) {
+            if (w->n_jobs > 0)
+                continue;
+
+            worker_free(w);
+
+            if (!(w = worker_new(p, i))) {
+                p->workers[i--] = p->workers[--p->n_started];
+                continue;
+            }
+
+            p->workers[i] = w;
+        }
+
+        if (!best || w->n_jobs < best->n_jobs)
+            best = w;
+    }
+
+    if ((!best || best->n_jobs > 0) && p->n_started < p->n_workers) {
+        pa_io_thread_worker *w;
+
+        if ((w = worker_new(p, p->n_started))) {
+            p->workers[p->n_started++] = w;
+            best = w;
+        }
+    }
+
+    return best;
+}
+
+pa_io_thread_job *pa_io_thread_job_new(pa_io_thread_pool *p, pa_module *m, pa_io_thread_job_cb_t cb, void *userdata) {
+    pa_io_thread_worker *w;
+    pa_io_thread_job *j;
+
+    pa_assert(p);
+    pa_assert(cb);
+
+    if (!(w = pick_worker(p)))
+        return NULL;
+
+    j = pa_xnew0(pa_io_thread_job, 1);
+    j->worker = w;
+    j->module = m;
+    j->callback = cb;
+    j->userdata = userdata;
+    j->heap_index = HEAP_INVALID;
+    j->deadline = PA_USEC_INVALID;
+
+    /* Written to by the main thread as well as by other IO threads */
+    pa_assert_se(j->inq = pa_asyncmsgq_new_mpsc(0));
+
+    w->n_jobs++;
+
+    return j;
+}
+
+void pa_io_thread_job_start(pa_io_thread_job *j) {
+    pa_assert(j);
+    pa_assert(!j->started);
+
+    pa_assert_se(pa_asyncmsgq_send(j->worker->thread_mq.inq, PA_MSGOBJECT(j->worker), WORKER_MESSAGE_ADD_JOB, j, 0, NULL) == 0);
+    j->started = TRUE;
+}
+
+void pa_io_thread_job_free(pa_io_thread_job *j) {
+    pa_assert(j);
+
+    if (j->started)
+        pa_assert_se(pa_asyncmsgq_send(j->worker->thread_mq.inq, PA_MSGOBJECT(j->worker), WORKER_MESSAGE_REMOVE_JOB, j, 0, NULL) == 0);
+
+    pa_assert(j->worker->n_jobs > 0);
+    j->worker->n_jobs--;
+
+    pa_asyncmsgq_unref(j->inq);
+    pa_xfree(j);
+}
+
+pa_asyncmsgq *pa_io_thread_job_get_asyncmsgq(pa_io_thread_job *j) {
+    pa_assert(j);
+
+    return j->inq;
+}
+
+pa_rtpoll *pa_io_thread_job_get_rtpoll(pa_io_thread_job *j) {
+    pa_assert(j);
+
+    return j->worker->rtpoll;
+}
+
+void pa_io_thread_job_wakeup(pa_io_thread_job *j) {
+    pa_assert(j);
+    pa_assert(j->rtpoll_item);
+
+    mark_dirty(j);
+}
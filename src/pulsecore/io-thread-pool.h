@@ -0,0 +1,68 @@
+#ifndef fooiothreadpoolhfoo
+#define fooiothreadpoolhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/mainloop-api.h>
+#include <pulse/sample.h>
+#include <pulsecore/asyncmsgq.h>
+#include <pulsecore/rtpoll.h>
+#include <pulsecore/module.h>
+
+/* A fixed number of IO threads that are shared by many sinks and
+ * sources, for modules that would otherwise spawn a thread of their
+ * own just to wake up every now and then, like module-null-sink.
+ *
+ * Each user creates a job, which gets its own message queue but
+ * shares the rtpoll of the worker thread it was assigned to. The
+ * worker calls the job's callback whenever a message for it was
+ * processed or its deadline has passed, earliest deadline first. The
+ * callback runs in IO context and returns the next deadline. */
+
+typedef struct pa_io_thread_pool pa_io_thread_pool;
+typedef struct pa_io_thread_job pa_io_thread_job;
+
+/* Called from IO context. Returns the absolute time at which the
+ * callback shall be called again, or PA_USEC_INVALID if it only needs
+ * to run when there are messages for the job. */
+typedef pa_usec_t (*pa_io_thread_job_cb_t)(pa_io_thread_job *j, pa_usec_t now, void *userdata);
+
+/* Threads are only started when jobs are added. If realtime_priority
+ * is > 0, they try to acquire realtime scheduling. */
+pa_io_thread_pool *pa_io_thread_pool_new(pa_mainloop_api *m, unsigned n_threads, int realtime_priority);
+void pa_io_thread_pool_free(pa_io_thread_pool *p);
+
+/* Called from main context. The job isn't run before
+ * pa_io_thread_job_start() is called. If the worker thread fails,
+ * module m gets unloaded. */
+pa_io_thread_job *pa_io_thread_job_new(pa_io_thread_pool *p, pa_module *m, pa_io_thread_job_cb_t cb, void *userdata);
+void pa_io_thread_job_start(pa_io_thread_job *j);
+void pa_io_thread_job_free(pa_io_thread_job *j);
+
+/* The queue and rtpoll to pass to pa_sink_set_asyncmsgq() and
+ * pa_sink_set_rtpoll(), or their source equivalents */
+pa_asyncmsgq *pa_io_thread_job_get_asyncmsgq(pa_io_thread_job *j);
+pa_rtpoll *pa_io_thread_job_get_rtpoll(pa_io_thread_job *j);
+
+/* Called from IO context. Makes the worker call the job's callback
+ * soon, e.g. from the callbacks of rtpoll items the job added. */
+void pa_io_thread_job_wakeup(pa_io_thread_job *j);
+
+#endif
@@ -25,6 +25,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 
@@ -231,6 +232,48 @@ ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l) {
     return r;
 }
 
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, unsigned n) {
+    ssize_t r;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n > 0);
+    pa_assert(io->ofd >= 0);
+
+#ifdef HAVE_SYS_UIO_H
+    /* Like pa_write() we try sendmsg() first to get MSG_NOSIGNAL and
+     * fall back to writev() for everything that is not a socket */
+    r = -1;
+
+    if (io->ofd_type == 0) {
+        struct msghdr mh;
+
+        pa_zero(mh);
+        mh.msg_iov = (struct iovec*) iov;
+        mh.msg_iovlen = n;
+
+        while ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+            ;
+
+        if (r < 0 && errno == ENOTSOCK)
+            io->ofd_type = 1;
+    }
+
+    if (io->ofd_type != 0)
+        while ((r = writev(io->ofd, iov, (int) n)) < 0 && errno == EINTR)
+            ;
+#else
+    r = pa_write(io->ofd, iov[0].iov_base, iov[0].iov_len, &io->ofd_type);
+#endif
+
+    if (r >= 0) {
+        io->writable = io->hungup = FALSE;
+        enable_events(io);
+    }
+
+    return r;
+}
+
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
     ssize_t r;
 
@@ -252,6 +295,10 @@ ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l) {
 
 #ifdef HAVE_CREDS
 
+#ifndef MSG_CMSG_CLOEXEC
+#define MSG_CMSG_CLOEXEC 0
+#endif
+
 pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io) {
     struct {
         struct sockaddr sa;
@@ -289,45 +336,78 @@ int pa_iochannel_creds_enable(pa_iochannel *io) {
 }
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred) {
-    ssize_t r;
-    struct msghdr mh;
     struct iovec iov;
-    union {
-        struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
-    } cmsg;
-    struct ucred *u;
+    pa_cmsg_ancil_data ancil;
 
-    pa_assert(io);
     pa_assert(data);
     pa_assert(l);
-    pa_assert(io->ofd >= 0);
 
     pa_zero(iov);
     iov.iov_base = (void*) data;
     iov.iov_len = l;
 
-    pa_zero(cmsg);
-    cmsg.hdr.cmsg_len = CMSG_LEN(sizeof(struct ucred));
-    cmsg.hdr.cmsg_level = SOL_SOCKET;
-    cmsg.hdr.cmsg_type = SCM_CREDENTIALS;
-
-    u = (struct ucred*) CMSG_DATA(&cmsg.hdr);
+    pa_zero(ancil);
+    ancil.creds_valid = TRUE;
 
-    u->pid = getpid();
-    if (ucred) {
-        u->uid = ucred->uid;
-        u->gid = ucred->gid;
-    } else {
-        u->uid = getuid();
-        u->gid = getgid();
+    if (ucred)
+        ancil.creds = *ucred;
+    else {
+        ancil.creds.uid = getuid();
+        ancil.creds.gid = getgid();
     }
 
+    return pa_iochannel_writev_with_ancil_data(io, &iov, 1, &ancil);
+}
+
+ssize_t pa_iochannel_writev_with_ancil_data(pa_iochannel*io, const struct iovec *iov, unsigned n, const pa_cmsg_ancil_data *ancil) {
+    ssize_t r;
+    struct msghdr mh;
+    union {
+        struct cmsghdr hdr;
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * PA_CMSG_FDS_MAX)];
+    } cmsg;
+    struct cmsghdr *cmh;
+
+    pa_assert(io);
+    pa_assert(iov);
+    pa_assert(n > 0);
+    pa_assert(io->ofd >= 0);
+    pa_assert(ancil);
+    pa_assert(ancil->nfd >= 0 && ancil->nfd <= PA_CMSG_FDS_MAX);
+
+    pa_zero(cmsg);
     pa_zero(mh);
-    mh.msg_iov = &iov;
-    mh.msg_iovlen = 1;
+    mh.msg_iov = (struct iovec*) iov;
+    mh.msg_iovlen = n;
     mh.msg_control = &cmsg;
-    mh.msg_controllen = sizeof(cmsg);
+    mh.msg_controllen = (ancil->creds_valid ? CMSG_SPACE(sizeof(struct ucred)) : 0) +
+        (ancil->nfd > 0 ? CMSG_SPACE(sizeof(int) * (size_t) ancil->nfd) : 0);
+
+    pa_assert(mh.msg_controllen > 0);
+
+    cmh = CMSG_FIRSTHDR(&mh);
+
+    if (ancil->creds_valid) {
+        struct ucred u;
+
+        cmh->cmsg_len = CMSG_LEN(sizeof(struct ucred));
+        cmh->cmsg_level = SOL_SOCKET;
+        cmh->cmsg_type = SCM_CREDENTIALS;
+
+        u.pid = getpid();
+        u.uid = ancil->creds.uid;
+        u.gid = ancil->creds.gid;
+        memcpy(CMSG_DATA(cmh), &u, sizeof(u));
+
+        cmh = CMSG_NXTHDR(&mh, cmh);
+    }
+
+    if (ancil->nfd > 0) {
+        cmh->cmsg_len = CMSG_LEN(sizeof(int) * (size_t) ancil->nfd);
+        cmh->cmsg_level = SOL_SOCKET;
+        cmh->cmsg_type = SCM_RIGHTS;
+        memcpy(CMSG_DATA(cmh), ancil->fds, sizeof(int) * (size_t) ancil->nfd);
+    }
 
     if ((r = sendmsg(io->ofd, &mh, MSG_NOSIGNAL)) >= 0) {
         io->writable = io->hungup = FALSE;
@@ -337,21 +417,20 @@ ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l
     return r;
 }
 
-ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *creds, pa_bool_t *creds_valid) {
+ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l, pa_cmsg_ancil_data *ancil) {
     ssize_t r;
     struct msghdr mh;
     struct iovec iov;
     union {
         struct cmsghdr hdr;
-        uint8_t data[CMSG_SPACE(sizeof(struct ucred))];
+        uint8_t data[CMSG_SPACE(sizeof(struct ucred)) + CMSG_SPACE(sizeof(int) * PA_CMSG_FDS_MAX)];
     } cmsg;
 
     pa_assert(io);
     pa_assert(data);
     pa_assert(l);
     pa_assert(io->ifd >= 0);
-    pa_assert(creds);
-    pa_assert(creds_valid);
+    pa_assert(ancil);
 
     pa_zero(iov);
     iov.iov_base = data;
@@ -364,25 +443,47 @@ ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_cr
     mh.msg_control = &cmsg;
     mh.msg_controllen = sizeof(cmsg);
 
-    if ((r = recvmsg(io->ifd, &mh, 0)) >= 0) {
+    if ((r = recvmsg(io->ifd, &mh, MSG_CMSG_CLOEXEC)) >= 0) {
         struct cmsghdr *cmh;
 
-        *creds_valid = FALSE;
+        ancil->creds_valid = FALSE;
+        ancil->nfd = 0;
 
         for (cmh = CMSG_FIRSTHDR(&mh); cmh; cmh = CMSG_NXTHDR(&mh, cmh)) {
 
-            if (cmh->cmsg_level == SOL_SOCKET && cmh->cmsg_type == SCM_CREDENTIALS) {
+            if (cmh->cmsg_level != SOL_SOCKET)
+                continue;
+
+            if (cmh->cmsg_type == SCM_CREDENTIALS) {
                 struct ucred u;
                 pa_assert(cmh->cmsg_len == CMSG_LEN(sizeof(struct ucred)));
                 memcpy(&u, CMSG_DATA(cmh), sizeof(struct ucred));
 
-                creds->gid = u.gid;
-                creds->uid = u.uid;
-                *creds_valid = TRUE;
-                break;
+                ancil->creds.gid = u.gid;
+                ancil->creds.uid = u.uid;
+                ancil->creds_valid = TRUE;
+
+            } else if (cmh->cmsg_type == SCM_RIGHTS) {
+                size_t i, nfd = (cmh->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+                for (i = 0; i < nfd; i++) {
+                    int fd;
+
+                    memcpy(&fd, CMSG_DATA(cmh) + i * sizeof(int), sizeof(int));
+
+                    if (ancil->nfd < PA_CMSG_FDS_MAX)
+                        ancil->fds[ancil->nfd++] = fd;
+                    else {
+                        pa_log_warn("Received too many file descriptors.");
+                        pa_close(fd);
+                    }
+                }
             }
         }
 
+        if (mh.msg_flags & MSG_CTRUNC)
+            pa_log_warn("Ancillary data was truncated, dropped some file descriptors.");
+
         io->readable = io->hungup = FALSE;
         enable_events(io);
     }
@@ -28,6 +28,9 @@
 #endif
 
 #include <sys/types.h>
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
 
 #include <pulse/mainloop-api.h>
 #include <pulsecore/creds.h>
@@ -40,6 +43,13 @@
 
 typedef struct pa_iochannel pa_iochannel;
 
+#ifndef HAVE_SYS_UIO_H
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+};
+#endif
+
 /* Create a new IO channel for the specified file descriptors for
 input resp. output. It is safe to pass the same file descriptor for
 both parameters (in case of full-duplex channels). For a simplex
@@ -51,12 +61,22 @@ void pa_iochannel_free(pa_iochannel*io);
 ssize_t pa_iochannel_write(pa_iochannel*io, const void*data, size_t l);
 ssize_t pa_iochannel_read(pa_iochannel*io, void*data, size_t l);
 
+/* Gathering write, returns the number of bytes written from all
+ * buffers together. Where the system has no writev() only the first
+ * buffer is written. */
+ssize_t pa_iochannel_writev(pa_iochannel*io, const struct iovec *iov, unsigned n);
+
 #ifdef HAVE_CREDS
 pa_bool_t pa_iochannel_creds_supported(pa_iochannel *io);
 int pa_iochannel_creds_enable(pa_iochannel *io);
 
 ssize_t pa_iochannel_write_with_creds(pa_iochannel*io, const void*data, size_t l, const pa_creds *ucred);
-ssize_t pa_iochannel_read_with_creds(pa_iochannel*io, void*data, size_t l, pa_creds *ucred, pa_bool_t *creds_valid);
+
+/* Sends the credentials and file descriptors in ancil along with the
+ * data. On reading, received file descriptors are stored in ancil and
+ * belong to the caller from then on. */
+ssize_t pa_iochannel_writev_with_ancil_data(pa_iochannel*io, const struct iovec *iov, unsigned n, const pa_cmsg_ancil_data *ancil);
+ssize_t pa_iochannel_read_with_ancil_data(pa_iochannel*io, void*data, size_t l, pa_cmsg_ancil_data *ancil);
 #endif
 
 pa_bool_t pa_iochannel_is_readable(pa_iochannel*io);
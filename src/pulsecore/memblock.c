@@ -713,31 +713,45 @@ static void memblock_replace_import(pa_memblock *b) {
 }
 
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size) {
+    return pa_mempool_new_full(shared, size, 0, FALSE);
+}
+
+pa_mempool* pa_mempool_new_full(pa_bool_t shared, size_t size, size_t slot_size, pa_bool_t huge_pages) {
     pa_mempool *p;
     char t1[PA_BYTES_SNPRINT_MAX], t2[PA_BYTES_SNPRINT_MAX];
 
     p = pa_xnew(pa_mempool, 1);
 
-    p->block_size = PA_PAGE_ALIGN(PA_MEMPOOL_SLOT_SIZE);
+    if (slot_size <= 0)
+        slot_size = PA_MEMPOOL_SLOT_SIZE;
+
+    p->block_size = PA_PAGE_ALIGN(slot_size);
     if (p->block_size < PA_PAGE_SIZE)
         p->block_size = PA_PAGE_SIZE;
 
     if (size <= 0)
-        p->n_blocks = PA_MEMPOOL_SLOTS_MAX;
-    else {
-        p->n_blocks = (unsigned) (size / p->block_size);
+        size = PA_MEMPOOL_SLOTS_MAX * p->block_size;
 
-        if (p->n_blocks < 2)
-            p->n_blocks = 2;
+    /* We need at least two slots, and pa_shm_create_rw() refuses
+     * anything larger than PA_SHM_SIZE_MAX */
+    size = PA_MIN(size, PA_SHM_SIZE_MAX);
+    size = PA_MAX(size, 2 * p->block_size);
+    p->n_blocks = (unsigned) (size / p->block_size);
+
+    if (p->n_blocks * p->block_size > PA_SHM_SIZE_MAX) {
+        pa_log("Memory pool slot size %lu is too large.", (unsigned long) p->block_size);
+        pa_xfree(p);
+        return NULL;
     }
 
-    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size, shared, 0700) < 0) {
+    if (pa_shm_create_rw(&p->memory, p->n_blocks * p->block_size, shared, huge_pages, 0700) < 0) {
         pa_xfree(p);
         return NULL;
     }
 
-    pa_log_debug("Using %s memory pool with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
+    pa_log_debug("Using %s memory pool%s with %u slots of size %s each, total size is %s, maximum usable slot size is %lu",
                  p->memory.shared ? "shared" : "private",
+                 p->memory.huge_pages ? " in huge pages" : "",
                  p->n_blocks,
                  pa_bytes_snprint(t1, sizeof(t1), (unsigned) p->block_size),
                  pa_bytes_snprint(t2, sizeof(t2), (unsigned) (p->n_blocks * p->block_size)),
@@ -120,6 +120,9 @@ pa_memblock *pa_memblock_will_need(pa_memblock *b);
 
 /* The memory block manager */
 pa_mempool* pa_mempool_new(pa_bool_t shared, size_t size);
+/* Like pa_mempool_new(), but with a custom slot size (0 for the
+ * default of 64 KiB) and optionally backed by huge pages */
+pa_mempool* pa_mempool_new_full(pa_bool_t shared, size_t size, size_t slot_size, pa_bool_t huge_pages);
 void pa_mempool_free(pa_mempool *p);
 const pa_mempool_stat* pa_mempool_get_stat(pa_mempool *p);
 void pa_mempool_vacuum(pa_mempool *p);
@@ -38,10 +38,26 @@
 
 /* #define MEMBLOCKQ_DEBUG */
 
+/* On top of the doubly linked list of blocks we maintain a skip list
+ * so that we can find the block for an arbitrary index quickly, e.g.
+ * after rewinding far on a queue with a large maxrewind. Every
+ * SKIP_FACTOR-th inserted block is linked into the next higher level
+ * too. */
+#define SKIP_LEVELS 4
+#define SKIP_FACTOR_SHIFT 3
+
+/* How many unused list items each queue keeps for itself */
+#define FREE_ITEMS_MAX 64
+
 struct list_item {
     struct list_item *next, *prev;
     int64_t index;
     pa_memchunk chunk;
+
+    /* The number of skip list levels this item is linked into, and
+     * the next item on each of them */
+    unsigned level;
+    struct list_item *skip_next[SKIP_LEVELS];
 };
 
 PA_STATIC_FLIST_DECLARE(list_items, 0, pa_xfree);
@@ -50,6 +66,10 @@ struct pa_memblockq {
     struct list_item *blocks, *blocks_tail;
     struct list_item *current_read, *current_write;
     unsigned n_blocks;
+    struct list_item *skip_head[SKIP_LEVELS], *skip_tail[SKIP_LEVELS];
+    unsigned n_inserted;
+    struct list_item *free_items;
+    unsigned n_free_items;
     size_t maxlength, tlength, base, prebuf, minreq, maxrewind;
     int64_t read_index, write_index;
     pa_bool_t in_prebuf;
@@ -81,6 +101,11 @@ pa_memblockq* pa_memblockq_new(
     bq->blocks = bq->blocks_tail = NULL;
     bq->current_read = bq->current_write = NULL;
     bq->n_blocks = 0;
+    memset(bq->skip_head, 0, sizeof(bq->skip_head));
+    memset(bq->skip_tail, 0, sizeof(bq->skip_tail));
+    bq->n_inserted = 0;
+    bq->free_items = NULL;
+    bq->n_free_items = 0;
 
     bq->sample_spec = *sample_spec;
     bq->base = pa_frame_size(sample_spec);
@@ -114,10 +139,19 @@ pa_memblockq* pa_memblockq_new(
 }
 
 void pa_memblockq_free(pa_memblockq* bq) {
+    struct list_item *q;
+
     pa_assert(bq);
 
     pa_memblockq_silence(bq);
 
+    while ((q = bq->free_items)) {
+        bq->free_items = q->next;
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(list_items), q) < 0)
+            pa_xfree(q);
+    }
+
     if (bq->silence.memblock)
         pa_memblock_unref(bq->silence.memblock);
 
@@ -128,7 +162,129 @@ void pa_memblockq_free(pa_memblockq* bq) {
     pa_xfree(bq);
 }
 
+static struct list_item *new_list_item(pa_memblockq *bq) {
+    struct list_item *q;
+
+    if ((q = bq->free_items)) {
+        bq->free_items = q->next;
+        bq->n_free_items--;
+    } else if (!(q = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
+        q = pa_xnew(struct list_item, 1);
+
+    return q;
+}
+
+static void free_list_item(pa_memblockq *bq, struct list_item *q) {
+
+    if (bq->n_free_items < FREE_ITEMS_MAX) {
+        q->next = bq->free_items;
+        bq->free_items = q;
+        bq->n_free_items++;
+    } else if (pa_flist_push(PA_STATIC_FLIST_GET(list_items), q) < 0)
+        pa_xfree(q);
+}
+
+/* Returns the last block that starts at or before idx, or NULL if
+ * there is none */
+static struct list_item *find_block(pa_memblockq *bq, int64_t idx) {
+    struct list_item *q = NULL, *n;
+    int k;
+
+    for (k = SKIP_LEVELS - 1; k >= 0; k--)
+        for (n = q ? q->skip_next[k] : bq->skip_head[k]; n && n->index <= idx; n = n->skip_next[k])
+            q = n;
+
+    for (n = q ? q->next : bq->blocks; n && n->index <= idx; n = n->next)
+        q = n;
+
+    return q;
+}
+
+/* Finds the last item on each skip list level that starts before
+ * idx, NULL meaning the head of that level */
+static void find_skip_prev(pa_memblockq *bq, int64_t idx, struct list_item *prev[SKIP_LEVELS]) {
+    struct list_item *q = NULL, *n;
+    int k;
+
+    for (k = SKIP_LEVELS - 1; k >= 0; k--) {
+        for (n = q ? q->skip_next[k] : bq->skip_head[k]; n && n->index < idx; n = n->skip_next[k])
+            q = n;
+
+        prev[k] = q;
+    }
+}
+
+/* Called after n has been added to the block list */
+static void skip_link(pa_memblockq *bq, struct list_item *n) {
+    struct list_item *prev[SKIP_LEVELS];
+    unsigned i, k;
+
+    /* Promote every SKIP_FACTOR-th item by one level */
+    n->level = 0;
+    for (i = ++bq->n_inserted; n->level < SKIP_LEVELS && !(i & ((1U << SKIP_FACTOR_SHIFT) - 1)); i >>= SKIP_FACTOR_SHIFT)
+        n->level++;
+
+    if (n->level <= 0)
+        return;
+
+    /* Appending is the common case */
+    if (!n->next)
+        memcpy(prev, bq->skip_tail, sizeof(prev));
+    else
+        find_skip_prev(bq, n->index, prev);
+
+    for (k = 0; k < n->level; k++) {
+        if (prev[k]) {
+            n->skip_next[k] = prev[k]->skip_next[k];
+            prev[k]->skip_next[k] = n;
+        } else {
+            n->skip_next[k] = bq->skip_head[k];
+            bq->skip_head[k] = n;
+        }
+
+        if (!n->skip_next[k])
+            bq->skip_tail[k] = n;
+    }
+}
+
+/* Called before q is removed from the block list */
+static void skip_unlink(pa_memblockq *bq, struct list_item *q) {
+    struct list_item *prev[SKIP_LEVELS];
+    unsigned k;
+
+    if (q->level <= 0)
+        return;
+
+    /* Dropping from the front is the common case */
+    if (q == bq->blocks)
+        memset(prev, 0, sizeof(prev));
+    else
+        find_skip_prev(bq, q->index, prev);
+
+    for (k = 0; k < q->level; k++) {
+        if (prev[k]) {
+            pa_assert(prev[k]->skip_next[k] == q);
+            prev[k]->skip_next[k] = q->skip_next[k];
+        } else {
+            pa_assert(bq->skip_head[k] == q);
+            bq->skip_head[k] = q->skip_next[k];
+        }
+
+        if (bq->skip_tail[k] == q)
+            bq->skip_tail[k] = prev[k];
+    }
+}
+
+/* The first block that ends after the read index, i.e. the block to
+ * play or the one following the silence to play */
+static pa_bool_t is_current_read(pa_memblockq *bq, struct list_item *q) {
+    return q->index + (int64_t) q->chunk.length > bq->read_index &&
+        (!q->prev || q->prev->index + (int64_t) q->prev->chunk.length <= bq->read_index);
+}
+
 static void fix_current_read(pa_memblockq *bq) {
+    struct list_item *q;
+
     pa_assert(bq);
 
     if (PA_UNLIKELY(!bq->blocks)) {
@@ -136,27 +292,45 @@ static void fix_current_read(pa_memblockq *bq) {
         return;
     }
 
-    if (PA_UNLIKELY(!bq->current_read))
-        bq->current_read = bq->blocks;
+    /* Usually we are already at the right block, or just before it */
+    if (PA_LIKELY((q = bq->current_read))) {
 
-    /* Scan left */
-    while (PA_UNLIKELY(bq->current_read->index > bq->read_index))
+        if (is_current_read(bq, q))
+            return;
 
-        if (bq->current_read->prev)
-            bq->current_read = bq->current_read->prev;
-        else
-            break;
+        if (q->next && is_current_read(bq, q->next)) {
+            bq->current_read = q->next;
+            return;
+        }
+    }
 
-    /* Scan right */
-    while (PA_LIKELY(bq->current_read != NULL) && PA_UNLIKELY(bq->current_read->index + (int64_t) bq->current_read->chunk.length <= bq->read_index))
-        bq->current_read = bq->current_read->next;
+    if (bq->blocks_tail->index + (int64_t) bq->blocks_tail->chunk.length <= bq->read_index) {
+        bq->current_read = NULL;
+        return;
+    }
+
+    /* We were rewound or everything was played, look it up */
+    if (!(q = find_block(bq, bq->read_index)))
+        q = bq->blocks;
+    else if (q->index + (int64_t) q->chunk.length <= bq->read_index)
+        q = q->next;
+
+    bq->current_read = q;
 
     /* At this point current_read will either point at or left of the
        next block to play. It may be NULL in case everything in
        the queue was already played */
 }
 
+/* The last block that starts at or before the write index */
+static pa_bool_t is_current_write(pa_memblockq *bq, struct list_item *q) {
+    return q->index <= bq->write_index &&
+        (!q->next || q->next->index > bq->write_index);
+}
+
 static void fix_current_write(pa_memblockq *bq) {
+    struct list_item *q;
+
     pa_assert(bq);
 
     if (PA_UNLIKELY(!bq->blocks)) {
@@ -164,20 +338,19 @@ static void fix_current_write(pa_memblockq *bq) {
         return;
     }
 
-    if (PA_UNLIKELY(!bq->current_write))
-        bq->current_write = bq->blocks_tail;
+    /* Usually we are already at the right block, or just before it */
+    if (PA_LIKELY((q = bq->current_write))) {
 
-    /* Scan right */
-    while (PA_UNLIKELY(bq->current_write->index + (int64_t) bq->current_write->chunk.length <= bq->write_index))
+        if (is_current_write(bq, q))
+            return;
 
-        if (bq->current_write->next)
-            bq->current_write = bq->current_write->next;
-        else
-            break;
+        if (q->next && is_current_write(bq, q->next)) {
+            bq->current_write = q->next;
+            return;
+        }
+    }
 
-    /* Scan left */
-    while (PA_LIKELY(bq->current_write != NULL) && PA_UNLIKELY(bq->current_write->index > bq->write_index))
-        bq->current_write = bq->current_write->prev;
+    bq->current_write = find_block(bq, bq->write_index);
 
     /* At this point current_write will either point at or right of
        the next block to write data to. It may be NULL in case
@@ -190,6 +363,8 @@ static void drop_block(pa_memblockq *bq, struct list_item *q) {
 
     pa_assert(bq->n_blocks >= 1);
 
+    skip_unlink(bq, q);
+
     if (q->prev)
         q->prev->next = q->next;
     else {
@@ -211,9 +386,7 @@ static void drop_block(pa_memblockq *bq, struct list_item *q) {
         bq->current_read = q->next;
 
     pa_memblock_unref(q->chunk.memblock);
-
-    if (pa_flist_push(PA_STATIC_FLIST_GET(list_items), q) < 0)
-        pa_xfree(q);
+    free_list_item(bq, q);
 
     bq->n_blocks--;
 }
@@ -350,8 +523,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
                 size_t d;
 
                 /* Create a new list entry for the end of the memchunk */
-                if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
-                    p = pa_xnew(struct list_item, 1);
+                p = new_list_item(bq);
 
                 p->chunk = q->chunk;
                 pa_memblock_ref(p->chunk.memblock);
@@ -362,6 +534,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
 
                 /* Drop it from the new entry */
                 p->index = q->index + (int64_t) d;
+                p->chunk.index += d;
                 p->chunk.length -= d;
 
                 /* Add it to the list */
@@ -372,6 +545,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
                     bq->blocks_tail = p;
                 q->next = p;
 
+                skip_link(bq, p);
                 bq->n_blocks++;
             }
 
@@ -420,8 +594,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     } else
         pa_assert(!bq->blocks || (bq->write_index + (int64_t)chunk.length <= bq->blocks->index));
 
-    if (!(n = pa_flist_pop(PA_STATIC_FLIST_GET(list_items))))
-        n = pa_xnew(struct list_item, 1);
+    n = new_list_item(bq);
 
     n->chunk = chunk;
     pa_memblock_ref(n->chunk.memblock);
@@ -441,6 +614,7 @@ int pa_memblockq_push(pa_memblockq* bq, const pa_memchunk *uchunk) {
     else
         bq->blocks = n;
 
+    skip_link(bq, n);
     bq->n_blocks++;
 
 finish:
@@ -0,0 +1,231 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sample-util.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <immintrin.h>
+
+/* Same approach as mix_sse.c, one 256 bit register holds the 8 samples
+ * processed per iteration. */
+
+#define MIX_STEP 8
+
+static unsigned channel_wrap(unsigned channels) {
+    unsigned wrap = channels;
+
+    while (wrap < MIX_STEP)
+        wrap += channels;
+
+    return wrap;
+}
+
+static void pa_mix_s16ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    int16_t *d = data, *e = end;
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        __m256i sum = _mm256_setzero_si256();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m256i v, cv, hi, lo;
+
+            v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) m->ptr));
+            cv = _mm256_loadu_si256((const __m256i *) &m->linear[channel]);
+
+            /* ((v * lo) >> 16) + (v * hi), see pa_mix_s16ne_c() */
+            hi = _mm256_srai_epi32(cv, 16);
+            lo = _mm256_and_si256(cv, mask);
+
+            sum = _mm256_add_epi32(sum, _mm256_add_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(v, lo), 16),
+                                                         _mm256_mullo_epi32(v, hi)));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(int16_t);
+        }
+
+        _mm_storeu_si128((__m128i *) d, _mm_packs_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1)));
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        int32_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t v, lo, hi, cv = m->linear[channel].i;
+
+            if (PA_LIKELY(cv > 0)) {
+                hi = cv >> 16;
+                lo = cv & 0xFFFF;
+
+                v = *((int16_t*) m->ptr);
+                v = ((v * lo) >> 16) + (v * hi);
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int16_t);
+        }
+
+        *d = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+    }
+}
+
+/* Arithmetic right shift of 64 bit values by 16 */
+static inline __m256i srai_epi64_16(__m256i a) {
+    __m256i sign = _mm256_cmpgt_epi64(_mm256_setzero_si256(), a);
+
+    return _mm256_or_si256(_mm256_srli_epi64(a, 16), _mm256_slli_epi64(sign, 48));
+}
+
+/* Clamps 64 bit values to the 32 bit range, the result is in the even
+ * dwords */
+static inline __m256i clamp_epi64(__m256i a) {
+    const __m256i max = _mm256_set1_epi64x(0x7FFFFFFFLL), min = _mm256_set1_epi64x(-0x80000000LL);
+
+    a = _mm256_blendv_epi8(a, max, _mm256_cmpgt_epi64(a, max));
+    return _mm256_blendv_epi8(a, min, _mm256_cmpgt_epi64(min, a));
+}
+
+static void pa_mix_s32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    int32_t *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        __m256i even = _mm256_setzero_si256(), odd = _mm256_setzero_si256();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m256i v, cv;
+
+            v = _mm256_loadu_si256((const __m256i *) m->ptr);
+            cv = _mm256_loadu_si256((const __m256i *) &m->linear[channel]);
+
+            even = _mm256_add_epi64(even, srai_epi64_16(_mm256_mul_epi32(v, cv)));
+            odd = _mm256_add_epi64(odd, srai_epi64_16(_mm256_mul_epi32(_mm256_srli_epi64(v, 32), _mm256_srli_epi64(cv, 32))));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(int32_t);
+        }
+
+        _mm256_storeu_si256((__m256i *) d, _mm256_blend_epi32(clamp_epi64(even), _mm256_slli_epi64(clamp_epi64(odd), 32), 0xAA));
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        int64_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t cv = m->linear[channel].i;
+            int64_t v;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((int32_t*) m->ptr);
+                v = (v * cv) >> 16;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int32_t);
+        }
+
+        *d = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+    }
+}
+
+/* v * cv, but 0 where cv isn't positive. Like in the C version, muted
+ * streams must not contribute anything, not even NaN or infinity. */
+static inline __m256 volume_float(__m256 v, __m256 cv) {
+    return _mm256_and_ps(_mm256_mul_ps(v, cv), _mm256_cmp_ps(cv, _mm256_setzero_ps(), _CMP_GT_OQ));
+}
+
+static void pa_mix_float32ne_avx2(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    float *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        __m256 sum = _mm256_setzero_ps();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+
+            /* No FMA here, it would round differently than the C version */
+            sum = _mm256_add_ps(sum, volume_float(_mm256_loadu_ps(m->ptr), _mm256_loadu_ps(&m->linear[channel].f)));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(float);
+        }
+
+        _mm256_storeu_ps(d, sum);
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        float sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            float v, cv = m->linear[channel].f;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((float*) m->ptr);
+                v *= cv;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(float);
+        }
+
+        *d = sum;
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_avx(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_AVX2) {
+        pa_log_info("Initialising AVX2 optimized mixing functions.");
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_avx2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_avx2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -0,0 +1,211 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-arm.h"
+#include "sample-util.h"
+
+#include <arm_neon.h>
+
+/* Same approach as mix_sse.c: 8 samples per iteration, volume factors
+ * are loaded from the padded linear[] array. Note that NEON flushes
+ * denormals to zero, so the float version only matches the C version
+ * for normal numbers. */
+
+#define MIX_STEP 8
+
+static unsigned channel_wrap(unsigned channels) {
+    unsigned wrap = channels;
+
+    while (wrap < MIX_STEP)
+        wrap += channels;
+
+    return wrap;
+}
+
+/* ((v * lo) >> 16) + (v * hi), see pa_mix_s16ne_c() */
+static inline int32x4_t volume_s16(int32x4_t v, int32x4_t cv) {
+    int32x4_t hi, lo;
+
+    hi = vshrq_n_s32(cv, 16);
+    lo = vandq_s32(cv, vdupq_n_s32(0xFFFF));
+
+    return vaddq_s32(vshrq_n_s32(vmulq_s32(v, lo), 16), vmulq_s32(v, hi));
+}
+
+static void pa_mix_s16ne_neon(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    int16_t *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        int32x4_t sum0 = vdupq_n_s32(0), sum1 = vdupq_n_s32(0);
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int16x8_t v = vld1q_s16(m->ptr);
+
+            sum0 = vaddq_s32(sum0, volume_s16(vmovl_s16(vget_low_s16(v)), vld1q_s32(&m->linear[channel].i)));
+            sum1 = vaddq_s32(sum1, volume_s16(vmovl_s16(vget_high_s16(v)), vld1q_s32(&m->linear[channel + 4].i)));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(int16_t);
+        }
+
+        vst1q_s16(d, vcombine_s16(vqmovn_s32(sum0), vqmovn_s32(sum1)));
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        int32_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t v, lo, hi, cv = m->linear[channel].i;
+
+            if (PA_LIKELY(cv > 0)) {
+                hi = cv >> 16;
+                lo = cv & 0xFFFF;
+
+                v = *((int16_t*) m->ptr);
+                v = ((v * lo) >> 16) + (v * hi);
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int16_t);
+        }
+
+        *d = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+    }
+}
+
+static void pa_mix_s32ne_neon(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    int32_t *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        int64x2_t sum[4];
+        unsigned i, j;
+
+        for (j = 0; j < 4; j++)
+            sum[j] = vdupq_n_s64(0);
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const int32_t *p = m->ptr;
+
+            for (j = 0; j < 4; j++)
+                sum[j] = vaddq_s64(sum[j], vshrq_n_s64(vmull_s32(vld1_s32(p + 2 * j), vld1_s32(&m->linear[channel + 2 * j].i)), 16));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(int32_t);
+        }
+
+        vst1q_s32(d, vcombine_s32(vqmovn_s64(sum[0]), vqmovn_s64(sum[1])));
+        vst1q_s32(d + 4, vcombine_s32(vqmovn_s64(sum[2]), vqmovn_s64(sum[3])));
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        int64_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t cv = m->linear[channel].i;
+            int64_t v;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((int32_t*) m->ptr);
+                v = (v * cv) >> 16;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int32_t);
+        }
+
+        *d = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+    }
+}
+
+/* v * cv, but 0 where cv isn't positive. Like in the C version, muted
+ * streams must not contribute anything, not even NaN or infinity. */
+static inline float32x4_t volume_float(float32x4_t v, float32x4_t cv) {
+    return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vmulq_f32(v, cv)), vcgtq_f32(cv, vdupq_n_f32(0))));
+}
+
+static void pa_mix_float32ne_neon(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    float *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        float32x4_t sum0 = vdupq_n_f32(0), sum1 = vdupq_n_f32(0);
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const float *p = m->ptr;
+
+            /* Separate multiply and add, vmla rounds like that too but
+             * let's be explicit about it */
+            sum0 = vaddq_f32(sum0, volume_float(vld1q_f32(p), vld1q_f32(&m->linear[channel].f)));
+            sum1 = vaddq_f32(sum1, volume_float(vld1q_f32(p + 4), vld1q_f32(&m->linear[channel + 4].f)));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(float);
+        }
+
+        vst1q_f32(d, sum0);
+        vst1q_f32(d + 4, sum1);
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        float sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            float v, cv = m->linear[channel].f;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((float*) m->ptr);
+                v *= cv;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(float);
+        }
+
+        *d = sum;
+    }
+}
+
+void pa_mix_func_init_neon(pa_cpu_arm_flag_t flags) {
+    pa_log_info("Initialising ARM NEON optimized mixing functions.");
+
+    pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_neon);
+    pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_neon);
+    pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_neon);
+}
@@ -0,0 +1,288 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <pulsecore/macro.h>
+#include <pulsecore/log.h>
+
+#include "cpu-x86.h"
+#include "sample-util.h"
+
+#if defined (__i386__) || defined (__amd64__)
+
+#include <emmintrin.h>
+
+/* All functions below process 8 samples per iteration and produce
+ * exactly the same output as their C counterparts in sample-util.c:
+ * streams are summed in the same order and the integer paths use the
+ * same fixed point arithmetic. The channel index into the stream
+ * volumes is kept modulo a multiple of the channel count that is at
+ * least 8, which together with PA_MIX_VOLUME_PADDING lets us load the
+ * factors for 8 consecutive samples at once. */
+
+#define MIX_STEP 8
+
+static unsigned channel_wrap(unsigned channels) {
+    unsigned wrap = channels;
+
+    while (wrap < MIX_STEP)
+        wrap += channels;
+
+    return wrap;
+}
+
+/* Lower 32 bits of a 32x32 bit multiplication, i.e. _mm_mullo_epi32()
+ * which is only available with SSE4.1 */
+static inline __m128i mullo_epi32(__m128i a, __m128i b) {
+    __m128i even, odd;
+
+    even = _mm_mul_epu32(a, b);
+    odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+/* ((v * lo) >> 16) + (v * hi), see pa_mix_s16ne_c() */
+static inline __m128i volume_s16(__m128i v, __m128i cv) {
+    __m128i hi, lo;
+
+    hi = _mm_srai_epi32(cv, 16);
+    lo = _mm_and_si128(cv, _mm_set1_epi32(0xFFFF));
+
+    return _mm_add_epi32(_mm_srai_epi32(mullo_epi32(v, lo), 16), mullo_epi32(v, hi));
+}
+
+static void pa_mix_s16ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    int16_t *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        __m128i sum0 = _mm_setzero_si128(), sum1 = _mm_setzero_si128();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            __m128i v, v0, v1;
+
+            v = _mm_loadu_si128((const __m128i *) m->ptr);
+            v0 = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+            v1 = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+            sum0 = _mm_add_epi32(sum0, volume_s16(v0, _mm_loadu_si128((const __m128i *) &m->linear[channel])));
+            sum1 = _mm_add_epi32(sum1, volume_s16(v1, _mm_loadu_si128((const __m128i *) &m->linear[channel + 4])));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(int16_t);
+        }
+
+        /* packssdw clamps exactly like PA_CLAMP_UNLIKELY() */
+        _mm_storeu_si128((__m128i *) d, _mm_packs_epi32(sum0, sum1));
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        int32_t sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t v, lo, hi, cv = m->linear[channel].i;
+
+            if (PA_LIKELY(cv > 0)) {
+                hi = cv >> 16;
+                lo = cv & 0xFFFF;
+
+                v = *((int16_t*) m->ptr);
+                v = ((v * lo) >> 16) + (v * hi);
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int16_t);
+        }
+
+        *d = (int16_t) PA_CLAMP_UNLIKELY(sum, -0x8000, 0x7FFF);
+    }
+}
+
+/* Signed 32x32->64 bit multiplication of the even dwords, i.e.
+ * _mm_mul_epi32() which is only available with SSE4.1. b must not be
+ * negative. */
+static inline __m128i mul_epi32(__m128i a, __m128i b) {
+    __m128i p, c;
+
+    p = _mm_mul_epu32(a, b);
+
+    /* _mm_mul_epu32() treated negative a as a + 2^32 */
+    c = _mm_and_si128(_mm_srai_epi32(a, 31), b);
+
+    return _mm_sub_epi64(p, _mm_slli_epi64(c, 32));
+}
+
+/* Arithmetic right shift of 64 bit values by 16 */
+static inline __m128i srai_epi64_16(__m128i a) {
+    __m128i sign;
+
+    sign = _mm_shuffle_epi32(_mm_srai_epi32(a, 31), _MM_SHUFFLE(3, 3, 1, 1));
+
+    return _mm_or_si128(_mm_srli_epi64(a, 16), _mm_slli_epi64(sign, 48));
+}
+
+/* Clamps 64 bit values to the 32 bit range, the result is in the even
+ * dwords */
+static inline __m128i clamp_epi64(__m128i a) {
+    __m128i sign, fits, sat;
+
+    sign = _mm_srai_epi32(a, 31);
+
+    /* A value fits if the high dword is the sign extension of the low one */
+    fits = _mm_cmpeq_epi32(a, _mm_slli_epi64(sign, 32));
+    fits = _mm_shuffle_epi32(fits, _MM_SHUFFLE(3, 3, 1, 1));
+
+    sign = _mm_shuffle_epi32(sign, _MM_SHUFFLE(3, 3, 1, 1));
+    sat = _mm_xor_si128(sign, _mm_set1_epi32(0x7FFFFFFF));
+
+    return _mm_or_si128(_mm_and_si128(fits, a), _mm_andnot_si128(fits, sat));
+}
+
+static inline __m128i mix_s32(pa_mix_info streams[], unsigned nstreams, unsigned channel, unsigned offset) {
+    __m128i even = _mm_setzero_si128(), odd = _mm_setzero_si128();
+    unsigned i;
+
+    for (i = 0; i < nstreams; i++) {
+        pa_mix_info *m = streams + i;
+        __m128i v, cv;
+
+        v = _mm_loadu_si128((const __m128i *) ((int32_t*) m->ptr + offset));
+        cv = _mm_loadu_si128((const __m128i *) &m->linear[channel + offset]);
+
+        even = _mm_add_epi64(even, srai_epi64_16(mul_epi32(v, cv)));
+        odd = _mm_add_epi64(odd, srai_epi64_16(mul_epi32(_mm_srli_epi64(v, 32), _mm_srli_epi64(cv, 32))));
+    }
+
+    return _mm_or_si128(_mm_and_si128(clamp_epi64(even), _mm_set_epi32(0, -1, 0, -1)),
+                        _mm_slli_epi64(clamp_epi64(odd), 32));
+}
+
+static void pa_mix_s32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    int32_t *d = data, *e = end;
+    unsigned i;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        _mm_storeu_si128((__m128i *) d, mix_s32(streams, nstreams, channel, 0));
+        _mm_storeu_si128((__m128i *) (d + 4), mix_s32(streams, nstreams, channel, 4));
+
+        for (i = 0; i < nstreams; i++)
+            streams[i].ptr = (uint8_t*) streams[i].ptr + MIX_STEP * sizeof(int32_t);
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        int64_t sum = 0;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            int32_t cv = m->linear[channel].i;
+            int64_t v;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((int32_t*) m->ptr);
+                v = (v * cv) >> 16;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(int32_t);
+        }
+
+        *d = (int32_t) PA_CLAMP_UNLIKELY(sum, -0x80000000LL, 0x7FFFFFFFLL);
+    }
+}
+
+/* v * cv, but 0 where cv isn't positive. Like in the C version, muted
+ * streams must not contribute anything, not even NaN or infinity. */
+static inline __m128 volume_float(__m128 v, __m128 cv) {
+    return _mm_and_ps(_mm_mul_ps(v, cv), _mm_cmpgt_ps(cv, _mm_setzero_ps()));
+}
+
+static void pa_mix_float32ne_sse2(pa_mix_info streams[], unsigned nstreams, unsigned channels, void *data, void *end) {
+    unsigned channel = 0, wrap = channel_wrap(channels);
+    float *d = data, *e = end;
+
+    for (; e - d >= MIX_STEP; d += MIX_STEP) {
+        __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            const float *p = m->ptr;
+
+            sum0 = _mm_add_ps(sum0, volume_float(_mm_loadu_ps(p), _mm_loadu_ps(&m->linear[channel].f)));
+            sum1 = _mm_add_ps(sum1, volume_float(_mm_loadu_ps(p + 4), _mm_loadu_ps(&m->linear[channel + 4].f)));
+
+            m->ptr = (uint8_t*) m->ptr + MIX_STEP * sizeof(float);
+        }
+
+        _mm_storeu_ps(d, sum0);
+        _mm_storeu_ps(d + 4, sum1);
+
+        channel += MIX_STEP;
+        if (channel >= wrap)
+            channel -= wrap;
+    }
+
+    for (; d < e; d++, channel++) {
+        float sum = 0;
+        unsigned i;
+
+        for (i = 0; i < nstreams; i++) {
+            pa_mix_info *m = streams + i;
+            float v, cv = m->linear[channel].f;
+
+            if (PA_LIKELY(cv > 0)) {
+                v = *((float*) m->ptr);
+                v *= cv;
+                sum += v;
+            }
+            m->ptr = (uint8_t*) m->ptr + sizeof(float);
+        }
+
+        *d = sum;
+    }
+}
+
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+void pa_mix_func_init_sse(pa_cpu_x86_flag_t flags) {
+#if defined (__i386__) || defined (__amd64__)
+    if (flags & PA_CPU_X86_SSE2) {
+        pa_log_info("Initialising SSE2 optimized mixing functions.");
+
+        pa_set_mix_func(PA_SAMPLE_S16NE, (pa_do_mix_func_t) pa_mix_s16ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_S32NE, (pa_do_mix_func_t) pa_mix_s32ne_sse2);
+        pa_set_mix_func(PA_SAMPLE_FLOAT32NE, (pa_do_mix_func_t) pa_mix_float32ne_sse2);
+    }
+#endif /* defined (__i386__) || defined (__amd64__) */
+}
@@ -176,6 +176,13 @@ enum {
     /* Supported since protocol v27 (3.0) */
     PA_COMMAND_SET_PORT_LATENCY_OFFSET,
 
+    /* Supported since protocol v28 (4.0) */
+    PA_COMMAND_ENABLE_SRBCHANNEL,
+    PA_COMMAND_DISABLE_SRBCHANNEL,
+
+    /* Supported since protocol v29 (5.0) */
+    PA_COMMAND_GET_INFO_LIST_SINCE,
+
     PA_COMMAND_MAX
 };
 
@@ -25,11 +25,89 @@
 
 #include <stdlib.h>
 
+#include <string.h>
+
 #include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
 
 #include "packet.h"
 
+/* Payload buffers of outgoing packets are recycled through a free list
+ * per size class. Larger buffers are just malloc()ed and free()d. */
+#define BUFFER_SIZE_SMALL 512
+#define BUFFER_SIZE_MEDIUM 4096
+#define BUFFER_SIZE_LARGE 32768
+
+PA_STATIC_FLIST_DECLARE(small_buffers, 0, pa_xfree);
+PA_STATIC_FLIST_DECLARE(medium_buffers, 0, pa_xfree);
+PA_STATIC_FLIST_DECLARE(large_buffers, 32, pa_xfree);
+
+PA_STATIC_FLIST_DECLARE(packets, 0, pa_xfree);
+
+static pa_flist *buffer_flist(size_t size) {
+    switch (size) {
+        case BUFFER_SIZE_SMALL:
+            return PA_STATIC_FLIST_GET(small_buffers);
+        case BUFFER_SIZE_MEDIUM:
+            return PA_STATIC_FLIST_GET(medium_buffers);
+        case BUFFER_SIZE_LARGE:
+            return PA_STATIC_FLIST_GET(large_buffers);
+        default:
+            return NULL;
+    }
+}
+
+void* pa_packet_buffer_alloc(size_t *size) {
+    pa_flist *l;
+    void *p;
+
+    pa_assert(size);
+    pa_assert(*size > 0);
+
+    if (*size <= BUFFER_SIZE_SMALL)
+        *size = BUFFER_SIZE_SMALL;
+    else if (*size <= BUFFER_SIZE_MEDIUM)
+        *size = BUFFER_SIZE_MEDIUM;
+    else if (*size <= BUFFER_SIZE_LARGE)
+        *size = BUFFER_SIZE_LARGE;
+
+    if ((l = buffer_flist(*size)) && (p = pa_flist_pop(l)))
+        return p;
+
+    return pa_xmalloc(*size);
+}
+
+void* pa_packet_buffer_realloc(void *p, size_t length, size_t allocated, size_t *size) {
+    void *n;
+
+    pa_assert(size);
+    pa_assert(length <= allocated);
+    pa_assert(length <= *size);
+
+    if (!p)
+        return pa_packet_buffer_alloc(size);
+
+    /* Beyond the size classes realloc() may get away without copying */
+    if (allocated > BUFFER_SIZE_LARGE)
+        return pa_xrealloc(p, *size);
+
+    n = pa_packet_buffer_alloc(size);
+    memcpy(n, p, length);
+    pa_packet_buffer_free(p, allocated);
+
+    return n;
+}
+
+void pa_packet_buffer_free(void *p, size_t size) {
+    pa_flist *l;
+
+    pa_assert(p);
+
+    if (!(l = buffer_flist(size)) || pa_flist_push(l, p) < 0)
+        pa_xfree(p);
+}
+
 pa_packet* pa_packet_new(size_t length) {
     pa_packet *p;
 
@@ -50,15 +128,30 @@ pa_packet* pa_packet_new_dynamic(void* data, size_t length) {
     pa_assert(data);
     pa_assert(length > 0);
 
-    p = pa_xnew(pa_packet, 1);
+    if (!(p = pa_flist_pop(PA_STATIC_FLIST_GET(packets))))
+        p = pa_xnew(pa_packet, 1);
+
     PA_REFCNT_INIT(p);
     p->length = length;
     p->data = data;
+    p->allocated = 0;
     p->type = PA_PACKET_DYNAMIC;
 
     return p;
 }
 
+pa_packet* pa_packet_new_pooled(void* data, size_t length, size_t allocated) {
+    pa_packet *p;
+
+    pa_assert(length <= allocated);
+
+    p = pa_packet_new_dynamic(data, length);
+    p->allocated = allocated;
+    p->type = PA_PACKET_POOLED;
+
+    return p;
+}
+
 pa_packet* pa_packet_ref(pa_packet *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
@@ -72,8 +165,17 @@ void pa_packet_unref(pa_packet *p) {
     pa_assert(PA_REFCNT_VALUE(p) >= 1);
 
     if (PA_REFCNT_DEC(p) <= 0) {
+        if (p->type == PA_PACKET_APPENDED) {
+            pa_xfree(p);
+            return;
+        }
+
         if (p->type == PA_PACKET_DYNAMIC)
             pa_xfree(p->data);
-        pa_xfree(p);
+        else
+            pa_packet_buffer_free(p->data, p->allocated);
+
+        if (pa_flist_push(PA_STATIC_FLIST_GET(packets), p) < 0)
+            pa_xfree(p);
     }
 }
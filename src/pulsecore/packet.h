@@ -29,14 +29,27 @@
 
 typedef struct pa_packet {
     PA_REFCNT_DECLARE;
-    enum { PA_PACKET_APPENDED, PA_PACKET_DYNAMIC } type;
+    enum { PA_PACKET_APPENDED, PA_PACKET_DYNAMIC, PA_PACKET_POOLED } type;
     size_t length;
     uint8_t *data;
+    size_t allocated; /* Only for PA_PACKET_POOLED */
 } pa_packet;
 
 pa_packet* pa_packet_new(size_t length);
 pa_packet* pa_packet_new_dynamic(void* data, size_t length);
 
+/* Takes ownership of a buffer from pa_packet_buffer_alloc() of the
+ * given size, and returns it to the pool when the packet is freed */
+pa_packet* pa_packet_new_pooled(void* data, size_t length, size_t allocated);
+
+/* Returns a buffer of at least *size bytes and stores its actual size
+ * in *size */
+void* pa_packet_buffer_alloc(size_t *size);
+/* Moves the first length bytes of a buffer from pa_packet_buffer_alloc()
+ * into one of at least *size bytes. p may be NULL. */
+void* pa_packet_buffer_realloc(void *p, size_t length, size_t allocated, size_t *size);
+void pa_packet_buffer_free(void *p, size_t size);
+
 pa_packet* pa_packet_ref(pa_packet *p);
 void pa_packet_unref(pa_packet *p);
 
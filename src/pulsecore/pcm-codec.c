@@ -0,0 +1,827 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-util.h>
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/sample-util.h>
+
+#include "pcm-codec.h"
+
+/* Every packet starts with this header:
+ *
+ *   uint8_t  'P', 'C'
+ *   uint8_t  codec type
+ *   uint8_t  number of channels
+ *   uint32_t length of the packet including header and padding (LE)
+ *   uint32_t number of frames (LE)
+ *
+ * followed by the channels one after another and zero padding up to a
+ * multiple of the frame size. */
+
+#define HEADER_SIZE 12
+#define MAX_PACKET_FRAMES 2048
+
+/* Lossless channels start with a 3 bit method, which is the predictor
+ * order or METHOD_VERBATIM. Predicted channels continue with the
+ * warm-up samples and one Rice parameter per partition of the
+ * residual. Quotients of RICE_ESCAPE or more are written as
+ * RICE_ESCAPE zero bits followed by the raw value. */
+#define METHOD_BITS 3
+#define METHOD_VERBATIM 7
+#define MAX_ORDER 3
+#define PARTITION_SIZE 256
+#define RICE_PARAM_BITS 5
+#define MAX_RICE_PARAM 20
+#define RICE_ESCAPE 24
+#define ESCAPE_BITS 20
+
+/* ADPCM channels start with the first sample (LE) and the step index,
+ * followed by one nibble per remaining sample, low nibble first. */
+#define ADPCM_CHANNEL_HEADER 3
+
+struct pa_pcm_codec {
+    pa_pcm_codec_type_t type;
+    pa_sample_spec ss;
+    size_t frame_size;
+    pa_bool_t swap;
+    pa_mempool *pool;
+
+    int32_t *samples, *residual;
+    uint8_t *adpcm_index;
+
+    uint8_t *pending;
+    size_t n_pending, pending_size;
+};
+
+struct bit_writer {
+    uint8_t *p;
+    uint64_t acc;
+    unsigned n;
+};
+
+struct bit_reader {
+    const uint8_t *p, *end;
+    uint64_t acc;
+    unsigned n;
+    pa_bool_t error;
+};
+
+static const int16_t adpcm_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t adpcm_index_table[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const char * const type_names[PA_PCM_CODEC_MAX] = {
+    [PA_PCM_CODEC_NONE] = "none",
+    [PA_PCM_CODEC_LOSSLESS] = "lossless",
+    [PA_PCM_CODEC_ADPCM] = "adpcm"
+};
+
+const char *pa_pcm_codec_type_to_string(pa_pcm_codec_type_t t) {
+
+    if (t < 0 || t >= PA_PCM_CODEC_MAX)
+        return NULL;
+
+    return type_names[t];
+}
+
+pa_pcm_codec_type_t pa_pcm_codec_type_from_string(const char *s) {
+    pa_pcm_codec_type_t t;
+
+    pa_assert(s);
+
+    for (t = 0; t < PA_PCM_CODEC_MAX; t++)
+        if (pa_streq(s, type_names[t]))
+            return t;
+
+    return PA_PCM_CODEC_INVALID;
+}
+
+pa_bool_t pa_pcm_codec_supported(pa_pcm_codec_type_t t, const pa_sample_spec *ss) {
+    pa_assert(ss);
+
+    return
+        (t == PA_PCM_CODEC_LOSSLESS || t == PA_PCM_CODEC_ADPCM) &&
+        (ss->format == PA_SAMPLE_S16LE || ss->format == PA_SAMPLE_S16BE) &&
+        pa_sample_spec_valid(ss);
+}
+
+pa_pcm_codec *pa_pcm_codec_new(pa_pcm_codec_type_t t, const pa_sample_spec *ss, pa_mempool *pool) {
+    pa_pcm_codec *c;
+
+    pa_assert(ss);
+    pa_assert(pool);
+
+    if (!pa_pcm_codec_supported(t, ss))
+        return NULL;
+
+    c = pa_xnew0(pa_pcm_codec, 1);
+    c->type = t;
+    c->ss = *ss;
+    c->frame_size = pa_frame_size(ss);
+    c->swap = ss->format != PA_SAMPLE_S16NE;
+    c->pool = pool;
+
+    c->samples = pa_xnew(int32_t, MAX_PACKET_FRAMES);
+    c->residual = pa_xnew(int32_t, MAX_PACKET_FRAMES);
+    c->adpcm_index = pa_xnew0(uint8_t, ss->channels);
+
+    return c;
+}
+
+void pa_pcm_codec_free(pa_pcm_codec *c) {
+    pa_assert(c);
+
+    pa_xfree(c->samples);
+    pa_xfree(c->residual);
+    pa_xfree(c->adpcm_index);
+    pa_xfree(c->pending);
+    pa_xfree(c);
+}
+
+static inline void write_u32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t) v;
+    p[1] = (uint8_t) (v >> 8);
+    p[2] = (uint8_t) (v >> 16);
+    p[3] = (uint8_t) (v >> 24);
+}
+
+static inline uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Upper bound of the encoded size of a packet, including the header
+ * and padding */
+static size_t max_packet_size(pa_pcm_codec *c, size_t n_frames) {
+    /* Verbatim lossless channels are the worst case of both codecs */
+    return HEADER_SIZE + c->ss.channels * (1 + n_frames * 2) + c->frame_size;
+}
+
+static void load_channel(pa_pcm_codec *c, const int16_t *src, unsigned channel, unsigned n_frames) {
+    unsigned i, channels = c->ss.channels;
+
+    src += channel;
+
+    if (c->swap)
+        for (i = 0; i < n_frames; i++, src += channels)
+            c->samples[i] = PA_INT16_SWAP(*src);
+    else
+        for (i = 0; i < n_frames; i++, src += channels)
+            c->samples[i] = *src;
+}
+
+static void store_channel(pa_pcm_codec *c, int16_t *dst, unsigned channel, unsigned n_frames) {
+    unsigned i, channels = c->ss.channels;
+
+    dst += channel;
+
+    if (c->swap)
+        for (i = 0; i < n_frames; i++, dst += channels)
+            *dst = PA_INT16_SWAP((int16_t) c->samples[i]);
+    else
+        for (i = 0; i < n_frames; i++, dst += channels)
+            *dst = (int16_t) c->samples[i];
+}
+
+static inline void bw_put(struct bit_writer *w, uint32_t v, unsigned bits) {
+    pa_assert(bits <= 32);
+
+    if (bits == 0)
+        return;
+
+    w->acc = (w->acc << bits) | v;
+    w->n += bits;
+
+    while (w->n >= 8) {
+        w->n -= 8;
+        *(w->p++) = (uint8_t) (w->acc >> w->n);
+    }
+}
+
+static inline void bw_flush(struct bit_writer *w) {
+    if (w->n > 0)
+        *(w->p++) = (uint8_t) (w->acc << (8 - w->n));
+
+    w->n = 0;
+    w->acc = 0;
+}
+
+static inline void br_refill(struct bit_reader *r) {
+    while (r->n <= 56 && r->p < r->end) {
+        r->acc |= (uint64_t) *(r->p++) << (56 - r->n);
+        r->n += 8;
+    }
+}
+
+static inline uint32_t br_get(struct bit_reader *r, unsigned bits) {
+    uint32_t v;
+
+    if (bits == 0)
+        return 0;
+
+    br_refill(r);
+
+    if (PA_UNLIKELY(r->n < bits)) {
+        r->error = TRUE;
+        return 0;
+    }
+
+    v = (uint32_t) (r->acc >> (64 - bits));
+    r->acc <<= bits;
+    r->n -= bits;
+
+    return v;
+}
+
+/* Returns the number of zero bits before the next one bit, at most
+ * RICE_ESCAPE. The one bit is consumed, the escape is not followed by
+ * one. */
+static inline unsigned br_get_unary(struct bit_reader *r) {
+    unsigned z;
+
+    br_refill(r);
+
+    z = r->acc ? (unsigned) __builtin_clzll(r->acc) : 64;
+
+    if (z >= RICE_ESCAPE) {
+        z = RICE_ESCAPE;
+
+        if (PA_UNLIKELY(r->n < z)) {
+            r->error = TRUE;
+            return 0;
+        }
+
+        r->acc <<= z;
+        r->n -= z;
+        return z;
+    }
+
+    if (PA_UNLIKELY(r->n < z + 1)) {
+        r->error = TRUE;
+        return 0;
+    }
+
+    r->acc <<= z + 1;
+    r->n -= z + 1;
+    return z;
+}
+
+static inline uint32_t zigzag(int32_t v) {
+    return ((uint32_t) v << 1) ^ (uint32_t) (v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u) {
+    return (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+}
+
+static inline int32_t predict(const int32_t *x, unsigned i, unsigned order) {
+    switch (order) {
+        case 0: return 0;
+        case 1: return x[i-1];
+        case 2: return 2 * x[i-1] - x[i-2];
+        default: return 3 * x[i-1] - 3 * x[i-2] + x[i-3];
+    }
+}
+
+static unsigned choose_order(const int32_t *x, unsigned n) {
+    uint64_t e[MAX_ORDER+1] = { 0, 0, 0, 0 };
+    unsigned i, order, best = 0;
+
+    if (n <= MAX_ORDER)
+        return 0;
+
+    for (i = MAX_ORDER; i < n; i++) {
+        int32_t d1 = x[i] - x[i-1];
+        int32_t d2 = d1 - (x[i-1] - x[i-2]);
+        int32_t d3 = d2 - (x[i-1] - 2 * x[i-2] + x[i-3]);
+
+        e[0] += (uint32_t) abs(x[i]);
+        e[1] += (uint32_t) abs(d1);
+        e[2] += (uint32_t) abs(d2);
+        e[3] += (uint32_t) abs(d3);
+    }
+
+    for (order = 1; order <= MAX_ORDER; order++)
+        if (e[order] < e[best])
+            best = order;
+
+    return best;
+}
+
+static unsigned choose_rice_param(const int32_t *r, unsigned n, uint64_t *bits) {
+    uint64_t sum = 0, b = 0;
+    unsigned i, k = 0;
+
+    for (i = 0; i < n; i++)
+        sum += zigzag(r[i]);
+
+    while (k < MAX_RICE_PARAM && ((uint64_t) n << (k + 1)) < sum)
+        k++;
+
+    for (i = 0; i < n; i++) {
+        uint32_t q = zigzag(r[i]) >> k;
+        b += q < RICE_ESCAPE ? q + 1 + k : RICE_ESCAPE + ESCAPE_BITS;
+    }
+
+    *bits += RICE_PARAM_BITS + b;
+    return k;
+}
+
+static void encode_lossless_channel(pa_pcm_codec *c, struct bit_writer *w, unsigned n) {
+    const int32_t *x = c->samples;
+    int32_t *r = c->residual;
+    unsigned k[MAX_PACKET_FRAMES / PARTITION_SIZE + 1];
+    unsigned i, p, order, m, n_partitions;
+    uint64_t bits;
+
+    order = choose_order(x, n);
+    m = n - order;
+
+    for (i = order; i < n; i++)
+        r[i - order] = x[i] - predict(x, i, order);
+
+    n_partitions = (m + PARTITION_SIZE - 1) / PARTITION_SIZE;
+    bits = 16 * order;
+
+    for (p = 0; p < n_partitions; p++)
+        k[p] = choose_rice_param(r + p * PARTITION_SIZE, PA_MIN(m - p * PARTITION_SIZE, (unsigned) PARTITION_SIZE), &bits);
+
+    if (bits >= 16 * (uint64_t) n) {
+        bw_put(w, METHOD_VERBATIM, METHOD_BITS);
+
+        for (i = 0; i < n; i++)
+            bw_put(w, (uint16_t) x[i], 16);
+
+        return;
+    }
+
+    bw_put(w, order, METHOD_BITS);
+
+    for (i = 0; i < order; i++)
+        bw_put(w, (uint16_t) x[i], 16);
+
+    for (p = 0, i = 0; p < n_partitions; p++) {
+        unsigned end = PA_MIN(m, (p + 1) * PARTITION_SIZE);
+
+        bw_put(w, k[p], RICE_PARAM_BITS);
+
+        for (; i < end; i++) {
+            uint32_t u = zigzag(r[i]);
+            uint32_t q = u >> k[p];
+
+            if (q < RICE_ESCAPE) {
+                bw_put(w, 1, q + 1);
+                bw_put(w, u & ((1U << k[p]) - 1), k[p]);
+            } else {
+                bw_put(w, 0, RICE_ESCAPE);
+                bw_put(w, u, ESCAPE_BITS);
+            }
+        }
+    }
+}
+
+static int decode_lossless_channel(pa_pcm_codec *c, struct bit_reader *r, unsigned n) {
+    int32_t *x = c->samples;
+    unsigned i, order, p;
+
+    order = br_get(r, METHOD_BITS);
+
+    if (order == METHOD_VERBATIM) {
+        for (i = 0; i < n; i++)
+            x[i] = (int16_t) br_get(r, 16);
+
+        return r->error ? -1 : 0;
+    }
+
+    if (order > MAX_ORDER || order > n)
+        return -1;
+
+    for (i = 0; i < order; i++)
+        x[i] = (int16_t) br_get(r, 16);
+
+    for (p = 0; i < n; p++) {
+        unsigned end = PA_MIN(n, order + (p + 1) * PARTITION_SIZE);
+        unsigned k = br_get(r, RICE_PARAM_BITS);
+
+        if (k > MAX_RICE_PARAM)
+            return -1;
+
+        for (; i < n && i < end; i++) {
+            uint32_t q = br_get_unary(r), u;
+            int32_t v;
+
+            if (q < RICE_ESCAPE)
+                u = (q << k) | br_get(r, k);
+            else
+                u = br_get(r, ESCAPE_BITS);
+
+            v = predict(x, i, order) + unzigzag(u);
+            x[i] = PA_CLAMP_UNLIKELY(v, -0x8000, 0x7FFF);
+        }
+
+        if (r->error)
+            return -1;
+    }
+
+    return r->error ? -1 : 0;
+}
+
+static inline uint8_t adpcm_encode_sample(int32_t x, int32_t *predictor, unsigned *index) {
+    int32_t diff = x - *predictor, step = adpcm_step_table[*index], vpdiff = step >> 3;
+    uint8_t nibble = 0;
+    int i;
+
+    if (diff < 0) {
+        nibble = 8;
+        diff = -diff;
+    }
+
+    if (diff >= step) {
+        nibble |= 4;
+        diff -= step;
+        vpdiff += step;
+    }
+    step >>= 1;
+
+    if (diff >= step) {
+        nibble |= 2;
+        diff -= step;
+        vpdiff += step;
+    }
+    step >>= 1;
+
+    if (diff >= step) {
+        nibble |= 1;
+        vpdiff += step;
+    }
+
+    *predictor += (nibble & 8) ? -vpdiff : vpdiff;
+    *predictor = PA_CLAMP(*predictor, -0x8000, 0x7FFF);
+
+    i = (int) *index + adpcm_index_table[nibble];
+    *index = (unsigned) PA_CLAMP(i, 0, 88);
+
+    return nibble;
+}
+
+static inline int32_t adpcm_decode_sample(uint8_t nibble, int32_t *predictor, unsigned *index) {
+    int32_t step = adpcm_step_table[*index], vpdiff = step >> 3;
+    int i;
+
+    if (nibble & 4)
+        vpdiff += step;
+    if (nibble & 2)
+        vpdiff += step >> 1;
+    if (nibble & 1)
+        vpdiff += step >> 2;
+
+    *predictor += (nibble & 8) ? -vpdiff : vpdiff;
+    *predictor = PA_CLAMP(*predictor, -0x8000, 0x7FFF);
+
+    i = (int) *index + adpcm_index_table[nibble];
+    *index = (unsigned) PA_CLAMP(i, 0, 88);
+
+    return *predictor;
+}
+
+static uint8_t *encode_adpcm_channel(pa_pcm_codec *c, uint8_t *d, unsigned channel, unsigned n) {
+    const int32_t *x = c->samples;
+    int32_t predictor = x[0];
+    unsigned i, index = c->adpcm_index[channel];
+
+    d[0] = (uint8_t) (uint16_t) predictor;
+    d[1] = (uint8_t) ((uint16_t) predictor >> 8);
+    d[2] = (uint8_t) index;
+    d += ADPCM_CHANNEL_HEADER;
+
+    for (i = 1; i + 1 < n; i += 2) {
+        uint8_t lo = adpcm_encode_sample(x[i], &predictor, &index);
+        uint8_t hi = adpcm_encode_sample(x[i+1], &predictor, &index);
+        *(d++) = lo | (uint8_t) (hi << 4);
+    }
+
+    if (i < n)
+        *(d++) = adpcm_encode_sample(x[i], &predictor, &index);
+
+    /* The next packet continues with the step size we ended with */
+    c->adpcm_index[channel] = (uint8_t) index;
+
+    return d;
+}
+
+static const uint8_t *decode_adpcm_channel(pa_pcm_codec *c, const uint8_t *s, const uint8_t *end, unsigned n) {
+    int32_t *x = c->samples;
+    int32_t predictor;
+    unsigned i, index;
+
+    if ((size_t) (end - s) < ADPCM_CHANNEL_HEADER + n / 2)
+        return NULL;
+
+    predictor = (int16_t) (uint16_t) (s[0] | (s[1] << 8));
+    index = s[2];
+    s += ADPCM_CHANNEL_HEADER;
+
+    if (index > 88)
+        return NULL;
+
+    x[0] = predictor;
+
+    for (i = 1; i + 1 < n; i += 2, s++) {
+        x[i] = adpcm_decode_sample(*s & 0xF, &predictor, &index);
+        x[i+1] = adpcm_decode_sample(*s >> 4, &predictor, &index);
+    }
+
+    if (i < n)
+        x[i] = adpcm_decode_sample(*(s++) & 0xF, &predictor, &index);
+
+    return s;
+}
+
+/* Encodes n frames from src into a packet at d, returns its length */
+static size_t encode_packet(pa_pcm_codec *c, const int16_t *src, unsigned n, uint8_t *d) {
+    uint8_t *p = d + HEADER_SIZE;
+    unsigned channel;
+    size_t l;
+
+    pa_assert(n > 0 && n <= MAX_PACKET_FRAMES);
+
+    if (c->type == PA_PCM_CODEC_LOSSLESS) {
+        struct bit_writer w;
+
+        pa_zero(w);
+        w.p = p;
+
+        for (channel = 0; channel < c->ss.channels; channel++) {
+            load_channel(c, src, channel, n);
+            encode_lossless_channel(c, &w, n);
+        }
+
+        bw_flush(&w);
+        p = w.p;
+    } else {
+        for (channel = 0; channel < c->ss.channels; channel++) {
+            load_channel(c, src, channel, n);
+            p = encode_adpcm_channel(c, p, channel, n);
+        }
+    }
+
+    l = (size_t) (p - d);
+    if (l % c->frame_size) {
+        size_t padding = c->frame_size - l % c->frame_size;
+        memset(p, 0, padding);
+        l += padding;
+    }
+
+    pa_assert(l <= max_packet_size(c, n));
+
+    d[0] = 'P';
+    d[1] = 'C';
+    d[2] = (uint8_t) c->type;
+    d[3] = c->ss.channels;
+    write_u32(d + 4, (uint32_t) l);
+    write_u32(d + 8, n);
+
+    return l;
+}
+
+void pa_pcm_codec_encode(pa_pcm_codec *c, const pa_memchunk *in, pa_memchunk *out) {
+    const int16_t *src;
+    uint8_t *dst;
+    size_t n_frames, n_packets, l = 0;
+
+    pa_assert(c);
+    pa_assert(in);
+    pa_assert(in->memblock);
+    pa_assert(out);
+    pa_assert(in->length % c->frame_size == 0);
+
+    n_frames = in->length / c->frame_size;
+    n_packets = (n_frames + MAX_PACKET_FRAMES - 1) / MAX_PACKET_FRAMES;
+
+    out->memblock = pa_memblock_new(c->pool, max_packet_size(c, n_frames) + (n_packets - 1) * max_packet_size(c, 0));
+    out->index = 0;
+
+    src = (const int16_t*) ((const uint8_t*) pa_memblock_acquire(in->memblock) + in->index);
+    dst = pa_memblock_acquire(out->memblock);
+
+    while (n_frames > 0) {
+        unsigned n = (unsigned) PA_MIN(n_frames, (size_t) MAX_PACKET_FRAMES);
+
+        l += encode_packet(c, src, n, dst + l);
+
+        src += n * c->ss.channels;
+        n_frames -= n;
+    }
+
+    pa_memblock_release(out->memblock);
+    pa_memblock_release(in->memblock);
+
+    out->length = l;
+}
+
+/* Checks the header at p. Returns the packet length and frame count
+ * if it is valid, 0 otherwise. */
+static size_t check_header(pa_pcm_codec *c, const uint8_t *p, unsigned *n_frames) {
+    uint32_t l, n;
+
+    if (p[0] != 'P' || p[1] != 'C' || p[2] != c->type || p[3] != c->ss.channels)
+        return 0;
+
+    l = read_u32(p + 4);
+    n = read_u32(p + 8);
+
+    if (n == 0 || n > MAX_PACKET_FRAMES)
+        return 0;
+
+    if (l < HEADER_SIZE || l > max_packet_size(c, n) || l % c->frame_size)
+        return 0;
+
+    *n_frames = n;
+    return l;
+}
+
+/* Finds the next complete packet in the length bytes at p, starting
+ * at *offset. Returns its length and sets *offset and *n_frames, or
+ * returns 0 and sets *offset to where the incomplete rest starts.
+ * *skipped is increased by the garbage bytes on the way. */
+static size_t next_packet(pa_pcm_codec *c, const uint8_t *p, size_t length, size_t *offset, unsigned *n_frames, size_t *skipped) {
+    size_t o = *offset;
+
+    for (;;) {
+        const uint8_t *m;
+        size_t l;
+
+        if (length - o < HEADER_SIZE)
+            break;
+
+        if ((l = check_header(c, p + o, n_frames)) > 0) {
+            if (length - o < l)
+                break;
+
+            *offset = o;
+            return l;
+        }
+
+        /* Resynchronize on the next magic */
+        if (!(m = memchr(p + o + 1, 'P', length - o - 1)))
+            m = p + length;
+
+        *skipped += (size_t) (m - p) - o;
+        o = (size_t) (m - p);
+    }
+
+    *offset = o;
+    return 0;
+}
+
+static int decode_packet(pa_pcm_codec *c, const uint8_t *p, size_t l, unsigned n, int16_t *dst) {
+    const uint8_t *end = p + l;
+    unsigned channel;
+
+    p += HEADER_SIZE;
+
+    if (c->type == PA_PCM_CODEC_LOSSLESS) {
+        struct bit_reader r;
+
+        pa_zero(r);
+        r.p = p;
+        r.end = end;
+
+        for (channel = 0; channel < c->ss.channels; channel++) {
+            if (decode_lossless_channel(c, &r, n) < 0)
+                return -1;
+
+            store_channel(c, dst, channel, n);
+        }
+    } else {
+        for (channel = 0; channel < c->ss.channels; channel++) {
+            if (!(p = decode_adpcm_channel(c, p, end, n)))
+                return -1;
+
+            store_channel(c, dst, channel, n);
+        }
+    }
+
+    return 0;
+}
+
+int pa_pcm_codec_decode(pa_pcm_codec *c, const pa_memchunk *in, pa_memchunk *out) {
+    const uint8_t *p;
+    const void *src;
+    size_t length, o, l, end, total_frames = 0, skipped = 0, n_broken = 0;
+    unsigned n;
+    int16_t *dst;
+
+    pa_assert(c);
+    pa_assert(in);
+    pa_assert(in->memblock);
+    pa_assert(out);
+
+    src = (const uint8_t*) pa_memblock_acquire(in->memblock) + in->index;
+
+    if (c->n_pending > 0) {
+        if (c->n_pending + in->length > c->pending_size) {
+            c->pending_size = PA_MAX(c->n_pending + in->length, 2 * c->pending_size);
+            c->pending = pa_xrealloc(c->pending, c->pending_size);
+        }
+
+        memcpy(c->pending + c->n_pending, src, in->length);
+        c->n_pending += in->length;
+
+        p = c->pending;
+        length = c->n_pending;
+    } else {
+        p = src;
+        length = in->length;
+    }
+
+    /* First find out how much we will get */
+    for (end = 0; (l = next_packet(c, p, length, &end, &n, &skipped)) > 0; end += l)
+        total_frames += n;
+
+    pa_memchunk_reset(out);
+
+    if (total_frames > 0) {
+        size_t dummy = 0;
+
+        out->memblock = pa_memblock_new(c->pool, total_frames * c->frame_size);
+        out->length = total_frames * c->frame_size;
+        dst = pa_memblock_acquire(out->memblock);
+
+        for (o = 0; (l = next_packet(c, p, end, &o, &n, &dummy)) > 0; o += l) {
+            if (decode_packet(c, p + o, l, n, dst) < 0) {
+                /* Keep the timing intact */
+                pa_silence_memory(dst, n * c->frame_size, &c->ss);
+                n_broken++;
+            }
+
+            dst += n * c->ss.channels;
+        }
+
+        pa_memblock_release(out->memblock);
+    }
+
+    /* Whatever is left is the beginning of a packet */
+    if (p == c->pending) {
+        c->n_pending = length - end;
+        if (c->n_pending > 0 && end > 0)
+            memmove(c->pending, c->pending + end, c->n_pending);
+    } else if (end < length) {
+        c->n_pending = length - end;
+
+        if (c->n_pending > c->pending_size) {
+            c->pending_size = PA_MAX(c->n_pending, max_packet_size(c, MAX_PACKET_FRAMES));
+            pa_xfree(c->pending);
+            c->pending = pa_xmalloc(c->pending_size);
+        }
+
+        memcpy(c->pending, p + end, c->n_pending);
+    }
+
+    pa_memblock_release(in->memblock);
+
+    if (skipped > 0 || n_broken > 0) {
+        if (pa_log_ratelimit(PA_LOG_WARN))
+            pa_log_warn("Skipped %lu bytes of garbage and %lu broken packets in compressed stream.", (unsigned long) skipped, (unsigned long) n_broken);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,69 @@
+#ifndef foopcmcodechfoo
+#define foopcmcodechfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memchunk.h>
+
+/* Compression of 16 bit PCM for streams over the native protocol, as
+ * used by module-tunnel. The encoder turns every chunk into one or
+ * more packets that can each be decoded on their own. The decoder
+ * accepts the encoded data in pieces of any size, as it comes out of
+ * a pstream, and keeps incomplete packets until the rest arrives.
+ * Broken packets are skipped up to the next packet header.
+ *
+ * PA_PCM_CODEC_LOSSLESS uses a fixed polynomial predictor of order
+ * 0-3 per channel and Rice codes for the residual, and falls back to
+ * storing samples verbatim where that doesn't help.
+ * PA_PCM_CODEC_ADPCM is IMA ADPCM with 4 bits per sample. */
+
+typedef enum pa_pcm_codec_type {
+    PA_PCM_CODEC_NONE = 0,
+    PA_PCM_CODEC_LOSSLESS = 1,
+    PA_PCM_CODEC_ADPCM = 2,
+    PA_PCM_CODEC_MAX,
+    PA_PCM_CODEC_INVALID = -1
+} pa_pcm_codec_type_t;
+
+typedef struct pa_pcm_codec pa_pcm_codec;
+
+const char *pa_pcm_codec_type_to_string(pa_pcm_codec_type_t t);
+pa_pcm_codec_type_t pa_pcm_codec_type_from_string(const char *s);
+
+/* Whether streams of this sample spec can be compressed with t */
+pa_bool_t pa_pcm_codec_supported(pa_pcm_codec_type_t t, const pa_sample_spec *ss);
+
+/* Returns NULL if t is not supported for ss */
+pa_pcm_codec *pa_pcm_codec_new(pa_pcm_codec_type_t t, const pa_sample_spec *ss, pa_mempool *pool);
+void pa_pcm_codec_free(pa_pcm_codec *c);
+
+/* Encodes the frame aligned chunk in into a new memblock. The length
+ * of the output is a multiple of the frame size, too. */
+void pa_pcm_codec_encode(pa_pcm_codec *c, const pa_memchunk *in, pa_memchunk *out);
+
+/* Decodes all packets that are complete after appending in. out is
+ * reset if there are none. Returns -1 if broken data was skipped, 0
+ * otherwise. */
+int pa_pcm_codec_decode(pa_pcm_codec *c, const pa_memchunk *in, pa_memchunk *out);
+
+#endif
@@ -34,6 +34,7 @@
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/ioline.h>
+#include <pulsecore/llist.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/log.h>
@@ -45,8 +46,10 @@
 
 #include "protocol-http.h"
 
-/* Don't allow more than this many concurrent connections */
-#define MAX_CONNECTIONS 10
+/* Don't allow more than this many concurrent connections. Listeners
+ * of the same source share a single source output, so this may be
+ * fairly high. */
+#define MAX_CONNECTIONS 256
 
 #define URL_ROOT "/"
 #define URL_CSS "/style"
@@ -72,6 +75,7 @@
     "        </body>\n"                                                 \
     "</html>\n"
 
+/* Listeners that fall behind by more than this are dropped */
 #define RECORD_BUFFER_SECONDS (5)
 #define DEFAULT_SOURCE_LATENCY (300*PA_USEC_PER_MSEC)
 
@@ -86,17 +90,30 @@ enum method {
     METHOD_HEAD
 };
 
+/* One source output that is shared by all listeners of the same
+ * source with the same sample spec. Its memblocks are pushed by
+ * reference into the memblockq of each connection. */
+struct stream {
+    pa_http_protocol *protocol;
+    pa_module *module;
+    pa_source_output *source_output;
+
+    PA_LLIST_HEAD(struct connection, connections);
+};
+
 struct connection {
     pa_http_protocol *protocol;
     pa_iochannel *io;
     pa_ioline *line;
     pa_memblockq *output_memblockq;
-    pa_source_output *source_output;
+    struct stream *stream;
     pa_client *client;
     enum state state;
     char *url;
     enum method method;
     pa_module *module;
+
+    PA_LLIST_FIELDS(struct connection);
 };
 
 struct pa_http_protocol {
@@ -104,6 +121,7 @@ struct pa_http_protocol {
 
     pa_core *core;
     pa_idxset *connections;
+    pa_idxset *streams;
 
     pa_strlist *servers;
 };
@@ -112,14 +130,30 @@ enum {
     SOURCE_OUTPUT_MESSAGE_POST_DATA = PA_SOURCE_OUTPUT_MESSAGE_MAX
 };
 
+/* Called from main context */
+static void stream_free(struct stream *s) {
+    pa_assert(s);
+    pa_assert(!s->connections);
+
+    if (s->source_output) {
+        pa_source_output_unlink(s->source_output);
+        s->source_output->userdata = NULL;
+        pa_source_output_unref(s->source_output);
+    }
+
+    pa_idxset_remove_by_data(s->protocol->streams, s, NULL);
+    pa_xfree(s);
+}
+
 /* Called from main context */
 static void connection_unlink(struct connection *c) {
     pa_assert(c);
 
-    if (c->source_output) {
-        pa_source_output_unlink(c->source_output);
-        c->source_output->userdata = NULL;
-        pa_source_output_unref(c->source_output);
+    if (c->stream) {
+        PA_LLIST_REMOVE(struct connection, c->stream->connections, c);
+
+        if (!c->stream->connections)
+            stream_free(c->stream);
     }
 
     if (c->client)
@@ -179,6 +213,10 @@ static int do_write(struct connection *c) {
 static void do_work(struct connection *c) {
     pa_assert(c);
 
+    /* The response header is still being sent */
+    if (!c->io)
+        return;
+
     if (pa_iochannel_is_hungup(c->io))
         goto fail;
 
@@ -192,14 +230,49 @@ fail:
     connection_unlink(c);
 }
 
+/* Called from main context */
+static void stream_post_data(struct stream *s, const pa_memchunk *chunk) {
+    struct connection *c, *n;
+
+    pa_assert(s);
+    pa_assert(chunk);
+
+    /* Unlinking the last connection frees the stream, so don't touch
+     * it once the list has been walked */
+    PA_LLIST_FOREACH_SAFE(c, n, s->connections) {
+
+        /* The queue only takes a reference to the memblock. If it is
+         * full, the listener can't keep up, and we drop it instead of
+         * letting it hold up the others. */
+        if (pa_memblockq_push_align(c->output_memblockq, chunk) < 0) {
+            pa_log_info("HTTP listener %s is too slow, dropping connection.",
+                        pa_strnull(pa_proplist_gets(c->client->proplist, "http-protocol.peer")));
+            connection_unlink(c);
+            continue;
+        }
+
+        do_work(c);
+    }
+}
+
+/* Called from main context */
+static void stream_kill(struct stream *s) {
+    struct connection *c, *n;
+
+    pa_assert(s);
+
+    PA_LLIST_FOREACH_SAFE(c, n, s->connections)
+        connection_unlink(c);
+}
+
 /* Called from thread context, except when it is not */
 static int source_output_process_msg(pa_msgobject *m, int code, void *userdata, int64_t offset, pa_memchunk *chunk) {
     pa_source_output *o = PA_SOURCE_OUTPUT(m);
-    struct connection *c;
+    struct stream *s;
 
     pa_source_output_assert_ref(o);
 
-    if (!(c = o->userdata))
+    if (!(s = o->userdata))
         return -1;
 
     switch (code) {
@@ -207,8 +280,7 @@ static int source_output_process_msg(pa_msgobject *m, int code, void *userdata,
         case SOURCE_OUTPUT_MESSAGE_POST_DATA:
             /* While this function is usually called from IO thread
              * context, this specific command is not! */
-            pa_memblockq_push_align(c->output_memblockq, chunk);
-            do_work(c);
+            stream_post_data(s, chunk);
             break;
 
         default:
@@ -220,10 +292,8 @@ static int source_output_process_msg(pa_msgobject *m, int code, void *userdata,
 
 /* Called from thread context */
 static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk) {
-    struct connection *c;
-
     pa_source_output_assert_ref(o);
-    pa_assert_se(c = o->userdata);
+    pa_assert(o->userdata);
     pa_assert(chunk);
 
     pa_asyncmsgq_post(pa_thread_mq_get()->outq, PA_MSGOBJECT(o), SOURCE_OUTPUT_MESSAGE_POST_DATA, NULL, 0, chunk, NULL);
@@ -231,22 +301,28 @@ static void source_output_push_cb(pa_source_output *o, const pa_memchunk *chunk)
 
 /* Called from main context */
 static void source_output_kill_cb(pa_source_output *o) {
-    struct connection*c;
+    struct stream *s;
 
     pa_source_output_assert_ref(o);
-    pa_assert_se(c = o->userdata);
+    pa_assert_se(s = o->userdata);
 
-    connection_unlink(c);
+    stream_kill(s);
 }
 
 /* Called from main context */
 static pa_usec_t source_output_get_latency_cb(pa_source_output *o) {
-    struct connection*c;
+    struct stream *s;
+    struct connection *c;
+    size_t l = 0;
 
     pa_source_output_assert_ref(o);
-    pa_assert_se(c = o->userdata);
+    pa_assert_se(s = o->userdata);
 
-    return pa_bytes_to_usec(pa_memblockq_get_length(c->output_memblockq), &c->source_output->sample_spec);
+    /* Report what the slowest listener lags behind */
+    PA_LLIST_FOREACH(c, s->connections)
+        l = PA_MAX(l, pa_memblockq_get_length(c->output_memblockq));
+
+    return pa_bytes_to_usec(l, &o->sample_spec);
 }
 
 /*** client callbacks ***/
@@ -533,9 +609,63 @@ static void line_drain_callback(pa_ioline *l, void *userdata) {
     c->line = NULL;
 }
 
+/* Called from main context */
+static struct stream *stream_get(pa_http_protocol *p, pa_module *m, pa_source *source, const pa_sample_spec *ss, const pa_channel_map *cm) {
+    struct stream *s;
+    pa_source_output_new_data data;
+    uint32_t idx;
+
+    pa_assert(p);
+    pa_assert(source);
+    pa_assert(ss);
+    pa_assert(cm);
+
+    PA_IDXSET_FOREACH(s, p->streams, idx)
+        if (s->module == m &&
+            s->source_output->source == source &&
+            pa_sample_spec_equal(&s->source_output->sample_spec, ss) &&
+            pa_channel_map_equal(&s->source_output->channel_map, cm))
+            return s;
+
+    s = pa_xnew0(struct stream, 1);
+    s->protocol = p;
+    s->module = m;
+    PA_LLIST_HEAD_INIT(struct connection, s->connections);
+
+    pa_source_output_new_data_init(&data);
+    data.driver = __FILE__;
+    data.module = m;
+    pa_source_output_new_data_set_source(&data, source, FALSE);
+    pa_proplist_sets(data.proplist, PA_PROP_APPLICATION_NAME, "HTTP listeners");
+    pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, source->name);
+    pa_source_output_new_data_set_sample_spec(&data, ss);
+    pa_source_output_new_data_set_channel_map(&data, cm);
+
+    pa_source_output_new(&s->source_output, p->core, &data);
+    pa_source_output_new_data_done(&data);
+
+    if (!s->source_output) {
+        pa_xfree(s);
+        return NULL;
+    }
+
+    s->source_output->parent.process_msg = source_output_process_msg;
+    s->source_output->push = source_output_push_cb;
+    s->source_output->kill = source_output_kill_cb;
+    s->source_output->get_latency = source_output_get_latency_cb;
+    s->source_output->userdata = s;
+
+    pa_source_output_set_requested_latency(s->source_output, DEFAULT_SOURCE_LATENCY);
+
+    pa_idxset_put(p->streams, s, NULL);
+
+    pa_source_output_put(s->source_output);
+
+    return s;
+}
+
 static void handle_listen_prefix(struct connection *c, const char *source_name) {
     pa_source *source;
-    pa_source_output_new_data data;
     pa_sample_spec ss;
     pa_channel_map cm;
     char *t;
@@ -557,31 +687,11 @@ static void handle_listen_prefix(struct connection *c, const char *source_name)
 
     pa_sample_spec_mimefy(&ss, &cm);
 
-    pa_source_output_new_data_init(&data);
-    data.driver = __FILE__;
-    data.module = c->module;
-    data.client = c->client;
-    pa_source_output_new_data_set_source(&data, source, FALSE);
-    pa_proplist_update(data.proplist, PA_UPDATE_MERGE, c->client->proplist);
-    pa_source_output_new_data_set_sample_spec(&data, &ss);
-    pa_source_output_new_data_set_channel_map(&data, &cm);
-
-    pa_source_output_new(&c->source_output, c->protocol->core, &data);
-    pa_source_output_new_data_done(&data);
-
-    if (!c->source_output) {
+    if (!(c->stream = stream_get(c->protocol, c->module, source, &ss, &cm))) {
         html_response(c, 403, "Cannot create source output", NULL);
         return;
     }
 
-    c->source_output->parent.process_msg = source_output_process_msg;
-    c->source_output->push = source_output_push_cb;
-    c->source_output->kill = source_output_kill_cb;
-    c->source_output->get_latency = source_output_get_latency_cb;
-    c->source_output->userdata = c;
-
-    pa_source_output_set_requested_latency(c->source_output, DEFAULT_SOURCE_LATENCY);
-
     l = (size_t) (pa_bytes_per_second(&ss)*RECORD_BUFFER_SECONDS);
     c->output_memblockq = pa_memblockq_new(
             "http protocol connection output_memblockq",
@@ -594,7 +704,7 @@ static void handle_listen_prefix(struct connection *c, const char *source_name)
             0,
             NULL);
 
-    pa_source_output_put(c->source_output);
+    PA_LLIST_PREPEND(struct connection, c->stream->connections, c);
 
     t = pa_sample_spec_to_mime_type(&ss, &cm);
     http_response(c, 200, "OK", t);
@@ -750,6 +860,7 @@ static pa_http_protocol* http_protocol_new(pa_core *c) {
     PA_REFCNT_INIT(p);
     p->core = c;
     p->connections = pa_idxset_new(NULL, NULL);
+    p->streams = pa_idxset_new(NULL, NULL);
 
     pa_assert_se(pa_shared_set(c, "http-protocol", p) >= 0);
 
@@ -788,6 +899,9 @@ void pa_http_protocol_unref(pa_http_protocol *p) {
 
     pa_idxset_free(p->connections, NULL, NULL);
 
+    pa_assert(pa_idxset_isempty(p->streams));
+    pa_idxset_free(p->streams, NULL, NULL);
+
     pa_strlist_free(p->servers);
 
     pa_assert_se(pa_shared_remove(p->core, "http-protocol") >= 0);
@@ -57,6 +57,7 @@
 #include <pulsecore/core-util.h>
 #include <pulsecore/ipacl.h>
 #include <pulsecore/thread-mq.h>
+#include <pulsecore/pcm-codec.h>
 
 #include "protocol-native.h"
 
@@ -84,6 +85,9 @@ typedef struct record_stream {
     pa_source_output *source_output;
     pa_memblockq *memblockq;
 
+    /* Compresses the data when it is sent to the client */
+    pa_pcm_codec *encoder;
+
     pa_bool_t adjust_latency:1;
     pa_bool_t early_requests:1;
 
@@ -121,6 +125,9 @@ typedef struct playback_stream {
     pa_sink_input *sink_input;
     pa_memblockq *memblockq;
 
+    /* Decompresses what the client sends, in the IO thread */
+    pa_pcm_codec *decoder;
+
     pa_bool_t adjust_latency:1;
     pa_bool_t early_requests:1;
 
@@ -181,6 +188,7 @@ struct pa_native_connection {
     uint32_t rrobin_index;
     pa_subscription *subscription;
     pa_time_event *auth_timeout_event;
+    pa_srbchannel *srbpending;
 };
 
 #define PA_NATIVE_CONNECTION(o) (pa_native_connection_cast(o))
@@ -270,6 +278,7 @@ static void command_play_sample(pa_pdispatch *pd, uint32_t command, uint32_t tag
 static void command_remove_sample(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_get_info_list_since(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_get_server_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_subscribe(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_volume(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -290,6 +299,7 @@ static void command_update_stream_sample_rate(pa_pdispatch *pd, uint32_t command
 static void command_update_proplist(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_remove_proplist(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_extension(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_card_profile(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_sink_or_source_port(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
 static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata);
@@ -333,6 +343,7 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
     [PA_COMMAND_GET_SINK_INPUT_INFO_LIST] = command_get_info_list,
     [PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST] = command_get_info_list,
     [PA_COMMAND_GET_SAMPLE_INFO_LIST] = command_get_info_list,
+    [PA_COMMAND_GET_INFO_LIST_SINCE] = command_get_info_list_since,
     [PA_COMMAND_GET_SERVER_INFO] = command_get_server_info,
     [PA_COMMAND_SUBSCRIBE] = command_subscribe,
 
@@ -396,6 +407,9 @@ static const pa_pdispatch_cb_t command_table[PA_COMMAND_MAX] = {
 
     [PA_COMMAND_SET_PORT_LATENCY_OFFSET] = command_set_port_latency_offset,
 
+    [PA_COMMAND_ENABLE_SRBCHANNEL] = command_enable_srbchannel,
+    [PA_COMMAND_DISABLE_SRBCHANNEL] = command_enable_srbchannel,
+
     [PA_COMMAND_EXTENSION] = command_extension
 };
 
@@ -490,6 +504,10 @@ static void record_stream_free(pa_object *o) {
     record_stream_unlink(s);
 
     pa_memblockq_free(s->memblockq);
+
+    if (s->encoder)
+        pa_pcm_codec_free(s->encoder);
+
     pa_xfree(s);
 }
 
@@ -785,6 +803,10 @@ static void playback_stream_free(pa_object* o) {
     playback_stream_unlink(s);
 
     pa_memblockq_free(s->memblockq);
+
+    if (s->decoder)
+        pa_pcm_codec_free(s->decoder);
+
     pa_xfree(s);
 }
 
@@ -1319,6 +1341,11 @@ static void native_connection_unlink(pa_native_connection *c) {
     if (c->subscription)
         pa_subscription_free(c->subscription);
 
+    if (c->srbpending) {
+        pa_srbchannel_free(c->srbpending);
+        c->srbpending = NULL;
+    }
+
     if (c->pstream)
         pa_pstream_unlink(c->pstream);
 
@@ -1373,7 +1400,16 @@ static void native_connection_send_memblock(pa_native_connection *c) {
             if (schunk.length > r->buffer_attr.fragsize)
                 schunk.length = r->buffer_attr.fragsize;
 
-            pa_pstream_send_memblock(c->pstream, r->index, 0, PA_SEEK_RELATIVE, &schunk);
+            if (r->encoder && schunk.memblock) {
+                pa_memchunk encoded;
+
+                /* The queue stays uncompressed so that the latency
+                 * accounting keeps working */
+                pa_pcm_codec_encode(r->encoder, &schunk, &encoded);
+                pa_pstream_send_memblock(c->pstream, r->index, 0, PA_SEEK_RELATIVE, &encoded);
+                pa_memblock_unref(encoded.memblock);
+            } else
+                pa_pstream_send_memblock(c->pstream, r->index, 0, PA_SEEK_RELATIVE, &schunk);
 
             pa_memblockq_drop(r->memblockq, schunk.length);
             pa_memblock_unref(schunk.memblock);
@@ -1442,6 +1478,16 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
         case SINK_INPUT_MESSAGE_SEEK:
         case SINK_INPUT_MESSAGE_POST_DATA: {
             int64_t windex = pa_memblockq_get_write_index(s->memblockq);
+            pa_memchunk decoded;
+
+            pa_memchunk_reset(&decoded);
+
+            /* Compressed data may end in the middle of a packet, in
+             * which case the decoder keeps it for the next time */
+            if (chunk && s->decoder) {
+                pa_pcm_codec_decode(s->decoder, chunk, &decoded);
+                chunk = decoded.memblock ? &decoded : NULL;
+            }
 
             if (code == SINK_INPUT_MESSAGE_SEEK) {
                 /* The client side is incapable of accounting correctly
@@ -1468,6 +1514,10 @@ static int sink_input_process_msg(pa_msgobject *o, int code, void *userdata, int
                 s->seek_windex = -1;
                 handle_seek(s, windex);
             }
+
+            if (decoded.memblock)
+                pa_memblock_unref(decoded.memblock);
+
             return 0;
         }
 
@@ -1940,6 +1990,7 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
     pa_tagstruct *reply;
     pa_sink *sink = NULL;
     pa_cvolume volume;
+    uint32_t compression = PA_PCM_CODEC_NONE;
     pa_bool_t
         corked = FALSE,
         no_remap = FALSE,
@@ -2087,6 +2138,14 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
         }
     }
 
+    if (c->version >= 30) {
+
+        if (pa_tagstruct_getu32(t, &compression) < 0) {
+            protocol_error(c);
+            goto finish;
+        }
+    }
+
     if (n_formats == 0) {
         CHECK_VALIDITY_GOTO(c->pstream, pa_sample_spec_valid(&ss), tag, PA_ERR_INVALID, finish);
         CHECK_VALIDITY_GOTO(c->pstream, map.channels == ss.channels && volume.channels == ss.channels, tag, PA_ERR_INVALID, finish);
@@ -2140,6 +2199,11 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
 
     CHECK_VALIDITY_GOTO(c->pstream, s, tag, ret, finish);
 
+    /* We only compress plain PCM, anything else is sent as it is */
+    if (compression != PA_PCM_CODEC_NONE && n_formats == 0 &&
+        (s->decoder = pa_pcm_codec_new(compression, &ss, c->protocol->core->mempool)))
+        pa_log_debug("Client sends %s compressed data.", pa_pcm_codec_type_to_string(compression));
+
     reply = reply_new(tag);
     pa_tagstruct_putu32(reply, s->index);
     pa_assert(s->sink_input);
@@ -2187,6 +2251,9 @@ static void command_create_playback_stream(pa_pdispatch *pd, uint32_t command, u
         }
     }
 
+    if (c->version >= 30)
+        pa_tagstruct_putu32(reply, s->decoder ? compression : PA_PCM_CODEC_NONE);
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 
 finish:
@@ -2265,6 +2332,7 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
     pa_tagstruct *reply;
     pa_source *source = NULL;
     pa_cvolume volume;
+    uint32_t compression = PA_PCM_CODEC_NONE;
     pa_bool_t
         corked = FALSE,
         no_remap = FALSE,
@@ -2405,6 +2473,14 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
         CHECK_VALIDITY_GOTO(c->pstream, pa_cvolume_valid(&volume), tag, PA_ERR_INVALID, finish);
     }
 
+    if (c->version >= 30) {
+
+        if (pa_tagstruct_getu32(t, &compression) < 0) {
+            protocol_error(c);
+            goto finish;
+        }
+    }
+
     if (n_formats == 0) {
         CHECK_VALIDITY_GOTO(c->pstream, pa_sample_spec_valid(&ss), tag, PA_ERR_INVALID, finish);
         CHECK_VALIDITY_GOTO(c->pstream, map.channels == ss.channels, tag, PA_ERR_INVALID, finish);
@@ -2462,6 +2538,11 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
 
     CHECK_VALIDITY_GOTO(c->pstream, s, tag, ret, finish);
 
+    /* We only compress plain PCM, anything else is sent as it is */
+    if (compression != PA_PCM_CODEC_NONE && n_formats == 0 &&
+        (s->encoder = pa_pcm_codec_new(compression, &ss, c->protocol->core->mempool)))
+        pa_log_debug("Sending %s compressed data to client.", pa_pcm_codec_type_to_string(compression));
+
     reply = reply_new(tag);
     pa_tagstruct_putu32(reply, s->index);
     pa_assert(s->source_output);
@@ -2502,6 +2583,9 @@ static void command_create_record_stream(pa_pdispatch *pd, uint32_t command, uin
         }
     }
 
+    if (c->version >= 30)
+        pa_tagstruct_putu32(reply, s->encoder ? compression : PA_PCM_CODEC_NONE);
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 
 finish:
@@ -2532,6 +2616,36 @@ static void command_exit(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
     pa_pstream_send_simple_ack(c->pstream, tag); /* nonsense */
 }
 
+/* Offers the client a shared ring buffer for the control traffic, which
+ * saves the socket round trips for every small packet while both sides
+ * are busy. Like SHM itself this requires a local client of the same
+ * user. */
+static void setup_srbchannel(pa_native_connection *c) {
+#ifdef HAVE_CREDS
+    pa_srbchannel_template srbt;
+    pa_tagstruct *t;
+    int fds[3];
+
+    if (c->version < 28 || !pa_pstream_get_shm(c->pstream) || c->srbpending)
+        return;
+
+    if (!(c->srbpending = pa_srbchannel_new(c->protocol->core->mainloop))) {
+        pa_log_debug("Failed to create the shared ring buffer channel.");
+        return;
+    }
+
+    pa_srbchannel_export(c->srbpending, &srbt);
+    fds[0] = srbt.memfd;
+    fds[1] = srbt.readfd;
+    fds[2] = srbt.writefd;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_putu32(t, PA_COMMAND_ENABLE_SRBCHANNEL);
+    pa_tagstruct_putu32(t, (uint32_t) (size_t) c->srbpending); /* tag */
+    pa_pstream_send_tagstruct_with_fds(c->pstream, t, 3, fds);
+#endif
+}
+
 static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
     const void*cookie;
@@ -2663,6 +2777,34 @@ static void command_auth(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_ta
 #else
     pa_pstream_send_tagstruct(c->pstream, reply);
 #endif
+
+    setup_srbchannel(c);
+}
+
+static void command_enable_srbchannel(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_srbchannel *srb;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    /* The tag is the one we sent the channel with */
+    if (!c->srbpending || tag != (uint32_t) (size_t) c->srbpending || !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    srb = c->srbpending;
+    c->srbpending = NULL;
+
+    if (command == PA_COMMAND_DISABLE_SRBCHANNEL) {
+        pa_log_debug("Client declined the shared ring buffer channel.");
+        pa_srbchannel_free(srb);
+        return;
+    }
+
+    pa_log_debug("Enabling the shared ring buffer channel.");
+    pa_pstream_set_srbchannel(c->pstream, srb);
 }
 
 static void command_set_client_name(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
@@ -3510,8 +3652,63 @@ static void command_get_info(pa_pdispatch *pd, uint32_t command, uint32_t tag, p
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
+static pa_idxset *info_list_idxset(pa_core *core, uint32_t command, pa_subscription_event_type_t *facility) {
+    pa_assert(core);
+    pa_assert(facility);
+
+    switch (command) {
+        case PA_COMMAND_GET_SINK_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SINK;
+            return core->sinks;
+        case PA_COMMAND_GET_SOURCE_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SOURCE;
+            return core->sources;
+        case PA_COMMAND_GET_CLIENT_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_CLIENT;
+            return core->clients;
+        case PA_COMMAND_GET_CARD_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_CARD;
+            return core->cards;
+        case PA_COMMAND_GET_MODULE_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_MODULE;
+            return core->modules;
+        case PA_COMMAND_GET_SINK_INPUT_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SINK_INPUT;
+            return core->sink_inputs;
+        case PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST:
+            *facility = PA_SUBSCRIPTION_EVENT_SOURCE_OUTPUT;
+            return core->source_outputs;
+        default:
+            pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+            *facility = PA_SUBSCRIPTION_EVENT_SAMPLE_CACHE;
+            return core->scache;
+    }
+}
+
+static void info_list_fill_tagstruct(pa_native_connection *c, pa_tagstruct *reply, uint32_t command, void *p) {
+    if (command == PA_COMMAND_GET_SINK_INFO_LIST)
+        sink_fill_tagstruct(c, reply, p);
+    else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
+        source_fill_tagstruct(c, reply, p);
+    else if (command == PA_COMMAND_GET_CLIENT_INFO_LIST)
+        client_fill_tagstruct(c, reply, p);
+    else if (command == PA_COMMAND_GET_CARD_INFO_LIST)
+        card_fill_tagstruct(c, reply, p);
+    else if (command == PA_COMMAND_GET_MODULE_INFO_LIST)
+        module_fill_tagstruct(c, reply, p);
+    else if (command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST)
+        sink_input_fill_tagstruct(c, reply, p);
+    else if (command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST)
+        source_output_fill_tagstruct(c, reply, p);
+    else {
+        pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
+        scache_fill_tagstruct(c, reply, p);
+    }
+}
+
 static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_subscription_event_type_t facility;
     pa_idxset *i;
     uint32_t idx;
     void *p;
@@ -3529,48 +3726,64 @@ static void command_get_info_list(pa_pdispatch *pd, uint32_t command, uint32_t t
 
     reply = reply_new(tag);
 
-    if (command == PA_COMMAND_GET_SINK_INFO_LIST)
-        i = c->protocol->core->sinks;
-    else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
-        i = c->protocol->core->sources;
-    else if (command == PA_COMMAND_GET_CLIENT_INFO_LIST)
-        i = c->protocol->core->clients;
-    else if (command == PA_COMMAND_GET_CARD_INFO_LIST)
-        i = c->protocol->core->cards;
-    else if (command == PA_COMMAND_GET_MODULE_INFO_LIST)
-        i = c->protocol->core->modules;
-    else if (command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST)
-        i = c->protocol->core->sink_inputs;
-    else if (command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST)
-        i = c->protocol->core->source_outputs;
-    else {
-        pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
-        i = c->protocol->core->scache;
-    }
-
-    if (i) {
-        PA_IDXSET_FOREACH(p, i, idx) {
-            if (command == PA_COMMAND_GET_SINK_INFO_LIST)
-                sink_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_SOURCE_INFO_LIST)
-                source_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_CLIENT_INFO_LIST)
-                client_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_CARD_INFO_LIST)
-                card_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_MODULE_INFO_LIST)
-                module_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST)
-                sink_input_fill_tagstruct(c, reply, p);
-            else if (command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST)
-                source_output_fill_tagstruct(c, reply, p);
-            else {
-                pa_assert(command == PA_COMMAND_GET_SAMPLE_INFO_LIST);
-                scache_fill_tagstruct(c, reply, p);
-            }
-        }
+    if ((i = info_list_idxset(c->protocol->core, command, &facility)))
+        PA_IDXSET_FOREACH(p, i, idx)
+            info_list_fill_tagstruct(c, reply, command, p);
+
+    pa_pstream_send_tagstruct(c->pstream, reply);
+}
+
+/* Like command_get_info_list(), but only sends the objects that changed
+ * after the generation the client passes. The reply starts with the
+ * current generation and the indexes of all objects in the list, so
+ * that the client can tell which objects went away. */
+static void command_get_info_list_since(pa_pdispatch *pd, uint32_t command, uint32_t tag, pa_tagstruct *t, void *userdata) {
+    pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
+    pa_subscription_event_type_t facility;
+    uint32_t list_command, idx;
+    uint64_t generation;
+    pa_idxset *i;
+    void *p;
+    pa_tagstruct *reply;
+
+    pa_native_connection_assert_ref(c);
+    pa_assert(t);
+
+    if (pa_tagstruct_getu32(t, &list_command) < 0 ||
+        pa_tagstruct_getu64(t, &generation) < 0 ||
+        !pa_tagstruct_eof(t)) {
+        protocol_error(c);
+        return;
+    }
+
+    CHECK_VALIDITY(c->pstream, c->authorized, tag, PA_ERR_ACCESS);
+    CHECK_VALIDITY(c->pstream,
+                   list_command == PA_COMMAND_GET_SINK_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_SOURCE_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_CLIENT_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_CARD_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_MODULE_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_SINK_INPUT_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_SOURCE_OUTPUT_INFO_LIST ||
+                   list_command == PA_COMMAND_GET_SAMPLE_INFO_LIST, tag, PA_ERR_INVALID);
+
+    reply = reply_new(tag);
+    pa_tagstruct_putu64(reply, c->protocol->core->generation);
+
+    if (!(i = info_list_idxset(c->protocol->core, list_command, &facility))) {
+        pa_tagstruct_putu32(reply, 0);
+        pa_pstream_send_tagstruct(c->pstream, reply);
+        return;
     }
 
+    pa_tagstruct_putu32(reply, pa_idxset_size(i));
+    PA_IDXSET_FOREACH(p, i, idx)
+        pa_tagstruct_putu32(reply, idx);
+
+    PA_IDXSET_FOREACH(p, i, idx)
+        if (pa_subscription_get_generation(c->protocol->core, facility, idx) > generation)
+            info_list_fill_tagstruct(c, reply, list_command, p);
+
     pa_pstream_send_tagstruct(c->pstream, reply);
 }
 
@@ -4767,14 +4980,14 @@ static void command_set_port_latency_offset(pa_pdispatch *pd, uint32_t command,
 
 /*** pstream callbacks ***/
 
-static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_creds *creds, void *userdata) {
+static void pstream_packet_callback(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
     pa_native_connection *c = PA_NATIVE_CONNECTION(userdata);
 
     pa_assert(p);
     pa_assert(packet);
     pa_native_connection_assert_ref(c);
 
-    if (pa_pdispatch_run(c->pdispatch, packet, creds, c) < 0) {
+    if (pa_pdispatch_run(c->pdispatch, packet, ancil_data, c) < 0) {
         pa_log("invalid packet.");
         native_connection_unlink(c);
     }
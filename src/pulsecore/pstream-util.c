@@ -23,25 +23,62 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <pulsecore/native-common.h>
 #include <pulsecore/macro.h>
 
 #include "pstream-util.h"
 
-void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
-    size_t length;
-    uint8_t *data;
+static void send_tagstruct_with_ancil_data(pa_pstream *p, pa_tagstruct *t, const pa_cmsg_ancil_data *ancil_data) {
     pa_packet *packet;
 
     pa_assert(p);
     pa_assert(t);
 
-    pa_assert_se(data = pa_tagstruct_free_data(t, &length));
-    pa_assert_se(packet = pa_packet_new_dynamic(data, length));
-    pa_pstream_send_packet(p, packet, creds);
+    pa_assert_se(packet = pa_tagstruct_free_to_packet(t));
+    pa_pstream_send_packet(p, packet, ancil_data);
     pa_packet_unref(packet);
 }
 
+#ifdef HAVE_CREDS
+
+void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+    if (creds) {
+        pa_cmsg_ancil_data a;
+
+        pa_zero(a);
+        a.creds = *creds;
+        a.creds_valid = TRUE;
+        send_tagstruct_with_ancil_data(p, t, &a);
+    } else
+        send_tagstruct_with_ancil_data(p, t, NULL);
+}
+
+void pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd, const int *fds) {
+    pa_cmsg_ancil_data a;
+
+    pa_assert(nfd > 0 && nfd <= PA_CMSG_FDS_MAX);
+    pa_assert(fds);
+
+    pa_zero(a);
+    a.nfd = nfd;
+    memcpy(a.fds, fds, sizeof(int) * nfd);
+    send_tagstruct_with_ancil_data(p, t, &a);
+}
+
+#else
+
+void pa_pstream_send_tagstruct_with_creds(pa_pstream *p, pa_tagstruct *t, const pa_creds *creds) {
+    send_tagstruct_with_ancil_data(p, t, NULL);
+}
+
+void pa_pstream_send_tagstruct_with_fds(pa_pstream *p, pa_tagstruct *t, int nfd, const int *fds) {
+    pa_assert_not_reached();
+}
+
+#endif
+
 void pa_pstream_send_error(pa_pstream *p, uint32_t tag, uint32_t error) {
     pa_tagstruct *t;
 
@@ -27,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <errno.h>
 
 #ifdef HAVE_NETINET_IN_H
 #include <netinet/in.h>
@@ -48,6 +49,7 @@
 #define PA_FLAG_SHMDATA    0x80000000LU
 #define PA_FLAG_SHMRELEASE 0x40000000LU
 #define PA_FLAG_SHMREVOKE  0xC0000000LU
+#define PA_FLAG_SRBSWITCH  0x20000000LU
 #define PA_FLAG_SHMMASK    0xFF000000LU
 #define PA_FLAG_SEEKMASK   0x000000FFLU
 
@@ -79,6 +81,13 @@ typedef uint32_t pa_pstream_descriptor[PA_PSTREAM_DESCRIPTOR_MAX];
  */
 #define FRAME_SIZE_MAX_ALLOW (1024*1024*16)
 
+/* How many queued items do_write() gathers into a single writev() */
+#define WRITE_FRAMES_MAX 16
+
+/* How many reads do_read() does per wakeup before giving other event
+ * sources a chance to run */
+#define READ_ITERATIONS_MAX 32
+
 PA_STATIC_FLIST_DECLARE(items, 0, pa_xfree);
 
 struct item_info {
@@ -86,14 +95,15 @@ struct item_info {
         PA_PSTREAM_ITEM_PACKET,
         PA_PSTREAM_ITEM_MEMBLOCK,
         PA_PSTREAM_ITEM_SHMRELEASE,
-        PA_PSTREAM_ITEM_SHMREVOKE
+        PA_PSTREAM_ITEM_SHMREVOKE,
+        PA_PSTREAM_ITEM_SRBSWITCH
     } type;
 
     /* packet info */
     pa_packet *packet;
 #ifdef HAVE_CREDS
-    pa_bool_t with_creds;
-    pa_creds creds;
+    pa_bool_t with_ancil_data;
+    pa_cmsg_ancil_data ancil_data;
 #endif
 
     /* memblock info */
@@ -106,34 +116,51 @@ struct item_info {
     uint32_t block_id;
 };
 
+struct write_frame {
+    pa_pstream_descriptor descriptor;
+    struct item_info* current;
+    uint32_t shm_info[PA_PSTREAM_SHM_MAX];
+    void *data;
+    pa_memchunk memchunk;
+    pa_bool_t use_srb;
+};
+
+struct pstream_read {
+    pa_pstream_descriptor descriptor;
+    pa_memblock *memblock;
+    pa_packet *packet;
+    uint32_t shm_info[PA_PSTREAM_SHM_MAX];
+    void *data;
+    size_t index;
+};
+
 struct pa_pstream {
     PA_REFCNT_DECLARE;
 
     pa_mainloop_api *mainloop;
     pa_defer_event *defer_event;
     pa_iochannel *io;
+    pa_srbchannel *srb;
+
+    /* srb_write is set once our switch frame has been queued, srb_read
+     * once we got the one of the other side */
+    pa_bool_t srb_write, srb_read;
 
     pa_queue *send_queue;
 
     pa_bool_t dead;
 
     struct {
-        pa_pstream_descriptor descriptor;
-        struct item_info* current;
-        uint32_t shm_info[PA_PSTREAM_SHM_MAX];
-        void *data;
+        /* Ring buffer of frames prepared for sending, index is the
+         * number of bytes already written of the first one */
+        struct write_frame frames[WRITE_FRAMES_MAX];
+        unsigned first, n_frames;
         size_t index;
-        pa_memchunk memchunk;
     } write;
 
-    struct {
-        pa_pstream_descriptor descriptor;
-        pa_memblock *memblock;
-        pa_packet *packet;
-        uint32_t shm_info[PA_PSTREAM_SHM_MAX];
-        void *data;
-        size_t index;
-    } read;
+    /* Frames on the socket and in the ring buffer are independent
+     * streams, each needs its own read state */
+    struct pstream_read readio, readsrb;
 
     pa_bool_t use_shm;
     pa_memimport *import;
@@ -160,13 +187,12 @@ struct pa_pstream {
     pa_mempool *mempool;
 
 #ifdef HAVE_CREDS
-    pa_creds read_creds, write_creds;
-    pa_bool_t read_creds_valid, send_creds_now;
+    pa_cmsg_ancil_data read_ancil_data;
 #endif
 };
 
 static int do_write(pa_pstream *p);
-static int do_read(pa_pstream *p);
+static int do_read(pa_pstream *p, struct pstream_read *re);
 
 static void do_something(pa_pstream *p) {
     pa_assert(p);
@@ -177,12 +203,17 @@ static void do_something(pa_pstream *p) {
     p->mainloop->defer_enable(p->defer_event, 0);
 
     if (!p->dead && pa_iochannel_is_readable(p->io)) {
-        if (do_read(p) < 0)
+        if (do_read(p, &p->readio) < 0)
             goto fail;
     } else if (!p->dead && pa_iochannel_is_hungup(p->io))
         goto fail;
 
-    if (!p->dead && pa_iochannel_is_writable(p->io)) {
+    if (!p->dead && p->srb && p->srb_read) {
+        if (do_read(p, &p->readsrb) < 0)
+            goto fail;
+    }
+
+    if (!p->dead) {
         if (do_write(p) < 0)
             goto fail;
     }
@@ -220,6 +251,26 @@ static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void*userdata)
     do_something(p);
 }
 
+static pa_bool_t srb_callback(pa_srbchannel *srb, void *userdata) {
+    pa_pstream *p = userdata;
+    pa_bool_t ret;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(p->srb == srb);
+
+    pa_pstream_ref(p);
+
+    do_something(p);
+
+    /* The channel is gone if we were unlinked meanwhile */
+    ret = !!p->srb;
+
+    pa_pstream_unref(p);
+
+    return ret;
+}
+
 static void memimport_release_cb(pa_memimport *i, uint32_t block_id, void *userdata);
 
 pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *pool) {
@@ -241,12 +292,13 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
 
     p->send_queue = pa_queue_new();
 
-    p->write.current = NULL;
+    p->srb = NULL;
+    p->srb_write = p->srb_read = FALSE;
+
+    p->write.first = p->write.n_frames = 0;
     p->write.index = 0;
-    pa_memchunk_reset(&p->write.memchunk);
-    p->read.memblock = NULL;
-    p->read.packet = NULL;
-    p->read.index = 0;
+    pa_zero(p->readio);
+    pa_zero(p->readsrb);
 
     p->receive_packet_callback = NULL;
     p->receive_packet_callback_userdata = NULL;
@@ -273,12 +325,22 @@ pa_pstream *pa_pstream_new(pa_mainloop_api *m, pa_iochannel *io, pa_mempool *poo
     pa_iochannel_socket_set_sndbuf(io, pa_mempool_block_size_max(p->mempool));
 
 #ifdef HAVE_CREDS
-    p->send_creds_now = FALSE;
-    p->read_creds_valid = FALSE;
+    pa_zero(p->read_ancil_data);
 #endif
     return p;
 }
 
+#ifdef HAVE_CREDS
+static void close_ancil_fds(pa_cmsg_ancil_data *ancil) {
+    int i;
+
+    for (i = 0; i < ancil->nfd; i++)
+        pa_close(ancil->fds[i]);
+
+    ancil->nfd = 0;
+}
+#endif
+
 static void item_free(void *item) {
     struct item_info *i = item;
     pa_assert(i);
@@ -291,10 +353,40 @@ static void item_free(void *item) {
         pa_packet_unref(i->packet);
     }
 
+#ifdef HAVE_CREDS
+    if (i->with_ancil_data)
+        close_ancil_fds(&i->ancil_data);
+#endif
+
     if (pa_flist_push(PA_STATIC_FLIST_GET(items), i) < 0)
         pa_xfree(i);
 }
 
+static struct write_frame *get_write_frame(pa_pstream *p, unsigned i) {
+    pa_assert(i < WRITE_FRAMES_MAX);
+
+    return &p->write.frames[(p->write.first + i) % WRITE_FRAMES_MAX];
+}
+
+static void write_frame_done(pa_pstream *p) {
+    struct write_frame *f;
+
+    pa_assert(p->write.n_frames > 0);
+
+    f = get_write_frame(p, 0);
+
+    item_free(f->current);
+    f->current = NULL;
+
+    if (f->memchunk.memblock)
+        pa_memblock_unref(f->memchunk.memblock);
+
+    pa_memchunk_reset(&f->memchunk);
+
+    p->write.first = (p->write.first + 1) % WRITE_FRAMES_MAX;
+    p->write.n_frames--;
+}
+
 static void pstream_free(pa_pstream *p) {
     pa_assert(p);
 
@@ -302,22 +394,29 @@ static void pstream_free(pa_pstream *p) {
 
     pa_queue_free(p->send_queue, item_free);
 
-    if (p->write.current)
-        item_free(p->write.current);
+    while (p->write.n_frames > 0)
+        write_frame_done(p);
+
+    if (p->readio.memblock)
+        pa_memblock_unref(p->readio.memblock);
 
-    if (p->write.memchunk.memblock)
-        pa_memblock_unref(p->write.memchunk.memblock);
+    if (p->readio.packet)
+        pa_packet_unref(p->readio.packet);
 
-    if (p->read.memblock)
-        pa_memblock_unref(p->read.memblock);
+    if (p->readsrb.memblock)
+        pa_memblock_unref(p->readsrb.memblock);
 
-    if (p->read.packet)
-        pa_packet_unref(p->read.packet);
+    if (p->readsrb.packet)
+        pa_packet_unref(p->readsrb.packet);
+
+#ifdef HAVE_CREDS
+    close_ancil_fds(&p->read_ancil_data);
+#endif
 
     pa_xfree(p);
 }
 
-void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *creds) {
+void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data) {
     struct item_info *i;
 
     pa_assert(p);
@@ -334,8 +433,18 @@ void pa_pstream_send_packet(pa_pstream*p, pa_packet *packet, const pa_creds *cre
     i->packet = pa_packet_ref(packet);
 
 #ifdef HAVE_CREDS
-    if ((i->with_creds = !!creds))
-        i->creds = *creds;
+    if ((i->with_ancil_data = !!ancil_data)) {
+        int j;
+
+        pa_assert(ancil_data->nfd >= 0 && ancil_data->nfd <= PA_CMSG_FDS_MAX);
+
+        /* We send our own copies of the file descriptors, so that the
+         * caller may close its ones right away */
+        i->ancil_data = *ancil_data;
+
+        for (j = 0; j < ancil_data->nfd; j++)
+            pa_assert_se((i->ancil_data.fds[j] = pa_dup_cloexec(ancil_data->fds[j])) >= 0);
+    }
 #endif
 
     pa_queue_push(p->send_queue, i);
@@ -377,7 +486,7 @@ void pa_pstream_send_memblock(pa_pstream*p, uint32_t channel, int64_t offset, pa
         i->offset = offset;
         i->seek_mode = seek_mode;
 #ifdef HAVE_CREDS
-        i->with_creds = FALSE;
+        i->with_ancil_data = FALSE;
 #endif
 
         pa_queue_push(p->send_queue, i);
@@ -404,7 +513,7 @@ void pa_pstream_send_release(pa_pstream *p, uint32_t block_id) {
     item->type = PA_PSTREAM_ITEM_SHMRELEASE;
     item->block_id = block_id;
 #ifdef HAVE_CREDS
-    item->with_creds = FALSE;
+    item->with_ancil_data = FALSE;
 #endif
 
     pa_queue_push(p->send_queue, item);
@@ -441,7 +550,7 @@ void pa_pstream_send_revoke(pa_pstream *p, uint32_t block_id) {
     item->type = PA_PSTREAM_ITEM_SHMREVOKE;
     item->block_id = block_id;
 #ifdef HAVE_CREDS
-    item->with_creds = FALSE;
+    item->with_ancil_data = FALSE;
 #endif
 
     pa_queue_push(p->send_queue, item);
@@ -461,53 +570,70 @@ static void memexport_revoke_cb(pa_memexport *e, uint32_t block_id, void *userda
         pa_pstream_send_revoke(p, block_id);
 }
 
-static void prepare_next_write_item(pa_pstream *p) {
+static pa_bool_t prepare_next_write_item(pa_pstream *p, struct write_frame *f) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(f);
 
-    p->write.current = pa_queue_pop(p->send_queue);
+    f->current = pa_queue_pop(p->send_queue);
 
-    if (!p->write.current)
-        return;
+    if (!f->current)
+        return FALSE;
 
-    p->write.index = 0;
-    p->write.data = NULL;
-    pa_memchunk_reset(&p->write.memchunk);
+    f->data = NULL;
+    pa_memchunk_reset(&f->memchunk);
 
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
-    p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
+    /* Ancillary data can only be passed on the socket */
+    f->use_srb = p->srb_write;
+#ifdef HAVE_CREDS
+    if (f->current->with_ancil_data)
+        f->use_srb = FALSE;
+#endif
 
-    if (p->write.current->type == PA_PSTREAM_ITEM_PACKET) {
+    f->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = 0;
+    f->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl((uint32_t) -1);
+    f->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = 0;
+    f->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+    f->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = 0;
 
-        pa_assert(p->write.current->packet);
-        p->write.data = p->write.current->packet->data;
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->packet->length);
+    if (f->current->type == PA_PSTREAM_ITEM_PACKET) {
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
+        pa_assert(f->current->packet);
+        f->data = f->current->packet->data;
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) f->current->packet->length);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+    } else if (f->current->type == PA_PSTREAM_ITEM_SHMRELEASE) {
 
-    } else if (p->write.current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMRELEASE);
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(f->current->block_id);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(p->write.current->block_id);
+    } else if (f->current->type == PA_PSTREAM_ITEM_SHMREVOKE) {
+
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SHMREVOKE);
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl(f->current->block_id);
+
+    } else if (f->current->type == PA_PSTREAM_ITEM_SRBSWITCH) {
+
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(PA_FLAG_SRBSWITCH);
+
+        /* This frame still goes over the socket, everything queued
+         * after it through the ring buffer */
+        f->use_srb = FALSE;
+        p->srb_write = TRUE;
+        return TRUE;
 
     } else {
         uint32_t flags;
         pa_bool_t send_payload = TRUE;
 
-        pa_assert(p->write.current->type == PA_PSTREAM_ITEM_MEMBLOCK);
-        pa_assert(p->write.current->chunk.memblock);
+        pa_assert(f->current->type == PA_PSTREAM_ITEM_MEMBLOCK);
+        pa_assert(f->current->chunk.memblock);
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(p->write.current->channel);
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) p->write.current->offset) >> 32));
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) p->write.current->offset));
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL] = htonl(f->current->channel);
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] = htonl((uint32_t) (((uint64_t) f->current->offset) >> 32));
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = htonl((uint32_t) ((uint64_t) f->current->offset));
 
-        flags = (uint32_t) (p->write.current->seek_mode & PA_FLAG_SEEKMASK);
+        flags = (uint32_t) (f->current->seek_mode & PA_FLAG_SEEKMASK);
 
         if (p->use_shm) {
             uint32_t block_id, shm_id;
@@ -516,7 +642,7 @@ static void prepare_next_write_item(pa_pstream *p) {
             pa_assert(p->export);
 
             if (pa_memexport_put(p->export,
-                                 p->write.current->chunk.memblock,
+                                 f->current->chunk.memblock,
                                  &block_id,
                                  &shm_id,
                                  &offset,
@@ -525,111 +651,169 @@ static void prepare_next_write_item(pa_pstream *p) {
                 flags |= PA_FLAG_SHMDATA;
                 send_payload = FALSE;
 
-                p->write.shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
-                p->write.shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
-                p->write.shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + p->write.current->chunk.index));
-                p->write.shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
+                f->shm_info[PA_PSTREAM_SHM_BLOCKID] = htonl(block_id);
+                f->shm_info[PA_PSTREAM_SHM_SHMID] = htonl(shm_id);
+                f->shm_info[PA_PSTREAM_SHM_INDEX] = htonl((uint32_t) (offset + f->current->chunk.index));
+                f->shm_info[PA_PSTREAM_SHM_LENGTH] = htonl((uint32_t) f->current->chunk.length);
 
-                p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(sizeof(p->write.shm_info));
-                p->write.data = p->write.shm_info;
+                f->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl(sizeof(f->shm_info));
+                f->data = f->shm_info;
             }
 /*             else */
 /*                 pa_log_warn("Failed to export memory block."); */
         }
 
         if (send_payload) {
-            p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) p->write.current->chunk.length);
-            p->write.memchunk = p->write.current->chunk;
-            pa_memblock_ref(p->write.memchunk.memblock);
-            p->write.data = NULL;
+            f->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH] = htonl((uint32_t) f->current->chunk.length);
+            f->memchunk = f->current->chunk;
+            pa_memblock_ref(f->memchunk.memblock);
+            f->data = NULL;
         }
 
-        p->write.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
+        f->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] = htonl(flags);
     }
 
-#ifdef HAVE_CREDS
-    if ((p->send_creds_now = p->write.current->with_creds))
-        p->write_creds = p->write.current->creds;
-#endif
+    return TRUE;
 }
 
 static int do_write(pa_pstream *p) {
-    void *d;
-    size_t l;
+    struct iovec iov[WRITE_FRAMES_MAX * 2];
+    pa_memblock *release_memblocks[WRITE_FRAMES_MAX];
+    unsigned n_iov = 0, n_release = 0, i;
+    size_t index;
     ssize_t r;
-    pa_memblock *release_memblock = NULL;
+    pa_bool_t done = FALSE, use_srb;
+#ifdef HAVE_CREDS
+    const pa_cmsg_ancil_data *ancil_data = NULL;
+#endif
 
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (!p->write.current)
-        prepare_next_write_item(p);
+    while (p->write.n_frames < WRITE_FRAMES_MAX &&
+           prepare_next_write_item(p, get_write_frame(p, p->write.n_frames)))
+        p->write.n_frames++;
 
-    if (!p->write.current)
+    if (p->write.n_frames <= 0)
         return 0;
 
-    if (p->write.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->write.descriptor + p->write.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->write.index;
-    } else {
-        pa_assert(p->write.data || p->write.memchunk.memblock);
+    use_srb = get_write_frame(p, 0)->use_srb;
 
-        if (p->write.data)
-            d = p->write.data;
-        else {
-            d = pa_memblock_acquire_chunk(&p->write.memchunk);
-            release_memblock = p->write.memchunk.memblock;
-        }
+    if (!use_srb && !pa_iochannel_is_writable(p->io))
+        return 0;
 
-        d = (uint8_t*) d + p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->write.index - PA_PSTREAM_DESCRIPTOR_SIZE);
-    }
+    /* Gather the remainder of the first frame and as many of the
+     * following frames for the same channel as we have prepared into a
+     * single write */
+    index = p->write.index;
 
-    pa_assert(l > 0);
+    for (i = 0; i < p->write.n_frames; i++) {
+        struct write_frame *f = get_write_frame(p, i);
+        size_t length = ntohl(f->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+
+        if (f->use_srb != use_srb)
+            break;
 
 #ifdef HAVE_CREDS
-    if (p->send_creds_now) {
+        /* Ancillary data is attached to a whole message, hence a frame
+         * that carries it is always sent on its own */
+        if (f->current->with_ancil_data) {
+            if (i > 0)
+                break;
+
+            if (index == 0)
+                ancil_data = &f->current->ancil_data;
+        }
+#endif
 
-        if ((r = pa_iochannel_write_with_creds(p->io, d, l, &p->write_creds)) < 0)
-            goto fail;
+        if (index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+            iov[n_iov].iov_base = (uint8_t*) f->descriptor + index;
+            iov[n_iov].iov_len = PA_PSTREAM_DESCRIPTOR_SIZE - index;
+            n_iov++;
 
-        p->send_creds_now = FALSE;
-    } else
+            index = PA_PSTREAM_DESCRIPTOR_SIZE;
+        }
+
+        if (length > 0) {
+            void *d;
+
+            pa_assert(f->data || f->memchunk.memblock);
+
+            if (f->data)
+                d = f->data;
+            else {
+                d = pa_memblock_acquire_chunk(&f->memchunk);
+                release_memblocks[n_release++] = f->memchunk.memblock;
+            }
+
+            iov[n_iov].iov_base = (uint8_t*) d + index - PA_PSTREAM_DESCRIPTOR_SIZE;
+            iov[n_iov].iov_len = length - (index - PA_PSTREAM_DESCRIPTOR_SIZE);
+            n_iov++;
+        }
+
+        index = 0;
+
+#ifdef HAVE_CREDS
+        if (f->current->with_ancil_data)
+            break;
 #endif
+    }
 
-    if ((r = pa_iochannel_write(p->io, d, l)) < 0)
-        goto fail;
+    pa_assert(n_iov > 0);
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+    if (use_srb) {
+        size_t n;
 
-    p->write.index += (size_t) r;
+        r = 0;
+        for (i = 0; i < n_iov; i++) {
+            n = pa_srbchannel_write(p->srb, iov[i].iov_base, iov[i].iov_len);
+            r += (ssize_t) n;
 
-    if (p->write.index >= PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(p->write.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH])) {
-        pa_assert(p->write.current);
-        item_free(p->write.current);
-        p->write.current = NULL;
+            if (n < iov[i].iov_len)
+                break;
+        }
 
-        if (p->write.memchunk.memblock)
-            pa_memblock_unref(p->write.memchunk.memblock);
+        /* If everything fit we won't get a wakeup from the ring
+         * buffer, so come back for the rest ourselves */
+        if (i >= n_iov)
+            p->mainloop->defer_enable(p->defer_event, 1);
 
-        pa_memchunk_reset(&p->write.memchunk);
+#ifdef HAVE_CREDS
+    } else if (ancil_data) {
+        r = pa_iochannel_writev_with_ancil_data(p->io, iov, n_iov, ancil_data);
+#endif
+    } else
+        r = pa_iochannel_writev(p->io, iov, n_iov);
 
-        if (p->drain_callback && !pa_pstream_is_pending(p))
-            p->drain_callback(p, p->drain_callback_userdata);
-    }
+    for (i = 0; i < n_release; i++)
+        pa_memblock_release(release_memblocks[i]);
 
-    return 0;
+    if (r < 0)
+        return -1;
 
-fail:
+    p->write.index += (size_t) r;
 
-    if (release_memblock)
-        pa_memblock_release(release_memblock);
+    while (p->write.n_frames > 0) {
+        size_t size = PA_PSTREAM_DESCRIPTOR_SIZE + ntohl(get_write_frame(p, 0)->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
 
-    return -1;
+        if (p->write.index < size)
+            break;
+
+        p->write.index -= size;
+        write_frame_done(p);
+        done = TRUE;
+    }
+
+    if (done && p->drain_callback && !pa_pstream_is_pending(p))
+        p->drain_callback(p, p->drain_callback_userdata);
+
+    return 0;
 }
 
-static int do_read(pa_pstream *p) {
+/* Returns 1 if something was read, 0 if no more data was available
+ * and -1 on failure. With first set we were woken up for reading and
+ * running out of data is a failure, too. */
+static int do_read_step(pa_pstream *p, struct pstream_read *re, pa_bool_t first) {
     void *d;
     size_t l;
     ssize_t r;
@@ -637,47 +821,81 @@ static int do_read(pa_pstream *p) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
 
-    if (p->read.index < PA_PSTREAM_DESCRIPTOR_SIZE) {
-        d = (uint8_t*) p->read.descriptor + p->read.index;
-        l = PA_PSTREAM_DESCRIPTOR_SIZE - p->read.index;
+    if (re->index < PA_PSTREAM_DESCRIPTOR_SIZE) {
+        d = (uint8_t*) re->descriptor + re->index;
+        l = PA_PSTREAM_DESCRIPTOR_SIZE - re->index;
     } else {
-        pa_assert(p->read.data || p->read.memblock);
+        pa_assert(re->data || re->memblock);
 
-        if (p->read.data)
-            d = p->read.data;
+        if (re->data)
+            d = re->data;
         else {
-            d = pa_memblock_acquire(p->read.memblock);
-            release_memblock = p->read.memblock;
+            d = pa_memblock_acquire(re->memblock);
+            release_memblock = re->memblock;
         }
 
-        d = (uint8_t*) d + p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE;
-        l = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE);
+        d = (uint8_t*) d + re->index - PA_PSTREAM_DESCRIPTOR_SIZE;
+        l = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) - (re->index - PA_PSTREAM_DESCRIPTOR_SIZE);
     }
 
+    if (re == &p->readsrb) {
+        if ((r = (ssize_t) pa_srbchannel_read(p->srb, d, l)) <= 0) {
+            if (release_memblock)
+                pa_memblock_release(release_memblock);
+
+            return 0;
+        }
+    } else {
 #ifdef HAVE_CREDS
-    {
-        pa_bool_t b = 0;
+        pa_cmsg_ancil_data b;
+        int i;
 
-        if ((r = pa_iochannel_read_with_creds(p->io, d, l, &p->read_creds, &b)) <= 0)
-            goto fail;
+        if ((r = pa_iochannel_read_with_ancil_data(p->io, d, l, &b)) <= 0)
+            goto read_fail;
 
-        p->read_creds_valid = p->read_creds_valid || b;
-    }
+        if (b.creds_valid) {
+            p->read_ancil_data.creds = b.creds;
+            p->read_ancil_data.creds_valid = TRUE;
+        }
+
+        for (i = 0; i < b.nfd; i++) {
+            if (p->read_ancil_data.nfd < PA_CMSG_FDS_MAX)
+                p->read_ancil_data.fds[p->read_ancil_data.nfd++] = b.fds[i];
+            else
+                pa_close(b.fds[i]);
+        }
 #else
-    if ((r = pa_iochannel_read(p->io, d, l)) <= 0)
-        goto fail;
+        if ((r = pa_iochannel_read(p->io, d, l)) <= 0)
+            goto read_fail;
 #endif
+    }
 
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
-    p->read.index += (size_t) r;
+    re->index += (size_t) r;
 
-    if (p->read.index == PA_PSTREAM_DESCRIPTOR_SIZE) {
+    if (re->index == PA_PSTREAM_DESCRIPTOR_SIZE) {
         uint32_t flags, length, channel;
         /* Reading of frame descriptor complete */
 
-        flags = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+        flags = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]);
+
+        if (flags == PA_FLAG_SRBSWITCH) {
+
+            /* The other side sends everything after this frame through
+             * the ring buffer */
+
+            if (re != &p->readio || !p->srb || p->srb_read) {
+                pa_log_warn("Received unexpected ring buffer switch frame.");
+                return -1;
+            }
+
+            p->srb_read = TRUE;
+            p->mainloop->defer_enable(p->defer_event, 1);
+
+            goto frame_done;
+        }
 
         if (!p->use_shm && (flags & PA_FLAG_SHMMASK) != 0) {
             pa_log_warn("Received SHM frame on a socket where SHM is disabled.");
@@ -688,10 +906,10 @@ static int do_read(pa_pstream *p) {
 
             /* This is a SHM memblock release frame with no payload */
 
-/*             pa_log("Got release frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+/*             pa_log("Got release frame for %u", ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
 
             pa_assert(p->export);
-            pa_memexport_process_release(p->export, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+            pa_memexport_process_release(p->export, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
 
             goto frame_done;
 
@@ -699,24 +917,24 @@ static int do_read(pa_pstream *p) {
 
             /* This is a SHM memblock revoke frame with no payload */
 
-/*             pa_log("Got revoke frame for %u", ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
+/*             pa_log("Got revoke frame for %u", ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])); */
 
             pa_assert(p->import);
-            pa_memimport_process_revoke(p->import, ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
+            pa_memimport_process_revoke(p->import, ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI]));
 
             goto frame_done;
         }
 
-        length = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
+        length = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]);
 
         if (length > FRAME_SIZE_MAX_ALLOW || length <= 0) {
             pa_log_warn("Received invalid frame size: %lu", (unsigned long) length);
             return -1;
         }
 
-        pa_assert(!p->read.packet && !p->read.memblock);
+        pa_assert(!re->packet && !re->memblock);
 
-        channel = ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
+        channel = ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]);
 
         if (channel == (uint32_t) -1) {
 
@@ -726,8 +944,8 @@ static int do_read(pa_pstream *p) {
             }
 
             /* Frame is a packet frame */
-            p->read.packet = pa_packet_new(length);
-            p->read.data = p->read.packet->data;
+            re->packet = pa_packet_new(length);
+            re->data = re->packet->data;
 
         } else {
 
@@ -738,20 +956,20 @@ static int do_read(pa_pstream *p) {
 
             if ((flags & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA) {
 
-                if (length != sizeof(p->read.shm_info)) {
+                if (length != sizeof(re->shm_info)) {
                     pa_log_warn("Received SHM memblock frame with Invalid frame length.");
                     return -1;
                 }
 
                 /* Frame is a memblock frame referencing an SHM memblock */
-                p->read.data = p->read.shm_info;
+                re->data = re->shm_info;
 
             } else if ((flags & PA_FLAG_SHMMASK) == 0) {
 
                 /* Frame is a memblock frame */
 
-                p->read.memblock = pa_memblock_new(p->mempool, length);
-                p->read.data = NULL;
+                re->memblock = pa_memblock_new(p->mempool, length);
+                re->data = NULL;
             } else {
 
                 pa_log_warn("Received memblock frame with invalid flags value.");
@@ -759,74 +977,78 @@ static int do_read(pa_pstream *p) {
             }
         }
 
-    } else if (p->read.index > PA_PSTREAM_DESCRIPTOR_SIZE) {
+    } else if (re->index > PA_PSTREAM_DESCRIPTOR_SIZE) {
         /* Frame payload available */
 
-        if (p->read.memblock && p->receive_memblock_callback) {
+        if (re->memblock && p->receive_memblock_callback) {
 
             /* Is this memblock data? Than pass it to the user */
-            l = (p->read.index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
+            l = (re->index - (size_t) r) < PA_PSTREAM_DESCRIPTOR_SIZE ? (size_t) (re->index - PA_PSTREAM_DESCRIPTOR_SIZE) : (size_t) r;
 
             if (l > 0) {
                 pa_memchunk chunk;
 
-                chunk.memblock = p->read.memblock;
-                chunk.index = p->read.index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
+                chunk.memblock = re->memblock;
+                chunk.index = re->index - PA_PSTREAM_DESCRIPTOR_SIZE - l;
                 chunk.length = l;
 
                 if (p->receive_memblock_callback) {
                     int64_t offset;
 
                     offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
 
                     p->receive_memblock_callback(
                         p,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
+                        ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
                         offset,
-                        ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+                        ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
                         &chunk,
                         p->receive_memblock_callback_userdata);
                 }
 
                 /* Drop seek info for following callbacks */
-                p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
-                    p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
+                re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS] =
+                    re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI] =
+                    re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO] = 0;
             }
         }
 
         /* Frame complete */
-        if (p->read.index >= ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE) {
+        if (re->index >= ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_LENGTH]) + PA_PSTREAM_DESCRIPTOR_SIZE) {
 
-            if (p->read.memblock) {
+            if (re->memblock) {
 
                 /* This was a memblock frame. We can unref the memblock now */
-                pa_memblock_unref(p->read.memblock);
+                pa_memblock_unref(re->memblock);
 
-            } else if (p->read.packet) {
+            } else if (re->packet) {
+
+                if (p->receive_packet_callback) {
+                    const pa_cmsg_ancil_data *ancil_data = NULL;
 
-                if (p->receive_packet_callback)
 #ifdef HAVE_CREDS
-                    p->receive_packet_callback(p, p->read.packet, p->read_creds_valid ? &p->read_creds : NULL, p->receive_packet_callback_userdata);
-#else
-                    p->receive_packet_callback(p, p->read.packet, NULL, p->receive_packet_callback_userdata);
+                    if (re == &p->readio && (p->read_ancil_data.creds_valid || p->read_ancil_data.nfd > 0))
+                        ancil_data = &p->read_ancil_data;
 #endif
 
-                pa_packet_unref(p->read.packet);
+                    p->receive_packet_callback(p, re->packet, ancil_data, p->receive_packet_callback_userdata);
+                }
+
+                pa_packet_unref(re->packet);
             } else {
                 pa_memblock *b;
 
-                pa_assert((ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA);
+                pa_assert((ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SHMMASK) == PA_FLAG_SHMDATA);
 
                 pa_assert(p->import);
 
                 if (!(b = pa_memimport_get(p->import,
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_BLOCKID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_SHMID]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_INDEX]),
-                                          ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH])))) {
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_BLOCKID]),
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_SHMID]),
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_INDEX]),
+                                          ntohl(re->shm_info[PA_PSTREAM_SHM_LENGTH])))) {
 
                     if (pa_log_ratelimit(PA_LOG_DEBUG))
                         pa_log_debug("Failed to import memory block.");
@@ -838,17 +1060,17 @@ static int do_read(pa_pstream *p) {
 
                     chunk.memblock = b;
                     chunk.index = 0;
-                    chunk.length = b ? pa_memblock_get_length(b) : ntohl(p->read.shm_info[PA_PSTREAM_SHM_LENGTH]);
+                    chunk.length = b ? pa_memblock_get_length(b) : ntohl(re->shm_info[PA_PSTREAM_SHM_LENGTH]);
 
                     offset = (int64_t) (
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
-                            (((uint64_t) ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_HI])) << 32) |
+                            (((uint64_t) ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_OFFSET_LO]))));
 
                     p->receive_memblock_callback(
                             p,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
+                            ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_CHANNEL]),
                             offset,
-                            ntohl(p->read.descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
+                            ntohl(re->descriptor[PA_PSTREAM_DESCRIPTOR_FLAGS]) & PA_FLAG_SEEKMASK,
                             &chunk,
                             p->receive_memblock_callback_userdata);
                 }
@@ -861,27 +1083,57 @@ static int do_read(pa_pstream *p) {
         }
     }
 
-    return 0;
+    return 1;
 
 frame_done:
-    p->read.memblock = NULL;
-    p->read.packet = NULL;
-    p->read.index = 0;
-    p->read.data = NULL;
+    re->memblock = NULL;
+    re->packet = NULL;
+    re->index = 0;
+    re->data = NULL;
 
 #ifdef HAVE_CREDS
-    p->read_creds_valid = FALSE;
+    /* File descriptors the receiver wants to keep have been dup()ed
+     * by it */
+    if (re == &p->readio) {
+        close_ancil_fds(&p->read_ancil_data);
+        p->read_ancil_data.creds_valid = FALSE;
+    }
 #endif
 
-    return 0;
+    return 1;
 
-fail:
+read_fail:
     if (release_memblock)
         pa_memblock_release(release_memblock);
 
+    if (r < 0 && errno == EAGAIN && !first)
+        return 0;
+
     return -1;
 }
 
+static int do_read(pa_pstream *p, struct pstream_read *re) {
+    unsigned n;
+    int r;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+
+    /* Keep on reading until the socket resp. ring buffer is drained, so
+     * that a burst of small frames is handled in a single wakeup. An
+     * empty ring buffer is not an error, we weren't woken up by it. */
+    for (n = 0; n < READ_ITERATIONS_MAX && !p->dead; n++)
+        if ((r = do_read_step(p, re, n == 0 && re == &p->readio)) <= 0)
+            return r;
+
+    /* Unlike the socket the ring buffer won't wake us up again for
+     * data that is already there */
+    if (re == &p->readsrb && !p->dead)
+        p->mainloop->defer_enable(p->defer_event, 1);
+
+    return 0;
+}
+
 void pa_pstream_set_die_callback(pa_pstream *p, pa_pstream_notify_cb_t cb, void *userdata) {
     pa_assert(p);
     pa_assert(PA_REFCNT_VALUE(p) > 0);
@@ -939,7 +1191,7 @@ pa_bool_t pa_pstream_is_pending(pa_pstream *p) {
     if (p->dead)
         b = FALSE;
     else
-        b = p->write.current || !pa_queue_isempty(p->send_queue);
+        b = p->write.n_frames > 0 || !pa_queue_isempty(p->send_queue);
 
     return b;
 }
@@ -983,6 +1235,11 @@ void pa_pstream_unlink(pa_pstream *p) {
         p->io = NULL;
     }
 
+    if (p->srb) {
+        pa_srbchannel_free(p->srb);
+        p->srb = NULL;
+    }
+
     if (p->defer_event) {
         p->mainloop->defer_free(p->defer_event);
         p->defer_event = NULL;
@@ -1020,3 +1277,32 @@ pa_bool_t pa_pstream_get_shm(pa_pstream *p) {
 
     return p->use_shm;
 }
+
+void pa_pstream_set_srbchannel(pa_pstream *p, pa_srbchannel *srb) {
+    struct item_info *item;
+
+    pa_assert(p);
+    pa_assert(PA_REFCNT_VALUE(p) > 0);
+    pa_assert(srb);
+    pa_assert(!p->srb);
+
+    if (p->dead) {
+        pa_srbchannel_free(srb);
+        return;
+    }
+
+    p->srb = srb;
+    pa_srbchannel_set_callback(srb, srb_callback, p);
+
+    /* Tell the other side from which point on to read from the ring
+     * buffer. Everything already queued still goes over the socket. */
+    if (!(item = pa_flist_pop(PA_STATIC_FLIST_GET(items))))
+        item = pa_xnew(struct item_info, 1);
+    item->type = PA_PSTREAM_ITEM_SRBSWITCH;
+#ifdef HAVE_CREDS
+    item->with_ancil_data = FALSE;
+#endif
+
+    pa_queue_push(p->send_queue, item);
+    p->mainloop->defer_enable(p->defer_event, 1);
+}
@@ -47,6 +47,10 @@
 /* Number of samples of extra space we allow the resamplers to return */
 #define EXTRA_FRAMES 128
 
+/* Size of the work format data that fused_run() passes through all
+ * steps at once */
+#define TILE_SIZE (8*1024)
+
 struct pa_resampler {
     pa_resample_method_t method;
     pa_resample_flags_t flags;
@@ -66,6 +70,11 @@ struct pa_resampler {
     unsigned from_work_format_buf_samples;
     pa_bool_t remap_buf_contains_leftover_data;
 
+    /* If set, pa_resampler_run() uses the buffers above only as scratch
+     * space for tile_frames frames at a time, see fused_run() */
+    pa_bool_t fused;
+    unsigned tile_frames;
+
     pa_sample_format_t work_format;
 
     pa_convert_func_t to_work_format_func;
@@ -202,6 +211,7 @@ pa_resampler* pa_resampler_new(
         pa_resample_flags_t flags) {
 
     pa_resampler *r = NULL;
+    unsigned channels;
 
     pa_assert(pool);
     pa_assert(a);
@@ -323,10 +333,22 @@ pa_resampler* pa_resampler_new(
         }
     }
 
+    /* Implementations that might leave input unconsumed clear this,
+     * see save_leftover() */
+    r->fused = !(flags & PA_RESAMPLER_NO_FUSE);
+
     /* initialize implementation */
     if (init_table[method](r) < 0)
         goto fail;
 
+    /* Fusing only pays off if there are at least two steps, otherwise
+     * it would just add a copy */
+    if (r->fused)
+        r->fused = (!!r->to_work_format_func + !!r->map_required + !!r->impl_resample + !!r->from_work_format_func) >= 2;
+
+    channels = PA_MAX(r->i_ss.channels, r->o_ss.channels);
+    r->tile_frames = PA_MAX(TILE_SIZE / (r->w_sz * channels), 1U);
+
     return r;
 
 fail:
@@ -1279,6 +1301,67 @@ static pa_memchunk *convert_from_work_format(pa_resampler *r, pa_memchunk *input
     return &r->from_work_format_buf;
 }
 
+/* Passes the input tile by tile through all steps, so that the
+ * intermediate data stays in the (small) conversion buffers while it is
+ * still in cache, and writes the result directly into the output block.
+ * This is the only block that is allocated. */
+static void fused_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
+    unsigned in_n_frames, out_n_frames, max_out_n_frames, n_frames;
+    pa_memchunk tile, *buf;
+    uint8_t *dst;
+    void *src;
+
+    pa_assert(!r->remap_buf_contains_leftover_data);
+
+    in_n_frames = (unsigned) (in->length / r->i_fz);
+    max_out_n_frames = (unsigned) (((uint64_t) in_n_frames * r->o_ss.rate) / r->i_ss.rate) + EXTRA_FRAMES;
+    out_n_frames = 0;
+
+    out->memblock = pa_memblock_new(r->mempool, max_out_n_frames * r->o_fz);
+    out->index = 0;
+    dst = pa_memblock_acquire(out->memblock);
+
+    tile.memblock = in->memblock;
+    tile.index = in->index;
+
+    for (; in_n_frames > 0; in_n_frames -= n_frames) {
+        n_frames = PA_MIN(in_n_frames, r->tile_frames);
+        tile.length = n_frames * r->i_fz;
+
+        buf = convert_to_work_format(r, &tile);
+        buf = remap_channels(r, buf);
+        buf = resample(r, buf);
+
+        tile.index += tile.length;
+
+        if (buf->length) {
+            unsigned n_samples = (unsigned) (buf->length / r->w_sz);
+
+            pa_assert(out_n_frames + n_samples / r->o_ss.channels <= max_out_n_frames);
+
+            src = pa_memblock_acquire_chunk(buf);
+
+            if (r->from_work_format_func)
+                r->from_work_format_func(n_samples, src, dst + out_n_frames * r->o_fz);
+            else
+                memcpy(dst + out_n_frames * r->o_fz, src, buf->length);
+
+            pa_memblock_release(buf->memblock);
+
+            out_n_frames += n_samples / r->o_ss.channels;
+        }
+    }
+
+    pa_memblock_release(out->memblock);
+
+    if (out_n_frames > 0)
+        out->length = out_n_frames * r->o_fz;
+    else {
+        pa_memblock_unref(out->memblock);
+        pa_memchunk_reset(out);
+    }
+}
+
 void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out) {
     pa_memchunk *buf;
 
@@ -1289,6 +1372,11 @@ void pa_resampler_run(pa_resampler *r, const pa_memchunk *in, pa_memchunk *out)
     pa_assert(in->memblock);
     pa_assert(in->length % r->i_fz == 0);
 
+    if (r->fused) {
+        fused_run(r, in, out);
+        return;
+    }
+
     buf = (pa_memchunk*) in;
     buf = convert_to_work_format(r, buf);
     buf = remap_channels(r, buf);
@@ -1400,6 +1488,7 @@ static int libsamplerate_init(pa_resampler *r) {
     r->impl_update_rates = libsamplerate_update_rates;
     r->impl_resample = libsamplerate_resample;
     r->impl_reset = libsamplerate_reset;
+    r->fused = FALSE;
 
     return 0;
 }
@@ -1607,7 +1696,7 @@ static void peaks_resample(pa_resampler *r, const pa_memchunk *input, unsigned i
                 o_index++, r->peaks.o_counter++;
             }
         } else if (r->work_format == PA_SAMPLE_S16NE) {
-            int16_t *s = (int16_t*) src + r->i_ss.channels * i;
+            int16_t *s = (int16_t*) src + r->o_ss.channels * i;
             int16_t *d = (int16_t*) dst + r->o_ss.channels * o_index;
 
             for (; i < i_end && i < in_n_frames; i++)
@@ -1626,7 +1715,7 @@ static void peaks_resample(pa_resampler *r, const pa_memchunk *input, unsigned i
                 o_index++, r->peaks.o_counter++;
             }
         } else {
-            float *s = (float*) src + r->i_ss.channels * i;
+            float *s = (float*) src + r->o_ss.channels * i;
             float *d = (float*) dst + r->o_ss.channels * o_index;
 
             for (; i < i_end && i < in_n_frames; i++)
@@ -1786,6 +1875,7 @@ static int ffmpeg_init(pa_resampler *r) {
 
     r->impl_free = ffmpeg_free;
     r->impl_resample = ffmpeg_resample;
+    r->fused = FALSE;
 
     for (c = 0; c < PA_ELEMENTSOF(r->ffmpeg.buf); c++)
         pa_memchunk_reset(&r->ffmpeg.buf[c]);
@@ -60,8 +60,9 @@
 #define MADV_REMOVE 9
 #endif
 
-/* 1 GiB at max */
-#define MAX_SHM_SIZE (PA_ALIGN(1024*1024*1024))
+/* The size of the huge pages we ask for with MAP_HUGETLB. This is the
+ * default size on x86 and most ARM systems. */
+#define HUGE_PAGE_SIZE (2*1024*1024)
 
 #ifdef __linux__
 /* On Linux we know that the shared memory blocks are files in
@@ -97,7 +98,14 @@ static char *segment_name(char *fn, size_t l, unsigned id) {
 }
 #endif
 
-int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
+static void advise_huge_pages(void *ptr, size_t size) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(ptr, size, MADV_HUGEPAGE) < 0)
+        pa_log_debug("madvise(MADV_HUGEPAGE) failed: %s", pa_cstrerror(errno));
+#endif
+}
+
+int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, pa_bool_t huge_pages, mode_t mode) {
 #ifdef HAVE_SHM_OPEN
     char fn[32];
     int fd = -1;
@@ -105,7 +113,7 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
 
     pa_assert(m);
     pa_assert(size > 0);
-    pa_assert(size <= MAX_SHM_SIZE);
+    pa_assert(size <= PA_SHM_SIZE_MAX);
     pa_assert(mode >= 0600);
 
     /* Each time we create a new SHM area, let's first drop all stale
@@ -115,14 +123,38 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
     /* Round up to make it page aligned */
     size = PA_PAGE_ALIGN(size);
 
+    m->huge_pages = FALSE;
+
     if (!shared) {
         m->id = 0;
         m->size = size;
 
 #ifdef MAP_ANONYMOUS
-        if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
-            pa_log("mmap() failed: %s", pa_cstrerror(errno));
-            goto fail;
+        m->ptr = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+        /* This only works if the administrator reserved enough huge
+         * pages, so failing here is not an error */
+        if (huge_pages) {
+            size_t huge_size = ((size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+
+            if ((m->ptr = mmap(NULL, huge_size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_HUGETLB, -1, (off_t) 0)) == MAP_FAILED)
+                pa_log_info("Failed to allocate huge pages, falling back to normal pages: %s", pa_cstrerror(errno));
+            else {
+                m->size = huge_size;
+                m->huge_pages = TRUE;
+            }
+        }
+#endif
+
+        if (m->ptr == MAP_FAILED) {
+            if ((m->ptr = mmap(NULL, m->size, PROT_READ|PROT_WRITE, MAP_ANONYMOUS|MAP_PRIVATE, -1, (off_t) 0)) == MAP_FAILED) {
+                pa_log("mmap() failed: %s", pa_cstrerror(errno));
+                goto fail;
+            }
+
+            if (huge_pages)
+                advise_huge_pages(m->ptr, m->size);
         }
 #elif defined(HAVE_POSIX_MEMALIGN)
         {
@@ -167,6 +199,9 @@ int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode) {
             goto fail;
         }
 
+        if (huge_pages)
+            advise_huge_pages(m->ptr, PA_PAGE_ALIGN(m->size));
+
         /* We store our PID at the end of the shm block, so that we
          * can check for dead shm segments later */
         marker = (struct shm_marker*) ((uint8_t*) m->ptr + m->size - SHM_MARKER_SIZE);
@@ -252,6 +287,11 @@ void pa_shm_punch(pa_shm *m, size_t offset, size_t size) {
     /* You're welcome to implement this as NOOP on systems that don't
      * support it */
 
+    /* Explicit huge pages can only be given back as a whole, and the
+     * slots are much smaller than that */
+    if (m->huge_pages)
+        return;
+
     /* Align the pointer up to multiples of the page size */
     ptr = (uint8_t*) m->ptr + offset;
     o = (size_t) ((uint8_t*) ptr - (uint8_t*) PA_PAGE_ALIGN_PTR(ptr));
@@ -305,7 +345,7 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
     }
 
     if (st.st_size <= 0 ||
-        st.st_size > (off_t) (MAX_SHM_SIZE+SHM_MARKER_SIZE) ||
+        st.st_size > (off_t) (PA_SHM_SIZE_MAX+SHM_MARKER_SIZE) ||
         PA_ALIGN((size_t) st.st_size) != (size_t) st.st_size) {
         pa_log("Invalid shared memory segment size");
         goto fail;
@@ -320,6 +360,7 @@ int pa_shm_attach_ro(pa_shm *m, unsigned id) {
 
     m->do_unlink = FALSE;
     m->shared = TRUE;
+    m->huge_pages = FALSE;
 
     pa_assert_se(pa_close(fd) == 0);
 
@@ -332,12 +373,101 @@ fail:
     return -1;
 }
 
+int pa_shm_create_fd(pa_shm *m, size_t size, int *ret_fd) {
+    char fn[32];
+    int fd = -1;
+
+    pa_assert(m);
+    pa_assert(size > 0);
+    pa_assert(size <= PA_SHM_SIZE_MAX);
+    pa_assert(ret_fd);
+
+    pa_zero(*m);
+
+    /* We unlink the segment right away, it can only be reached through
+     * the file descriptor afterwards */
+    pa_random(&m->id, sizeof(m->id));
+    segment_name(fn, sizeof(fn), m->id);
+
+    if ((fd = shm_open(fn, O_RDWR|O_CREAT|O_EXCL, 0600)) < 0) {
+        pa_log("shm_open() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    shm_unlink(fn);
+    pa_make_fd_cloexec(fd);
+
+    m->size = size;
+
+    if (ftruncate(fd, (off_t) m->size) < 0) {
+        pa_log("ftruncate() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    m->do_unlink = FALSE;
+    m->shared = TRUE;
+
+    *ret_fd = fd;
+    return 0;
+
+fail:
+    pa_close(fd);
+    pa_zero(*m);
+
+    return -1;
+}
+
+int pa_shm_attach_fd(pa_shm *m, int fd) {
+    struct stat st;
+
+    pa_assert(m);
+    pa_assert(fd >= 0);
+
+    pa_zero(*m);
+
+    if (fstat(fd, &st) < 0) {
+        pa_log("fstat() failed: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (st.st_size <= 0 || st.st_size > (off_t) PA_SHM_SIZE_MAX) {
+        pa_log("Invalid shared memory segment size");
+        return -1;
+    }
+
+    m->size = (size_t) st.st_size;
+
+    if ((m->ptr = mmap(NULL, PA_PAGE_ALIGN(m->size), PROT_READ|PROT_WRITE, MAP_SHARED, fd, (off_t) 0)) == MAP_FAILED) {
+        pa_log("mmap() failed: %s", pa_cstrerror(errno));
+        pa_zero(*m);
+        return -1;
+    }
+
+    m->do_unlink = FALSE;
+    m->shared = TRUE;
+
+    return 0;
+}
+
 #else /* HAVE_SHM_OPEN */
 
 int pa_shm_attach_ro(pa_shm *m, unsigned id) {
     return -1;
 }
 
+int pa_shm_create_fd(pa_shm *m, size_t size, int *ret_fd) {
+    return -1;
+}
+
+int pa_shm_attach_fd(pa_shm *m, int fd) {
+    return -1;
+}
+
 #endif /* HAVE_SHM_OPEN */
 
 int pa_shm_cleanup(void) {
@@ -26,17 +26,31 @@
 
 #include <pulsecore/macro.h>
 
+/* 1 GiB at max */
+#define PA_SHM_SIZE_MAX (PA_ALIGN(1024*1024*1024))
+
 typedef struct pa_shm {
     unsigned id;
     void *ptr;
     size_t size;
     pa_bool_t do_unlink:1;
     pa_bool_t shared:1;
+    pa_bool_t huge_pages:1; /* Mapped with MAP_HUGETLB */
 } pa_shm;
 
-int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, mode_t mode);
+/* If huge_pages is TRUE we try to back private segments with
+ * explicitly reserved huge pages, and if that is not possible (or for
+ * shared segments) ask the kernel for transparent huge pages. */
+int pa_shm_create_rw(pa_shm *m, size_t size, pa_bool_t shared, pa_bool_t huge_pages, mode_t mode);
 int pa_shm_attach_ro(pa_shm *m, unsigned id);
 
+/* Creates a writable shared segment that has no name and can only be
+ * shared by passing the returned file descriptor to another process,
+ * which then maps it writable with pa_shm_attach_fd(). The caller owns
+ * the file descriptor in both cases. */
+int pa_shm_create_fd(pa_shm *m, size_t size, int *fd);
+int pa_shm_attach_fd(pa_shm *m, int fd);
+
 void pa_shm_punch(pa_shm *m, size_t offset, size_t size);
 
 void pa_shm_free(pa_shm *m);
@@ -50,7 +50,7 @@
 
 #include "sink.h"
 
-#define MAX_MIX_CHANNELS 32
+#define MIX_INFO_INITIAL_SIZE 32
 #define MIX_BUFFER_LENGTH (PA_PAGE_SIZE)
 #define ABSOLUTE_MIN_LATENCY (500)
 #define ABSOLUTE_MAX_LATENCY (10*PA_USEC_PER_SEC)
@@ -328,6 +328,8 @@ pa_sink* pa_sink_new(
     s->thread_info.inputs = pa_hashmap_new(pa_idxset_trivial_hash_func, pa_idxset_trivial_compare_func);
     s->thread_info.soft_volume =  s->soft_volume;
     s->thread_info.soft_muted = s->muted;
+    s->thread_info.mix_info_size = MIX_INFO_INITIAL_SIZE;
+    s->thread_info.mix_info = pa_xnew(pa_mix_info, s->thread_info.mix_info_size);
     s->thread_info.state = s->state;
     s->thread_info.rewind_nbytes = 0;
     s->thread_info.rewind_requested = FALSE;
@@ -737,6 +739,8 @@ static void sink_free(pa_object *o) {
 
     pa_hashmap_free(s->thread_info.inputs, NULL, NULL);
 
+    pa_xfree(s->thread_info.mix_info);
+
     if (s->silence.memblock)
         pa_memblock_unref(s->silence.memblock);
 
@@ -958,6 +962,29 @@ void pa_sink_process_rewind(pa_sink *s, size_t nbytes) {
     }
 }
 
+/* Called from IO thread context */
+static pa_mix_info *get_mix_info(pa_sink *s) {
+    unsigned n;
+
+    pa_sink_assert_ref(s);
+    pa_sink_assert_io_context(s);
+
+    n = pa_hashmap_size(s->thread_info.inputs);
+
+    if (PA_UNLIKELY(n > s->thread_info.mix_info_size)) {
+        /* Grow geometrically, so that we only need to reallocate a
+         * handful of times even if the number of inputs keeps
+         * increasing. We never shrink again. */
+        while (s->thread_info.mix_info_size < n)
+            s->thread_info.mix_info_size *= 2;
+
+        pa_xfree(s->thread_info.mix_info);
+        s->thread_info.mix_info = pa_xnew(pa_mix_info, s->thread_info.mix_info_size);
+    }
+
+    return s->thread_info.mix_info;
+}
+
 /* Called from IO thread context */
 static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, unsigned maxinfo) {
     pa_sink_input *i;
@@ -968,8 +995,9 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
     pa_sink_assert_ref(s);
     pa_sink_assert_io_context(s);
     pa_assert(info);
+    pa_assert(maxinfo >= pa_hashmap_size(s->thread_info.inputs));
 
-    while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL)) && maxinfo > 0) {
+    while ((i = pa_hashmap_iterate(s->thread_info.inputs, &state, NULL))) {
         pa_sink_input_assert_ref(i);
 
         pa_sink_input_peek(i, *length, &info->chunk, &info->volume);
@@ -989,7 +1017,6 @@ static unsigned fill_mix_info(pa_sink *s, size_t *length, pa_mix_info *info, uns
 
         info++;
         n++;
-        maxinfo--;
     }
 
     if (mixlength > 0)
@@ -1097,7 +1124,7 @@ static void inputs_drop(pa_sink *s, pa_mix_info *info, unsigned n, pa_memchunk *
 
 /* Called from IO thread context */
 void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_mix_info *info;
     unsigned n;
     size_t block_size_max;
 
@@ -1128,7 +1155,8 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = get_mix_info(s);
+    n = fill_mix_info(s, &length, info, s->thread_info.mix_info_size);
 
     if (n == 0) {
 
@@ -1182,7 +1210,7 @@ void pa_sink_render(pa_sink*s, size_t length, pa_memchunk *result) {
 
 /* Called from IO thread context */
 void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
-    pa_mix_info info[MAX_MIX_CHANNELS];
+    pa_mix_info *info;
     unsigned n;
     size_t length, block_size_max;
 
@@ -1211,7 +1239,8 @@ void pa_sink_render_into(pa_sink*s, pa_memchunk *target) {
 
     pa_assert(length > 0);
 
-    n = fill_mix_info(s, &length, info, MAX_MIX_CHANNELS);
+    info = get_mix_info(s);
+    n = fill_mix_info(s, &length, info, s->thread_info.mix_info_size);
 
     if (n == 0) {
         if (target->length > length)
@@ -42,6 +42,7 @@ typedef struct pa_sink_volume_change pa_sink_volume_change;
 #include <pulsecore/asyncmsgq.h>
 #include <pulsecore/msgobject.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/sample-util.h>
 #include <pulsecore/device-port.h>
 #include <pulsecore/card.h>
 #include <pulsecore/queue.h>
@@ -243,6 +244,12 @@ struct pa_sink {
         pa_cvolume soft_volume;
         pa_bool_t soft_muted:1;
 
+        /* Scratch space for pa_sink_render() and friends. It is grown
+         * on demand so that it can hold one entry per input, and is
+         * reused across render cycles. */
+        pa_mix_info *mix_info;
+        unsigned mix_info_size;
+
         /* The requested latency is used for dynamic latency
          * sinks. For fixed latency sinks it is always identical to
          * the fixed_latency. See below. */
@@ -0,0 +1,313 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-scache.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/tagstruct.h>
+
+#include "sound-file-cache.h"
+
+#define CACHE_MAGIC 0x43534150U /* "PASC" */
+#define CACHE_VERSION 2
+
+/* The header, the path of the sound file and its properties are
+ * followed by the sample data at this fixed offset. That way we can find the beginning of the
+ * mapping from the data pointer alone when the memblock is freed. */
+#define CACHE_DATA_OFFSET 4096
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+
+    /* Of the sound file */
+    uint64_t file_size;
+    int64_t file_mtime;
+    uint32_t path_length;
+
+    /* Serialized like in the native protocol */
+    uint32_t proplist_length;
+
+    pa_sample_spec sample_spec;
+    pa_channel_map channel_map;
+    uint64_t length;
+};
+
+#ifdef HAVE_SYS_MMAN_H
+
+static char *cache_file_name(const char *dir, const char *fname) {
+    uint64_t hash = 14695981039346656037ULL;
+    const char *p;
+
+    /* FNV-1a, we compare the full path on load anyway */
+    for (p = fname; *p; p++) {
+        hash ^= (uint8_t) *p;
+        hash *= 1099511628211ULL;
+    }
+
+    return pa_sprintf_malloc("%s" PA_PATH_SEP "%016llx.sample", dir, (unsigned long long) hash);
+}
+
+static void unmap_cb(void *p) {
+    uint8_t *base = (uint8_t*) p - CACHE_DATA_OFFSET;
+    const struct cache_header *h = (const struct cache_header*) base;
+
+    pa_assert_se(munmap(base, CACHE_DATA_OFFSET + (size_t) h->length) == 0);
+}
+
+int pa_sound_file_cache_load(pa_mempool *pool, const char *dir, const char *fname, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    struct stat st, cst;
+    const struct cache_header *h;
+    char *cn;
+    size_t path_length;
+    int fd = -1, ret = -1;
+    void *base = MAP_FAILED;
+    pa_tagstruct *t;
+    pa_proplist *q;
+
+    pa_assert(pool);
+    pa_assert(dir);
+    pa_assert(fname);
+    pa_assert(ss);
+    pa_assert(chunk);
+
+    pa_memchunk_reset(chunk);
+
+    if (stat(fname, &st) < 0)
+        return -1;
+
+    cn = cache_file_name(dir, fname);
+
+    if ((fd = pa_open_cloexec(cn, O_RDONLY, 0)) < 0) {
+        if (errno != ENOENT)
+            pa_log_warn("Failed to open sample cache file %s: %s", cn, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    if (fstat(fd, &cst) < 0 || cst.st_size <= CACHE_DATA_OFFSET)
+        goto stale;
+
+    if ((base = mmap(NULL, (size_t) cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        pa_log_warn("mmap() of sample cache file %s failed: %s", cn, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    h = base;
+    path_length = strlen(fname);
+
+    if (h->magic != CACHE_MAGIC ||
+        h->version != CACHE_VERSION ||
+        h->file_size != (uint64_t) st.st_size ||
+        h->file_mtime != (int64_t) st.st_mtime ||
+        h->path_length != path_length ||
+        h->proplist_length <= 0 ||
+        h->proplist_length > CACHE_DATA_OFFSET ||
+        sizeof(*h) + path_length + h->proplist_length > CACHE_DATA_OFFSET ||
+        memcmp((const uint8_t*) base + sizeof(*h), fname, path_length) != 0)
+        goto stale;
+
+    if (h->length <= 0 ||
+        h->length > PA_SCACHE_ENTRY_SIZE_MAX ||
+        CACHE_DATA_OFFSET + h->length != (uint64_t) cst.st_size ||
+        !pa_sample_spec_valid(&h->sample_spec) ||
+        h->length % pa_frame_size(&h->sample_spec) != 0 ||
+        !pa_channel_map_valid(&h->channel_map) ||
+        !pa_channel_map_compatible(&h->channel_map, &h->sample_spec))
+        goto stale;
+
+    q = pa_proplist_new();
+    t = pa_tagstruct_new((const uint8_t*) base + sizeof(*h) + path_length, h->proplist_length);
+
+    if (pa_tagstruct_get_proplist(t, q) < 0 || !pa_tagstruct_eof(t)) {
+        pa_tagstruct_free(t);
+        pa_proplist_free(q);
+        goto stale;
+    }
+
+    pa_tagstruct_free(t);
+
+    if (p)
+        pa_proplist_update(p, PA_UPDATE_REPLACE, q);
+
+    pa_proplist_free(q);
+
+    *ss = h->sample_spec;
+    if (map)
+        *map = h->channel_map;
+
+    chunk->memblock = pa_memblock_new_user(pool, (uint8_t*) base + CACHE_DATA_OFFSET, (size_t) h->length, unmap_cb, TRUE);
+    chunk->index = 0;
+    chunk->length = (size_t) h->length;
+
+    /* Owned by the memblock now */
+    base = MAP_FAILED;
+
+    pa_log_debug("Mapped decoded %s from sample cache", fname);
+    ret = 0;
+    goto finish;
+
+stale:
+    pa_log_debug("Sample cache entry for %s is stale", fname);
+
+finish:
+    if (base != MAP_FAILED)
+        munmap(base, (size_t) cst.st_size);
+
+    if (fd >= 0)
+        pa_close(fd);
+
+    pa_xfree(cn);
+
+    return ret;
+}
+
+int pa_sound_file_cache_save(const char *dir, const char *fname, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p) {
+    struct stat st;
+    struct cache_header *h;
+    char *cn, *tn;
+    uint8_t *buf;
+    const void *data;
+    const uint8_t *pl;
+    size_t path_length, proplist_length;
+    pa_tagstruct *t;
+    ssize_t r;
+    int fd, ret = -1;
+
+    pa_assert(dir);
+    pa_assert(fname);
+    pa_assert(ss);
+    pa_assert(map);
+    pa_assert(chunk);
+    pa_assert(chunk->memblock);
+    pa_assert(p);
+
+    path_length = strlen(fname);
+
+    if (sizeof(*h) + path_length > CACHE_DATA_OFFSET || chunk->length <= 0)
+        return -1;
+
+    if (stat(fname, &st) < 0)
+        return -1;
+
+    t = pa_tagstruct_new(NULL, 0);
+    pa_tagstruct_put_proplist(t, p);
+    pl = pa_tagstruct_data(t, &proplist_length);
+
+    /* A sample whose properties we can't store would differ between
+     * the first load and the later ones */
+    if (sizeof(*h) + path_length + proplist_length > CACHE_DATA_OFFSET) {
+        pa_log_debug("Properties of %s are too large for the sample cache", fname);
+        pa_tagstruct_free(t);
+        return -1;
+    }
+
+    cn = cache_file_name(dir, fname);
+
+    /* Write a private copy and rename it into place, so that nobody
+     * ever maps a half-written file. The loader thread and the main
+     * thread may store the same sample at the same time, hence the
+     * unique name. */
+    tn = pa_sprintf_malloc("%s.XXXXXX", cn);
+
+    if ((fd = mkstemp(tn)) < 0) {
+        pa_log_warn("Failed to create sample cache file %s: %s", tn, pa_cstrerror(errno));
+        goto finish;
+    }
+
+    pa_make_fd_cloexec(fd);
+
+    buf = pa_xmalloc0(CACHE_DATA_OFFSET);
+    h = (struct cache_header*) buf;
+    h->magic = CACHE_MAGIC;
+    h->version = CACHE_VERSION;
+    h->file_size = (uint64_t) st.st_size;
+    h->file_mtime = (int64_t) st.st_mtime;
+    h->path_length = (uint32_t) path_length;
+    h->proplist_length = (uint32_t) proplist_length;
+    h->sample_spec = *ss;
+    h->channel_map = *map;
+    h->length = chunk->length;
+    memcpy(buf + sizeof(*h), fname, path_length);
+    memcpy(buf + sizeof(*h) + path_length, pl, proplist_length);
+
+    r = pa_loop_write(fd, buf, CACHE_DATA_OFFSET, NULL);
+    pa_xfree(buf);
+
+    if (r == CACHE_DATA_OFFSET) {
+        data = pa_memblock_acquire_chunk(chunk);
+        r = pa_loop_write(fd, data, chunk->length, NULL);
+        pa_memblock_release(chunk->memblock);
+    } else
+        r = -1;
+
+    if (pa_close(fd) < 0 || r != (ssize_t) chunk->length) {
+        pa_log_warn("Failed to write sample cache file %s: %s", tn, pa_cstrerror(errno));
+        unlink(tn);
+        goto finish;
+    }
+
+    if (rename(tn, cn) < 0) {
+        pa_log_warn("Failed to rename sample cache file %s: %s", tn, pa_cstrerror(errno));
+        unlink(tn);
+        goto finish;
+    }
+
+    pa_log_debug("Stored decoded %s in sample cache", fname);
+    ret = 0;
+
+finish:
+    pa_tagstruct_free(t);
+    pa_xfree(cn);
+    pa_xfree(tn);
+
+    return ret;
+}
+
+#else
+
+int pa_sound_file_cache_load(pa_mempool *pool, const char *dir, const char *fname, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p) {
+    pa_memchunk_reset(chunk);
+    return -1;
+}
+
+int pa_sound_file_cache_save(const char *dir, const char *fname, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p) {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef foosoundfilecachehfoo
+#define foosoundfilecachehfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <pulse/sample.h>
+#include <pulse/channelmap.h>
+#include <pulse/proplist.h>
+#include <pulsecore/memchunk.h>
+
+/* A directory of decoded sound files, so that we don't need to decode
+ * them again, e.g. after a restart. Entries are keyed by the path of
+ * the sound file and invalidated when its size or modification time
+ * changes. Cached samples are mapped into memory instead of being
+ * read, so the returned memblocks are read-only. */
+
+/* Returns 0 and the decoded sample if there's an up-to-date cache
+ * entry for fname in dir, a negative value otherwise. The properties
+ * that were stored with the sample are merged into p, like
+ * pa_sound_file_load() does. */
+int pa_sound_file_cache_load(pa_mempool *pool, const char *dir, const char *fname, pa_sample_spec *ss, pa_channel_map *map, pa_memchunk *chunk, pa_proplist *p);
+
+/* Stores the decoded sample of fname in dir, together with the
+ * properties pa_sound_file_load() returned for it */
+int pa_sound_file_cache_save(const char *dir, const char *fname, const pa_sample_spec *ss, const pa_channel_map *map, const pa_memchunk *chunk, pa_proplist *p);
+
+#endif
@@ -0,0 +1,362 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/fdsem.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/shm.h>
+
+#include "srbchannel.h"
+
+/* Size of the whole shared segment, i.e. the header and both ring
+ * buffers. Large enough for a few periods of control traffic at low
+ * latencies, audio data itself usually travels as SHM references. */
+#define SRBCHANNEL_SIZE (64*1024)
+
+/* The part of the segment both sides write to. Ring buffer 0 is
+ * written by the side that created the channel and read by the peer,
+ * ring buffer 1 the other way round. Each side sleeps on the
+ * semaphore with its own reading index. */
+struct srb_shared {
+    pa_fdsem_data sem_data[2];
+    pa_atomic_t count[2];
+    pa_atomic_t blocked[2];
+};
+
+#define SRB_HEADER_SIZE PA_ALIGN(sizeof(struct srb_shared))
+
+struct ring {
+    pa_atomic_t *count;
+    pa_atomic_t *blocked;
+    uint8_t *memory;
+    size_t index;
+};
+
+struct pa_srbchannel {
+    pa_mainloop_api *mainloop;
+
+    pa_shm shm;
+    int memfd;
+    size_t capacity;
+
+    struct ring rb_read, rb_write;
+    pa_fdsem *sem_read, *sem_write;
+
+    pa_io_event *read_event;
+    pa_defer_event *defer_event;
+    pa_bool_t waiting;
+
+    pa_srbchannel_cb_t callback;
+    void *userdata;
+};
+
+/* pa_atomic_load() has its barrier only before the load, but we must
+ * not touch the ring buffer memory before we know the count */
+static size_t load_count(struct ring *r, size_t capacity) {
+    int count = pa_atomic_add(r->count, 0);
+
+    /* The other side might have scribbled over the counter */
+    if (count < 0)
+        return 0;
+
+    return PA_MIN((size_t) count, capacity);
+}
+
+static size_t ring_write(struct ring *r, size_t capacity, const uint8_t *data, size_t l) {
+    size_t n, done = 0;
+
+    n = PA_MIN(l, capacity - load_count(r, capacity));
+
+    while (done < n) {
+        size_t k = PA_MIN(n - done, capacity - r->index);
+
+        memcpy(r->memory + r->index, data + done, k);
+        r->index = (r->index + k) % capacity;
+        done += k;
+    }
+
+    if (n > 0)
+        pa_atomic_add(r->count, (int) n);
+
+    return n;
+}
+
+static size_t ring_read(struct ring *r, size_t capacity, uint8_t *data, size_t l) {
+    size_t n, done = 0;
+
+    n = PA_MIN(l, load_count(r, capacity));
+
+    while (done < n) {
+        size_t k = PA_MIN(n - done, capacity - r->index);
+
+        memcpy(data + done, r->memory + r->index, k);
+        r->index = (r->index + k) % capacity;
+        done += k;
+    }
+
+    if (n > 0)
+        pa_atomic_sub(r->count, (int) n);
+
+    return n;
+}
+
+size_t pa_srbchannel_write(pa_srbchannel *sr, const void *data, size_t l) {
+    size_t n;
+
+    pa_assert(sr);
+    pa_assert(data);
+
+    n = ring_write(&sr->rb_write, sr->capacity, data, l);
+
+    if (n < l) {
+        /* Ask the reader to wake us up once it made room, and try
+         * again in case it did so before it saw the flag */
+        pa_atomic_store(sr->rb_write.blocked, 1);
+        n += ring_write(&sr->rb_write, sr->capacity, (const uint8_t*) data + n, l - n);
+    }
+
+    if (n > 0)
+        pa_fdsem_post(sr->sem_write);
+
+    return n;
+}
+
+size_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l) {
+    size_t n;
+
+    pa_assert(sr);
+    pa_assert(data);
+
+    n = ring_read(&sr->rb_read, sr->capacity, data, l);
+
+    if (n > 0 && pa_atomic_cmpxchg(sr->rb_read.blocked, 1, 0))
+        pa_fdsem_post(sr->sem_write);
+
+    return n;
+}
+
+static void srbchannel_rwloop(pa_srbchannel *sr) {
+    if (sr->waiting) {
+        pa_fdsem_after_poll(sr->sem_read);
+        sr->waiting = FALSE;
+    }
+
+    for (;;) {
+        if (sr->callback && !sr->callback(sr, sr->userdata))
+            return;
+
+        /* Only go to sleep if nothing was signalled in the meantime */
+        if (pa_fdsem_before_poll(sr->sem_read) >= 0) {
+            sr->waiting = TRUE;
+            return;
+        }
+    }
+}
+
+static void io_callback(pa_mainloop_api *m, pa_io_event *e, int fd, pa_io_event_flags_t events, void *userdata) {
+    pa_srbchannel *sr = userdata;
+
+    pa_assert(sr);
+    pa_assert(sr->read_event == e);
+
+    srbchannel_rwloop(sr);
+}
+
+static void defer_callback(pa_mainloop_api *m, pa_defer_event *e, void *userdata) {
+    pa_srbchannel *sr = userdata;
+
+    pa_assert(sr);
+    pa_assert(sr->defer_event == e);
+
+    m->defer_enable(e, 0);
+    srbchannel_rwloop(sr);
+}
+
+static pa_srbchannel* srbchannel_setup(pa_srbchannel *sr, unsigned side) {
+    struct srb_shared *h;
+    uint8_t *rings;
+
+    h = sr->shm.ptr;
+    rings = (uint8_t*) sr->shm.ptr + SRB_HEADER_SIZE;
+    sr->capacity = (sr->shm.size - SRB_HEADER_SIZE) / 2;
+
+    sr->rb_write.count = &h->count[side];
+    sr->rb_write.blocked = &h->blocked[side];
+    sr->rb_write.memory = rings + side * sr->capacity;
+    sr->rb_write.index = 0;
+
+    sr->rb_read.count = &h->count[!side];
+    sr->rb_read.blocked = &h->blocked[!side];
+    sr->rb_read.memory = rings + !side * sr->capacity;
+    sr->rb_read.index = 0;
+
+    sr->read_event = sr->mainloop->io_new(sr->mainloop, pa_fdsem_get(sr->sem_read), PA_IO_EVENT_INPUT, io_callback, sr);
+    sr->defer_event = sr->mainloop->defer_new(sr->mainloop, defer_callback, sr);
+
+    return sr;
+}
+
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m) {
+    pa_srbchannel *sr;
+    struct srb_shared *h;
+    int fd;
+
+    pa_assert(m);
+
+    sr = pa_xnew0(pa_srbchannel, 1);
+    sr->mainloop = m;
+    sr->memfd = -1;
+
+    if (pa_shm_create_fd(&sr->shm, SRBCHANNEL_SIZE, &sr->memfd) < 0)
+        goto fail;
+
+    h = sr->shm.ptr;
+
+    if (!(sr->sem_read = pa_fdsem_new_shm(&h->sem_data[1], &fd)) ||
+        !(sr->sem_write = pa_fdsem_new_shm(&h->sem_data[0], &fd)))
+        goto fail;
+
+    pa_atomic_store(&h->count[0], 0);
+    pa_atomic_store(&h->count[1], 0);
+    pa_atomic_store(&h->blocked[0], 0);
+    pa_atomic_store(&h->blocked[1], 0);
+
+    return srbchannel_setup(sr, 0);
+
+fail:
+    if (sr->sem_read)
+        pa_fdsem_free(sr->sem_read);
+
+    if (sr->shm.ptr)
+        pa_shm_free(&sr->shm);
+
+    if (sr->memfd >= 0)
+        pa_close(sr->memfd);
+
+    pa_xfree(sr);
+    return NULL;
+}
+
+void pa_srbchannel_export(pa_srbchannel *sr, pa_srbchannel_template *t) {
+    pa_assert(sr);
+    pa_assert(t);
+    pa_assert(sr->memfd >= 0);
+
+    t->memfd = sr->memfd;
+    t->readfd = pa_fdsem_get(sr->sem_write);
+    t->writefd = pa_fdsem_get(sr->sem_read);
+}
+
+pa_srbchannel* pa_srbchannel_new_from_template(pa_mainloop_api *m, const pa_srbchannel_template *t) {
+    pa_srbchannel *sr;
+    struct srb_shared *h;
+    int readfd = -1, writefd = -1;
+
+    pa_assert(m);
+    pa_assert(t);
+
+    sr = pa_xnew0(pa_srbchannel, 1);
+    sr->mainloop = m;
+    sr->memfd = -1;
+
+    if (pa_shm_attach_fd(&sr->shm, t->memfd) < 0)
+        goto fail;
+
+    if (sr->shm.size != SRBCHANNEL_SIZE) {
+        pa_log_warn("Shared ring buffer has unexpected size %lu.", (unsigned long) sr->shm.size);
+        goto fail;
+    }
+
+    if ((readfd = pa_dup_cloexec(t->readfd)) < 0 ||
+        (writefd = pa_dup_cloexec(t->writefd)) < 0) {
+        pa_log("dup() failed: %s", pa_cstrerror(errno));
+        goto fail;
+    }
+
+    h = sr->shm.ptr;
+
+    if (!(sr->sem_read = pa_fdsem_open_shm(&h->sem_data[0], readfd)))
+        goto fail;
+    readfd = -1;
+
+    if (!(sr->sem_write = pa_fdsem_open_shm(&h->sem_data[1], writefd)))
+        goto fail;
+
+    return srbchannel_setup(sr, 1);
+
+fail:
+    if (sr->sem_read)
+        pa_fdsem_free(sr->sem_read);
+
+    if (readfd >= 0)
+        pa_close(readfd);
+
+    if (writefd >= 0)
+        pa_close(writefd);
+
+    if (sr->shm.ptr)
+        pa_shm_free(&sr->shm);
+
+    pa_xfree(sr);
+    return NULL;
+}
+
+void pa_srbchannel_free(pa_srbchannel *sr) {
+    pa_assert(sr);
+
+    sr->mainloop->io_free(sr->read_event);
+    sr->mainloop->defer_free(sr->defer_event);
+
+    if (sr->waiting)
+        pa_fdsem_after_poll(sr->sem_read);
+
+    pa_fdsem_free(sr->sem_read);
+    pa_fdsem_free(sr->sem_write);
+
+    pa_shm_free(&sr->shm);
+
+    if (sr->memfd >= 0)
+        pa_close(sr->memfd);
+
+    pa_xfree(sr);
+}
+
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t callback, void *userdata) {
+    pa_assert(sr);
+
+    sr->callback = callback;
+    sr->userdata = userdata;
+
+    /* There might already be something waiting for us */
+    if (callback)
+        sr->mainloop->defer_enable(sr->defer_event, 1);
+}
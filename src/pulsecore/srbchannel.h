@@ -0,0 +1,63 @@
+#ifndef foopulsesrbchannelhfoo
+#define foopulsesrbchannelhfoo
+
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <pulse/mainloop-api.h>
+#include <pulsecore/macro.h>
+
+/* A bidirectional byte channel between two processes, made of two ring
+ * buffers in a shared memory segment. Each side sleeps on its own
+ * pa_fdsem, which the other side only signals (and hence only makes a
+ * syscall) when it is actually sleeping. The segment and the two
+ * eventfds are handed to the peer as file descriptors. */
+
+typedef struct pa_srbchannel pa_srbchannel;
+
+/* The file descriptors the peer needs to open the channel. They stay
+ * owned by the channel that exported them. */
+typedef struct pa_srbchannel_template {
+    int memfd;
+    int readfd;
+    int writefd;
+} pa_srbchannel_template;
+
+pa_srbchannel* pa_srbchannel_new(pa_mainloop_api *m);
+void pa_srbchannel_export(pa_srbchannel *sr, pa_srbchannel_template *t);
+
+/* The file descriptors are duplicated, the caller keeps ownership of
+ * the ones in the template */
+pa_srbchannel* pa_srbchannel_new_from_template(pa_mainloop_api *m, const pa_srbchannel_template *t);
+
+void pa_srbchannel_free(pa_srbchannel *sr);
+
+/* Both return the number of bytes actually transferred, which is 0 if
+ * the ring buffer is full resp. empty. */
+size_t pa_srbchannel_write(pa_srbchannel *sr, const void *data, size_t l);
+size_t pa_srbchannel_read(pa_srbchannel *sr, void *data, size_t l);
+
+/* Called when there might be new data to read or new space to write
+ * to. The callback has to return FALSE if it freed the channel. */
+typedef pa_bool_t (*pa_srbchannel_cb_t)(pa_srbchannel *sr, void *userdata);
+void pa_srbchannel_set_callback(pa_srbchannel *sr, pa_srbchannel_cb_t callback, void *userdata);
+
+#endif
@@ -37,6 +37,7 @@
 
 #include <pulsecore/socket.h>
 #include <pulsecore/macro.h>
+#include <pulsecore/flist.h>
 
 #include "tagstruct.h"
 
@@ -50,12 +51,16 @@ struct pa_tagstruct {
     pa_bool_t dynamic;
 };
 
+PA_STATIC_FLIST_DECLARE(tagstructs, 0, pa_xfree);
+
 pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
     pa_tagstruct*t;
 
     pa_assert(!data || (data && length));
 
-    t = pa_xnew(pa_tagstruct, 1);
+    if (!(t = pa_flist_pop(PA_STATIC_FLIST_GET(tagstructs))))
+        t = pa_xnew(pa_tagstruct, 1);
+
     t->data = (uint8_t*) data;
     t->allocated = t->length = data ? length : 0;
     t->rindex = 0;
@@ -64,12 +69,17 @@ pa_tagstruct *pa_tagstruct_new(const uint8_t* data, size_t length) {
     return t;
 }
 
+static void free_struct(pa_tagstruct *t) {
+    if (pa_flist_push(PA_STATIC_FLIST_GET(tagstructs), t) < 0)
+        pa_xfree(t);
+}
+
 void pa_tagstruct_free(pa_tagstruct*t) {
     pa_assert(t);
 
-    if (t->dynamic)
-        pa_xfree(t->data);
-    pa_xfree(t);
+    if (t->dynamic && t->data)
+        pa_packet_buffer_free(t->data, t->allocated);
+    free_struct(t);
 }
 
 uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l) {
@@ -81,18 +91,36 @@ uint8_t* pa_tagstruct_free_data(pa_tagstruct*t, size_t *l) {
 
     p = t->data;
     *l = t->length;
-    pa_xfree(t);
+    free_struct(t);
     return p;
 }
 
+pa_packet* pa_tagstruct_free_to_packet(pa_tagstruct *t) {
+    pa_packet *p;
+
+    pa_assert(t);
+    pa_assert(t->dynamic);
+    pa_assert(t->length > 0);
+
+    p = pa_packet_new_pooled(t->data, t->length, t->allocated);
+    free_struct(t);
+    return p;
+}
+
+/* Buffers come from the packet buffer pool and at least double in size
+ * each time, so that building a big reply needs only a few copies */
 static void extend(pa_tagstruct*t, size_t l) {
+    size_t size;
+
     pa_assert(t);
     pa_assert(t->dynamic);
 
     if (t->length+l <= t->allocated)
         return;
 
-    t->data = pa_xrealloc(t->data, t->allocated = t->length+l+100);
+    size = PA_MAX(t->length+l, t->allocated*2);
+    t->data = pa_packet_buffer_realloc(t->data, t->length, t->allocated, &size);
+    t->allocated = size;
 }
 
 void pa_tagstruct_puts(pa_tagstruct*t, const char *s) {
@@ -267,8 +295,18 @@ void pa_tagstruct_put_volume(pa_tagstruct *t, pa_volume_t vol) {
     t->length += 5;
 }
 
+/* Number of proplist entries that are looked up before writing them */
+#define PROPLIST_BATCH 32
+
 void pa_tagstruct_put_proplist(pa_tagstruct *t, pa_proplist *p) {
     void *state = NULL;
+    struct {
+        const char *key;
+        const void *data;
+        size_t nbytes;
+    } e[PROPLIST_BATCH];
+    unsigned n, i;
+
     pa_assert(t);
     pa_assert(p);
 
@@ -276,19 +314,27 @@ void pa_tagstruct_put_proplist(pa_tagstruct *t, pa_proplist *p) {
 
     t->data[t->length++] = PA_TAG_PROPLIST;
 
-    for (;;) {
-        const char *k;
-        const void *d;
-        size_t l;
+    do {
+        size_t l = 1;
 
-        if (!(k = pa_proplist_iterate(p, &state)))
-            break;
+        /* Look up a batch of entries, then make room for all of them
+         * and the terminating NULL string at once */
+        for (n = 0; n < PROPLIST_BATCH; n++) {
+            if (!(e[n].key = pa_proplist_iterate(p, &state)))
+                break;
 
-        pa_tagstruct_puts(t, k);
-        pa_assert_se(pa_proplist_get(p, k, &d, &l) >= 0);
-        pa_tagstruct_putu32(t, (uint32_t) l);
-        pa_tagstruct_put_arbitrary(t, d, l);
-    }
+            pa_assert_se(pa_proplist_get(p, e[n].key, &e[n].data, &e[n].nbytes) >= 0);
+            l += strlen(e[n].key) + 2 + 5 + 5 + e[n].nbytes;
+        }
+
+        extend(t, l);
+
+        for (i = 0; i < n; i++) {
+            pa_tagstruct_puts(t, e[i].key);
+            pa_tagstruct_putu32(t, (uint32_t) e[i].nbytes);
+            pa_tagstruct_put_arbitrary(t, e[i].data, e[i].nbytes);
+        }
+    } while (n == PROPLIST_BATCH);
 
     pa_tagstruct_puts(t, NULL);
 }
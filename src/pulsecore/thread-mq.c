@@ -81,7 +81,11 @@ void pa_thread_mq_init(pa_thread_mq *q, pa_mainloop_api *mainloop, pa_rtpoll *rt
     pa_assert(mainloop);
 
     q->mainloop = mainloop;
-    pa_assert_se(q->inq = pa_asyncmsgq_new(0));
+
+    /* The inq is written to by the main thread as well as by other
+     * I/O threads (e.g. module-echo-cancel sends to the sink from the
+     * source thread), so use the lock-free multiple-writer queue */
+    pa_assert_se(q->inq = pa_asyncmsgq_new_mpsc(0));
     pa_assert_se(q->outq = pa_asyncmsgq_new(0));
 
     pa_assert_se(pa_asyncmsgq_read_before_poll(q->outq) == 0);
@@ -0,0 +1,265 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/database.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+
+#include <modules/alsa/alsa-mixer.h>
+#include <modules/alsa/alsa-probe-cache.h>
+
+/* PROFILE_SETS_DIR points to the profile sets in the tree, so that we
+ * don't depend on what is installed */
+#define PROFILE_SET PROFILE_SETS_DIR "/default.conf"
+#define FOREIGN_PROFILE_SET PROFILE_SETS_DIR "/native-instruments-audio4dj.conf"
+
+#define PROFILE "output:analog-stereo+input:analog-stereo"
+#define MAPPING "analog-stereo"
+
+#define SUPPORTED \
+    "P " PROFILE "\n" \
+    "P output:analog-stereo\n" \
+    "M 2 " MAPPING "\n"
+
+static char dir[] = "/tmp/pa-alsa-probe-cache-test-XXXXXX";
+
+/* Nothing is marked as supported, and the profile set can still be
+ * probed */
+static pa_bool_t untouched(pa_alsa_profile_set *ps) {
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    void *state;
+
+    if (ps->probed || ps->profiles_probed)
+        return FALSE;
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        if (p->supported)
+            return FALSE;
+
+    PA_HASHMAP_FOREACH(m, ps->mappings, state)
+        if (m->supported)
+            return FALSE;
+
+    return TRUE;
+}
+
+START_TEST (round_trip_test) {
+    pa_alsa_profile_set *a, *b;
+    pa_alsa_profile *p;
+    pa_alsa_mapping *m;
+    char *s, *t;
+
+    fail_unless((a = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+    fail_unless(untouched(a));
+
+    fail_unless(pa_alsa_profile_set_supported_from_string(a, SUPPORTED) == 0);
+    fail_unless(a->profiles_probed);
+    fail_unless((p = pa_hashmap_get(a->profiles, PROFILE)) && p->supported);
+    fail_unless((m = pa_hashmap_get(a->mappings, MAPPING)) && m->supported == 2);
+    fail_unless((m = pa_hashmap_get(a->mappings, "analog-mono")) && !m->supported);
+
+    /* Only unprobed profile sets take results */
+    fail_unless(pa_alsa_profile_set_supported_from_string(a, SUPPORTED) < 0);
+
+    s = pa_alsa_profile_set_supported_to_string(a);
+    fail_unless(strstr(s, "P " PROFILE "\n") != NULL);
+    fail_unless(strstr(s, "M 2 " MAPPING "\n") != NULL);
+
+    fail_unless((b = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+    fail_unless(pa_alsa_profile_set_supported_from_string(b, s) == 0);
+    t = pa_alsa_profile_set_supported_to_string(b);
+    fail_unless(pa_streq(s, t));
+
+    pa_xfree(s);
+    pa_xfree(t);
+    pa_alsa_profile_set_free(a);
+    pa_alsa_profile_set_free(b);
+}
+END_TEST
+
+static char *all_profiles_to_string(pa_alsa_profile_set *ps) {
+    pa_strbuf *buf;
+    pa_alsa_profile *p;
+    void *state;
+
+    buf = pa_strbuf_new();
+
+    PA_HASHMAP_FOREACH(p, ps->profiles, state)
+        pa_strbuf_printf(buf, "P %s\n", p->name);
+
+    return pa_strbuf_tostring_free(buf);
+}
+
+START_TEST (stale_test) {
+    static const char * const stale[] = {
+        "P output:no-such-profile\n",
+        "M 1 no-such-mapping\n",
+        "M 0 " MAPPING "\n",
+        "M x " MAPPING "\n",
+        "M 1\n",
+        "M 1 \n",
+        "X " MAPPING "\n",
+        SUPPORTED "P output:no-such-profile\n",
+        SUPPORTED "garbage\n"
+    };
+    pa_alsa_profile_set *ps, *foreign;
+    char *s;
+    unsigned i;
+
+    fail_unless((ps = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+
+    for (i = 0; i < PA_ELEMENTSOF(stale); i++) {
+        fail_unless(pa_alsa_profile_set_supported_from_string(ps, stale[i]) < 0);
+        fail_unless(untouched(ps));
+    }
+
+    /* Results of a different profile set */
+    fail_unless((foreign = pa_alsa_profile_set_new(FOREIGN_PROFILE_SET, NULL)) != NULL);
+    s = all_profiles_to_string(foreign);
+    fail_unless(pa_alsa_profile_set_supported_from_string(foreign, s) == 0);
+
+    fail_unless(pa_alsa_profile_set_supported_from_string(ps, s) < 0);
+    fail_unless(untouched(ps));
+
+    /* The stale ones didn't get in the way */
+    fail_unless(pa_alsa_profile_set_supported_from_string(ps, SUPPORTED) == 0);
+
+    pa_xfree(s);
+    pa_alsa_profile_set_free(ps);
+    pa_alsa_profile_set_free(foreign);
+}
+END_TEST
+
+static void set_entry(pa_database *db, const char *key, const char *value) {
+    pa_datum k, data;
+
+    k.data = (char*) key;
+    k.size = strlen(key);
+    data.data = (char*) value;
+    data.size = strlen(value) + 1;
+
+    fail_unless(pa_database_set(db, &k, &data, TRUE) == 0);
+}
+
+START_TEST (entry_version_test) {
+    static const char * const invalid[] = {
+        /* The version has to match */
+        "0\n" SUPPORTED,
+        "2\n" SUPPORTED,
+        "11\n" SUPPORTED,
+        SUPPORTED,
+        "1",
+        "",
+        /* And the results the profile set */
+        "1\nP output:no-such-profile\n"
+    };
+    pa_alsa_profile_set *ps;
+    pa_database *db;
+    char *fn, *s, *t;
+    unsigned i;
+
+    fn = pa_sprintf_malloc("%s/alsa-probe-cache", dir);
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+
+    fail_unless((ps = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+    fail_unless(pa_alsa_profile_set_supported_from_string(ps, SUPPORTED) == 0);
+    s = pa_alsa_profile_set_supported_to_string(ps);
+
+    pa_alsa_probe_cache_save(db, "card", ps);
+    fail_unless(pa_alsa_probe_cache_has(db, "card"));
+    pa_alsa_profile_set_free(ps);
+
+    fail_unless((ps = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+    fail_unless(pa_alsa_probe_cache_load(db, "card", ps));
+    t = pa_alsa_profile_set_supported_to_string(ps);
+    fail_unless(pa_streq(s, t));
+    pa_xfree(t);
+    pa_alsa_profile_set_free(ps);
+
+    /* The entry is written as we expect it */
+    t = pa_sprintf_malloc("1\n%s", s);
+    set_entry(db, "card", t);
+    fail_unless((ps = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+    fail_unless(pa_alsa_probe_cache_load(db, "card", ps));
+    pa_alsa_profile_set_free(ps);
+    pa_xfree(t);
+
+    /* Invalid entries are ignored and dropped */
+    for (i = 0; i < PA_ELEMENTSOF(invalid); i++) {
+        set_entry(db, "card", invalid[i]);
+
+        fail_unless((ps = pa_alsa_profile_set_new(PROFILE_SET, NULL)) != NULL);
+        fail_unless(!pa_alsa_probe_cache_load(db, "card", ps));
+        fail_unless(untouched(ps));
+        fail_unless(!pa_alsa_probe_cache_has(db, "card"));
+        pa_alsa_profile_set_free(ps);
+    }
+
+    pa_xfree(s);
+    pa_database_close(db);
+    pa_xfree(fn);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+    char *cmd;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    if (!mkdtemp(dir))
+        return EXIT_FAILURE;
+
+    s = suite_create("ALSA Probe Cache");
+    tc = tcase_create("alsa-probe-cache");
+    tcase_add_test(tc, round_trip_test);
+    tcase_add_test(tc, stale_test);
+    tcase_add_test(tc, entry_version_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    cmd = pa_sprintf_malloc("rm -rf %s", dir);
+    if (system(cmd) != 0)
+        failed++;
+    pa_xfree(cmd);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
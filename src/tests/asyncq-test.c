@@ -28,11 +28,17 @@
 #include <check.h>
 
 #include <pulse/util.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 #include <pulsecore/asyncq.h>
 #include <pulsecore/thread.h>
+#include <pulsecore/mutex.h>
 #include <pulsecore/log.h>
 #include <pulsecore/macro.h>
 
+#define STRESS_ITEMS (256*1024)
+#define STRESS_MAX_PRODUCERS 16
+
 static void producer(void *_q) {
     pa_asyncq *q = _q;
     int i;
@@ -89,6 +95,116 @@ START_TEST (asyncq_test) {
 }
 END_TEST
 
+struct stress_producer {
+    pa_asyncq *q;
+    pa_mutex *mutex;
+    unsigned id;
+    unsigned n_items;
+};
+
+/* Items are the producer id in the upper bits and the running number
+ * (starting at 1) in the lower 24 bits */
+static void stress_producer(void *_p) {
+    struct stress_producer *p = _p;
+    unsigned i;
+
+    for (i = 1; i <= p->n_items; i++) {
+        void *item = PA_UINT_TO_PTR((p->id << 24) | i);
+
+        if (p->mutex)
+            pa_mutex_lock(p->mutex);
+
+        /* Alternate between pushing and posting. The last item is
+         * always pushed, which flushes everything that might have been
+         * queued locally. */
+        if (i % 2 == 1 && i < p->n_items)
+            pa_asyncq_post(p->q, item);
+        else
+            pa_assert_se(pa_asyncq_push(p->q, item, TRUE) == 0);
+
+        if (p->mutex)
+            pa_mutex_unlock(p->mutex);
+    }
+}
+
+/* Runs n_producers writer threads, with a single reader checking that
+ * the order of each producer's items is kept. If multiple_writers is
+ * FALSE, a plain pa_asyncq is used with a mutex on the writer side like
+ * pa_asyncmsgq does. */
+static void stress(unsigned n_producers, pa_bool_t multiple_writers) {
+    struct stress_producer p[STRESS_MAX_PRODUCERS];
+    pa_thread *t[STRESS_MAX_PRODUCERS];
+    unsigned next[STRESS_MAX_PRODUCERS];
+    unsigned i, n;
+    pa_mutex *mutex = NULL;
+    pa_asyncq *q;
+    pa_usec_t start, stop;
+
+    pa_assert(n_producers <= STRESS_MAX_PRODUCERS);
+
+    if (multiple_writers)
+        q = pa_asyncq_new_mpsc(0);
+    else {
+        q = pa_asyncq_new(0);
+        mutex = pa_mutex_new(FALSE, FALSE);
+    }
+
+    fail_unless(q != NULL);
+
+    start = pa_rtclock_now();
+
+    for (i = 0; i < n_producers; i++) {
+        p[i].q = q;
+        p[i].mutex = mutex;
+        p[i].id = i;
+        p[i].n_items = STRESS_ITEMS / n_producers;
+        next[i] = 1;
+
+        t[i] = pa_thread_new("producer", stress_producer, &p[i]);
+        fail_unless(t[i] != NULL);
+    }
+
+    for (n = 0; n < p[0].n_items * n_producers; n++) {
+        unsigned v = PA_PTR_TO_UINT(pa_asyncq_pop(q, TRUE));
+        unsigned id = v >> 24;
+
+        fail_unless(id < n_producers);
+        fail_unless((v & 0xFFFFFF) == next[id]);
+        next[id]++;
+    }
+
+    stop = pa_rtclock_now();
+
+    for (i = 0; i < n_producers; i++) {
+        pa_thread_free(t[i]);
+        fail_unless(next[i] == p[i].n_items + 1);
+    }
+
+    fail_unless(pa_asyncq_pop(q, FALSE) == NULL);
+
+    pa_log_info("%s, %2u producers: %.1f items/ms",
+                multiple_writers ? "lock-free" : "mutex", n_producers,
+                (double) n * PA_USEC_PER_MSEC / (double) PA_MAX(stop - start, 1U));
+
+    pa_asyncq_free(q, NULL);
+
+    if (mutex)
+        pa_mutex_free(mutex);
+}
+
+START_TEST (asyncq_stress_test) {
+    unsigned n;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    for (n = 1; n <= STRESS_MAX_PRODUCERS; n *= 2) {
+        stress(n, FALSE);
+        stress(n, TRUE);
+    }
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -99,6 +215,10 @@ int main(int argc, char *argv[]) {
     tc = tcase_create("asyncq");
     tcase_add_test(tc, asyncq_test);
     suite_add_tcase(s, tc);
+    tc = tcase_create("stress");
+    tcase_add_test(tc, asyncq_stress_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
     srunner_run_all(sr, CK_NORMAL);
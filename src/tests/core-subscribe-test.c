@@ -0,0 +1,123 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulsecore/core.h>
+#include <pulsecore/core-subscribe.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_OBJECTS 3
+
+/* What PA_COMMAND_GET_INFO_LIST_SINCE sends a record for */
+static pa_bool_t changed_since(pa_core *c, uint32_t idx, uint64_t generation) {
+    return pa_subscription_get_generation(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT, idx) > generation;
+}
+
+START_TEST (generation_test) {
+    pa_mainloop *m;
+    pa_core *c;
+    uint64_t g;
+    uint32_t i;
+
+    m = pa_mainloop_new();
+    fail_unless((c = pa_core_new(pa_mainloop_get_api(m), FALSE, 0, 0, FALSE)) != NULL);
+
+    /* Generations of different server instances differ in the upper
+     * bits */
+    fail_unless((c->generation >> 32) == c->cookie);
+
+    for (i = 0; i < N_OBJECTS; i++)
+        pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, i);
+
+    /* Passing 0 returns everything */
+    for (i = 0; i < N_OBJECTS; i++)
+        fail_unless(changed_since(c, i, 0));
+
+    /* Nothing changed */
+    g = c->generation;
+
+    for (i = 0; i < N_OBJECTS; i++)
+        fail_unless(!changed_since(c, i, g));
+
+    /* Objects of other types with the same index don't count */
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+    fail_unless(c->generation > g);
+
+    for (i = 0; i < N_OBJECTS; i++)
+        fail_unless(!changed_since(c, i, g));
+
+    /* One object changed */
+    g = c->generation;
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_CHANGE, 1);
+
+    fail_unless(!changed_since(c, 0, g));
+    fail_unless(changed_since(c, 1, g));
+    fail_unless(!changed_since(c, 2, g));
+
+    /* One object was removed. It isn't listed anymore, and if its index
+     * gets reused the new object is sent. */
+    g = c->generation;
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_REMOVE, 2);
+    fail_unless(c->generation > g);
+
+    fail_unless(!changed_since(c, 0, g));
+    fail_unless(!changed_since(c, 1, g));
+
+    g = c->generation;
+    pa_subscription_post(c, PA_SUBSCRIPTION_EVENT_SINK_INPUT|PA_SUBSCRIPTION_EVENT_NEW, 2);
+
+    fail_unless(!changed_since(c, 0, g));
+    fail_unless(!changed_since(c, 1, g));
+    fail_unless(changed_since(c, 2, g));
+
+    pa_core_unref(c);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Core Subscribe");
+    tc = tcase_create("core-subscribe");
+    tcase_add_test(tc, generation_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
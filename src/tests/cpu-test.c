@@ -423,6 +423,228 @@ END_TEST
 #undef TIMES
 /* End conversion tests */
 
+/* Start mix tests */
+#define SAMPLES 1028
+#define TIMES 1000
+#define TIMES2 100
+#define NSTREAMS 4
+
+static void setup_mix_streams(pa_mix_info m[], unsigned nstreams, void *src[], pa_sample_format_t format,
+        const pa_mix_info volumes[], unsigned channels) {
+    unsigned i, c;
+
+    for (i = 0; i < nstreams; i++) {
+        m[i].ptr = src[i];
+
+        /* Pad the factors like pa_mix() does */
+        for (c = 0; c < PA_CHANNELS_MAX + PA_MIX_VOLUME_PADDING; c++)
+            m[i].linear[c] = volumes[i].linear[c % channels];
+    }
+}
+
+static void run_mix_test(pa_do_mix_func_t func, pa_do_mix_func_t orig_func, pa_sample_format_t format, int align,
+        unsigned channels, pa_bool_t correct, pa_bool_t perf) {
+    PA_DECLARE_ALIGNED(8, uint8_t, in[NSTREAMS][SAMPLES * 4]);
+    PA_DECLARE_ALIGNED(8, uint8_t, out[SAMPLES * 4]) = { 0 };
+    PA_DECLARE_ALIGNED(8, uint8_t, out_ref[SAMPLES * 4]) = { 0 };
+    pa_mix_info m[NSTREAMS], volumes[NSTREAMS];
+    void *src[NSTREAMS];
+    uint8_t *samples, *samples_ref;
+    size_t ss, size;
+    unsigned i, c, nsamples;
+
+    ss = pa_sample_size_of_format(format);
+
+    /* Force sample alignment as requested */
+    samples = out + (8 - align) * ss;
+    samples_ref = out_ref + (8 - align) * ss;
+    nsamples = SAMPLES - (8 - align);
+    nsamples -= nsamples % channels;
+    size = nsamples * ss;
+
+    for (i = 0; i < NSTREAMS; i++) {
+        src[i] = in[i] + (8 - align) * ss;
+
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            float *f = src[i];
+            unsigned j;
+
+            for (j = 0; j < nsamples; j++)
+                f[j] = 2.0f * (rand()/(float) RAND_MAX - 0.5f);
+        } else
+            pa_random(src[i], size);
+
+        /* Mix in some muted channels and factors above 1.0 */
+        for (c = 0; c < channels; c++) {
+            if (format == PA_SAMPLE_FLOAT32NE)
+                volumes[i].linear[c].f = (rand() % 5 == 0) ? 0.0f : 2.0f * rand()/(float) RAND_MAX;
+            else
+                volumes[i].linear[c].i = (rand() % 5 == 0) ? 0 : rand() % 0x20000;
+        }
+
+        /* Muted channels must not contribute anything, not even NaN or
+         * infinity */
+        if (format == PA_SAMPLE_FLOAT32NE) {
+            float *f = src[i];
+            unsigned j;
+
+            for (j = 0; j < nsamples; j++)
+                if (volumes[i].linear[j % channels].f <= 0.0f)
+                    f[j] = j % 2 ? NAN : INFINITY;
+        }
+    }
+
+    if (correct) {
+        setup_mix_streams(m, NSTREAMS, src, format, volumes, channels);
+        orig_func(m, NSTREAMS, channels, samples_ref, samples_ref + size);
+
+        setup_mix_streams(m, NSTREAMS, src, format, volumes, channels);
+        func(m, NSTREAMS, channels, samples, samples + size);
+
+        for (i = 0; i < NSTREAMS; i++)
+            fail_unless((uint8_t*) m[i].ptr == (uint8_t*) src[i] + size);
+
+        if (memcmp(samples, samples_ref, size) != 0) {
+            for (i = 0; i < size; i += ss)
+                if (memcmp(samples + i, samples_ref + i, ss) != 0)
+                    break;
+
+            pa_log_debug("Correctness test failed: format=%s, align=%d, channels=%u, sample %u",
+                    pa_sample_format_to_string(format), align, channels, (unsigned) (i / ss));
+            fail();
+        }
+    }
+
+    if (perf) {
+        pa_log_debug("Testing %s mix performance with %d sample alignment, %u channels",
+                pa_sample_format_to_string(format), align, channels);
+
+        PA_CPU_TEST_RUN_START("func", TIMES, TIMES2) {
+            setup_mix_streams(m, NSTREAMS, src, format, volumes, channels);
+            func(m, NSTREAMS, channels, samples, samples + size);
+        } PA_CPU_TEST_RUN_STOP
+
+        PA_CPU_TEST_RUN_START("orig", TIMES, TIMES2) {
+            setup_mix_streams(m, NSTREAMS, src, format, volumes, channels);
+            orig_func(m, NSTREAMS, channels, samples_ref, samples_ref + size);
+        } PA_CPU_TEST_RUN_STOP
+
+        fail_unless(memcmp(samples_ref, samples, size) == 0);
+    }
+}
+
+static const pa_sample_format_t mix_formats[] = { PA_SAMPLE_S16NE, PA_SAMPLE_S32NE, PA_SAMPLE_FLOAT32NE };
+
+static void run_mix_tests(pa_do_mix_func_t orig_funcs[], const char *name) {
+    unsigned f, c;
+    int j;
+
+    for (f = 0; f < PA_ELEMENTSOF(mix_formats); f++) {
+        pa_do_mix_func_t func = pa_get_mix_func(mix_formats[f]);
+
+        pa_log_debug("Checking %s mix (%s)", name, pa_sample_format_to_string(mix_formats[f]));
+
+        for (c = 1; c <= 9; c++) {
+            for (j = 0; j < 8; j++)
+                run_mix_test(func, orig_funcs[f], mix_formats[f], j, c, TRUE, FALSE);
+        }
+        run_mix_test(func, orig_funcs[f], mix_formats[f], 7, PA_CHANNELS_MAX, TRUE, FALSE);
+
+        run_mix_test(func, orig_funcs[f], mix_formats[f], 8, 2, TRUE, TRUE);
+        run_mix_test(func, orig_funcs[f], mix_formats[f], 8, 6, TRUE, TRUE);
+    }
+}
+
+static void get_mix_funcs(pa_do_mix_func_t funcs[]) {
+    unsigned f;
+
+    for (f = 0; f < PA_ELEMENTSOF(mix_formats); f++)
+        funcs[f] = pa_get_mix_func(mix_formats[f]);
+}
+
+static void set_mix_funcs(pa_do_mix_func_t funcs[]) {
+    unsigned f;
+
+    for (f = 0; f < PA_ELEMENTSOF(mix_formats); f++)
+        pa_set_mix_func(mix_formats[f], funcs[f]);
+}
+
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+START_TEST (mix_sse_test) {
+    pa_do_mix_func_t orig_funcs[PA_ELEMENTSOF(mix_formats)];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_SSE2)) {
+        pa_log_info("SSE2 not supported. Skipping");
+        return;
+    }
+
+    get_mix_funcs(orig_funcs);
+    pa_mix_func_init_sse(flags);
+
+    run_mix_tests(orig_funcs, "SSE2");
+
+    set_mix_funcs(orig_funcs);
+}
+END_TEST
+#endif /* HAVE_SSE2 */
+
+#ifdef HAVE_AVX2
+START_TEST (mix_avx_test) {
+    pa_do_mix_func_t orig_funcs[PA_ELEMENTSOF(mix_formats)];
+    pa_cpu_x86_flag_t flags = 0;
+
+    pa_cpu_get_x86_flags(&flags);
+
+    if (!(flags & PA_CPU_X86_AVX2)) {
+        pa_log_info("AVX2 not supported. Skipping");
+        return;
+    }
+
+    get_mix_funcs(orig_funcs);
+    pa_mix_func_init_avx(flags);
+
+    run_mix_tests(orig_funcs, "AVX2");
+
+    set_mix_funcs(orig_funcs);
+}
+END_TEST
+#endif /* HAVE_AVX2 */
+#endif /* defined (__i386__) || defined (__amd64__) */
+
+#if defined (__arm__) && defined (__linux__)
+#ifdef HAVE_NEON
+START_TEST (mix_neon_test) {
+    pa_do_mix_func_t orig_funcs[PA_ELEMENTSOF(mix_formats)];
+    pa_cpu_arm_flag_t flags = 0;
+
+    pa_cpu_get_arm_flags(&flags);
+
+    if (!(flags & PA_CPU_ARM_NEON)) {
+        pa_log_info("NEON not supported. Skipping");
+        return;
+    }
+
+    get_mix_funcs(orig_funcs);
+    pa_mix_func_init_neon(flags);
+
+    run_mix_tests(orig_funcs, "NEON");
+
+    set_mix_funcs(orig_funcs);
+}
+END_TEST
+#endif /* HAVE_NEON */
+#endif /* defined (__arm__) && defined (__linux__) */
+
+#undef SAMPLES
+#undef TIMES
+#undef TIMES2
+#undef NSTREAMS
+/* End mix tests */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -460,6 +682,24 @@ int main(int argc, char *argv[]) {
     tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
+    /* Mixing tests */
+    tc = tcase_create("mix");
+#if defined (__i386__) || defined (__amd64__)
+#ifdef HAVE_SSE2
+    tcase_add_test(tc, mix_sse_test);
+#endif
+#ifdef HAVE_AVX2
+    tcase_add_test(tc, mix_avx_test);
+#endif
+#endif
+#if defined (__arm__) && defined (__linux__)
+#ifdef HAVE_NEON
+    tcase_add_test(tc, mix_neon_test);
+#endif
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
     sr = srunner_create(s);
     srunner_run_all(sr, CK_NORMAL);
     failed = srunner_ntests_failed(sr);
@@ -0,0 +1,388 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/database.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_ENTRIES 1000
+#define N_BENCHMARK_ENTRIES 10000
+#define N_BENCHMARK_UPDATES 1000
+
+static char dir[] = "/tmp/pa-database-test-XXXXXX";
+
+static void make_datum(pa_datum *d, char *buf, size_t l, const char *prefix, unsigned i) {
+    /* Values of different lengths, so that a shifted record can't be
+     * mistaken for a correct one */
+    pa_snprintf(buf, l, "%s-%u-%0*u", prefix, i, (int) (i % 17), 0);
+    d->data = buf;
+    d->size = strlen(buf);
+}
+
+static void set(pa_database *db, unsigned i, const char *value) {
+    pa_datum key, data;
+    char k[64], v[64];
+
+    make_datum(&key, k, sizeof(k), "key", i);
+    make_datum(&data, v, sizeof(v), value, i);
+
+    fail_unless(pa_database_set(db, &key, &data, TRUE) == 0);
+}
+
+static void unset(pa_database *db, unsigned i) {
+    pa_datum key;
+    char k[64];
+
+    make_datum(&key, k, sizeof(k), "key", i);
+    fail_unless(pa_database_unset(db, &key) == 0);
+}
+
+static pa_bool_t check(pa_database *db, unsigned i, const char *value) {
+    pa_datum key, data, expected;
+    char k[64], v[64];
+    pa_bool_t r;
+
+    make_datum(&key, k, sizeof(k), "key", i);
+
+    if (!pa_database_get(db, &key, &data))
+        return !value;
+
+    if (!value) {
+        pa_datum_free(&data);
+        return FALSE;
+    }
+
+    make_datum(&expected, v, sizeof(v), value, i);
+    r = data.size == expected.size && memcmp(data.data, expected.data, data.size) == 0;
+    pa_datum_free(&data);
+
+    return r;
+}
+
+static char *db_name(const char *name) {
+    return pa_sprintf_malloc("%s/%s", dir, name);
+}
+
+START_TEST (database_test) {
+    pa_database *db;
+    pa_datum key, next;
+    char *fn;
+    unsigned i, n;
+
+    fn = db_name("basic");
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_size(db) == 0);
+
+    for (i = 0; i < N_ENTRIES; i++)
+        set(db, i, "a");
+
+    fail_unless(pa_database_sync(db) == 0);
+
+    /* Overwrite some, remove some, and don't sync explicitly */
+    for (i = 0; i < N_ENTRIES; i += 3)
+        set(db, i, "b");
+    for (i = 1; i < N_ENTRIES; i += 3)
+        unset(db, i);
+
+    fail_unless(pa_database_size(db) == N_ENTRIES - (N_ENTRIES + 1) / 3);
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == N_ENTRIES - (N_ENTRIES + 1) / 3);
+
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(check(db, i, i % 3 == 0 ? "b" : i % 3 == 1 ? NULL : "a"));
+
+    /* Iterating visits every entry once */
+    n = 0;
+    if (pa_database_first(db, &key, NULL)) {
+        pa_bool_t more;
+
+        do {
+            n++;
+            more = !!pa_database_next(db, &key, &next, NULL);
+            pa_datum_free(&key);
+            key = next;
+        } while (more);
+    }
+    fail_unless(n == N_ENTRIES - (N_ENTRIES + 1) / 3);
+
+    pa_database_close(db);
+
+    /* Clearing survives a reopen too */
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_clear(db) == 0);
+    set(db, 7, "c");
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == 1);
+    fail_unless(check(db, 7, "c"));
+    pa_database_close(db);
+
+    pa_xfree(fn);
+}
+END_TEST
+
+START_TEST (database_clear_test) {
+    pa_database *db;
+    char *fn;
+    unsigned i;
+
+    fn = db_name("clear");
+
+    /* Enough entries that clearing them makes the file worth
+     * compacting, which then has no records left to write */
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    for (i = 0; i < 2 * N_ENTRIES; i++)
+        set(db, i, "a");
+    fail_unless(pa_database_sync(db) == 0);
+
+    fail_unless(pa_database_clear(db) == 0);
+    fail_unless(pa_database_sync(db) == 0);
+    fail_unless(pa_database_size(db) == 0);
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_size(db) == 0);
+    set(db, 3, "b");
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == 1);
+    fail_unless(check(db, 3, "b"));
+    fail_unless(check(db, 4, NULL));
+    pa_database_close(db);
+
+    pa_xfree(fn);
+}
+END_TEST
+
+#ifdef HAVE_JOURNALDB
+START_TEST (database_journal_recovery_test) {
+    pa_database *db;
+    char *fn, *path;
+    struct stat st;
+    off_t synced;
+    unsigned i;
+
+    fn = db_name("recovery");
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".journal", fn);
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    for (i = 0; i < N_ENTRIES; i++)
+        set(db, i, "a");
+    fail_unless(pa_database_sync(db) == 0);
+
+    fail_unless(stat(path, &st) == 0);
+    synced = st.st_size;
+
+    set(db, 0, "b");
+    set(db, 1, "b");
+    pa_database_close(db);
+
+    /* Pretend we crashed in the middle of writing the last record */
+    fail_unless(stat(path, &st) == 0);
+    fail_unless(st.st_size > synced);
+    fail_unless(truncate(path, st.st_size - 3) == 0);
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    fail_unless(pa_database_size(db) == N_ENTRIES);
+    fail_unless(check(db, 0, "b"));
+    fail_unless(check(db, 1, "a"));
+
+    /* The damaged record is dropped, so new ones aren't lost behind it */
+    set(db, 2, "b");
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(check(db, 0, "b"));
+    fail_unless(check(db, 1, "a"));
+    fail_unless(check(db, 2, "b"));
+    pa_database_close(db);
+
+    /* Lots of updates get compacted instead of growing the file */
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    for (i = 0; i < 50 * N_ENTRIES; i++) {
+        set(db, i % N_ENTRIES, i % 2 ? "a" : "b");
+        fail_unless(pa_database_sync(db) == 0);
+    }
+    pa_database_close(db);
+
+    fail_unless(stat(path, &st) == 0);
+    fail_unless(st.st_size < 3 * synced);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == N_ENTRIES);
+    for (i = 0; i < N_ENTRIES; i++)
+        fail_unless(check(db, i, i % 2 ? "a" : "b"));
+    pa_database_close(db);
+
+    pa_xfree(path);
+    pa_xfree(fn);
+}
+END_TEST
+
+START_TEST (database_journal_short_write_test) {
+    pa_database *db;
+    char *fn, *path;
+    struct stat st;
+    struct rlimit old_limit, limit;
+    unsigned i;
+
+    fn = db_name("short-write");
+    path = pa_sprintf_malloc("%s."CANONICAL_HOST".journal", fn);
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+    for (i = 0; i < 10; i++)
+        set(db, i, "a");
+    fail_unless(pa_database_sync(db) == 0);
+    fail_unless(stat(path, &st) == 0);
+
+    /* Let the next write get only part of the way, so that it fails
+     * with EFBIG after having written something */
+    fail_unless(signal(SIGXFSZ, SIG_IGN) != SIG_ERR);
+    fail_unless(getrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+    limit = old_limit;
+    limit.rlim_cur = (rlim_t) st.st_size + 16;
+    fail_unless(setrlimit(RLIMIT_FSIZE, &limit) == 0);
+
+    for (i = 10; i < 20; i++)
+        set(db, i, "a");
+    fail_unless(pa_database_sync(db) < 0);
+
+    fail_unless(setrlimit(RLIMIT_FSIZE, &old_limit) == 0);
+    fail_unless(signal(SIGXFSZ, SIG_DFL) != SIG_ERR);
+
+    /* The records that are still pending and the ones after them must
+     * all make it to the file now */
+    set(db, 20, "b");
+    fail_unless(pa_database_sync(db) == 0);
+    pa_database_close(db);
+
+    fail_unless((db = pa_database_open(fn, FALSE)) != NULL);
+    fail_unless(pa_database_size(db) == 21);
+    for (i = 0; i < 20; i++)
+        fail_unless(check(db, i, "a"));
+    fail_unless(check(db, 20, "b"));
+    pa_database_close(db);
+
+    pa_xfree(path);
+    pa_xfree(fn);
+}
+END_TEST
+#endif
+
+START_TEST (database_benchmark) {
+    pa_database *db;
+    pa_usec_t t, max = 0;
+    char *fn;
+    unsigned i;
+
+    fn = db_name("benchmark");
+
+    fail_unless((db = pa_database_open(fn, TRUE)) != NULL);
+
+    t = pa_rtclock_now();
+    for (i = 0; i < N_BENCHMARK_ENTRIES; i++)
+        set(db, i, "a");
+    fail_unless(pa_database_sync(db) == 0);
+    pa_log_debug("Initial sync of %u entries: %llu usec", N_BENCHMARK_ENTRIES, (unsigned long long) (pa_rtclock_now() - t));
+
+    /* This is what e.g. module-stream-restore does whenever a stream
+     * volume changes */
+    t = pa_rtclock_now();
+    for (i = 0; i < N_BENCHMARK_UPDATES; i++) {
+        pa_usec_t u = pa_rtclock_now();
+
+        set(db, (i * 7919) % N_BENCHMARK_ENTRIES, "b");
+        fail_unless(pa_database_sync(db) == 0);
+
+        max = PA_MAX(max, pa_rtclock_now() - u);
+    }
+    t = pa_rtclock_now() - t;
+
+    pa_log_debug("set+sync with %u entries: %llu usec on average, %llu usec at most",
+                 N_BENCHMARK_ENTRIES, (unsigned long long) (t / N_BENCHMARK_UPDATES), (unsigned long long) max);
+
+    pa_database_close(db);
+    pa_xfree(fn);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+    char *cmd;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    if (!mkdtemp(dir))
+        return EXIT_FAILURE;
+
+    s = suite_create("Database");
+    tc = tcase_create("database");
+    tcase_add_test(tc, database_test);
+    tcase_add_test(tc, database_clear_test);
+#ifdef HAVE_JOURNALDB
+    tcase_add_test(tc, database_journal_recovery_test);
+    tcase_add_test(tc, database_journal_short_write_test);
+#endif
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, database_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    cmd = pa_sprintf_malloc("rm -rf %s", dir);
+    if (system(cmd) != 0)
+        failed++;
+    pa_xfree(cmd);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
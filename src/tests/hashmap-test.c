@@ -0,0 +1,346 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_BENCHMARK_MAX 100000
+
+START_TEST (hashmap_test) {
+    pa_hashmap *h;
+    void *state;
+    const void *key;
+    unsigned i, n;
+
+    h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    fail_unless(pa_hashmap_isempty(h));
+    fail_unless(pa_hashmap_first(h) == NULL);
+    fail_unless(pa_hashmap_last(h) == NULL);
+
+    fail_unless(pa_hashmap_put(h, "eins", (void*) "1") == 0);
+    fail_unless(pa_hashmap_put(h, "zwei", (void*) "2") == 0);
+    fail_unless(pa_hashmap_put(h, "drei", (void*) "3") == 0);
+    fail_unless(pa_hashmap_put(h, "zwei", (void*) "x") < 0);
+
+    fail_unless(pa_hashmap_size(h) == 3);
+    fail_unless(pa_streq(pa_hashmap_get(h, "zwei"), "2"));
+    fail_unless(pa_hashmap_get(h, "vier") == NULL);
+
+    fail_unless(pa_streq(pa_hashmap_first(h), "1"));
+    fail_unless(pa_streq(pa_hashmap_last(h), "3"));
+
+    fail_unless(pa_streq(pa_hashmap_remove(h, "zwei"), "2"));
+    fail_unless(pa_hashmap_remove(h, "zwei") == NULL);
+    fail_unless(pa_hashmap_put(h, "zwei", (void*) "2") == 0);
+
+    /* The insertion order is kept */
+    state = NULL;
+    fail_unless(pa_streq(pa_hashmap_iterate(h, &state, &key), "1") && pa_streq(key, "eins"));
+    fail_unless(pa_streq(pa_hashmap_iterate(h, &state, &key), "3") && pa_streq(key, "drei"));
+    fail_unless(pa_streq(pa_hashmap_iterate(h, &state, &key), "2") && pa_streq(key, "zwei"));
+    fail_unless(pa_hashmap_iterate(h, &state, &key) == NULL && key == NULL);
+
+    state = NULL;
+    fail_unless(pa_streq(pa_hashmap_iterate_backwards(h, &state, NULL), "2"));
+    fail_unless(pa_streq(pa_hashmap_iterate_backwards(h, &state, NULL), "3"));
+    fail_unless(pa_streq(pa_hashmap_iterate_backwards(h, &state, NULL), "1"));
+    fail_unless(pa_hashmap_iterate_backwards(h, &state, NULL) == NULL);
+
+    fail_unless(pa_streq(pa_hashmap_steal_first(h), "1"));
+    fail_unless(pa_streq(pa_hashmap_steal_first(h), "3"));
+    fail_unless(pa_streq(pa_hashmap_steal_first(h), "2"));
+    fail_unless(pa_hashmap_steal_first(h) == NULL);
+    fail_unless(pa_hashmap_isempty(h));
+
+    pa_hashmap_free(h, NULL, NULL);
+
+    /* Grow, remove every other entry while iterating and shrink
+     * again. The array size is a power of two, so 16384 entries fill
+     * it up and then half of it is dead. */
+    h = pa_hashmap_new(NULL, NULL);
+
+    for (i = 0; i < 16384; i++)
+        fail_unless(pa_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1)) == 0);
+
+    n = 0;
+    state = NULL;
+    while (pa_hashmap_iterate(h, &state, &key)) {
+        fail_unless(PA_PTR_TO_UINT(key) == n);
+
+        if (n % 2 == 0)
+            pa_hashmap_remove(h, key);
+
+        n++;
+    }
+
+    fail_unless(n == 16384);
+    fail_unless(pa_hashmap_size(h) == 8192);
+
+    for (i = 0; i < 16384; i++)
+        fail_unless(pa_hashmap_get(h, PA_UINT_TO_PTR(i)) == (i % 2 ? PA_UINT_TO_PTR(i + 1) : NULL));
+
+    /* Re-adding compacts the entries while we are iterating, every
+     * entry must still be returned exactly once and in order */
+    n = 0;
+    state = NULL;
+    while (pa_hashmap_iterate(h, &state, &key)) {
+        fail_unless(PA_PTR_TO_UINT(key) == (n < 8192 ? 2 * n + 1 : 2 * (n - 8192)));
+
+        if (n == 1)
+            for (i = 0; i < 16384; i += 2)
+                fail_unless(pa_hashmap_put(h, PA_UINT_TO_PTR(i), PA_UINT_TO_PTR(i + 1)) == 0);
+
+        n++;
+    }
+
+    fail_unless(n == 16384);
+
+    n = 0;
+    state = NULL;
+    while (pa_hashmap_iterate_backwards(h, &state, &key)) {
+        fail_unless(PA_PTR_TO_UINT(key) == (n < 8192 ? 16382 - 2 * n : 16383 - 2 * (n - 8192)));
+        n++;
+    }
+
+    fail_unless(n == 16384);
+
+    for (i = 0; i < 16374; i++)
+        fail_unless(pa_hashmap_remove(h, PA_UINT_TO_PTR(i)) == PA_UINT_TO_PTR(i + 1));
+
+    fail_unless(pa_hashmap_size(h) == 10);
+    fail_unless(pa_hashmap_first(h) == PA_UINT_TO_PTR(16375 + 1));
+    fail_unless(pa_hashmap_last(h) == PA_UINT_TO_PTR(16382 + 1));
+
+    pa_hashmap_free(h, NULL, NULL);
+}
+END_TEST
+
+START_TEST (idxset_test) {
+    pa_idxset *s;
+    uint32_t idx, a, b, c;
+    void *state, *p;
+    unsigned i, n;
+
+    s = pa_idxset_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+    fail_unless(pa_idxset_put(s, (void*) "eins", &a) == 0);
+    fail_unless(pa_idxset_put(s, (void*) "zwei", &b) == 0);
+    fail_unless(pa_idxset_put(s, (void*) "drei", &c) == 0);
+    fail_unless(pa_idxset_put(s, (void*) "zwei", &idx) < 0 && idx == b);
+
+    fail_unless(a < b && b < c);
+    fail_unless(pa_streq(pa_idxset_get_by_index(s, b), "zwei"));
+    fail_unless(pa_streq(pa_idxset_get_by_data(s, "drei", &idx), "drei") && idx == c);
+
+    fail_unless(pa_streq(pa_idxset_remove_by_index(s, b), "zwei"));
+    fail_unless(pa_idxset_get_by_index(s, b) == NULL);
+
+    /* pa_idxset_next() continues after entries that have been removed */
+    idx = b;
+    fail_unless(pa_streq(pa_idxset_next(s, &idx), "drei") && idx == c);
+    fail_unless(pa_idxset_next(s, &idx) == NULL && idx == PA_IDXSET_INVALID);
+
+    idx = a;
+    fail_unless(pa_streq(pa_idxset_rrobin(s, &idx), "drei") && idx == c);
+    fail_unless(pa_streq(pa_idxset_rrobin(s, &idx), "eins") && idx == a);
+
+    pa_idxset_free(s, NULL, NULL);
+
+    s = pa_idxset_new(NULL, NULL);
+
+    for (i = 0; i < 10000; i++) {
+        fail_unless(pa_idxset_put(s, PA_UINT_TO_PTR(i + 1), &idx) == 0);
+        fail_unless(idx == i);
+    }
+
+    /* Removing the current entry while iterating is allowed */
+    n = 0;
+    PA_IDXSET_FOREACH(p, s, idx) {
+        fail_unless(idx == n && p == PA_UINT_TO_PTR(n + 1));
+
+        if (n % 3 != 0)
+            fail_unless(pa_idxset_remove_by_data(s, p, NULL) == p);
+
+        n++;
+    }
+
+    fail_unless(n == 10000);
+    fail_unless(pa_idxset_size(s) == 3334);
+
+    /* New entries are appended and compact the old ones */
+    for (i = 0; i < 10000; i++)
+        if (i % 3 != 0)
+            fail_unless(pa_idxset_put(s, PA_UINT_TO_PTR(i + 1), NULL) == 0);
+
+    n = 0;
+    state = NULL;
+    while ((p = pa_idxset_iterate(s, &state, &idx))) {
+        fail_unless(pa_idxset_get_by_index(s, idx) == p);
+        fail_unless(n >= 3334 || idx == 3 * n);
+        n++;
+    }
+
+    fail_unless(n == 10000);
+
+    for (i = 0; i < 10000; i++)
+        fail_unless(pa_idxset_get_by_data(s, PA_UINT_TO_PTR(i + 1), NULL) == PA_UINT_TO_PTR(i + 1));
+
+    pa_idxset_free(s, NULL, NULL);
+}
+END_TEST
+
+static void log_time(const char *what, unsigned n, pa_usec_t t) {
+    pa_log_debug("%s, %u entries: %0.1f ns per entry", what, n, (double) t * PA_NSEC_PER_USEC / n);
+}
+
+START_TEST (hashmap_benchmark) {
+    char **keys;
+    unsigned i, n;
+
+    keys = pa_xnew(char*, N_BENCHMARK_MAX);
+
+    for (i = 0; i < N_BENCHMARK_MAX; i++)
+        keys[i] = pa_sprintf_malloc("key-%u", i);
+
+    for (n = 10000; n <= N_BENCHMARK_MAX; n *= 10) {
+        pa_hashmap *h;
+        pa_usec_t t;
+        void *state;
+
+        h = pa_hashmap_new(pa_idxset_string_hash_func, pa_idxset_string_compare_func);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            pa_hashmap_put(h, keys[i], keys[i]);
+        log_time("pa_hashmap_put()", n, pa_rtclock_now() - t);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            fail_unless(pa_hashmap_get(h, keys[(i * 7919) % n]) == keys[(i * 7919) % n]);
+        log_time("pa_hashmap_get()", n, pa_rtclock_now() - t);
+
+        t = pa_rtclock_now();
+        state = NULL;
+        for (i = 0; pa_hashmap_iterate(h, &state, NULL); i++)
+            ;
+        log_time("pa_hashmap_iterate()", n, pa_rtclock_now() - t);
+        fail_unless(i == n);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            pa_hashmap_remove(h, keys[(i * 7919) % n]);
+        log_time("pa_hashmap_remove()", n, pa_rtclock_now() - t);
+        fail_unless(pa_hashmap_isempty(h));
+
+        pa_hashmap_free(h, NULL, NULL);
+    }
+
+    for (i = 0; i < N_BENCHMARK_MAX; i++)
+        pa_xfree(keys[i]);
+    pa_xfree(keys);
+}
+END_TEST
+
+START_TEST (idxset_benchmark) {
+    unsigned i, n;
+
+    for (n = 10000; n <= N_BENCHMARK_MAX; n *= 10) {
+        pa_idxset *s;
+        pa_usec_t t;
+        uint32_t idx;
+        void *p;
+
+        s = pa_idxset_new(NULL, NULL);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            pa_idxset_put(s, PA_UINT_TO_PTR(i + 1), NULL);
+        log_time("pa_idxset_put()", n, pa_rtclock_now() - t);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            fail_unless(pa_idxset_get_by_index(s, (i * 7919) % n) != NULL);
+        log_time("pa_idxset_get_by_index()", n, pa_rtclock_now() - t);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            fail_unless(pa_idxset_get_by_data(s, PA_UINT_TO_PTR((i * 7919) % n + 1), NULL) != NULL);
+        log_time("pa_idxset_get_by_data()", n, pa_rtclock_now() - t);
+
+        t = pa_rtclock_now();
+        i = 0;
+        PA_IDXSET_FOREACH(p, s, idx)
+            i++;
+        log_time("PA_IDXSET_FOREACH()", n, pa_rtclock_now() - t);
+        fail_unless(i == n);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < n; i++)
+            pa_idxset_remove_by_index(s, (i * 7919) % n);
+        log_time("pa_idxset_remove_by_index()", n, pa_rtclock_now() - t);
+        fail_unless(pa_idxset_isempty(s));
+
+        pa_idxset_free(s, NULL, NULL);
+    }
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Hashmap");
+    tc = tcase_create("hashmap");
+    tcase_add_test(tc, hashmap_test);
+    tcase_add_test(tc, idxset_test);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, hashmap_benchmark);
+    tcase_add_test(tc, idxset_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,306 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <check.h>
+
+#include <pulse/pulseaudio.h>
+
+/* Many local clients listen to the monitor of a null sink over HTTP,
+ * while one more client never reads anything. The listeners must
+ * share a single source output, keep getting data, and the slow
+ * client must be dropped. The daemon's rlimit-nofile needs to be
+ * large enough for all the connections. */
+
+#define N_LISTENERS 200
+#define HTTP_PORT 14714
+#define SINK_NAME "http_listen_stress"
+#define RUN_USEC (2 * PA_USEC_PER_SEC)
+#define DROP_TIMEOUT_USEC (30 * PA_USEC_PER_SEC)
+
+static pa_threaded_mainloop *mainloop = NULL;
+static pa_context *context = NULL;
+
+static int listeners[N_LISTENERS];
+static size_t received[N_LISTENERS];
+static int slow_listener = -1;
+
+static void context_state_callback(pa_context *c, void *userdata) {
+    switch (pa_context_get_state(c)) {
+        case PA_CONTEXT_READY:
+        case PA_CONTEXT_FAILED:
+        case PA_CONTEXT_TERMINATED:
+            pa_threaded_mainloop_signal(mainloop, 0);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void wait_for_operation(pa_operation *o) {
+    fail_unless(o != NULL);
+
+    while (pa_operation_get_state(o) == PA_OPERATION_RUNNING)
+        pa_threaded_mainloop_wait(mainloop);
+
+    pa_operation_unref(o);
+}
+
+static void index_callback(pa_context *c, uint32_t idx, void *userdata) {
+    *(uint32_t*) userdata = idx;
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void success_callback(pa_context *c, int success, void *userdata) {
+    pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void client_info_callback(pa_context *c, const pa_client_info *i, int eol, void *userdata) {
+    if (i && i->driver && strstr(i->driver, "protocol-http"))
+        (*(unsigned*) userdata)++;
+
+    if (eol)
+        pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static void source_output_info_callback(pa_context *c, const pa_source_output_info *i, int eol, void *userdata) {
+    if (i && i->driver && strstr(i->driver, "protocol-http"))
+        (*(unsigned*) userdata)++;
+
+    if (eol)
+        pa_threaded_mainloop_signal(mainloop, 0);
+}
+
+static uint32_t load_module(const char *name, const char *argument) {
+    uint32_t idx = PA_INVALID_INDEX;
+
+    pa_threaded_mainloop_lock(mainloop);
+    wait_for_operation(pa_context_load_module(context, name, argument, index_callback, &idx));
+    pa_threaded_mainloop_unlock(mainloop);
+
+    fail_unless(idx != PA_INVALID_INDEX);
+
+    return idx;
+}
+
+static void unload_module(uint32_t idx) {
+    pa_threaded_mainloop_lock(mainloop);
+    wait_for_operation(pa_context_unload_module(context, idx, success_callback, NULL));
+    pa_threaded_mainloop_unlock(mainloop);
+}
+
+static unsigned count_http_clients(void) {
+    unsigned n = 0;
+
+    pa_threaded_mainloop_lock(mainloop);
+    wait_for_operation(pa_context_get_client_info_list(context, client_info_callback, &n));
+    pa_threaded_mainloop_unlock(mainloop);
+
+    return n;
+}
+
+static unsigned count_http_source_outputs(void) {
+    unsigned n = 0;
+
+    pa_threaded_mainloop_lock(mainloop);
+    wait_for_operation(pa_context_get_source_output_info_list(context, source_output_info_callback, &n));
+    pa_threaded_mainloop_unlock(mainloop);
+
+    return n;
+}
+
+static int connect_listener(int slow) {
+    static const char request[] = "GET /listen/source/" SINK_NAME ".monitor HTTP/1.0\r\n\r\n";
+    struct sockaddr_in sa;
+    int fd;
+
+    fail_unless((fd = socket(AF_INET, SOCK_STREAM, 0)) >= 0);
+
+    /* Keep the kernel from buffering much for the client that never
+     * reads, so that it falls behind quickly */
+    if (slow) {
+        int l = 4096;
+        fail_unless(setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &l, sizeof(l)) == 0);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_port = htons(HTTP_PORT);
+    sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    fail_unless(connect(fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    fail_unless(write(fd, request, sizeof(request) - 1) == sizeof(request) - 1);
+
+    return fd;
+}
+
+/* Reads whatever the listeners got until the deadline or, if
+ * n_clients is non-zero, until that many HTTP clients are left */
+static void read_listeners(pa_usec_t deadline, unsigned n_clients) {
+    struct pollfd pollfd[N_LISTENERS];
+    char buf[16384];
+    pa_usec_t last_check = 0;
+    unsigned i;
+
+    for (i = 0; i < N_LISTENERS; i++) {
+        pollfd[i].fd = listeners[i];
+        pollfd[i].events = POLLIN;
+    }
+
+    while (pa_rtclock_now() < deadline) {
+        fail_unless(poll(pollfd, N_LISTENERS, 100) >= 0);
+
+        for (i = 0; i < N_LISTENERS; i++) {
+            ssize_t r;
+
+            if (!pollfd[i].revents)
+                continue;
+
+            r = read(listeners[i], buf, sizeof(buf));
+
+            /* None of the fast listeners may get disconnected */
+            if (r <= 0)
+                fprintf(stderr, "Listener %u was disconnected: %s\n", i, r < 0 ? strerror(errno) : "EOF");
+            fail_unless(r > 0);
+
+            received[i] += (size_t) r;
+        }
+
+        if (n_clients > 0 && pa_rtclock_now() - last_check > 500 * PA_USEC_PER_MSEC) {
+            if (count_http_clients() == n_clients)
+                return;
+
+            last_check = pa_rtclock_now();
+        }
+    }
+
+    fail_unless(n_clients == 0);
+}
+
+START_TEST (http_listen_stress_test) {
+    uint32_t null_sink, http;
+    char argument[64];
+    size_t before[N_LISTENERS];
+    pa_usec_t t;
+    unsigned i;
+
+    mainloop = pa_threaded_mainloop_new();
+    fail_unless(mainloop != NULL);
+
+    context = pa_context_new(pa_threaded_mainloop_get_api(mainloop), "http-listen-stress");
+    fail_unless(context != NULL);
+    pa_context_set_state_callback(context, context_state_callback, NULL);
+
+    fail_unless(pa_context_connect(context, NULL, 0, NULL) == 0);
+    fail_unless(pa_threaded_mainloop_start(mainloop) == 0);
+
+    pa_threaded_mainloop_lock(mainloop);
+    while (pa_context_get_state(context) != PA_CONTEXT_READY) {
+        fail_unless(PA_CONTEXT_IS_GOOD(pa_context_get_state(context)));
+        pa_threaded_mainloop_wait(mainloop);
+    }
+    pa_threaded_mainloop_unlock(mainloop);
+
+    null_sink = load_module("module-null-sink", "sink_name=" SINK_NAME);
+    snprintf(argument, sizeof(argument), "listen=127.0.0.1 port=%u", HTTP_PORT);
+    http = load_module("module-http-protocol-tcp", argument);
+
+    for (i = 0; i < N_LISTENERS; i++)
+        listeners[i] = connect_listener(0);
+    slow_listener = connect_listener(1);
+
+    t = pa_rtclock_now();
+    read_listeners(t + RUN_USEC, 0);
+
+    fprintf(stderr, "%u listeners connected, %u HTTP source outputs.\n", N_LISTENERS, count_http_source_outputs());
+
+    /* All listeners share one source output */
+    fail_unless(count_http_source_outputs() == 1);
+    fail_unless(count_http_clients() == N_LISTENERS + 1);
+
+    for (i = 0; i < N_LISTENERS; i++) {
+        fail_unless(received[i] > 0);
+        before[i] = received[i];
+    }
+
+    /* Wait until the slow client is dropped, while everybody else
+     * keeps getting data */
+    read_listeners(pa_rtclock_now() + DROP_TIMEOUT_USEC, N_LISTENERS);
+
+    fprintf(stderr, "Slow listener dropped after %llu ms.\n", (unsigned long long) ((pa_rtclock_now() - t) / PA_USEC_PER_MSEC));
+
+    read_listeners(pa_rtclock_now() + RUN_USEC, 0);
+
+    for (i = 0; i < N_LISTENERS; i++)
+        fail_unless(received[i] > before[i]);
+
+    fail_unless(count_http_source_outputs() == 1);
+
+    for (i = 0; i < N_LISTENERS; i++)
+        close(listeners[i]);
+    close(slow_listener);
+
+    unload_module(http);
+    unload_module(null_sink);
+
+    pa_threaded_mainloop_lock(mainloop);
+    pa_context_disconnect(context);
+    pa_context_unref(context);
+    context = NULL;
+    pa_threaded_mainloop_unlock(mainloop);
+
+    pa_threaded_mainloop_stop(mainloop);
+    pa_threaded_mainloop_free(mainloop);
+    mainloop = NULL;
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    s = suite_create("HTTP Listen Stress");
+    tc = tcase_create("httplistenstress");
+    tcase_add_test(tc, http_listen_stress_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,189 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/io-thread-pool.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/msgobject.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/thread-mq.h>
+
+#define N_THREADS 2
+#define N_JOBS 20
+#define RUN_USEC (200 * PA_USEC_PER_MSEC)
+
+struct job {
+    pa_io_thread_job *job;
+    pa_usec_t period;
+    pa_usec_t deadline;
+    pa_thread *thread;
+    pa_atomic_t n_calls;
+    pa_atomic_t n_early;
+    pa_atomic_t n_foreign;
+    pa_atomic_t n_unordered;
+};
+
+/* The deadline of the last job each worker thread ran because its
+ * deadline had passed */
+PA_STATIC_TLS_DECLARE(last_deadline, pa_xfree);
+
+typedef struct test_object {
+    pa_msgobject parent;
+    pa_atomic_t n_messages;
+} test_object;
+
+PA_DEFINE_PRIVATE_CLASS(test_object, pa_msgobject);
+#define TEST_OBJECT(o) (test_object_cast(o))
+
+static int test_object_process_msg(pa_msgobject *o, int code, void *data, int64_t offset, pa_memchunk *chunk) {
+    pa_atomic_inc(&TEST_OBJECT(o)->n_messages);
+    return 0;
+}
+
+static pa_usec_t job_cb(pa_io_thread_job *j, pa_usec_t now, void *userdata) {
+    struct job *t = userdata;
+
+    pa_assert_io_context();
+
+    if (!t->thread)
+        t->thread = pa_thread_self();
+    else if (t->thread != pa_thread_self())
+        pa_atomic_inc(&t->n_foreign);
+
+    if (pa_atomic_inc(&t->n_calls) > 0) {
+        pa_usec_t *last;
+
+        if (now < t->deadline)
+            pa_atomic_inc(&t->n_early);
+
+        /* Timed jobs have to be run in the order of their deadlines */
+        if (t->period > 0) {
+            if (!(last = PA_STATIC_TLS_GET(last_deadline)))
+                PA_STATIC_TLS_SET(last_deadline, last = pa_xnew0(pa_usec_t, 1));
+
+            if (t->deadline < *last)
+                pa_atomic_inc(&t->n_unordered);
+
+            *last = t->deadline;
+        }
+    }
+
+    if (t->period == 0)
+        return PA_USEC_INVALID;
+
+    return t->deadline = now + t->period;
+}
+
+START_TEST (io_thread_pool_test) {
+    pa_mainloop *m;
+    pa_io_thread_pool *p;
+    struct job jobs[N_JOBS];
+    test_object *o;
+    pa_usec_t t;
+    unsigned i;
+
+    m = pa_mainloop_new();
+    p = pa_io_thread_pool_new(pa_mainloop_get_api(m), N_THREADS, 0);
+
+    for (i = 0; i < N_JOBS; i++) {
+        pa_zero(jobs[i]);
+
+        /* The last job only runs when there are messages for it */
+        jobs[i].period = i < N_JOBS - 1 ? (i % 5 + 1) * PA_USEC_PER_MSEC : 0;
+
+        fail_unless((jobs[i].job = pa_io_thread_job_new(p, NULL, job_cb, &jobs[i])) != NULL);
+        pa_io_thread_job_start(jobs[i].job);
+    }
+
+    usleep(RUN_USEC);
+
+    o = pa_msgobject_new(test_object);
+    o->parent.process_msg = test_object_process_msg;
+    pa_atomic_store(&o->n_messages, 0);
+
+    fail_unless(pa_atomic_load(&jobs[N_JOBS - 1].n_calls) == 1);
+    fail_unless(pa_asyncmsgq_send(pa_io_thread_job_get_asyncmsgq(jobs[N_JOBS - 1].job), PA_MSGOBJECT(o), 0, NULL, 0, NULL) == 0);
+    fail_unless(pa_atomic_load(&o->n_messages) == 1);
+
+    /* The job is called right after the message was processed */
+    t = pa_rtclock_now();
+    while (pa_atomic_load(&jobs[N_JOBS - 1].n_calls) < 2 && pa_rtclock_now() - t < PA_USEC_PER_SEC)
+        usleep(1000);
+    fail_unless(pa_atomic_load(&jobs[N_JOBS - 1].n_calls) == 2);
+
+    for (i = 0; i < N_JOBS; i++) {
+        int n_calls = pa_atomic_load(&jobs[i].n_calls);
+
+        pa_io_thread_job_free(jobs[i].job);
+
+        pa_log_debug("Job %u with a period of %llu usec was called %i times",
+                     i, (unsigned long long) jobs[i].period, n_calls);
+
+        fail_unless(pa_atomic_load(&jobs[i].n_early) == 0);
+        fail_unless(pa_atomic_load(&jobs[i].n_foreign) == 0);
+        fail_unless(pa_atomic_load(&jobs[i].n_unordered) == 0);
+
+        /* Be generous, machines running the tests may be busy */
+        if (jobs[i].period > 0)
+            fail_unless(n_calls >= (int) (RUN_USEC / jobs[i].period / 4));
+    }
+
+    pa_msgobject_unref(PA_MSGOBJECT(o));
+    pa_io_thread_pool_free(p);
+    pa_mainloop_free(m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("IO Thread Pool");
+    tc = tcase_create("io-thread-pool");
+    tcase_add_test(tc, io_thread_pool_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -22,16 +22,21 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <poll.h>
 #include <sys/time.h>
 #include <assert.h>
 #include <check.h>
 
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/core-util.h>
 #include <pulsecore/core-rtclock.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
 
 #ifdef GLIB_MAIN_LOOP
 
@@ -122,17 +127,329 @@ START_TEST (mainloop_test) {
 }
 END_TEST
 
+#ifndef GLIB_MAIN_LOOP
+
+#define N_TIME_EVENTS 10000
+#define N_PIPES 500
+#define N_ITERATIONS 10000
+
+struct time_event_info {
+    pa_time_event *event;
+    pa_usec_t time;
+    unsigned n_dispatched;
+};
+
+static pa_usec_t last_dispatched;
+static unsigned n_out_of_order;
+
+static void ordered_tcb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct time_event_info *i = userdata;
+    struct time_event_info *victim;
+    struct timeval tv2;
+
+    if (i->time < last_dispatched)
+        n_out_of_order++;
+    last_dispatched = i->time;
+
+    i->n_dispatched++;
+
+    /* Restarting an elapsed event must not dispatch it again in the
+     * same iteration */
+    a->time_restart(e, pa_timeval_rtstore(&tv2, 0, TRUE));
+
+    /* Freeing one that is about to be dispatched must work too */
+    victim = i + 1;
+    if (victim->event && victim->time > i->time && victim->time % 7 == 0) {
+        a->time_free(victim->event);
+        victim->event = NULL;
+    }
+}
+
+START_TEST (time_event_test) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    struct time_event_info *infos;
+    struct timeval tv;
+    unsigned i;
+
+    m = pa_mainloop_new();
+    a = pa_mainloop_get_api(m);
+
+    /* One extra, so that the callbacks can look at i + 1 */
+    infos = pa_xnew0(struct time_event_info, 1001);
+
+    srand(42);
+    for (i = 0; i < 1000; i++) {
+        infos[i].time = (pa_usec_t) (rand() % 100000) + 1;
+        infos[i].event = a->time_new(a, pa_timeval_rtstore(&tv, infos[i].time, TRUE), ordered_tcb, &infos[i]);
+    }
+
+    last_dispatched = 0;
+    n_out_of_order = 0;
+
+    fail_unless(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    fail_unless(n_out_of_order == 0);
+
+    for (i = 0; i < 1000; i++) {
+        fail_unless(infos[i].n_dispatched <= 1);
+        fail_unless(infos[i].n_dispatched == 1 || !infos[i].event);
+    }
+
+    /* The restarted ones are dispatched in the next iteration */
+    fail_unless(pa_mainloop_iterate(m, 0, NULL) >= 0);
+    for (i = 0; i < 1000; i++)
+        fail_unless(!infos[i].event || infos[i].n_dispatched == 2);
+
+    for (i = 0; i < 1000; i++)
+        if (infos[i].event)
+            a->time_free(infos[i].event);
+
+    pa_mainloop_free(m);
+    pa_xfree(infos);
+}
+END_TEST
+
+/* Two io events on the same fd, the second one is registered with epoll
+ * through a dup() of it. Whichever is dispatched first frees the
+ * other. */
+struct same_fd_info {
+    pa_io_event *events[2];
+    unsigned n_dispatched[2];
+};
+
+static void same_fd_iocb(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    struct same_fd_info *info = userdata;
+    unsigned i = e == info->events[0] ? 0 : 1;
+
+    fail_unless(info->events[i] == e);
+    fail_unless(f == PA_IO_EVENT_INPUT);
+    info->n_dispatched[i]++;
+
+    if (info->events[!i]) {
+        a->io_free(info->events[!i]);
+        info->events[!i] = NULL;
+    }
+}
+
+static unsigned n_poll_func_calls;
+
+static int counting_poll_func(struct pollfd *ufds, unsigned long nfds, int timeout, void *userdata) {
+    n_poll_func_calls++;
+    return poll(ufds, nfds, timeout);
+}
+
+static void same_fd_test(pa_bool_t use_poll_func) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    struct same_fd_info info;
+    int pipe_fds[2];
+    unsigned victim;
+    char c = 'x';
+
+    setenv("PULSE_MAINLOOP_EPOLL", "1", 1);
+
+    m = pa_mainloop_new();
+    a = pa_mainloop_get_api(m);
+
+    n_poll_func_calls = 0;
+    if (use_poll_func)
+        pa_mainloop_set_poll_func(m, counting_poll_func, NULL);
+
+    fail_unless(pipe(pipe_fds) == 0);
+
+    /* The byte is never read, so the fd stays readable */
+    fail_unless(write(pipe_fds[1], &c, 1) == 1);
+
+    pa_memzero(&info, sizeof(info));
+    info.events[0] = a->io_new(a, pipe_fds[0], PA_IO_EVENT_INPUT, same_fd_iocb, &info);
+    info.events[1] = a->io_new(a, pipe_fds[0], PA_IO_EVENT_INPUT, same_fd_iocb, &info);
+
+    /* The one freed from the other's callback is not dispatched */
+    fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+    fail_unless(info.n_dispatched[0] + info.n_dispatched[1] == 1);
+    fail_unless(!info.events[0] != !info.events[1]);
+
+    /* The other one is still registered */
+    fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+    fail_unless(info.n_dispatched[0] + info.n_dispatched[1] == 2);
+    fail_unless(info.n_dispatched[0] == 2 || info.n_dispatched[1] == 2);
+
+    a->io_free(info.events[0] ? info.events[0] : info.events[1]);
+
+    /* Removing either of them leaves the other one working */
+    for (victim = 0; victim < 2; victim++) {
+        pa_memzero(&info, sizeof(info));
+        info.events[0] = a->io_new(a, pipe_fds[0], PA_IO_EVENT_INPUT, same_fd_iocb, &info);
+        info.events[1] = a->io_new(a, pipe_fds[0], PA_IO_EVENT_INPUT, same_fd_iocb, &info);
+
+        a->io_free(info.events[victim]);
+        info.events[victim] = NULL;
+
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+        fail_unless(info.n_dispatched[victim] == 0);
+        fail_unless(info.n_dispatched[!victim] == 1);
+
+        a->io_free(info.events[!victim]);
+    }
+
+    fail_unless(!use_poll_func || n_poll_func_calls == 4);
+
+    pa_mainloop_free(m);
+    pa_close_pipe(pipe_fds);
+
+    unsetenv("PULSE_MAINLOOP_EPOLL");
+}
+
+START_TEST (epoll_test) {
+    same_fd_test(FALSE);
+}
+END_TEST
+
+/* With a poll function set, epoll is not used */
+START_TEST (epoll_poll_func_test) {
+    same_fd_test(TRUE);
+}
+END_TEST
+
+static unsigned n_timer_dispatched, n_io_dispatched;
+
+static void hot_tcb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    struct timeval tv2;
+
+    n_timer_dispatched++;
+    a->time_restart(e, pa_timeval_rtstore(&tv2, 0, TRUE));
+}
+
+static void idle_tcb(pa_mainloop_api*a, pa_time_event *e, const struct timeval *tv, void *userdata) {
+    fail();
+}
+
+static void pipe_iocb(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    char c;
+
+    fail_unless(f == PA_IO_EVENT_INPUT);
+    fail_unless(read(fd, &c, sizeof(c)) == 1);
+    n_io_dispatched++;
+}
+
+static void unused_iocb(pa_mainloop_api*a, pa_io_event *e, int fd, pa_io_event_flags_t f, void *userdata) {
+    fail();
+}
+
+/* Lots of timers far in the future and lots of idle fds, like the
+ * daemon's main loop with many clients connected, and one timer and
+ * one fd that are busy */
+static void benchmark(pa_bool_t use_epoll) {
+    pa_mainloop *m;
+    pa_mainloop_api *a;
+    pa_time_event **timers;
+    pa_io_event **ios;
+    int *pipes;
+    pa_usec_t t, now;
+    struct timeval tv;
+    unsigned i;
+
+    if (use_epoll)
+        setenv("PULSE_MAINLOOP_EPOLL", "1", 1);
+    else
+        unsetenv("PULSE_MAINLOOP_EPOLL");
+
+    m = pa_mainloop_new();
+    a = pa_mainloop_get_api(m);
+
+    timers = pa_xnew(pa_time_event*, N_TIME_EVENTS);
+    ios = pa_xnew(pa_io_event*, 2 * N_PIPES);
+    pipes = pa_xnew(int, 2 * N_PIPES);
+
+    now = pa_rtclock_now();
+
+    t = pa_rtclock_now();
+    for (i = 0; i < N_TIME_EVENTS - 1; i++)
+        timers[i] = a->time_new(a, pa_timeval_rtstore(&tv, now + 3600 * PA_USEC_PER_SEC + i, TRUE), idle_tcb, NULL);
+    timers[i] = a->time_new(a, pa_timeval_rtstore(&tv, 0, TRUE), hot_tcb, NULL);
+
+    for (i = 0; i < N_PIPES; i++) {
+        fail_unless(pipe(pipes + 2*i) == 0);
+        ios[2*i] = a->io_new(a, pipes[2*i], PA_IO_EVENT_INPUT, pipe_iocb, NULL);
+        ios[2*i+1] = a->io_new(a, pipes[2*i+1], PA_IO_EVENT_NULL, unused_iocb, NULL);
+    }
+    pa_log_debug("Creating %u time events and %u io events took %llu usec",
+                 N_TIME_EVENTS, 2 * N_PIPES, (unsigned long long) (pa_rtclock_now() - t));
+
+    n_timer_dispatched = n_io_dispatched = 0;
+
+    t = pa_rtclock_now();
+    for (i = 0; i < N_ITERATIONS; i++) {
+        char c = 'x';
+
+        fail_unless(write(pipes[2 * ((i * 7919) % N_PIPES) + 1], &c, 1) == 1);
+        fail_unless(pa_mainloop_iterate(m, 1, NULL) >= 0);
+
+        /* Restarting timers, like per client auto timing updates */
+        a->time_restart(timers[i % (N_TIME_EVENTS - 1)], pa_timeval_rtstore(&tv, now + 7200 * PA_USEC_PER_SEC + i, TRUE));
+    }
+    t = pa_rtclock_now() - t;
+
+    pa_log_debug("%u iterations with %s took %llu usec", N_ITERATIONS, use_epoll ? "epoll" : "poll", (unsigned long long) t);
+
+    fail_unless(n_timer_dispatched == N_ITERATIONS);
+    fail_unless(n_io_dispatched == N_ITERATIONS);
+
+    for (i = 0; i < N_TIME_EVENTS; i++)
+        a->time_free(timers[i]);
+
+    for (i = 0; i < N_PIPES; i++) {
+        a->io_free(ios[2*i]);
+        a->io_free(ios[2*i+1]);
+        pa_close_pipe(pipes + 2*i);
+    }
+
+    pa_mainloop_free(m);
+
+    pa_xfree(timers);
+    pa_xfree(ios);
+    pa_xfree(pipes);
+
+    unsetenv("PULSE_MAINLOOP_EPOLL");
+}
+
+START_TEST (mainloop_benchmark) {
+    benchmark(FALSE);
+    benchmark(TRUE);
+}
+END_TEST
+
+#endif /* GLIB_MAIN_LOOP */
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
     TCase *tc;
     SRunner *sr;
 
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
     s = suite_create("MainLoop");
     tc = tcase_create("mainloop");
     tcase_add_test(tc, mainloop_test);
+#ifndef GLIB_MAIN_LOOP
+    tcase_add_test(tc, time_event_test);
+#endif
+    suite_add_tcase(s, tc);
+
+#ifndef GLIB_MAIN_LOOP
+    tc = tcase_create("epoll");
+    tcase_add_test(tc, epoll_test);
+    tcase_add_test(tc, epoll_poll_func_test);
     suite_add_tcase(s, tc);
 
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, mainloop_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+#endif
+
     sr = srunner_create(s);
     srunner_run_all(sr, CK_NORMAL);
     failed = srunner_ntests_failed(sr);
@@ -23,6 +23,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 
 #include <check.h>
@@ -34,6 +35,8 @@
 #include <pulsecore/core-util.h>
 
 #include <pulse/xmalloc.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
 
 static const char *fixed[] = {
     "1122444411441144__22__11______3333______________________________",
@@ -214,6 +217,240 @@ START_TEST (memblockq_test) {
 }
 END_TEST
 
+/* The skip index only speeds up finding blocks, so a random sequence
+ * of operations has to give the same result as a plain byte array in
+ * which 0 marks a hole. Indexes are kept within the array, and maxrewind
+ * is large enough that the queue never drops history. */
+#define RANDOM_SIZE 4096
+#define RANDOM_SILENCE 16
+
+static void check_peek(pa_memblockq *bq, const uint8_t *ref, int64_t read_index) {
+    pa_memchunk out;
+    uint8_t *d;
+    size_t i;
+
+    fail_unless(pa_memblockq_peek(bq, &out) == 0);
+    fail_unless(out.memblock != NULL);
+    fail_unless(out.length > 0);
+    fail_unless(read_index + (int64_t) out.length <= RANDOM_SIZE + RANDOM_SILENCE);
+
+    d = pa_memblock_acquire_chunk(&out);
+    for (i = 0; i < out.length; i++)
+        fail_unless(d[i] == ref[read_index + (int64_t) i]);
+    pa_memblock_release(out.memblock);
+    pa_memblock_unref(out.memblock);
+
+    fail_unless(pa_memblockq_peek_fixed_size(bq, RANDOM_SILENCE, &out) == 0);
+    fail_unless(out.length == RANDOM_SILENCE);
+
+    d = pa_memblock_acquire_chunk(&out);
+    for (i = 0; i < out.length; i++)
+        fail_unless(d[i] == ref[read_index + (int64_t) i]);
+    pa_memblock_release(out.memblock);
+    pa_memblock_unref(out.memblock);
+}
+
+START_TEST (memblockq_random_test) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk silence, data;
+    uint8_t ref[RANDOM_SIZE + RANDOM_SILENCE], *d;
+    int64_t read_index = 0, write_index = 0, offset;
+    size_t i, l;
+    unsigned n;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_U8,
+        .rate = 48000,
+        .channels = 1
+    };
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    srand(4711);
+
+    p = pa_mempool_new(FALSE, 0);
+
+    silence.memblock = pa_memblock_new(p, RANDOM_SILENCE);
+    silence.index = 0;
+    silence.length = RANDOM_SILENCE;
+    d = pa_memblock_acquire(silence.memblock);
+    memset(d, 0, RANDOM_SILENCE);
+    pa_memblock_release(silence.memblock);
+
+    /* Pushed data is taken from here, bytes are never 0 */
+    data.memblock = pa_memblock_new(p, RANDOM_SIZE);
+    data.index = 0;
+    data.length = 0;
+    d = pa_memblock_acquire(data.memblock);
+    for (i = 0; i < RANDOM_SIZE; i++)
+        d[i] = (uint8_t) (rand() % 255 + 1);
+    pa_memblock_release(data.memblock);
+
+    bq = pa_memblockq_new("random memblockq", 0, 4 * RANDOM_SIZE, RANDOM_SIZE, &ss, 0, 0, 4 * RANDOM_SIZE, &silence);
+    fail_unless(bq != NULL);
+
+    memset(ref, 0, sizeof(ref));
+
+    for (n = 0; n < 100000; n++) {
+
+        switch (rand() % 8) {
+            case 0:
+            case 1:
+                /* Push, continuing the previous chunk sometimes, so that
+                 * blocks get merged */
+                if (write_index >= RANDOM_SIZE - 1)
+                    break;
+
+                if (rand() % 2 == 0 || data.index + data.length >= RANDOM_SIZE)
+                    data.index = (size_t) rand() % (RANDOM_SIZE - 1);
+                else
+                    data.index += data.length;
+
+                l = (size_t) rand() % 64 + 1;
+                l = PA_MIN(l, RANDOM_SIZE - data.index);
+                data.length = PA_MIN(l, (size_t) (RANDOM_SIZE - write_index));
+
+                fail_unless(pa_memblockq_push(bq, &data) == 0);
+
+                d = pa_memblock_acquire_chunk(&data);
+                memcpy(ref + write_index, d, data.length);
+                pa_memblock_release(data.memblock);
+
+                write_index += (int64_t) data.length;
+                break;
+
+            case 2:
+                offset = rand() % RANDOM_SIZE;
+
+                if (rand() % 2 == 0)
+                    pa_memblockq_seek(bq, offset, PA_SEEK_ABSOLUTE, FALSE);
+                else
+                    pa_memblockq_seek(bq, offset - write_index, PA_SEEK_RELATIVE, FALSE);
+
+                write_index = offset;
+                break;
+
+            case 3:
+                l = (size_t) rand() % ((size_t) read_index + 1);
+                pa_memblockq_rewind(bq, l);
+                read_index -= (int64_t) l;
+                break;
+
+            case 4:
+            case 5:
+                l = (size_t) rand() % 128;
+                l = PA_MIN(l, (size_t) (RANDOM_SIZE - read_index));
+                pa_memblockq_drop(bq, l);
+                read_index += (int64_t) l;
+                break;
+
+            case 6:
+                if (read_index < RANDOM_SIZE)
+                    check_peek(bq, ref, read_index);
+                break;
+
+            case 7:
+                if (rand() % 100 == 0) {
+                    pa_memblockq_silence(bq);
+                    memset(ref, 0, sizeof(ref));
+                }
+                break;
+        }
+
+        fail_unless(pa_memblockq_get_read_index(bq) == read_index);
+        fail_unless(pa_memblockq_get_write_index(bq) == write_index);
+    }
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(silence.memblock);
+    pa_memblock_unref(data.memblock);
+
+    pa_mempool_free(p);
+}
+END_TEST
+
+static void log_time(const char *what, unsigned n, pa_usec_t t) {
+    pa_log_debug("%s: %0.1f ns per operation", what, (double) t * PA_NSEC_PER_USEC / n);
+}
+
+/* 10s of 1ms blocks of 48kHz stereo S16, i.e. a long queue as used
+ * with large maxrewind/tlength values */
+#define BENCHMARK_BLOCK_SIZE 192
+#define BENCHMARK_N_BLOCKS 10000
+
+START_TEST (memblockq_benchmark) {
+    pa_mempool *p;
+    pa_memblockq *bq;
+    pa_memchunk chunk[2], out;
+    pa_usec_t t;
+    unsigned i, n;
+    size_t length = BENCHMARK_BLOCK_SIZE * BENCHMARK_N_BLOCKS;
+    pa_sample_spec ss = {
+        .format = PA_SAMPLE_S16LE,
+        .rate = 48000,
+        .channels = 2
+    };
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    p = pa_mempool_new(FALSE, 0);
+
+    /* Alternate between two memblocks, so that the pushed chunks
+     * don't get merged */
+    for (i = 0; i < 2; i++) {
+        chunk[i].memblock = pa_memblock_new(p, BENCHMARK_BLOCK_SIZE);
+        chunk[i].index = 0;
+        chunk[i].length = BENCHMARK_BLOCK_SIZE;
+    }
+
+    bq = pa_memblockq_new("benchmark memblockq", 0, 2 * length, length, &ss, 0, 0, length, NULL);
+    fail_unless(bq != NULL);
+
+    for (n = 0; n < 10; n++) {
+
+        t = pa_rtclock_now();
+        for (i = 0; i < BENCHMARK_N_BLOCKS; i++)
+            fail_unless(pa_memblockq_push(bq, &chunk[i % 2]) == 0);
+        log_time("pa_memblockq_push()", BENCHMARK_N_BLOCKS, pa_rtclock_now() - t);
+
+        t = pa_rtclock_now();
+        for (i = 0; i < BENCHMARK_N_BLOCKS; i++) {
+            fail_unless(pa_memblockq_peek(bq, &out) == 0);
+            fail_unless(out.length == BENCHMARK_BLOCK_SIZE);
+            pa_memblock_unref(out.memblock);
+            pa_memblockq_drop(bq, out.length);
+        }
+        log_time("pa_memblockq_peek() + pa_memblockq_drop()", BENCHMARK_N_BLOCKS, pa_rtclock_now() - t);
+
+        /* Now everything is kept for rewinding. Rewind by a varying
+         * amount and peek, which needs to find the block again, then
+         * move forward again (not measured) */
+        t = 0;
+        for (i = 0; i < 1000; i++) {
+            size_t l = ((i * 7919) % BENCHMARK_N_BLOCKS + 1) * BENCHMARK_BLOCK_SIZE;
+            pa_usec_t u;
+
+            u = pa_rtclock_now();
+            pa_memblockq_rewind(bq, l);
+            fail_unless(pa_memblockq_peek(bq, &out) == 0);
+            t += pa_rtclock_now() - u;
+
+            pa_memblock_unref(out.memblock);
+            pa_memblockq_drop(bq, l);
+        }
+        log_time("pa_memblockq_rewind() + pa_memblockq_peek()", 1000, t);
+    }
+
+    pa_memblockq_free(bq);
+    pa_memblock_unref(chunk[0].memblock);
+    pa_memblock_unref(chunk[1].memblock);
+
+    pa_mempool_free(p);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -223,6 +460,11 @@ int main(int argc, char *argv[]) {
     s = suite_create("Memblock Queue");
     tc = tcase_create("memblockq");
     tcase_add_test(tc, memblockq_test);
+    tcase_add_test(tc, memblockq_random_test);
+    suite_add_tcase(s, tc);
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, memblockq_benchmark);
+    tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -28,6 +28,8 @@
 
 #include <pulse/sample.h>
 #include <pulse/volume.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
 
 #include <pulsecore/macro.h>
 #include <pulsecore/endianmacros.h>
@@ -465,6 +467,82 @@ START_TEST (mix_test) {
 }
 END_TEST
 
+#define SCALING_FRAMES 1024
+#define SCALING_MAX_STREAMS 512
+#define SCALING_TIMES 20
+
+/* Mixes 1 to SCALING_MAX_STREAMS inputs into one buffer, the same way
+ * pa_sink_render() does when that many non-silent streams are connected,
+ * and checks that every input actually ends up in the result. Time per
+ * frame and stream should stay roughly constant. */
+START_TEST (mix_scaling_test) {
+    pa_mempool *pool;
+    pa_sample_spec a;
+    pa_mix_info *m;
+    pa_memblock *r;
+    unsigned n, i;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    fail_unless((pool = pa_mempool_new(FALSE, 0)) != NULL, NULL);
+
+    a.format = PA_SAMPLE_S16NE;
+    a.channels = 2;
+    a.rate = 44100;
+
+    m = pa_xnew(pa_mix_info, SCALING_MAX_STREAMS);
+
+    for (i = 0; i < SCALING_MAX_STREAMS; i++) {
+        int16_t *d;
+        unsigned j;
+
+        m[i].chunk.memblock = pa_memblock_new(pool, SCALING_FRAMES * pa_frame_size(&a));
+        m[i].chunk.index = 0;
+        m[i].chunk.length = pa_memblock_get_length(m[i].chunk.memblock);
+        pa_cvolume_reset(&m[i].volume, a.channels);
+        m[i].userdata = NULL;
+
+        d = pa_memblock_acquire(m[i].chunk.memblock);
+        for (j = 0; j < SCALING_FRAMES * a.channels; j++)
+            d[j] = 1;
+        pa_memblock_release(m[i].chunk.memblock);
+    }
+
+    r = pa_memblock_new(pool, SCALING_FRAMES * pa_frame_size(&a));
+
+    for (n = 1; n <= SCALING_MAX_STREAMS; n *= 2) {
+        pa_usec_t start, stop;
+        int16_t *d;
+        unsigned j;
+
+        d = pa_memblock_acquire(r);
+
+        start = pa_rtclock_now();
+        for (j = 0; j < SCALING_TIMES; j++)
+            pa_mix(m, n, d, pa_memblock_get_length(r), &a, NULL, FALSE);
+        stop = pa_rtclock_now();
+
+        for (j = 0; j < SCALING_FRAMES * a.channels; j++)
+            fail_unless(d[j] == (int16_t) n, NULL);
+
+        pa_memblock_release(r);
+
+        pa_log_debug("%3u streams: %llu usec (%g ns per frame and stream)", n,
+                     (unsigned long long) (stop - start),
+                     (double) (stop - start) * 1000.0 / (SCALING_TIMES * SCALING_FRAMES * n));
+    }
+
+    pa_memblock_unref(r);
+
+    for (i = 0; i < SCALING_MAX_STREAMS; i++)
+        pa_memblock_unref(m[i].chunk.memblock);
+
+    pa_xfree(m);
+    pa_mempool_free(pool);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -474,6 +552,7 @@ int main(int argc, char *argv[]) {
     s = suite_create("Mix");
     tc = tcase_create("mix");
     tcase_add_test(tc, mix_test);
+    tcase_add_test(tc, mix_scaling_test);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
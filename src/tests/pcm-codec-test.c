@@ -0,0 +1,412 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/sample.h>
+#include <pulse/xmalloc.h>
+
+#include <pulsecore/endianmacros.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/pcm-codec.h>
+
+#define RATE 48000
+#define BENCHMARK_SECONDS 10
+#define CHUNK_FRAMES 1200
+
+typedef enum signal_type {
+    SIGNAL_MUSIC,
+    SIGNAL_NOISE,
+    SIGNAL_SILENCE
+} signal_type_t;
+
+static pa_mempool *pool = NULL;
+static uint32_t seed = 1;
+
+static uint32_t lcg(void) {
+    return seed = seed * 1103515245 + 12345;
+}
+
+/* Something that looks a bit like music: a few partials per channel
+ * under a slow envelope, plus some noise */
+static int16_t *make_signal(signal_type_t type, const pa_sample_spec *ss, size_t n_frames) {
+    int16_t *d = pa_xnew(int16_t, n_frames * ss->channels);
+    size_t i;
+    unsigned c;
+
+    for (i = 0; i < n_frames; i++)
+        for (c = 0; c < ss->channels; c++) {
+            double t = (double) i / ss->rate, v;
+
+            switch (type) {
+                case SIGNAL_MUSIC:
+                    v = (0.5 + 0.4 * sin(2 * M_PI * 0.7 * t + c)) *
+                        (0.2 * sin(2 * M_PI * (220.0 + 55 * c) * t) +
+                         0.1 * sin(2 * M_PI * (660.0 + 30 * c) * t + 1) +
+                         0.05 * sin(2 * M_PI * 3520.0 * t * (1 + 0.01 * sin(t)))) * 0x7FFF +
+                        (double) (lcg() >> 24) / 32 - 4;
+                    break;
+
+                case SIGNAL_NOISE:
+                    v = (double) (int16_t) (lcg() >> 16);
+                    break;
+
+                default:
+                    v = 0;
+            }
+
+            d[i * ss->channels + c] = (int16_t) v;
+
+            if (ss->format != PA_SAMPLE_S16NE)
+                d[i * ss->channels + c] = PA_INT16_SWAP(d[i * ss->channels + c]);
+        }
+
+    return d;
+}
+
+/* Encodes data in chunks of chunk_frames into one buffer */
+static uint8_t *encode(pa_pcm_codec *c, const int16_t *data, const pa_sample_spec *ss, size_t n_frames, size_t chunk_frames, size_t *length) {
+    size_t fs = pa_frame_size(ss), i, l = 0, size = 0;
+    uint8_t *e = NULL;
+
+    for (i = 0; i < n_frames; i += chunk_frames) {
+        size_t n = PA_MIN(chunk_frames, n_frames - i);
+        pa_memchunk in, out;
+        void *p;
+
+        in.memblock = pa_memblock_new_fixed(pool, (uint8_t*) data + i * fs, n * fs, TRUE);
+        in.index = 0;
+        in.length = n * fs;
+
+        pa_pcm_codec_encode(c, &in, &out);
+        fail_unless(out.length % fs == 0);
+
+        if (l + out.length > size) {
+            size = PA_MAX(l + out.length, 2 * size);
+            e = pa_xrealloc(e, size);
+        }
+
+        p = pa_memblock_acquire(out.memblock);
+        memcpy(e + l, (uint8_t*) p + out.index, out.length);
+        pa_memblock_release(out.memblock);
+        l += out.length;
+
+        pa_memblock_unref(out.memblock);
+        pa_memblock_unref(in.memblock);
+    }
+
+    *length = l;
+    return e;
+}
+
+/* Decodes the buffer in pieces of random size up to max_piece, or
+ * all at once if max_piece is 0. Returns the decoded length. */
+static size_t decode(pa_pcm_codec *c, const uint8_t *e, size_t length, size_t max_piece, int16_t *data, size_t size, int *ret) {
+    size_t i, l = 0, n;
+
+    *ret = 0;
+
+    for (i = 0; i < length; i += n) {
+        pa_memchunk in, out;
+
+        n = max_piece ? PA_MIN(1 + lcg() % max_piece, length - i) : length;
+
+        in.memblock = pa_memblock_new_fixed(pool, (uint8_t*) e + i, n, TRUE);
+        in.index = 0;
+        in.length = n;
+
+        if (pa_pcm_codec_decode(c, &in, &out) < 0)
+            *ret = -1;
+
+        if (out.memblock) {
+            void *p;
+
+            fail_unless(l + out.length <= size);
+
+            p = pa_memblock_acquire(out.memblock);
+            memcpy((uint8_t*) data + l, (uint8_t*) p + out.index, out.length);
+            pa_memblock_release(out.memblock);
+            l += out.length;
+
+            pa_memblock_unref(out.memblock);
+        }
+
+        pa_memblock_unref(in.memblock);
+    }
+
+    return l;
+}
+
+static double snr(const int16_t *a, const int16_t *b, size_t n, pa_bool_t swap) {
+    double s = 0, e = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        double x = swap ? PA_INT16_SWAP(a[i]) : a[i];
+        double y = swap ? PA_INT16_SWAP(b[i]) : b[i];
+
+        s += x * x;
+        e += (x - y) * (x - y);
+    }
+
+    return 10 * log10(s / PA_MAX(e, 1.0));
+}
+
+START_TEST (lossless_test) {
+    static const pa_sample_format_t formats[] = { PA_SAMPLE_S16LE, PA_SAMPLE_S16BE };
+    static const unsigned channels[] = { 1, 2, 6 };
+    static const size_t chunk_frames[] = { 1, 3, 1200, 2049, 5000 };
+    unsigned f, c, t, k;
+
+    for (f = 0; f < PA_ELEMENTSOF(formats); f++)
+        for (c = 0; c < PA_ELEMENTSOF(channels); c++)
+            for (t = SIGNAL_MUSIC; t <= SIGNAL_SILENCE; t++) {
+                pa_sample_spec ss;
+                size_t n_frames = RATE / 4, length, l;
+                int16_t *data, *decoded;
+                uint8_t *e;
+                int ret;
+
+                ss.format = formats[f];
+                ss.rate = RATE;
+                ss.channels = (uint8_t) channels[c];
+
+                data = make_signal(t, &ss, n_frames);
+                decoded = pa_xnew(int16_t, n_frames * ss.channels);
+
+                for (k = 0; k < PA_ELEMENTSOF(chunk_frames); k++) {
+                    pa_pcm_codec *enc, *dec;
+
+                    /* Single frame chunks take long enough for one case */
+                    if (chunk_frames[k] == 1 && (c > 0 || t > 0))
+                        continue;
+
+                    fail_unless((enc = pa_pcm_codec_new(PA_PCM_CODEC_LOSSLESS, &ss, pool)) != NULL);
+                    fail_unless((dec = pa_pcm_codec_new(PA_PCM_CODEC_LOSSLESS, &ss, pool)) != NULL);
+
+                    e = encode(enc, data, &ss, n_frames, chunk_frames[k], &length);
+                    memset(decoded, 0x55, n_frames * pa_frame_size(&ss));
+                    l = decode(dec, e, length, 700, decoded, n_frames * pa_frame_size(&ss), &ret);
+
+                    fail_unless(ret == 0);
+                    fail_unless(l == n_frames * pa_frame_size(&ss));
+                    fail_unless(memcmp(data, decoded, l) == 0);
+
+                    if (chunk_frames[k] == CHUNK_FRAMES)
+                        pa_log_debug("%s, %u channels, signal %u: ratio %0.2f",
+                                     pa_sample_format_to_string(ss.format), ss.channels, t, (double) l / length);
+
+                    /* Noise must not grow by more than the headers */
+                    if (chunk_frames[k] >= CHUNK_FRAMES)
+                        fail_unless(length <= l + l / 20 + 64);
+
+                    pa_xfree(e);
+                    pa_pcm_codec_free(enc);
+                    pa_pcm_codec_free(dec);
+                }
+
+                pa_xfree(data);
+                pa_xfree(decoded);
+            }
+}
+END_TEST
+
+START_TEST (adpcm_test) {
+    pa_sample_spec ss;
+    pa_pcm_codec *enc, *dec;
+    size_t n_frames = RATE, length, l;
+    int16_t *data, *decoded;
+    uint8_t *e;
+    double s;
+    int ret;
+
+    ss.format = PA_SAMPLE_S16BE;
+    ss.rate = RATE;
+    ss.channels = 2;
+
+    data = make_signal(SIGNAL_MUSIC, &ss, n_frames);
+    decoded = pa_xnew(int16_t, n_frames * ss.channels);
+
+    fail_unless((enc = pa_pcm_codec_new(PA_PCM_CODEC_ADPCM, &ss, pool)) != NULL);
+    fail_unless((dec = pa_pcm_codec_new(PA_PCM_CODEC_ADPCM, &ss, pool)) != NULL);
+
+    e = encode(enc, data, &ss, n_frames, CHUNK_FRAMES, &length);
+    l = decode(dec, e, length, 333, decoded, n_frames * pa_frame_size(&ss), &ret);
+
+    fail_unless(ret == 0);
+    fail_unless(l == n_frames * pa_frame_size(&ss));
+
+    s = snr(data, decoded, n_frames * ss.channels, ss.format != PA_SAMPLE_S16NE);
+    pa_log_debug("ADPCM: ratio %0.2f, SNR %0.1f dB", (double) l / length, s);
+
+    fail_unless(length * 3 < l);
+    fail_unless(s > 20);
+
+    pa_xfree(e);
+    pa_xfree(data);
+    pa_xfree(decoded);
+    pa_pcm_codec_free(enc);
+    pa_pcm_codec_free(dec);
+}
+END_TEST
+
+START_TEST (resync_test) {
+    static const char garbage[] = "PC garbage PCPCP";
+    pa_sample_spec ss;
+    pa_pcm_codec *enc, *dec;
+    size_t n_frames = 3000, length, first, l, fs;
+    int16_t *data, *decoded;
+    uint8_t *e, *broken;
+    int ret;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = RATE;
+    ss.channels = 2;
+    fs = pa_frame_size(&ss);
+
+    data = make_signal(SIGNAL_MUSIC, &ss, n_frames);
+    decoded = pa_xnew(int16_t, n_frames * ss.channels);
+
+    fail_unless((enc = pa_pcm_codec_new(PA_PCM_CODEC_LOSSLESS, &ss, pool)) != NULL);
+    fail_unless((dec = pa_pcm_codec_new(PA_PCM_CODEC_LOSSLESS, &ss, pool)) != NULL);
+
+    /* Garbage between the two packets is skipped */
+    pa_xfree(encode(enc, data, &ss, 1000, 1000, &first));
+    e = encode(enc, data, &ss, n_frames, 1000, &length);
+
+    broken = pa_xmalloc(length + sizeof(garbage));
+    memcpy(broken, e, first);
+    memcpy(broken + first, garbage, sizeof(garbage));
+    memcpy(broken + first + sizeof(garbage), e + first, length - first);
+
+    l = decode(dec, broken, length + sizeof(garbage), 100, decoded, n_frames * fs, &ret);
+
+    fail_unless(ret < 0);
+    fail_unless(l == n_frames * fs);
+    fail_unless(memcmp(data, decoded, l) == 0);
+
+    /* A broken payload turns into silence of the same length */
+    memcpy(broken, e, length);
+    memset(broken + first + 16, 0xFF, 64);
+
+    l = decode(dec, broken, length, 0, decoded, n_frames * fs, &ret);
+
+    fail_unless(l == n_frames * fs);
+    fail_unless(memcmp(data, decoded, 1000 * fs) == 0);
+    fail_unless(memcmp((uint8_t*) data + 2000 * fs, (uint8_t*) decoded + 2000 * fs, 1000 * fs) == 0);
+
+    pa_xfree(broken);
+    pa_xfree(e);
+    pa_xfree(data);
+    pa_xfree(decoded);
+    pa_pcm_codec_free(enc);
+    pa_pcm_codec_free(dec);
+}
+END_TEST
+
+START_TEST (benchmark_test) {
+    static const unsigned channels[] = { 2, 6 };
+    pa_pcm_codec_type_t type;
+    unsigned c;
+
+    for (type = PA_PCM_CODEC_LOSSLESS; type < PA_PCM_CODEC_MAX; type++)
+        for (c = 0; c < PA_ELEMENTSOF(channels); c++) {
+            pa_sample_spec ss;
+            pa_pcm_codec *enc, *dec;
+            size_t n_frames = RATE * BENCHMARK_SECONDS, length, l;
+            int16_t *data, *decoded;
+            pa_usec_t t0, t1, t2;
+            uint8_t *e;
+            int ret;
+
+            ss.format = PA_SAMPLE_S16LE;
+            ss.rate = RATE;
+            ss.channels = (uint8_t) channels[c];
+
+            data = make_signal(SIGNAL_MUSIC, &ss, n_frames);
+            decoded = pa_xnew(int16_t, n_frames * ss.channels);
+
+            enc = pa_pcm_codec_new(type, &ss, pool);
+            dec = pa_pcm_codec_new(type, &ss, pool);
+
+            t0 = pa_rtclock_now();
+            e = encode(enc, data, &ss, n_frames, CHUNK_FRAMES, &length);
+            t1 = pa_rtclock_now();
+            l = decode(dec, e, length, 4096, decoded, n_frames * pa_frame_size(&ss), &ret);
+            t2 = pa_rtclock_now();
+
+            fail_unless(ret == 0);
+            fail_unless(l == n_frames * pa_frame_size(&ss));
+
+            pa_log_info("%s, %u channels: ratio %0.2f, encoding %0.1f ns/frame, decoding %0.1f ns/frame",
+                        pa_pcm_codec_type_to_string(type), ss.channels, (double) l / length,
+                        (double) (t1 - t0) * 1000 / n_frames, (double) (t2 - t1) * 1000 / n_frames);
+
+            pa_xfree(e);
+            pa_xfree(data);
+            pa_xfree(decoded);
+            pa_pcm_codec_free(enc);
+            pa_pcm_codec_free(dec);
+        }
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    pool = pa_mempool_new(FALSE, 0);
+
+    s = suite_create("PCM Codec");
+    tc = tcase_create("pcm-codec");
+    tcase_add_test(tc, lossless_test);
+    tcase_add_test(tc, adpcm_test);
+    tcase_add_test(tc, resync_test);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("pcm-codec-benchmark");
+    tcase_add_test(tc, benchmark_test);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    pa_mempool_free(pool);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
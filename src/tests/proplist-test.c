@@ -26,11 +26,15 @@
 #include <check.h>
 
 #include <pulse/proplist.h>
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 #include <pulsecore/macro.h>
 #include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
 #include <pulsecore/modargs.h>
 
+#define N_BENCHMARK_ROUNDS 100000
+
 START_TEST (proplist_test) {
     pa_modargs *ma;
     pa_proplist *a, *b, *c, *d;
@@ -98,6 +102,137 @@ START_TEST (proplist_test) {
 }
 END_TEST
 
+START_TEST (proplist_many_test) {
+    pa_proplist *a, *b;
+    const char *k;
+    void *state;
+    char key[32], value[32];
+    unsigned i, n;
+    char *s;
+
+    a = pa_proplist_new();
+
+    /* Other keys, added in no particular order, and then a few well
+     * known ones */
+    for (i = 0; i < 500; i++) {
+        unsigned j = (i * 7919) % 500;
+
+        pa_snprintf(key, sizeof(key), "test.%u", j);
+        pa_snprintf(value, sizeof(value), "%u", j);
+        fail_unless(pa_proplist_sets(a, key, value) == 0);
+    }
+
+    fail_unless(pa_proplist_sets(a, PA_PROP_MEDIA_NAME, "foo") == 0);
+    fail_unless(pa_proplist_sets(a, PA_PROP_APPLICATION_NAME, "bar") == 0);
+    fail_unless(pa_proplist_sets(a, PA_PROP_MEDIA_NAME, "waldo") == 0);
+    fail_unless(pa_proplist_size(a) == 502);
+
+    for (i = 0; i < 500; i++) {
+        pa_snprintf(key, sizeof(key), "test.%u", i);
+        pa_snprintf(value, sizeof(value), "%u", i);
+        fail_unless(pa_streq(pa_strnull(pa_proplist_gets(a, key)), value));
+    }
+    fail_unless(pa_streq(pa_strnull(pa_proplist_gets(a, PA_PROP_MEDIA_NAME)), "waldo"));
+    fail_unless(!pa_proplist_gets(a, "test.500"));
+
+    /* Changing values while iterating */
+    n = 0;
+    state = NULL;
+    while ((k = pa_proplist_iterate(a, &state))) {
+        fail_unless(pa_proplist_sets(a, k, "changed") == 0);
+        n++;
+    }
+    fail_unless(n == 502);
+    fail_unless(pa_streq(pa_strnull(pa_proplist_gets(a, "test.0")), "changed"));
+
+    /* Removing the current entry while iterating */
+    n = 0;
+    state = NULL;
+    while ((k = pa_proplist_iterate(a, &state))) {
+        if (n++ % 2 == 0)
+            fail_unless(pa_proplist_unset(a, k) == 0);
+    }
+    fail_unless(n == 502);
+    fail_unless(pa_proplist_size(a) == 251);
+    fail_unless(pa_proplist_unset(a, "test.500") == -2);
+
+    n = 0;
+    state = NULL;
+    while ((k = pa_proplist_iterate(a, &state)))
+        n++;
+    fail_unless(n == 251);
+
+    b = pa_proplist_copy(a);
+    fail_unless(pa_proplist_equal(a, b));
+
+    fail_unless(pa_proplist_sets(b, "test.new", "x") == 0);
+    fail_unless(!pa_proplist_equal(a, b));
+    fail_unless(pa_proplist_size(b) == 252);
+
+    pa_proplist_update(a, PA_UPDATE_MERGE, b);
+    fail_unless(pa_proplist_equal(a, b));
+
+    s = pa_proplist_to_string(a);
+    pa_proplist_free(b);
+    fail_unless((b = pa_proplist_from_string(s)) != NULL);
+    fail_unless(pa_proplist_equal(a, b));
+    pa_xfree(s);
+
+    pa_proplist_clear(a);
+    fail_unless(pa_proplist_isempty(a));
+    pa_proplist_update(a, PA_UPDATE_REPLACE, b);
+    fail_unless(pa_proplist_equal(a, b));
+
+    pa_proplist_free(a);
+    pa_proplist_free(b);
+}
+END_TEST
+
+START_TEST (proplist_benchmark) {
+    static const char * const keys[] = {
+        PA_PROP_MEDIA_NAME, PA_PROP_MEDIA_ROLE, PA_PROP_APPLICATION_NAME,
+        PA_PROP_APPLICATION_ID, PA_PROP_APPLICATION_ICON_NAME,
+        PA_PROP_APPLICATION_VERSION, PA_PROP_APPLICATION_LANGUAGE,
+        PA_PROP_APPLICATION_PROCESS_ID, PA_PROP_APPLICATION_PROCESS_BINARY,
+        PA_PROP_APPLICATION_PROCESS_USER, PA_PROP_APPLICATION_PROCESS_HOST,
+        PA_PROP_APPLICATION_PROCESS_MACHINE_ID, PA_PROP_APPLICATION_PROCESS_SESSION_ID,
+        PA_PROP_WINDOW_X11_DISPLAY, PA_PROP_WINDOW_NAME, PA_PROP_WINDOW_ID,
+        PA_PROP_MEDIA_ICON_NAME, PA_PROP_FILTER_WANT,
+        PA_PROP_DEVICE_DESCRIPTION, PA_PROP_DEVICE_CLASS, PA_PROP_DEVICE_API,
+        "native-protocol.peer", "native-protocol.version", "stream-restore.id",
+        NULL
+    };
+    pa_proplist *client, *stream;
+    pa_usec_t t;
+    unsigned i;
+
+    client = pa_proplist_new();
+    for (i = 0; keys[i]; i++)
+        pa_proplist_setf(client, keys[i], "some value %u", i);
+
+    stream = pa_proplist_new();
+    pa_proplist_sets(stream, PA_PROP_MEDIA_NAME, "Playback Stream");
+    pa_proplist_sets(stream, PA_PROP_MEDIA_ROLE, "music");
+
+    /* What happens to the proplists when a stream is created */
+    t = pa_rtclock_now();
+    for (i = 0; i < N_BENCHMARK_ROUNDS; i++) {
+        pa_proplist *p;
+
+        p = pa_proplist_copy(stream);
+        pa_proplist_update(p, PA_UPDATE_MERGE, client);
+        fail_unless(pa_proplist_gets(p, PA_PROP_APPLICATION_NAME) != NULL);
+        pa_proplist_free(p);
+    }
+
+    pa_log_debug("%u rounds of copying and merging proplists with %u entries took %llu usec",
+                 N_BENCHMARK_ROUNDS, pa_proplist_size(client), (unsigned long long) (pa_rtclock_now() - t));
+
+    pa_proplist_free(client);
+    pa_proplist_free(stream);
+}
+END_TEST
+
 int main(int argc, char *argv[]) {
     int failed = 0;
     Suite *s;
@@ -110,6 +245,12 @@ int main(int argc, char *argv[]) {
     s = suite_create("Property List");
     tc = tcase_create("propertylist");
     tcase_add_test(tc, proplist_test);
+    tcase_add_test(tc, proplist_many_test);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, proplist_benchmark);
+    tcase_set_timeout(tc, 120);
     suite_add_tcase(s, tc);
 
     sr = srunner_create(s);
@@ -0,0 +1,334 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/socket.h>
+#include <pulsecore/pstream.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_FRAMES 2000
+#define N_BENCHMARK_PACKETS 100000
+#define N_BENCHMARK_MEMBLOCKS 10000
+
+struct test_state {
+    pa_mainloop *m;
+    pa_mempool *pool;
+    pa_pstream *sender, *receiver;
+
+    unsigned n_packets, n_memblocks;
+    unsigned expected_packets;
+    size_t expected_bytes, received_bytes;
+    pa_bool_t verify, with_creds;
+};
+
+static void log_time(const char *what, unsigned n, pa_usec_t t) {
+    pa_log_debug("%s: %u frames in %llu usec (%0.1f frames/ms)", what, n, (unsigned long long) t, (double) n * PA_USEC_PER_MSEC / PA_MAX(t, (pa_usec_t) 1));
+}
+
+static pa_bool_t is_done(struct test_state *s) {
+    return s->n_packets == s->expected_packets && s->received_bytes == s->expected_bytes;
+}
+
+static void run(struct test_state *s) {
+    while (!is_done(s))
+        fail_unless(pa_mainloop_iterate(s->m, 1, NULL) >= 0);
+}
+
+static void packet_cb(pa_pstream *p, pa_packet *packet, const pa_cmsg_ancil_data *ancil_data, void *userdata) {
+    struct test_state *s = userdata;
+
+    if (s->verify) {
+        unsigned i;
+        size_t j;
+
+        fail_unless(packet->length >= sizeof(uint32_t));
+        memcpy(&i, packet->data, sizeof(uint32_t));
+
+        /* Frames must arrive in the order they were sent */
+        fail_unless(i == s->n_packets + s->n_memblocks);
+        fail_unless(packet->length == sizeof(uint32_t) + i % 100);
+
+        for (j = sizeof(uint32_t); j < packet->length; j++)
+            fail_unless(packet->data[j] == (uint8_t) i);
+
+#ifdef HAVE_CREDS
+        if (s->with_creds && i % 13 == 0) {
+            fail_unless(ancil_data != NULL);
+            fail_unless(ancil_data->creds_valid);
+            fail_unless(ancil_data->creds.uid == getuid());
+        }
+#endif
+    }
+
+    s->n_packets++;
+}
+
+static void memblock_cb(pa_pstream *p, uint32_t channel, int64_t offset, pa_seek_mode_t seek, const pa_memchunk *chunk, void *userdata) {
+    struct test_state *s = userdata;
+
+    if (s->verify) {
+        const uint8_t *d;
+        size_t j;
+
+        /* Memblock frames may be delivered in pieces, so we only count
+         * a frame once its last byte was received */
+        fail_unless(channel == s->n_packets + s->n_memblocks);
+
+        d = pa_memblock_acquire_chunk(chunk);
+        for (j = 0; j < chunk->length; j++)
+            fail_unless(d[j] == (uint8_t) (channel + chunk->index + j));
+        pa_memblock_release(chunk->memblock);
+
+        if (chunk->index + chunk->length == pa_memblock_get_length(chunk->memblock))
+            s->n_memblocks++;
+    }
+
+    s->received_bytes += chunk->length;
+}
+
+static void die_cb(pa_pstream *p, void *userdata) {
+    fail_unless(FALSE, "pstream died");
+}
+
+static void setup(struct test_state *s, pa_bool_t use_srb) {
+    int fds[2];
+    pa_iochannel *io;
+
+    pa_zero(*s);
+
+    fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+
+    s->m = pa_mainloop_new();
+    fail_unless(s->m != NULL);
+
+    s->pool = pa_mempool_new(FALSE, 0);
+    fail_unless(s->pool != NULL);
+
+    s->sender = pa_pstream_new(pa_mainloop_get_api(s->m), pa_iochannel_new(pa_mainloop_get_api(s->m), fds[0], fds[0]), s->pool);
+
+    io = pa_iochannel_new(pa_mainloop_get_api(s->m), fds[1], fds[1]);
+#ifdef HAVE_CREDS
+    fail_unless(pa_iochannel_creds_enable(io) == 0);
+#endif
+    s->receiver = pa_pstream_new(pa_mainloop_get_api(s->m), io, s->pool);
+
+    pa_pstream_set_die_callback(s->sender, die_cb, s);
+    pa_pstream_set_die_callback(s->receiver, die_cb, s);
+    pa_pstream_set_receive_packet_callback(s->receiver, packet_cb, s);
+    pa_pstream_set_receive_memblock_callback(s->receiver, memblock_cb, s);
+
+    if (use_srb) {
+        pa_srbchannel *srb;
+        pa_srbchannel_template t;
+
+        srb = pa_srbchannel_new(pa_mainloop_get_api(s->m));
+        fail_unless(srb != NULL);
+
+        pa_srbchannel_export(srb, &t);
+        pa_pstream_set_srbchannel(s->receiver, pa_srbchannel_new_from_template(pa_mainloop_get_api(s->m), &t));
+        pa_pstream_set_srbchannel(s->sender, srb);
+    }
+}
+
+static void teardown(struct test_state *s) {
+    pa_pstream_unlink(s->sender);
+    pa_pstream_unref(s->sender);
+    pa_pstream_unlink(s->receiver);
+    pa_pstream_unref(s->receiver);
+    pa_mempool_free(s->pool);
+    pa_mainloop_free(s->m);
+}
+
+static void send_packet(struct test_state *s, unsigned i, size_t extra, pa_bool_t with_creds) {
+    pa_packet *packet;
+
+    packet = pa_packet_new(sizeof(uint32_t) + extra);
+    memcpy(packet->data, &i, sizeof(uint32_t));
+    memset(packet->data + sizeof(uint32_t), (uint8_t) i, extra);
+
+#ifdef HAVE_CREDS
+    if (with_creds) {
+        pa_cmsg_ancil_data a;
+
+        pa_zero(a);
+        a.creds.uid = getuid();
+        a.creds.gid = getgid();
+        a.creds_valid = TRUE;
+        pa_pstream_send_packet(s->sender, packet, &a);
+    } else
+#endif
+        pa_pstream_send_packet(s->sender, packet, NULL);
+
+    pa_packet_unref(packet);
+    s->expected_packets++;
+}
+
+static void send_memblock(struct test_state *s, unsigned channel, size_t length) {
+    pa_memchunk chunk;
+    uint8_t *d;
+    size_t j;
+
+    chunk.memblock = pa_memblock_new(s->pool, length);
+    chunk.index = 0;
+    chunk.length = pa_memblock_get_length(chunk.memblock);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (j = 0; j < chunk.length; j++)
+        d[j] = (uint8_t) (channel + j);
+    pa_memblock_release(chunk.memblock);
+
+    pa_pstream_send_memblock(s->sender, channel, 0, PA_SEEK_RELATIVE, &chunk);
+    pa_memblock_unref(chunk.memblock);
+
+    s->expected_bytes += chunk.length;
+}
+
+static void send_frames(struct test_state *s, pa_bool_t with_creds) {
+    unsigned i;
+
+    s->with_creds = with_creds;
+
+    /* A mix of small packets, some of them with credentials, and
+     * memblocks up to the maximum size, which won't fit into the
+     * socket buffer in one go */
+    for (i = 0; i < N_FRAMES; i++) {
+        if (i % 7 == 3)
+            send_memblock(s, i, i % 49 == 3 ? pa_mempool_block_size_max(s->pool) : 64 + i);
+        else
+            send_packet(s, i, i % 100, with_creds && i % 13 == 0);
+    }
+}
+
+START_TEST (pstream_test) {
+    struct test_state s;
+
+    setup(&s, FALSE);
+    s.verify = TRUE;
+
+    send_frames(&s, TRUE);
+
+    fail_unless(pa_pstream_is_pending(s.sender));
+
+    run(&s);
+
+    fail_unless(s.n_packets + s.n_memblocks == N_FRAMES);
+    fail_unless(s.received_bytes == s.expected_bytes);
+    fail_unless(!pa_pstream_is_pending(s.sender));
+
+    teardown(&s);
+}
+END_TEST
+
+START_TEST (pstream_srb_test) {
+    struct test_state s;
+
+    setup(&s, TRUE);
+    s.verify = TRUE;
+
+    /* Frames with credentials still go over the socket and are hence
+     * not ordered with respect to the ones in the ring buffer */
+    send_frames(&s, FALSE);
+
+    fail_unless(pa_pstream_is_pending(s.sender));
+
+    run(&s);
+
+    fail_unless(s.n_packets + s.n_memblocks == N_FRAMES);
+    fail_unless(s.received_bytes == s.expected_bytes);
+    fail_unless(!pa_pstream_is_pending(s.sender));
+
+    teardown(&s);
+}
+END_TEST
+
+static void benchmark(pa_bool_t use_srb) {
+    struct test_state s;
+    pa_usec_t t;
+    unsigned i;
+
+    setup(&s, use_srb);
+
+    pa_log_debug("%s:", use_srb ? "Ring buffer" : "Socket");
+
+    t = pa_rtclock_now();
+    for (i = 0; i < N_BENCHMARK_PACKETS; i++)
+        send_packet(&s, i, 28, FALSE);
+    run(&s);
+    log_time("32 byte packets", N_BENCHMARK_PACKETS, pa_rtclock_now() - t);
+
+    fail_unless(s.n_packets == N_BENCHMARK_PACKETS);
+
+    t = pa_rtclock_now();
+    for (i = 0; i < N_BENCHMARK_MEMBLOCKS; i++)
+        send_memblock(&s, i, 4096);
+    run(&s);
+    log_time("4 KiB memblocks", N_BENCHMARK_MEMBLOCKS, pa_rtclock_now() - t);
+
+    fail_unless(s.received_bytes == s.expected_bytes);
+
+    teardown(&s);
+}
+
+START_TEST (pstream_benchmark) {
+    benchmark(FALSE);
+    benchmark(TRUE);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Pstream");
+    tc = tcase_create("pstream");
+    tcase_add_test(tc, pstream_test);
+    tcase_add_test(tc, pstream_srb_test);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, pstream_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
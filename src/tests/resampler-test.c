@@ -22,6 +22,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <getopt.h>
 #include <locale.h>
 
@@ -253,6 +254,152 @@ static pa_memblock* generate_block(pa_mempool *pool, const pa_sample_spec *ss) {
     return r;
 }
 
+/* Random-ish test signal in format ss, made by converting s16 */
+static pa_memblock* generate_noise(pa_mempool *pool, const pa_sample_spec *ss, unsigned n_frames) {
+    pa_sample_spec s16;
+    pa_resampler *convert;
+    pa_memchunk i, j;
+    int16_t *d;
+    unsigned k;
+    uint32_t x = 4711;
+
+    s16 = *ss;
+    s16.format = PA_SAMPLE_S16NE;
+
+    i.memblock = pa_memblock_new(pool, n_frames * pa_frame_size(&s16));
+    i.length = pa_memblock_get_length(i.memblock);
+    i.index = 0;
+
+    d = pa_memblock_acquire(i.memblock);
+    for (k = 0; k < n_frames * s16.channels; k++) {
+        x = x * 1103515245 + 12345;
+        d[k] = (int16_t) (x >> 16);
+    }
+    pa_memblock_release(i.memblock);
+
+    if (ss->format == PA_SAMPLE_S16NE)
+        return i.memblock;
+
+    pa_assert_se(convert = pa_resampler_new(pool, &s16, NULL, ss, NULL, PA_RESAMPLER_COPY, 0));
+    pa_resampler_run(convert, &i, &j);
+    pa_resampler_free(convert);
+    pa_memblock_unref(i.memblock);
+
+    pa_assert(j.index == 0);
+    return j.memblock;
+}
+
+/* Runs the input through r in pieces of different sizes, and returns
+ * everything that came out */
+static uint8_t* run_in_pieces(pa_resampler *r, const pa_memchunk *in, size_t *length) {
+    static const unsigned piece_frames[] = { 1, 7, 4096, 333, 2000, 64, 10000 };
+    size_t fs = pa_frame_size(pa_resampler_input_sample_spec(r));
+    pa_memchunk piece, out;
+    uint8_t *buf = NULL;
+    unsigned k = 0;
+
+    *length = 0;
+    piece = *in;
+
+    while (piece.index < in->index + in->length) {
+        void *d;
+
+        piece.length = PA_MIN(piece_frames[k++ % PA_ELEMENTSOF(piece_frames)] * fs, in->index + in->length - piece.index);
+        pa_resampler_run(r, &piece, &out);
+        piece.index += piece.length;
+
+        if (!out.memblock)
+            continue;
+
+        buf = pa_xrealloc(buf, *length + out.length);
+        d = pa_memblock_acquire_chunk(&out);
+        memcpy(buf + *length, d, out.length);
+        pa_memblock_release(out.memblock);
+        pa_memblock_unref(out.memblock);
+
+        *length += out.length;
+    }
+
+    return buf;
+}
+
+/* The conversion steps are normally run tile by tile (fused), this
+ * checks that the result is the same as when running them one after
+ * another on the whole chunk */
+static pa_bool_t check_fused(pa_mempool *pool) {
+    static const struct {
+        pa_sample_format_t from_format, to_format;
+        uint8_t from_channels, to_channels;
+        uint32_t from_rate, to_rate;
+    } cases[] = {
+        { PA_SAMPLE_S16LE, PA_SAMPLE_S16LE, 2, 2, 44100, 48000 },
+        { PA_SAMPLE_S16LE, PA_SAMPLE_FLOAT32LE, 2, 2, 44100, 48000 },
+        { PA_SAMPLE_FLOAT32LE, PA_SAMPLE_S16LE, 6, 2, 48000, 44100 },
+        { PA_SAMPLE_U8, PA_SAMPLE_S16LE, 1, 2, 22050, 44100 },
+        { PA_SAMPLE_S32LE, PA_SAMPLE_FLOAT32LE, 2, 6, 44100, 48000 },
+        { PA_SAMPLE_S16LE, PA_SAMPLE_ULAW, 6, 1, 44100, 44100 },
+        { PA_SAMPLE_FLOAT32LE, PA_SAMPLE_S16LE, 2, 2, 48000, 48000 },
+    };
+    pa_bool_t good = TRUE;
+    unsigned c;
+    int m;
+
+    for (c = 0; c < PA_ELEMENTSOF(cases); c++) {
+        pa_sample_spec a, b;
+        pa_memchunk in;
+
+        a.format = cases[c].from_format;
+        a.channels = cases[c].from_channels;
+        a.rate = cases[c].from_rate;
+        b.format = cases[c].to_format;
+        b.channels = cases[c].to_channels;
+        b.rate = cases[c].to_rate;
+
+        /* Enough to need several tiles per piece */
+        in.memblock = generate_noise(pool, &a, 40000);
+        in.length = pa_memblock_get_length(in.memblock);
+        in.index = 0;
+
+        for (m = 0; m < PA_RESAMPLER_MAX; m++) {
+            pa_resampler *fused, *unfused;
+            uint8_t *f, *u;
+            size_t f_length, u_length;
+
+            if (!pa_resample_method_supported(m))
+                continue;
+
+            /* Peaks can only reduce the rate */
+            if (m == PA_RESAMPLER_PEAKS && a.rate < b.rate)
+                continue;
+
+            if (!(fused = pa_resampler_new(pool, &a, NULL, &b, NULL, m, 0)))
+                continue;
+
+            pa_assert_se(unfused = pa_resampler_new(pool, &a, NULL, &b, NULL, m, PA_RESAMPLER_NO_FUSE));
+
+            f = run_in_pieces(fused, &in, &f_length);
+            u = run_in_pieces(unfused, &in, &u_length);
+
+            if (f_length != u_length || (f_length > 0 && memcmp(f, u, f_length) != 0)) {
+                pa_log_error("Fused and unfused output differ for %d Hz %d ch (%s) -> %d Hz %d ch (%s) with %s.",
+                             a.rate, a.channels, pa_sample_format_to_string(a.format),
+                             b.rate, b.channels, pa_sample_format_to_string(b.format),
+                             pa_resample_method_to_string(m));
+                good = FALSE;
+            }
+
+            pa_xfree(f);
+            pa_xfree(u);
+            pa_resampler_free(fused);
+            pa_resampler_free(unfused);
+        }
+
+        pa_memblock_unref(in.memblock);
+    }
+
+    return good;
+}
+
 static void help(const char *argv0) {
     printf(_("%s [options]\n\n"
              "-h, --help                            Show this help\n"
@@ -265,6 +412,7 @@ static void help(const char *argv0) {
              "      --to-channels=CHANNELS          To number of channels (defaults to 1)\n"
              "      --resample-method=METHOD        Resample method (defaults to auto)\n"
              "      --seconds=SECONDS               From stream duration (defaults to 60)\n"
+             "      --benchmark                     Measure common 44100 Hz -> 48000 Hz conversions\n"
              "\n"
              "If the formats are not specified, the test performs all formats combinations,\n"
              "back and forth.\n"
@@ -286,7 +434,8 @@ enum {
     ARG_TO_CHANNELS,
     ARG_SECONDS,
     ARG_RESAMPLE_METHOD,
-    ARG_DUMP_RESAMPLE_METHODS
+    ARG_DUMP_RESAMPLE_METHODS,
+    ARG_BENCHMARK
 };
 
 static void dump_resample_methods(void) {
@@ -298,11 +447,67 @@ static void dump_resample_methods(void) {
 
 }
 
+static void run_benchmark(pa_mempool *pool, pa_resample_method_t method, int seconds) {
+    static const struct {
+        pa_sample_format_t from_format, to_format;
+        uint8_t from_channels, to_channels;
+    } cases[] = {
+        { PA_SAMPLE_S16LE, PA_SAMPLE_S16LE, 2, 2 },
+        { PA_SAMPLE_S16LE, PA_SAMPLE_FLOAT32LE, 2, 2 },
+        { PA_SAMPLE_FLOAT32LE, PA_SAMPLE_FLOAT32LE, 2, 2 },
+        { PA_SAMPLE_S16LE, PA_SAMPLE_S16LE, 6, 6 },
+        { PA_SAMPLE_FLOAT32LE, PA_SAMPLE_FLOAT32LE, 6, 6 },
+        { PA_SAMPLE_S16LE, PA_SAMPLE_S16LE, 6, 2 },
+    };
+    unsigned c;
+
+    for (c = 0; c < PA_ELEMENTSOF(cases); c++) {
+        pa_sample_spec a, b;
+        pa_resampler *resampler;
+        pa_memchunk i, j;
+        pa_usec_t ts;
+        unsigned n, blocks;
+
+        a.format = cases[c].from_format;
+        a.rate = 44100;
+        a.channels = cases[c].from_channels;
+        b.format = cases[c].to_format;
+        b.rate = 48000;
+        b.channels = cases[c].to_channels;
+
+        pa_assert_se(resampler = pa_resampler_new(pool, &a, NULL, &b, NULL, method, 0));
+
+        /* 20ms blocks, as a sink input would typically see them */
+        i.memblock = pa_memblock_new(pool, pa_usec_to_bytes(20 * PA_USEC_PER_MSEC, &a));
+        i.length = pa_memblock_get_length(i.memblock);
+        i.index = 0;
+        pa_silence_memblock(i.memblock, &a);
+
+        blocks = (unsigned) seconds * 50;
+
+        ts = pa_rtclock_now();
+        for (n = 0; n < blocks; n++) {
+            pa_resampler_run(resampler, &i, &j);
+            if (j.memblock)
+                pa_memblock_unref(j.memblock);
+        }
+        ts = pa_rtclock_now() - ts;
+
+        pa_log_info("%d Hz %d ch (%s) -> %d Hz %d ch (%s): %0.2f ns/frame",
+                    a.rate, a.channels, pa_sample_format_to_string(a.format),
+                    b.rate, b.channels, pa_sample_format_to_string(b.format),
+                    (double) ts * PA_NSEC_PER_USEC / ((double) blocks * (i.length / pa_frame_size(&a))));
+
+        pa_memblock_unref(i.memblock);
+        pa_resampler_free(resampler);
+    }
+}
+
 int main(int argc, char *argv[]) {
     pa_mempool *pool = NULL;
     pa_sample_spec a, b;
     int ret = 1, c;
-    pa_bool_t all_formats = TRUE;
+    pa_bool_t all_formats = TRUE, benchmark = FALSE;
     pa_resample_method_t method;
     int seconds;
 
@@ -319,6 +524,7 @@ int main(int argc, char *argv[]) {
         {"seconds",               1, NULL, ARG_SECONDS},
         {"resample-method",       1, NULL, ARG_RESAMPLE_METHOD},
         {"dump-resample-methods", 0, NULL, ARG_DUMP_RESAMPLE_METHODS},
+        {"benchmark",             0, NULL, ARG_BENCHMARK},
         {NULL,                    0, NULL, 0}
     };
 
@@ -401,6 +607,10 @@ int main(int argc, char *argv[]) {
                 method = pa_parse_resample_method(optarg);
                 break;
 
+            case ARG_BENCHMARK:
+                benchmark = TRUE;
+                break;
+
             default:
                 goto quit;
         }
@@ -409,6 +619,15 @@ int main(int argc, char *argv[]) {
     ret = 0;
     pa_assert_se(pool = pa_mempool_new(FALSE, 0));
 
+    if (benchmark) {
+        pa_log_debug(_("Compilation CFLAGS: %s"), PA_CFLAGS);
+        pa_log_debug(_("=== Benchmark: %d seconds per conversion"), seconds);
+
+        run_benchmark(pool, method, seconds);
+
+        goto quit;
+    }
+
     if (!all_formats) {
 
         pa_resampler *resampler;
@@ -441,6 +660,11 @@ int main(int argc, char *argv[]) {
         goto quit;
     }
 
+    if (!check_fused(pool)) {
+        ret = 1;
+        goto quit;
+    }
+
     for (a.format = 0; a.format < PA_SAMPLE_MAX; a.format ++) {
         for (b.format = 0; b.format < PA_SAMPLE_MAX; b.format ++) {
             pa_resampler *forth, *back;
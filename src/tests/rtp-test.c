@@ -0,0 +1,445 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/in.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/timeval.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/arpa-inet.h>
+#include <pulsecore/core-rtclock.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/memblockq.h>
+#include <pulsecore/poll.h>
+#include <pulsecore/socket-util.h>
+
+#include <modules/rtp/rtp.h>
+
+#define PACKET_FRAMES 48
+#define JITTER_BUFFER_PACKETS 8
+#define FIRST_SEQUENCE 65530
+#define FIRST_TIMESTAMP 0xffffff00U
+
+#define N_BENCHMARK_PACKETS 20000
+#define BENCHMARK_BATCH 32
+#define MCAST_ADDRESS "224.0.0.56"
+
+static const pa_sample_spec ss = {
+    .format = PA_SAMPLE_S16BE,
+    .rate = 48000,
+    .channels = 1
+};
+
+static pa_mempool *pool;
+
+struct output {
+    uint32_t timestamp;
+    size_t length;
+    int16_t sample;
+};
+
+static struct output outputs[64];
+static unsigned n_outputs;
+
+static int16_t packet_sample(unsigned n) {
+    return (int16_t) (1000 * (n + 1));
+}
+
+static int16_t get_sample(const pa_memchunk *chunk) {
+    uint8_t *d;
+    int16_t s;
+
+    d = pa_memblock_acquire_chunk(chunk);
+    s = (int16_t) ((d[0] << 8) | d[1]);
+    pa_memblock_release(chunk->memblock);
+
+    return s;
+}
+
+/* Pushes the n-th packet of the stream and collects everything that
+ * comes out of the jitter buffer */
+static void push_packet(pa_rtp_jitter_buffer *b, unsigned n) {
+    pa_memchunk chunk;
+    uint32_t timestamp;
+    uint8_t *d;
+    unsigned i;
+
+    chunk.memblock = pa_memblock_new(pool, PACKET_FRAMES * pa_frame_size(&ss));
+    chunk.index = 0;
+    chunk.length = pa_memblock_get_length(chunk.memblock);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < PACKET_FRAMES; i++) {
+        d[2*i] = (uint8_t) (packet_sample(n) >> 8);
+        d[2*i+1] = (uint8_t) (packet_sample(n) & 0xff);
+    }
+    pa_memblock_release(chunk.memblock);
+
+    pa_rtp_jitter_buffer_push(b, (uint16_t) (FIRST_SEQUENCE + n), FIRST_TIMESTAMP + n * PACKET_FRAMES, &chunk);
+    pa_memblock_unref(chunk.memblock);
+
+    while (pa_rtp_jitter_buffer_pop(b, &chunk, &timestamp)) {
+        fail_unless(n_outputs < PA_ELEMENTSOF(outputs));
+
+        outputs[n_outputs].timestamp = timestamp;
+        outputs[n_outputs].length = chunk.length;
+        outputs[n_outputs].sample = get_sample(&chunk);
+        n_outputs++;
+
+        pa_memblock_unref(chunk.memblock);
+    }
+}
+
+static void check_output(unsigned i, unsigned n) {
+    fail_unless(outputs[i].timestamp == FIRST_TIMESTAMP + n * PACKET_FRAMES);
+    fail_unless(outputs[i].length == PACKET_FRAMES * pa_frame_size(&ss));
+    fail_unless(outputs[i].sample == packet_sample(n));
+}
+
+START_TEST (jitter_buffer_test) {
+    pa_rtp_jitter_buffer *b;
+    unsigned i, n;
+
+    pool = pa_mempool_new(FALSE, 0);
+    b = pa_rtp_jitter_buffer_new(&ss, JITTER_BUFFER_PACKETS);
+    n_outputs = 0;
+
+    /* Sequence numbers and timestamps wrap around in here. Packets
+     * that arrive in order come out right away. */
+    push_packet(b, 0);
+    push_packet(b, 1);
+    fail_unless(n_outputs == 2);
+
+    /* Reordered, duplicate and late packets */
+    push_packet(b, 3);
+    fail_unless(n_outputs == 2);
+    push_packet(b, 2);
+    push_packet(b, 4);
+    push_packet(b, 4);
+    push_packet(b, 1);
+    fail_unless(n_outputs == 5);
+
+    for (i = 0; i < 5; i++)
+        check_output(i, i);
+
+    /* Packet 5 is lost. It is waited for until the buffer is full,
+     * then packet 4 is repeated at a lower volume in its place. */
+    for (n = 6; n < 6 + JITTER_BUFFER_PACKETS - 1; n++)
+        push_packet(b, n);
+    fail_unless(n_outputs == 5);
+
+    push_packet(b, n++);
+    fail_unless(n_outputs == 6 + JITTER_BUFFER_PACKETS);
+
+    fail_unless(outputs[5].timestamp == FIRST_TIMESTAMP + 5 * PACKET_FRAMES);
+    fail_unless(outputs[5].length == PACKET_FRAMES * pa_frame_size(&ss));
+    fail_unless(outputs[5].sample > 0 && outputs[5].sample < packet_sample(4));
+
+    for (i = 6; i < n_outputs; i++)
+        check_output(i, i);
+
+    /* A long burst of losses is concealed for a while, fading out,
+     * the rest is left to the caller */
+    n_outputs = 0;
+    n += 10;
+    for (i = 0; i < JITTER_BUFFER_PACKETS; i++)
+        push_packet(b, n + i);
+
+    fail_unless(n_outputs > 2 + JITTER_BUFFER_PACKETS);
+
+    for (i = 1; i < n_outputs - JITTER_BUFFER_PACKETS; i++) {
+        fail_unless(outputs[i].timestamp == outputs[i-1].timestamp + PACKET_FRAMES);
+        fail_unless(outputs[i].sample > 0 && outputs[i].sample < outputs[i-1].sample);
+    }
+
+    for (i = 0; i < JITTER_BUFFER_PACKETS; i++)
+        check_output(n_outputs - JITTER_BUFFER_PACKETS + i, n + i);
+
+    /* After a reset anything goes */
+    pa_rtp_jitter_buffer_reset(b);
+    n_outputs = 0;
+    push_packet(b, 3);
+    fail_unless(n_outputs == 1);
+    check_output(0, 3);
+
+    /* A jump by more than half the sequence number space makes the
+     * packets look late. After a few of them the buffer starts over. */
+    n = 3 + 40000;
+    for (i = 0; n_outputs == 1 && i < 1000; i++)
+        push_packet(b, n + i);
+
+    fail_unless(i > 1 && i < 1000);
+    fail_unless(n_outputs == 2);
+    check_output(1, n + i - 1);
+
+    push_packet(b, n + i);
+    fail_unless(n_outputs == 3);
+    check_output(2, n + i);
+
+    pa_rtp_jitter_buffer_free(b);
+    pa_mempool_free(pool);
+}
+END_TEST
+
+static pa_usec_t cpu_time(void) {
+    struct timespec ts;
+
+    pa_assert_se(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts) == 0);
+
+    return pa_timespec_load(&ts);
+}
+
+/* Returns a receiving socket and a sending socket connected to it,
+ * over loopback multicast if possible, over plain loopback otherwise */
+static void make_sockets(int *recv_fd, int *send_fd) {
+    struct sockaddr_in sa;
+    struct ip_mreq mr;
+    socklen_t salen = sizeof(sa);
+    int one = 1;
+
+    fail_unless((*recv_fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+    fail_unless((*send_fd = socket(AF_INET, SOCK_DGRAM, 0)) >= 0);
+
+    fail_unless(setsockopt(*recv_fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one)) == 0);
+    pa_make_fd_nonblock(*recv_fd);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(INADDR_ANY);
+    fail_unless(bind(*recv_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+    fail_unless(getsockname(*recv_fd, (struct sockaddr*) &sa, &salen) == 0);
+
+    memset(&mr, 0, sizeof(mr));
+    inet_pton(AF_INET, MCAST_ADDRESS, &mr.imr_multiaddr);
+    mr.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (setsockopt(*recv_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mr, sizeof(mr)) == 0 &&
+        setsockopt(*send_fd, IPPROTO_IP, IP_MULTICAST_IF, &mr.imr_interface, sizeof(mr.imr_interface)) == 0 &&
+        setsockopt(*send_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &one, sizeof(one)) == 0) {
+        pa_log_debug("Using multicast.");
+        sa.sin_addr = mr.imr_multiaddr;
+    } else {
+        pa_log_debug("Multicast not available, using unicast.");
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    }
+
+    fail_unless(connect(*send_fd, (struct sockaddr*) &sa, sizeof(sa)) == 0);
+}
+
+/* The first packet is the smallest, the receiver must not truncate
+ * the larger ones that follow it in the same batch */
+static const unsigned mixed_frames[] = { 8, 48, 16, 480, 8, 960, 48, 4000, 1, 240, 8, 720 };
+
+START_TEST (mixed_size_test) {
+    pa_rtp_context send_context, recv_context;
+    pa_memblockq *q;
+    unsigned i, n_sent, n_received = 0;
+    uint16_t sequence = 0;
+    int recv_fd, send_fd;
+    pa_usec_t t;
+
+    pool = pa_mempool_new(FALSE, 0);
+
+    make_sockets(&recv_fd, &send_fd);
+    pa_rtp_context_init_send(&send_context, send_fd, 0, pa_rtp_payload_from_sample_spec(&ss), pa_frame_size(&ss));
+    pa_rtp_context_init_recv(&recv_context, recv_fd, pa_frame_size(&ss));
+
+    q = pa_memblockq_new("rtp-test memblockq", 0, 1024*1024, 0, &ss, 1, 0, 0, NULL);
+
+    /* Everything is sent before anything is received, so that the
+     * packets are read in as few batches as possible */
+    n_sent = 2 * PA_ELEMENTSOF(mixed_frames);
+
+    for (i = 0; i < n_sent; i++) {
+        pa_memchunk chunk;
+        uint8_t *d;
+        unsigned j;
+
+        chunk.memblock = pa_memblock_new(pool, mixed_frames[i % PA_ELEMENTSOF(mixed_frames)] * pa_frame_size(&ss));
+        chunk.index = 0;
+        chunk.length = pa_memblock_get_length(chunk.memblock);
+
+        d = pa_memblock_acquire(chunk.memblock);
+        for (j = 0; j < chunk.length / 2; j++) {
+            d[2*j] = (uint8_t) (packet_sample(i) >> 8);
+            d[2*j+1] = (uint8_t) (packet_sample(i) & 0xff);
+        }
+        pa_memblock_release(chunk.memblock);
+
+        fail_unless(pa_memblockq_push(q, &chunk) == 0);
+        fail_unless(pa_rtp_send(&send_context, chunk.length, q) == 0);
+        fail_unless(pa_memblockq_get_length(q) == 0);
+
+        pa_memblock_unref(chunk.memblock);
+    }
+
+    t = pa_rtclock_now();
+
+    while (n_received < n_sent && pa_rtclock_now() - t < PA_USEC_PER_SEC) {
+        struct pollfd p;
+        struct timeval tstamp;
+        pa_memchunk packet;
+        int r;
+
+        p.fd = recv_fd;
+        p.events = POLLIN;
+        if (pa_poll(&p, 1, 100) <= 0)
+            continue;
+
+        while ((r = pa_rtp_recv(&recv_context, &packet, pool, &tstamp)) > 0) {
+            fail_unless(n_received < n_sent);
+            fail_unless(n_received == 0 || recv_context.sequence == (uint16_t) (sequence + 1));
+            fail_unless(packet.length == mixed_frames[n_received % PA_ELEMENTSOF(mixed_frames)] * pa_frame_size(&ss));
+            fail_unless(get_sample(&packet) == packet_sample(n_received));
+
+            sequence = recv_context.sequence;
+            n_received++;
+
+            pa_memblock_unref(packet.memblock);
+        }
+
+        fail_unless(r == 0);
+    }
+
+    /* Nothing gets lost on loopback with so few packets */
+    fail_unless(n_received == n_sent);
+
+    pa_memblockq_free(q);
+    pa_rtp_context_destroy(&send_context);
+    pa_rtp_context_destroy(&recv_context);
+    pa_mempool_free(pool);
+}
+END_TEST
+
+START_TEST (rtp_benchmark) {
+    pa_rtp_context send_context, recv_context;
+    pa_memblockq *q;
+    pa_memchunk chunk;
+    pa_usec_t send_time = 0, recv_time = 0, t;
+    size_t size = PACKET_FRAMES * pa_frame_size(&ss);
+    unsigned n_sent = 0, n_received = 0;
+    uint16_t sequence = 0;
+    int recv_fd, send_fd;
+
+    pool = pa_mempool_new(FALSE, 0);
+
+    make_sockets(&recv_fd, &send_fd);
+    pa_rtp_context_init_send(&send_context, send_fd, 0, pa_rtp_payload_from_sample_spec(&ss), pa_frame_size(&ss));
+    pa_rtp_context_init_recv(&recv_context, recv_fd, pa_frame_size(&ss));
+
+    q = pa_memblockq_new("rtp-test memblockq", 0, 1024*1024, 0, &ss, 1, 0, 0, NULL);
+
+    chunk.memblock = pa_memblock_new(pool, size * BENCHMARK_BATCH);
+    chunk.index = 0;
+    chunk.length = pa_memblock_get_length(chunk.memblock);
+    memset(pa_memblock_acquire(chunk.memblock), 0, chunk.length);
+    pa_memblock_release(chunk.memblock);
+
+    while (n_sent < N_BENCHMARK_PACKETS) {
+        struct pollfd p;
+        struct timeval tstamp;
+        pa_memchunk packet;
+        int r;
+
+        fail_unless(pa_memblockq_push(q, &chunk) == 0);
+
+        t = cpu_time();
+        fail_unless(pa_rtp_send(&send_context, size, q) == 0);
+        send_time += cpu_time() - t;
+
+        fail_unless(pa_memblockq_get_length(q) == 0);
+        n_sent += BENCHMARK_BATCH;
+
+        p.fd = recv_fd;
+        p.events = POLLIN;
+        if (pa_poll(&p, 1, 1000) <= 0)
+            continue;
+
+        t = cpu_time();
+        while ((r = pa_rtp_recv(&recv_context, &packet, pool, &tstamp)) > 0) {
+            fail_unless(packet.length == size);
+            fail_unless(n_received == 0 || (int16_t) (recv_context.sequence - sequence) > 0);
+
+            sequence = recv_context.sequence;
+            n_received++;
+
+            pa_memblock_unref(packet.memblock);
+        }
+        recv_time += cpu_time() - t;
+
+        fail_unless(r == 0);
+    }
+
+    pa_log_debug("Sent %u packets, received %u", n_sent, n_received);
+    pa_log_debug("CPU time per 1000 packets: %llu usec sending, %llu usec receiving",
+                 (unsigned long long) (send_time * 1000 / n_sent),
+                 (unsigned long long) (recv_time * 1000 / PA_MAX(n_received, 1U)));
+
+    /* Loopback doesn't lose much, even on busy machines */
+    fail_unless(n_received >= n_sent / 2);
+
+    pa_memblock_unref(chunk.memblock);
+    pa_memblockq_free(q);
+    pa_rtp_context_destroy(&send_context);
+    pa_rtp_context_destroy(&recv_context);
+    pa_mempool_free(pool);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("RTP");
+    tc = tcase_create("rtp");
+    tcase_add_test(tc, jitter_buffer_test);
+    tcase_add_test(tc, mixed_size_test);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, rtp_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
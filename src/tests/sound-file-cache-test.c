@@ -0,0 +1,281 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <check.h>
+
+#include <pulse/proplist.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/sound-file-cache.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/memblock.h>
+#include <pulsecore/sample-util.h>
+#include <pulsecore/thread.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_FRAMES 10000
+
+static void touch(const char *fn, const char *data, time_t mtime) {
+    FILE *f;
+    struct timeval tv[2];
+
+    fail_unless((f = fopen(fn, "w")) != NULL);
+    fputs(data, f);
+    fclose(f);
+
+    tv[0].tv_sec = tv[1].tv_sec = mtime;
+    tv[0].tv_usec = tv[1].tv_usec = 0;
+    fail_unless(utimes(fn, tv) == 0);
+}
+
+/* Removes the sound file and the cache files */
+static void remove_dir(const char *dir) {
+    DIR *d;
+    struct dirent *de;
+
+    fail_unless((d = opendir(dir)) != NULL);
+
+    while ((de = readdir(d)))
+        if (de->d_name[0] != '.') {
+            char *fn;
+
+            fn = pa_sprintf_malloc("%s/%s", dir, de->d_name);
+            fail_unless(unlink(fn) == 0);
+            pa_xfree(fn);
+        }
+
+    closedir(d);
+    fail_unless(rmdir(dir) == 0);
+}
+
+static pa_proplist *file_proplist(void) {
+    pa_proplist *p;
+
+    p = pa_proplist_new();
+    pa_proplist_sets(p, PA_PROP_MEDIA_TITLE, "Sample");
+    pa_proplist_sets(p, PA_PROP_MEDIA_ARTIST, "Test");
+
+    return p;
+}
+
+START_TEST (sound_file_cache_test) {
+    pa_mempool *pool;
+    pa_sample_spec ss, ss2;
+    pa_channel_map map, map2;
+    pa_memchunk chunk, chunk2, chunk3;
+    pa_proplist *p, *p2;
+    char dir[] = "/tmp/pa-sound-file-cache-test-XXXXXX";
+    char *fn;
+    int16_t *d;
+    const int16_t *d2;
+    unsigned i;
+
+    fail_unless(mkdtemp(dir) != NULL);
+    fn = pa_sprintf_malloc("%s/sample.wav", dir);
+
+    pool = pa_mempool_new(FALSE, 0);
+    fail_unless(pool != NULL);
+
+    ss.format = PA_SAMPLE_S16NE;
+    ss.rate = 44100;
+    ss.channels = 2;
+    pa_channel_map_init_stereo(&map);
+
+    chunk.memblock = pa_memblock_new(pool, N_FRAMES * pa_frame_size(&ss));
+    chunk.index = 0;
+    chunk.length = pa_memblock_get_length(chunk.memblock);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    for (i = 0; i < chunk.length / sizeof(int16_t); i++)
+        d[i] = (int16_t) (i * 13);
+    pa_memblock_release(chunk.memblock);
+
+    p = file_proplist();
+    p2 = pa_proplist_new();
+
+    /* Nothing cached yet */
+    touch(fn, "foo", 1000000);
+    fail_unless(pa_sound_file_cache_load(pool, dir, fn, &ss2, &map2, &chunk2, p2) < 0);
+    fail_unless(pa_proplist_isempty(p2));
+
+    fail_unless(pa_sound_file_cache_save(dir, fn, &ss, &map, &chunk, p) >= 0);
+
+    /* A hit returns the same properties as loading the file, merged
+     * into the ones that are already there */
+    pa_proplist_sets(p2, PA_PROP_MEDIA_NAME, "Name");
+    pa_proplist_sets(p2, PA_PROP_MEDIA_TITLE, "Old");
+
+    fail_unless(pa_sound_file_cache_load(pool, dir, fn, &ss2, &map2, &chunk2, p2) >= 0);
+    fail_unless(pa_sample_spec_equal(&ss, &ss2));
+    fail_unless(pa_channel_map_equal(&map, &map2));
+    fail_unless(chunk2.length == chunk.length);
+
+    fail_unless(pa_proplist_size(p2) == 3);
+    fail_unless(pa_streq(pa_proplist_gets(p2, PA_PROP_MEDIA_NAME), "Name"));
+    fail_unless(pa_streq(pa_proplist_gets(p2, PA_PROP_MEDIA_TITLE), "Sample"));
+    fail_unless(pa_streq(pa_proplist_gets(p2, PA_PROP_MEDIA_ARTIST), "Test"));
+
+    /* Touching the sound file invalidates the entry, but samples
+     * that were loaded from it stay valid even when it is replaced */
+    touch(fn, "foo", 2000000);
+    fail_unless(pa_sound_file_cache_load(pool, dir, fn, &ss2, &map2, &chunk3, NULL) < 0);
+    fail_unless(pa_sound_file_cache_save(dir, fn, &ss, &map, &chunk, p) >= 0);
+
+    d = pa_memblock_acquire(chunk.memblock);
+    d2 = pa_memblock_acquire_chunk(&chunk2);
+    fail_unless(memcmp(d, d2, chunk.length) == 0);
+    pa_memblock_release(chunk2.memblock);
+    pa_memblock_release(chunk.memblock);
+    pa_memblock_unref(chunk2.memblock);
+
+    fail_unless(pa_sound_file_cache_load(pool, dir, fn, &ss2, &map2, &chunk3, NULL) >= 0);
+    pa_memblock_unref(chunk3.memblock);
+
+    /* So does changing its size */
+    touch(fn, "fooo", 2000000);
+    fail_unless(pa_sound_file_cache_load(pool, dir, fn, &ss2, &map2, &chunk3, NULL) < 0);
+
+    pa_proplist_free(p);
+    pa_proplist_free(p2);
+    pa_memblock_unref(chunk.memblock);
+    pa_mempool_free(pool);
+
+    remove_dir(dir);
+    pa_xfree(fn);
+}
+END_TEST
+
+#define N_SAVES 200
+
+struct save_job {
+    const char *dir, *fn;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_memchunk chunk;
+    unsigned n_failed;
+};
+
+static void save_thread(void *userdata) {
+    struct save_job *j = userdata;
+    pa_proplist *p;
+    unsigned i;
+
+    p = file_proplist();
+
+    for (i = 0; i < N_SAVES; i++)
+        if (pa_sound_file_cache_save(j->dir, j->fn, &j->ss, &j->map, &j->chunk, p) < 0)
+            j->n_failed++;
+
+    pa_proplist_free(p);
+}
+
+/* The loader thread and the main thread may store the same sample at
+ * the same time */
+START_TEST (sound_file_cache_concurrent_test) {
+    pa_mempool *pool;
+    struct save_job job;
+    pa_thread *t;
+    pa_memchunk chunk;
+    char dir[] = "/tmp/pa-sound-file-cache-test-XXXXXX";
+    char *fn;
+    DIR *d;
+    struct dirent *de;
+    unsigned n_files = 0;
+
+    fail_unless(mkdtemp(dir) != NULL);
+    fn = pa_sprintf_malloc("%s/sample.wav", dir);
+    touch(fn, "foo", 1000000);
+
+    pool = pa_mempool_new(FALSE, 0);
+    fail_unless(pool != NULL);
+
+    pa_memzero(&job, sizeof(job));
+    job.dir = dir;
+    job.fn = fn;
+    job.ss.format = PA_SAMPLE_S16NE;
+    job.ss.rate = 44100;
+    job.ss.channels = 2;
+    pa_channel_map_init_stereo(&job.map);
+
+    job.chunk.memblock = pa_memblock_new(pool, N_FRAMES * pa_frame_size(&job.ss));
+    job.chunk.index = 0;
+    job.chunk.length = pa_memblock_get_length(job.chunk.memblock);
+    pa_silence_memchunk(&job.chunk, &job.ss);
+
+    fail_unless((t = pa_thread_new("save", save_thread, &job)) != NULL);
+    save_thread(&job);
+    pa_thread_free(t);
+
+    fail_unless(job.n_failed == 0);
+
+    fail_unless(pa_sound_file_cache_load(pool, dir, fn, &job.ss, &job.map, &chunk, NULL) >= 0);
+    fail_unless(chunk.length == job.chunk.length);
+    pa_memblock_unref(chunk.memblock);
+
+    /* No temporary files are left behind */
+    fail_unless((d = opendir(dir)) != NULL);
+    while ((de = readdir(d)))
+        if (de->d_name[0] != '.')
+            n_files++;
+    closedir(d);
+
+    fail_unless(n_files == 2);
+
+    pa_memblock_unref(job.chunk.memblock);
+    pa_mempool_free(pool);
+
+    remove_dir(dir);
+    pa_xfree(fn);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Sound File Cache");
+    tc = tcase_create("sound-file-cache");
+    tcase_add_test(tc, sound_file_cache_test);
+    tcase_add_test(tc, sound_file_cache_concurrent_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
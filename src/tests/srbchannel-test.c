@@ -0,0 +1,154 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include <check.h>
+
+#include <pulse/mainloop.h>
+#include <pulsecore/srbchannel.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_ROUNDS 1000
+#define CHUNK_SIZE 3001
+
+struct test_state {
+    pa_mainloop *m;
+    pa_srbchannel *a, *b;
+
+    unsigned written, read;
+    unsigned wakeups;
+};
+
+static uint8_t pattern(unsigned i) {
+    return (uint8_t) (i * 7 + i / 256);
+}
+
+/* Writes as much as fits and reads everything that is there, so that
+ * each side only gets going again when woken up by the other one */
+static pa_bool_t writer_cb(pa_srbchannel *sr, void *userdata) {
+    struct test_state *s = userdata;
+    uint8_t buf[CHUNK_SIZE];
+
+    s->wakeups++;
+
+    while (s->written < N_ROUNDS * CHUNK_SIZE) {
+        size_t l, n, j;
+
+        l = PA_MIN(sizeof(buf), N_ROUNDS * CHUNK_SIZE - s->written);
+        for (j = 0; j < l; j++)
+            buf[j] = pattern(s->written + j);
+
+        n = pa_srbchannel_write(sr, buf, l);
+        s->written += n;
+
+        if (n < l)
+            break;
+    }
+
+    return TRUE;
+}
+
+static pa_bool_t reader_cb(pa_srbchannel *sr, void *userdata) {
+    struct test_state *s = userdata;
+    uint8_t buf[CHUNK_SIZE];
+    size_t n, j;
+
+    while ((n = pa_srbchannel_read(sr, buf, sizeof(buf))) > 0) {
+        for (j = 0; j < n; j++)
+            fail_unless(buf[j] == pattern(s->read + j));
+
+        s->read += n;
+    }
+
+    if (s->read == N_ROUNDS * CHUNK_SIZE)
+        pa_mainloop_quit(s->m, 0);
+
+    return TRUE;
+}
+
+START_TEST (srbchannel_test) {
+    struct test_state s;
+    pa_srbchannel_template t;
+    uint8_t c;
+
+    pa_zero(s);
+
+    s.m = pa_mainloop_new();
+    fail_unless(s.m != NULL);
+
+    s.a = pa_srbchannel_new(pa_mainloop_get_api(s.m));
+    fail_unless(s.a != NULL);
+
+    pa_srbchannel_export(s.a, &t);
+    s.b = pa_srbchannel_new_from_template(pa_mainloop_get_api(s.m), &t);
+    fail_unless(s.b != NULL);
+
+    /* Both directions are independent */
+    fail_unless(pa_srbchannel_write(s.b, "x", 1) == 1);
+    fail_unless(pa_srbchannel_read(s.b, &c, 1) == 0);
+    fail_unless(pa_srbchannel_read(s.a, &c, 1) == 1);
+    fail_unless(c == 'x');
+    fail_unless(pa_srbchannel_read(s.a, &c, 1) == 0);
+
+    /* Push a lot more data than fits in the ring buffer through it, in
+     * chunks that don't divide its size */
+    pa_srbchannel_set_callback(s.a, writer_cb, &s);
+    pa_srbchannel_set_callback(s.b, reader_cb, &s);
+
+    fail_unless(pa_mainloop_run(s.m, NULL) >= 0);
+
+    fail_unless(s.written == N_ROUNDS * CHUNK_SIZE);
+    fail_unless(s.read == N_ROUNDS * CHUNK_SIZE);
+
+    pa_log_debug("Transferred %u bytes with %u writer wakeups", s.read, s.wakeups);
+
+    pa_srbchannel_free(s.a);
+    pa_srbchannel_free(s.b);
+    pa_mainloop_free(s.m);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Srbchannel");
+    tc = tcase_create("srbchannel");
+    tcase_add_test(tc, srbchannel_test);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
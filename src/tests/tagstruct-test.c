@@ -0,0 +1,314 @@
+/***
+  This file is part of PulseAudio.
+
+  PulseAudio is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License as published
+  by the Free Software Foundation; either version 2.1 of the License,
+  or (at your option) any later version.
+
+  PulseAudio is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with PulseAudio; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <check.h>
+
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+#include <pulsecore/tagstruct.h>
+#include <pulsecore/packet.h>
+#include <pulsecore/native-common.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+#define N_PORTS 4
+#define N_BENCHMARK_ROUNDS 20000
+#define N_BENCHMARK_LIST_OBJECTS 200
+
+static pa_proplist *make_proplist(unsigned n) {
+    pa_proplist *p;
+    unsigned i;
+
+    p = pa_proplist_new();
+
+    pa_proplist_sets(p, PA_PROP_DEVICE_DESCRIPTION, "Built-in Audio Analog Stereo");
+    pa_proplist_sets(p, PA_PROP_DEVICE_CLASS, "sound");
+    pa_proplist_sets(p, PA_PROP_DEVICE_API, "alsa");
+    pa_proplist_sets(p, PA_PROP_DEVICE_STRING, "front:0");
+    pa_proplist_sets(p, PA_PROP_DEVICE_BUS_PATH, "pci-0000:00:1b.0");
+
+    for (i = 0; i < n; i++) {
+        char k[32], v[64];
+
+        pa_snprintf(k, sizeof(k), "test.property.%u", i);
+        pa_snprintf(v, sizeof(v), "value of property number %u", i);
+        pa_proplist_sets(p, k, v);
+    }
+
+    return p;
+}
+
+/* Roughly what sink_fill_tagstruct() in protocol-native.c sends */
+static void put_sink_info(pa_tagstruct *t, uint32_t idx, pa_proplist *p, pa_format_info *f) {
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_cvolume v;
+    unsigned i;
+
+    ss.format = PA_SAMPLE_S16LE;
+    ss.rate = 44100;
+    ss.channels = 2;
+    pa_channel_map_init_stereo(&map);
+    pa_cvolume_set(&v, 2, PA_VOLUME_NORM / 2);
+
+    pa_tagstruct_put(
+            t,
+            PA_TAG_U32, idx,
+            PA_TAG_STRING, "alsa_output.pci-0000_00_1b.0.analog-stereo",
+            PA_TAG_SAMPLE_SPEC, &ss,
+            PA_TAG_CHANNEL_MAP, &map,
+            PA_TAG_U32, 7,
+            PA_TAG_CVOLUME, &v,
+            PA_TAG_BOOLEAN, FALSE,
+            PA_TAG_U32, idx + 1,
+            PA_TAG_STRING, "alsa_output.pci-0000_00_1b.0.analog-stereo.monitor",
+            PA_TAG_USEC, (pa_usec_t) 12345,
+            PA_TAG_STRING, "module-alsa-card.c",
+            PA_TAG_U32, 0x1f,
+            PA_TAG_INVALID);
+
+    pa_tagstruct_put_proplist(t, p);
+    pa_tagstruct_put_usec(t, 20000);
+    pa_tagstruct_put_volume(t, PA_VOLUME_NORM);
+    pa_tagstruct_putu32(t, 0);
+    pa_tagstruct_putu32(t, PA_VOLUME_NORM + 1);
+    pa_tagstruct_putu32(t, 3);
+
+    pa_tagstruct_putu32(t, N_PORTS);
+    for (i = 0; i < N_PORTS; i++) {
+        pa_tagstruct_puts(t, "analog-output-speaker");
+        pa_tagstruct_puts(t, "Speakers");
+        pa_tagstruct_putu32(t, 100 * i);
+        pa_tagstruct_putu32(t, 2);
+    }
+    pa_tagstruct_puts(t, "analog-output-speaker");
+
+    pa_tagstruct_putu8(t, 1);
+    pa_tagstruct_put_format_info(t, f);
+}
+
+static pa_bool_t get_sink_info(pa_tagstruct *t, uint32_t idx, pa_proplist *expected) {
+    uint32_t u, flags, n_ports, i;
+    const char *name, *monitor_name, *driver, *port;
+    pa_sample_spec ss;
+    pa_channel_map map;
+    pa_cvolume v;
+    pa_bool_t mute;
+    pa_usec_t latency, configured_latency;
+    pa_volume_t base_volume;
+    uint8_t n_formats;
+    pa_proplist *p;
+    pa_format_info *f;
+    pa_bool_t r = FALSE;
+
+    p = pa_proplist_new();
+    f = pa_format_info_new();
+
+    if (pa_tagstruct_getu32(t, &u) < 0 || u != idx ||
+        pa_tagstruct_gets(t, &name) < 0 ||
+        pa_tagstruct_get_sample_spec(t, &ss) < 0 ||
+        pa_tagstruct_get_channel_map(t, &map) < 0 ||
+        pa_tagstruct_getu32(t, &u) < 0 ||
+        pa_tagstruct_get_cvolume(t, &v) < 0 ||
+        pa_tagstruct_get_boolean(t, &mute) < 0 ||
+        pa_tagstruct_getu32(t, &u) < 0 || u != idx + 1 ||
+        pa_tagstruct_gets(t, &monitor_name) < 0 ||
+        pa_tagstruct_get_usec(t, &latency) < 0 ||
+        pa_tagstruct_gets(t, &driver) < 0 ||
+        pa_tagstruct_getu32(t, &flags) < 0 ||
+        pa_tagstruct_get_proplist(t, p) < 0 ||
+        pa_tagstruct_get_usec(t, &configured_latency) < 0 ||
+        pa_tagstruct_get_volume(t, &base_volume) < 0 ||
+        pa_tagstruct_getu32(t, &u) < 0 ||
+        pa_tagstruct_getu32(t, &u) < 0 ||
+        pa_tagstruct_getu32(t, &u) < 0 ||
+        pa_tagstruct_getu32(t, &n_ports) < 0 || n_ports != N_PORTS)
+        goto finish;
+
+    for (i = 0; i < n_ports; i++) {
+        const char *desc;
+        uint32_t priority, available;
+
+        if (pa_tagstruct_gets(t, &port) < 0 ||
+            pa_tagstruct_gets(t, &desc) < 0 ||
+            pa_tagstruct_getu32(t, &priority) < 0 || priority != 100 * i ||
+            pa_tagstruct_getu32(t, &available) < 0)
+            goto finish;
+    }
+
+    if (pa_tagstruct_gets(t, &port) < 0 ||
+        pa_tagstruct_getu8(t, &n_formats) < 0 || n_formats != 1 ||
+        pa_tagstruct_get_format_info(t, f) < 0)
+        goto finish;
+
+    r = pa_streq(name, "alsa_output.pci-0000_00_1b.0.analog-stereo") &&
+        ss.rate == 44100 && ss.channels == 2 && map.channels == 2 &&
+        pa_cvolume_channels_equal_to(&v, PA_VOLUME_NORM / 2) &&
+        !mute && latency == 12345 && flags == 0x1f &&
+        configured_latency == 20000 && base_volume == PA_VOLUME_NORM &&
+        pa_proplist_equal(p, expected) &&
+        f->encoding == PA_ENCODING_PCM;
+
+finish:
+    pa_proplist_free(p);
+    pa_format_info_free(f);
+    return r;
+}
+
+START_TEST (tagstruct_test) {
+    pa_proplist *p;
+    pa_format_info *f;
+    unsigned n;
+
+    f = pa_format_info_new();
+    f->encoding = PA_ENCODING_PCM;
+
+    /* Small packets that fit the pooled buffers and big ones that
+     * don't */
+    for (n = 0; n <= 2000; n = n * 4 + 1) {
+        pa_tagstruct *t;
+        pa_packet *packet;
+        unsigned i;
+
+        p = make_proplist(n);
+
+        t = pa_tagstruct_new(NULL, 0);
+        for (i = 0; i < 3; i++)
+            put_sink_info(t, i, p, f);
+        pa_tagstruct_putu64(t, 0x123456789abcdefULL);
+        pa_tagstruct_puts64(t, -42);
+        pa_tagstruct_puts(t, NULL);
+
+        packet = pa_tagstruct_free_to_packet(t);
+        fail_unless(packet != NULL);
+
+        t = pa_tagstruct_new(packet->data, packet->length);
+
+        for (i = 0; i < 3; i++)
+            fail_unless(get_sink_info(t, i, p));
+
+        {
+            uint64_t u;
+            int64_t s;
+            const char *str;
+
+            fail_unless(pa_tagstruct_getu64(t, &u) >= 0 && u == 0x123456789abcdefULL);
+            fail_unless(pa_tagstruct_gets64(t, &s) >= 0 && s == -42);
+            fail_unless(pa_tagstruct_gets(t, &str) >= 0 && !str);
+        }
+
+        fail_unless(pa_tagstruct_eof(t));
+
+        pa_tagstruct_free(t);
+        pa_packet_unref(packet);
+        pa_proplist_free(p);
+    }
+
+    pa_format_info_free(f);
+}
+END_TEST
+
+/* Builds and parses replies with n_objects sink infos each, like
+ * single sink info replies and sink info list replies */
+static void benchmark(unsigned n_objects, unsigned n_rounds, pa_proplist *p, pa_format_info *f) {
+    pa_usec_t build = 0, parse = 0, t0;
+    size_t length = 0;
+    uint32_t command, tag;
+    unsigned i, j;
+
+    for (i = 0; i < n_rounds; i++) {
+        pa_tagstruct *t;
+        pa_packet *packet;
+
+        t0 = pa_rtclock_now();
+        t = pa_tagstruct_new(NULL, 0);
+        pa_tagstruct_putu32(t, PA_COMMAND_REPLY);
+        pa_tagstruct_putu32(t, i);
+        for (j = 0; j < n_objects; j++)
+            put_sink_info(t, j, p, f);
+        packet = pa_tagstruct_free_to_packet(t);
+        build += pa_rtclock_now() - t0;
+
+        length = packet->length;
+
+        t0 = pa_rtclock_now();
+        t = pa_tagstruct_new(packet->data, packet->length);
+        fail_unless(pa_tagstruct_getu32(t, &command) >= 0 && command == PA_COMMAND_REPLY);
+        fail_unless(pa_tagstruct_getu32(t, &tag) >= 0 && tag == i);
+        for (j = 0; j < n_objects; j++)
+            fail_unless(get_sink_info(t, j, p));
+        pa_tagstruct_free(t);
+        pa_packet_unref(packet);
+        parse += pa_rtclock_now() - t0;
+    }
+
+    pa_log_debug("%u packets with %u sink infos, %lu bytes each: building took %llu usec, parsing %llu usec",
+                 n_rounds, n_objects, (unsigned long) length, (unsigned long long) build, (unsigned long long) parse);
+}
+
+START_TEST (tagstruct_benchmark) {
+    pa_proplist *p;
+    pa_format_info *f;
+
+    p = make_proplist(20);
+    f = pa_format_info_new();
+    f->encoding = PA_ENCODING_PCM;
+
+    benchmark(1, N_BENCHMARK_ROUNDS, p, f);
+    benchmark(N_BENCHMARK_LIST_OBJECTS, N_BENCHMARK_ROUNDS / N_BENCHMARK_LIST_OBJECTS, p, f);
+
+    pa_format_info_free(f);
+    pa_proplist_free(p);
+}
+END_TEST
+
+int main(int argc, char *argv[]) {
+    int failed = 0;
+    Suite *s;
+    TCase *tc;
+    SRunner *sr;
+
+    if (!getenv("MAKE_CHECK"))
+        pa_log_set_level(PA_LOG_DEBUG);
+
+    s = suite_create("Tagstruct");
+    tc = tcase_create("tagstruct");
+    tcase_add_test(tc, tagstruct_test);
+    suite_add_tcase(s, tc);
+
+    tc = tcase_create("benchmark");
+    tcase_add_test(tc, tagstruct_benchmark);
+    tcase_set_timeout(tc, 120);
+    suite_add_tcase(s, tc);
+
+    sr = srunner_create(s);
+    srunner_run_all(sr, CK_NORMAL);
+    failed = srunner_ntests_failed(sr);
+    srunner_free(sr);
+
+    return (failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}